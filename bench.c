@@ -0,0 +1,400 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  headless decoder and dsp benchmark
+
+  Copyright (C) 2009-2013 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+// Every stage (decoder read, pcm_convert to float, each dsp plugin) is
+// run over the whole file several times, and the fastest run is reported
+// in nanoseconds per sample (one sample = one frame of all channels),
+// which is much more stable between runs than the average.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "bench.h"
+#include "playlist.h"
+#include "plugins.h"
+#include "premix.h"
+#include "messagepump.h"
+#include "threadpool.h"
+#include "conf.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+#define BENCH_DEFAULT_REPEAT 5
+#define BENCH_BLOCK 1024 // frames per decoder read / dsp process call
+#define BENCH_DSP_MAXFRAMES (BENCH_BLOCK*4) // room for resampling up to 4x
+
+#define REFERENCE_SAMPLERATE 44100
+#define REFERENCE_SECONDS 20
+
+static int repeat = BENCH_DEFAULT_REPEAT;
+
+static int64_t
+bench_time (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+write_le (FILE *fp, uint32_t val, int size) {
+    for (int i = 0; i < size; i++) {
+        fputc ((val >> (i * 8)) & 0xff, fp);
+    }
+}
+
+// 16 bit stereo: exponential sweep on the left channel, two tones on the right,
+// and pseudo-random noise on both, so that the lossy encoders have some work
+static int
+bench_write_reference (const char *fname) {
+    FILE *fp = fopen (fname, "wb");
+    if (!fp) {
+        fprintf (stderr, "bench: failed to open %s for writing\n", fname);
+        return -1;
+    }
+    uint32_t nframes = REFERENCE_SAMPLERATE * REFERENCE_SECONDS;
+    uint32_t datasize = nframes * 4;
+    fwrite ("RIFF", 1, 4, fp);
+    write_le (fp, 36 + datasize, 4);
+    fwrite ("WAVEfmt ", 1, 8, fp);
+    write_le (fp, 16, 4);
+    write_le (fp, 1, 2); // PCM
+    write_le (fp, 2, 2);
+    write_le (fp, REFERENCE_SAMPLERATE, 4);
+    write_le (fp, REFERENCE_SAMPLERATE * 4, 4);
+    write_le (fp, 4, 2);
+    write_le (fp, 16, 2);
+    fwrite ("data", 1, 4, fp);
+    write_le (fp, datasize, 4);
+
+    uint32_t seed = 1;
+    double phase = 0;
+    for (uint32_t i = 0; i < nframes; i++) {
+        double t = (double)i / REFERENCE_SAMPLERATE;
+        double freq = 20 * pow (1000, t / REFERENCE_SECONDS); // 20Hz..20kHz
+        phase += 2 * M_PI * freq / REFERENCE_SAMPLERATE;
+        if (phase > 2 * M_PI) {
+            phase -= 2 * M_PI;
+        }
+        seed = seed * 1103515245 + 12345;
+        double noise = (double)((seed >> 16) & 0x7fff) / 0x7fff - 0.5;
+        double l = 0.5 * sin (phase) + 0.05 * noise;
+        double r = 0.3 * sin (2 * M_PI * 440 * t) + 0.2 * sin (2 * M_PI * 3520 * t) + 0.05 * noise;
+        write_le (fp, (uint16_t)(int16_t)(l * 32767), 2);
+        write_le (fp, (uint16_t)(int16_t)(r * 32767), 2);
+    }
+    int err = ferror (fp);
+    fclose (fp);
+    return err ? -1 : 0;
+}
+
+// decodes the whole track; the timing covers only the decoder->read calls;
+// the decoded data is returned in *pcm when it's not NULL
+static int64_t
+bench_decode (DB_decoder_t *dec, playItem_t *it, char **pcm, int64_t *pcmsize, ddb_waveformat_t *fmt) {
+    DB_fileinfo_t *fi;
+    if (dec->plugin.api_vminor >= 7 && dec->open2) {
+        fi = dec->open2 (0, DB_PLAYITEM (it));
+    }
+    else {
+        fi = dec->open (0);
+    }
+    if (!fi) {
+        return -1;
+    }
+    if (dec->init (fi, DB_PLAYITEM (it)) != 0) {
+        dec->free (fi);
+        return -1;
+    }
+    memcpy (fmt, &fi->fmt, sizeof (ddb_waveformat_t));
+    int samplesize = (fmt->bps >> 3) * fmt->channels;
+    if (samplesize <= 0) {
+        dec->free (fi);
+        return -1;
+    }
+
+    int blocksize = BENCH_BLOCK * samplesize;
+    char *buffer = NULL;
+    int64_t size = 0;
+    int64_t alloced = 0;
+    char tmp[blocksize];
+    int64_t total = 0;
+    for (;;) {
+        char *out = tmp;
+        if (pcm) {
+            if (size + blocksize > alloced) {
+                alloced = alloced ? alloced * 2 : blocksize * 256;
+                char *newbuf = realloc (buffer, alloced);
+                if (!newbuf) {
+                    free (buffer);
+                    dec->free (fi);
+                    return -1;
+                }
+                buffer = newbuf;
+            }
+            out = buffer + size;
+        }
+        int64_t t1 = bench_time ();
+        int rd = dec->read (fi, out, blocksize);
+        total += bench_time () - t1;
+        if (rd <= 0) {
+            break;
+        }
+        size += rd;
+    }
+    dec->free (fi);
+    if (pcm) {
+        *pcm = buffer;
+        *pcmsize = size - size % samplesize;
+    }
+    return total;
+}
+
+static int64_t
+bench_convert (const ddb_waveformat_t *infmt, const char *input, int64_t nframes, const ddb_waveformat_t *outfmt, char *output) {
+    int insamplesize = (infmt->bps >> 3) * infmt->channels;
+    int outsamplesize = (outfmt->bps >> 3) * outfmt->channels;
+    int64_t t1 = bench_time ();
+    for (int64_t f = 0; f < nframes; f += BENCH_BLOCK) {
+        int n = nframes - f < BENCH_BLOCK ? (int)(nframes - f) : BENCH_BLOCK;
+        pcm_convert (infmt, input + f * insamplesize, outfmt, output + f * outsamplesize, n * insamplesize);
+    }
+    return bench_time () - t1;
+}
+
+static void
+bench_dsp_configure (DB_dsp_t *dsp, ddb_dsp_context_t *ctx, const ddb_waveformat_t *fmt) {
+    if (!strcmp (dsp->plugin.id, "SRC")) {
+        // fixed target rate, so that the result doesn't depend on the output plugin
+        dsp->set_param (ctx, 2, "0"); // auto samplerate
+        dsp->set_param (ctx, 1, fmt->samplerate == 48000 ? "44100" : "48000");
+    }
+    else if (!strcmp (dsp->plugin.id, "supereq")) {
+        dsp->set_param (ctx, 2, "6");
+        dsp->set_param (ctx, 10, "-6");
+        dsp->set_param (ctx, 16, "3");
+    }
+}
+
+// runs the dsp over the float data in BENCH_BLOCK blocks,
+// the same way the streamer feeds the dsp chain
+static int64_t
+bench_dsp (DB_dsp_t *dsp, const ddb_waveformat_t *infmt, const float *input, int64_t nframes) {
+    ddb_dsp_context_t *ctx = dsp->open ();
+    if (!ctx) {
+        return -1;
+    }
+    ctx->enabled = 1;
+    bench_dsp_configure (dsp, ctx, infmt);
+
+    float *buffer = malloc (BENCH_DSP_MAXFRAMES * infmt->channels * sizeof (float) * 2);
+    int64_t total = 0;
+    for (int64_t f = 0; f < nframes; f += BENCH_BLOCK) {
+        int n = nframes - f < BENCH_BLOCK ? (int)(nframes - f) : BENCH_BLOCK;
+        // process can change the format, e.g. samplerate or channels
+        ddb_waveformat_t fmt;
+        memcpy (&fmt, infmt, sizeof (ddb_waveformat_t));
+        memcpy (buffer, input + f * infmt->channels, n * infmt->channels * sizeof (float));
+        float ratio = 1;
+        int64_t t1 = bench_time ();
+        int res = dsp->process (ctx, buffer, n, BENCH_DSP_MAXFRAMES, &fmt, &ratio);
+        total += bench_time () - t1;
+        if (res < 0) {
+            total = -1;
+            break;
+        }
+    }
+    free (buffer);
+    dsp->close (ctx);
+    return total;
+}
+
+static void
+bench_report (const char *name, const char *stage, int64_t ns, int64_t nframes) {
+    if (ns < 0) {
+        printf ("%-24s %-12s %12s\n", name, stage, "failed");
+        return;
+    }
+    printf ("%-24s %-12s %12.2f ns/sample\n", name, stage, (double)ns / nframes);
+}
+
+static int64_t
+min_time (int64_t a, int64_t b) {
+    if (a < 0 || b < 0) {
+        return -1;
+    }
+    return a < b ? a : b;
+}
+
+static const char *dsp_ids[] = { "supereq", "SRC", "m2s", NULL };
+
+static int
+bench_file (const char *fname) {
+    const char *name = strrchr (fname, '/');
+    name = name ? name + 1 : fname;
+
+    playlist_t *plt = plt_alloc ("bench");
+    playItem_t *it = plt_insert_file (plt, NULL, fname, NULL, NULL, NULL);
+    if (!it) {
+        fprintf (stderr, "bench: %s: unsupported file\n", fname);
+        plt_free (plt);
+        return -1;
+    }
+    it = plt->head[PL_MAIN];
+    pl_lock ();
+    const char *decoder_id = pl_find_meta (it, ":DECODER");
+    DB_decoder_t *dec = decoder_id ? plug_get_decoder_for_id (decoder_id) : NULL;
+    pl_unlock ();
+    if (!dec) {
+        fprintf (stderr, "bench: %s: decoder not found\n", fname);
+        plt_free (plt);
+        return -1;
+    }
+
+    // decode
+    char *pcm = NULL;
+    int64_t pcmsize = 0;
+    ddb_waveformat_t fmt;
+    int64_t best = bench_decode (dec, it, &pcm, &pcmsize, &fmt);
+    for (int i = 1; i < repeat && best >= 0; i++) {
+        ddb_waveformat_t f;
+        best = min_time (best, bench_decode (dec, it, NULL, NULL, &f));
+    }
+    int64_t nframes = pcm ? pcmsize / ((fmt.bps >> 3) * fmt.channels) : 0;
+    if (best < 0 || !nframes) {
+        fprintf (stderr, "bench: %s: failed to decode\n", fname);
+        free (pcm);
+        plt_free (plt);
+        return -1;
+    }
+    bench_report (name, dec->plugin.id, best, nframes);
+
+    // convert to float
+    ddb_waveformat_t floatfmt;
+    memcpy (&floatfmt, &fmt, sizeof (ddb_waveformat_t));
+    floatfmt.bps = 32;
+    floatfmt.is_float = 1;
+    float *data = malloc (nframes * fmt.channels * sizeof (float));
+    best = bench_convert (&fmt, pcm, nframes, &floatfmt, (char *)data);
+    for (int i = 1; i < repeat; i++) {
+        best = min_time (best, bench_convert (&fmt, pcm, nframes, &floatfmt, (char *)data));
+    }
+    bench_report (name, "pcm_convert", best, nframes);
+    free (pcm);
+
+    // mono downmix for the mono2stereo plugin
+    ddb_waveformat_t monofmt;
+    memcpy (&monofmt, &floatfmt, sizeof (ddb_waveformat_t));
+    monofmt.channels = 1;
+    monofmt.channelmask = DDB_SPEAKER_FRONT_LEFT;
+    float *mono = malloc (nframes * sizeof (float));
+    for (int64_t f = 0; f < nframes; f++) {
+        mono[f] = data[f * fmt.channels];
+    }
+
+    for (int d = 0; dsp_ids[d]; d++) {
+        DB_plugin_t *p = plug_get_for_id (dsp_ids[d]);
+        if (!p || p->type != DB_PLUGIN_DSP) {
+            continue;
+        }
+        DB_dsp_t *dsp = (DB_dsp_t *)p;
+        int m2s = !strcmp (dsp_ids[d], "m2s");
+        const ddb_waveformat_t *dspfmt = m2s ? &monofmt : &floatfmt;
+        const float *input = m2s ? mono : data;
+        best = bench_dsp (dsp, dspfmt, input, nframes);
+        for (int i = 1; i < repeat; i++) {
+            best = min_time (best, bench_dsp (dsp, dspfmt, input, nframes));
+        }
+        bench_report (name, dsp_ids[d], best, nframes);
+    }
+
+    free (mono);
+    free (data);
+    plt_free (plt);
+    return 0;
+}
+
+static void
+print_usage (void) {
+    fprintf (stderr, "usage: deadbeef --bench [-r REPEAT] file(s)\n");
+    fprintf (stderr, "       deadbeef --bench -w reference.wav\n");
+}
+
+int
+bench_main (int argc, char *argv[]) {
+    int first = 0;
+    while (first < argc && argv[first][0] == '-') {
+        if (!strcmp (argv[first], "-w") && first + 1 < argc) {
+            return bench_write_reference (argv[first+1]) ? 1 : 0;
+        }
+        else if (!strcmp (argv[first], "-r") && first + 1 < argc) {
+            repeat = atoi (argv[first+1]);
+            if (repeat < 1) {
+                repeat = 1;
+            }
+            first += 2;
+        }
+        else {
+            print_usage ();
+            return 1;
+        }
+    }
+    if (first >= argc) {
+        print_usage ();
+        return 1;
+    }
+
+    // the configuration is not loaded, so that the results
+    // don't depend on the user settings
+    pl_init ();
+    conf_init ();
+    conf_set_int ("plugins.deferred_loading", 0);
+    messagepump_init ();
+    threadpool_init ();
+    if (plug_load_all ()) {
+        return 1;
+    }
+
+    int res = 0;
+    for (int i = first; i < argc; i++) {
+        if (bench_file (argv[i])) {
+            res = 1;
+        }
+    }
+
+    threadpool_stop ();
+    plug_unload_all ();
+    pl_free ();
+    conf_free ();
+    messagepump_free ();
+    threadpool_free ();
+    plug_cleanup ();
+    return res;
+}
@@ -44,5 +44,6 @@ extern char dbdocdir[PATH_MAX]; // see deadbeef->get_doc_dir
 extern char dbplugindir[PATH_MAX]; // see deadbeef->get_plugin_dir
 extern char dbpixmapdir[PATH_MAX]; // see deadbeef->get_pixmap_dir
 extern char dbcachedir[PATH_MAX];
+extern char dbruntimedir[PATH_MAX]; // /run/user/<uid>/deadbeef
 
 #endif // __COMMON_H
@@ -43,13 +43,66 @@
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
+#define CONF_HASH_SIZE 4096
+
+// items are kept in a sorted list for conf_find / conf_save,
+// and additionally chained into a case-insensitive hash for lookups
+typedef struct conf_item_s {
+    DB_conf_item_t item;
+    struct conf_item_s *hashnext;
+    uint32_t hash;
+} conf_item_t;
+
 static DB_conf_item_t *conf_items;
+static DB_conf_item_t *conf_items_tail;
+static conf_item_t *conf_hash[CONF_HASH_SIZE];
 static int changed = 0;
 static uintptr_t mutex;
+// writers hold both the mutex and the write lock;
+// conf_get_* readers only take the read lock, and don't serialize
+static uintptr_t rwlock;
+
+static uint32_t
+conf_get_hash (const char *key) {
+    uint32_t hash = 0;
+    int c;
+
+    while ((c = (uint8_t)*key++)) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = c + (hash << 6) + (hash << 16) - hash;
+    }
+
+    return hash;
+}
+
+static conf_item_t *
+conf_hash_find (const char *key, uint32_t h) {
+    for (conf_item_t *it = conf_hash[h % CONF_HASH_SIZE]; it; it = it->hashnext) {
+        if (it->hash == h && !strcasecmp (key, it->item.key)) {
+            return it;
+        }
+    }
+    return NULL;
+}
+
+static void
+conf_hash_remove (conf_item_t *item) {
+    conf_item_t **pp = &conf_hash[item->hash % CONF_HASH_SIZE];
+    for (; *pp; pp = &(*pp)->hashnext) {
+        if (*pp == item) {
+            *pp = item->hashnext;
+            item->hashnext = NULL;
+            return;
+        }
+    }
+}
 
 void
 conf_init (void) {
     mutex = mutex_create ();
+    rwlock = rwlock_create ();
 }
 
 void
@@ -62,16 +115,34 @@ conf_unlock (void) {
     mutex_unlock (mutex);
 }
 
+static void
+conf_write_lock (void) {
+    mutex_lock (mutex);
+    rwlock_wrlock (rwlock);
+}
+
+static void
+conf_write_unlock (void) {
+    rwlock_unlock (rwlock);
+    mutex_unlock (mutex);
+}
+
 void
 conf_free (void) {
-    mutex_lock (mutex);
+    conf_write_lock ();
     DB_conf_item_t *next = NULL;
     for (DB_conf_item_t *it = conf_items; it; it = next) {
         next = it->next;
         conf_item_free (it);
     }
     conf_items = NULL;
+    conf_items_tail = NULL;
+    memset (conf_hash, 0, sizeof (conf_hash));
     changed = 0;
+    rwlock_unlock (rwlock);
+    rwlock_free (rwlock);
+    rwlock = 0;
+    mutex_unlock (mutex);
     mutex_free (mutex);
     mutex = 0;
 }
@@ -215,17 +286,13 @@ conf_item_free (DB_conf_item_t *it) {
 
 const char *
 conf_get_str_fast (const char *key, const char *def) {
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        if (!strcasecmp (key, it->key)) {
-            return it->value;
-        }
-    }
-    return def;
+    conf_item_t *it = conf_hash_find (key, conf_get_hash (key));
+    return it ? it->item.value : def;
 }
 
 void
 conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
-    conf_lock ();
+    rwlock_rdlock (rwlock);
     const char *out = conf_get_str_fast (key, def);
     if (out) {
         size_t n = strlen (out)+1;
@@ -236,31 +303,34 @@ conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
     else {
         *buffer = 0;
     }
-    conf_unlock ();
+    rwlock_unlock (rwlock);
 }
 
 float
 conf_get_float (const char *key, float def) {
-    conf_lock ();
+    rwlock_rdlock (rwlock);
     const char *v = conf_get_str_fast (key, NULL);
-    conf_unlock ();
-    return v ? atof (v) : def;
+    float res = v ? atof (v) : def;
+    rwlock_unlock (rwlock);
+    return res;
 }
 
 int
 conf_get_int (const char *key, int def) {
-    conf_lock ();
+    rwlock_rdlock (rwlock);
     const char *v = conf_get_str_fast (key, NULL);
-    conf_unlock ();
-    return v ? atoi (v) : def;
+    int res = v ? atoi (v) : def;
+    rwlock_unlock (rwlock);
+    return res;
 }
 
 int64_t
 conf_get_int64 (const char *key, int64_t def) {
-    conf_lock ();
+    rwlock_rdlock (rwlock);
     const char *v = conf_get_str_fast (key, NULL);
-    conf_unlock ();
-    return v ? atoll (v) : def;
+    int64_t res = v ? atoll (v) : def;
+    rwlock_unlock (rwlock);
+    return res;
 }
 
 DB_conf_item_t *
@@ -276,34 +346,49 @@ conf_find (const char *group, DB_conf_item_t *prev) {
 
 void
 conf_set_str (const char *key, const char *val) {
-    conf_lock ();
-    DB_conf_item_t *prev = NULL;
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        int cmp = strcasecmp (key, it->key);
-        if (!cmp) {
-            if (!strcmp (it->value, val)) {
-                conf_unlock ();
-                return;
-            }
-            free (it->value);
-            it->value = strdup (val);
-            conf_unlock ();
-            changed = 1;
+    conf_write_lock ();
+    uint32_t h = conf_get_hash (key);
+    conf_item_t *found = conf_hash_find (key, h);
+    if (found) {
+        DB_conf_item_t *it = &found->item;
+        if (!strcmp (it->value, val)) {
+            conf_write_unlock ();
             return;
         }
-        else if (cmp < 0) {
-            break;
-        }
-        prev = it;
+        free (it->value);
+        it->value = strdup (val);
+        changed = 1;
+        conf_write_unlock ();
+        return;
     }
     if (!val) {
-        conf_unlock ();
+        conf_write_unlock ();
         return;
     }
-    DB_conf_item_t *it = malloc (sizeof (DB_conf_item_t));
-    memset (it, 0, sizeof (DB_conf_item_t));
+
+    // find insertion point; the config file is saved sorted,
+    // so conf_load normally appends at the tail
+    DB_conf_item_t *prev = NULL;
+    if (conf_items_tail && strcasecmp (key, conf_items_tail->key) > 0) {
+        prev = conf_items_tail;
+    }
+    else {
+        for (DB_conf_item_t *it = conf_items; it; it = it->next) {
+            if (strcasecmp (key, it->key) < 0) {
+                break;
+            }
+            prev = it;
+        }
+    }
+
+    conf_item_t *item = malloc (sizeof (conf_item_t));
+    memset (item, 0, sizeof (conf_item_t));
+    DB_conf_item_t *it = &item->item;
     it->key = strdup (key);
     it->value = strdup (val);
+    item->hash = h;
+    item->hashnext = conf_hash[h % CONF_HASH_SIZE];
+    conf_hash[h % CONF_HASH_SIZE] = item;
     changed = 1;
     if (prev) {
         DB_conf_item_t *next = prev->next;
@@ -314,7 +399,10 @@ conf_set_str (const char *key, const char *val) {
         it->next = conf_items;
         conf_items = it;
     }
-    conf_unlock ();
+    if (!it->next) {
+        conf_items_tail = it;
+    }
+    conf_write_unlock ();
 }
 
 void
@@ -351,7 +439,7 @@ conf_setchanged (int c) {
 void
 conf_remove_items (const char *key) {
     size_t l = strlen (key);
-    conf_lock ();
+    conf_write_lock ();
     DB_conf_item_t *prev = NULL;
     DB_conf_item_t *it;
     for (it = conf_items; it; prev = it, it = it->next) {
@@ -362,6 +450,7 @@ conf_remove_items (const char *key) {
     DB_conf_item_t *next = NULL;
     while (it) {
         next = it->next;
+        conf_hash_remove ((conf_item_t *)it);
         conf_item_free (it);
         it = next;
         if (!it || strncasecmp (key, it->key, l)) {
@@ -374,5 +463,8 @@ conf_remove_items (const char *key) {
     else {
         conf_items = next;
     }
-    conf_unlock ();
+    if (!next) {
+        conf_items_tail = prev;
+    }
+    conf_write_unlock ();
 }
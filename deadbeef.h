@@ -70,6 +70,7 @@ extern "C" {
 // that there's a better replacement in the newer deadbeef versions.
 
 // api version history:
+// 1.10 -- deadbeef-0.7.2
 // 1.9 -- deadbeef-0.7.1
 // 1.8 -- deadbeef-0.7.0
 // 1.7 -- deadbeef-0.6.2
@@ -93,7 +94,7 @@ extern "C" {
 // 0.1 -- deadbeef-0.2.0
 
 #define DB_API_VERSION_MAJOR 1
-#define DB_API_VERSION_MINOR 9
+#define DB_API_VERSION_MINOR 10
 
 #define DDB_DEPRECATED(x)
 
@@ -469,6 +470,29 @@ enum ddb_sys_directory_t {
     DDB_SYS_DIR_CACHE = 6,
 };
 
+#if (DDB_API_LEVEL >= 10)
+// priorities of the jobs submitted to the shared thread pool
+enum ddb_job_priority_t {
+    DDB_JOB_PRIORITY_REALTIME, // work the playback is waiting for, runs before anything else
+    DDB_JOB_PRIORITY_INTERACTIVE, // work the user is waiting for, e.g. loading visible artwork
+    DDB_JOB_PRIORITY_BACKGROUND, // scanning, cache maintenance, etc; never occupies all workers
+};
+
+// opaque job handle, returned by job_submit
+typedef struct ddb_job_s ddb_job_t;
+
+// opaque resumable search, returned by plt_search_begin
+typedef struct ddb_search_s ddb_search_t;
+
+// cumulative streamer performance counters, see streamer_get_perf
+typedef struct {
+    int64_t decoded_frames; // frames returned by the decoders
+    double decode_time; // seconds spent in the decoders' read
+    int64_t dsp_frames; // frames passed into the dsp chain
+    double dsp_time; // seconds spent in the dsp chain
+} ddb_streamer_perf_t;
+#endif
+
 // typecasting macros
 #define DB_PLUGIN(x) ((DB_plugin_t *)(x))
 #define DB_CALLBACK(x) ((DB_callback_t)(x))
@@ -1191,6 +1215,76 @@ typedef struct {
     // search results, or not
     void (*plt_search_process2) (ddb_playlist_t *plt, const char *text, int select_results);
 #endif
+
+    // since 1.10
+#if (DDB_API_LEVEL >= 10)
+    // metadata key handles, for fast lookups by pointer comparison.
+    // pl_meta_key_get returns a case-insensitive handle for the key,
+    // which must be released with pl_meta_key_release when not needed anymore.
+    const char *(*pl_meta_key_get) (const char *key);
+    void (*pl_meta_key_release) (const char *key);
+
+    // same as pl_find_meta and pl_find_meta_raw, but take a key handle
+    const char *(*pl_find_meta_interned) (DB_playItem_t *it, const char *key);
+    const char *(*pl_find_meta_raw_interned) (DB_playItem_t *it, const char *key);
+
+    // reads APEv2, ID3v2 and ID3v1 tags, same as calling junk_apev2_read,
+    // junk_id3v2_read and junk_id3v1_read in this order, but fetches
+    // the head and the tail of the file in one read each.
+    // returns 0 if at least one tag was found
+    int (*junk_read_tags) (DB_playItem_t *it, DB_FILE *fp);
+
+    // shared worker thread pool.
+    // work is called on a pool thread, long running jobs should poll
+    // job_cancelled and return early.
+    // done (optional) is called on the main thread after work has returned,
+    // or instead of it, with cancelled=1, if the job was cancelled before
+    // it started.
+    // job_submit returns a handle which must be released with job_release,
+    // or NULL if the job couldn't be submitted (e.g. during shutdown).
+    // job_wait blocks until work has returned or the job was cancelled,
+    // and must not be called from the job itself.
+    ddb_job_t *(*job_submit) (int priority, void (*work) (ddb_job_t *job, void *ctx), void (*done) (ddb_job_t *job, void *ctx, int cancelled), void *ctx);
+    void (*job_cancel) (ddb_job_t *job);
+    int (*job_cancelled) (ddb_job_t *job);
+    void (*job_wait) (ddb_job_t *job);
+    void (*job_release) (ddb_job_t *job);
+
+    // output plugins report how many seconds of the data returned by
+    // streamer_read are buffered but not played yet (0 if unknown);
+    // used to correct the reported play position and visualization timing
+    void (*streamer_set_output_latency) (float latency);
+
+    // fills in the streamer performance counters; they only ever grow,
+    // so take the difference of two calls to measure a time span
+    void (*streamer_get_perf) (ddb_streamer_perf_t *perf);
+
+    // resumable search, for searching big playlists without holding the
+    // playlist lock all the time.
+    // plt_search_begin clears the search results, like plt_search_process2,
+    // and returns NULL if out of memory.
+    // plt_search_continue searches up to count more tracks, appending the
+    // matches to the PL_SEARCH list; returns 0 while there are more tracks
+    // to search, 1 when done, and -1 if the playlist was modified or another
+    // search was started meanwhile, and this one has to be started over.
+    // plt_search_end frees the search, the results stay.
+    ddb_search_t *(*plt_search_begin) (ddb_playlist_t *plt, const char *text, int select_results);
+    int (*plt_search_continue) (ddb_search_t *search, int count);
+    void (*plt_search_end) (ddb_search_t *search);
+
+    // same as plug_get_decoder_list, but doesn't load the plugins which are
+    // loaded on first use. those are represented by stubs, which have the
+    // plugin info, exts and prefixes, but no callbacks, so only use this
+    // list to look at the supported formats.
+    struct DB_decoder_s **(*plug_get_decoder_info_list) (void);
+
+    // same as cond_wait, but the mutex must be locked by the caller, and is
+    // still locked on return, so that the wait condition can be checked
+    // without missing a signal. the mutex must not be recursive.
+    // the timeout version returns ETIMEDOUT after timeout_ms milliseconds.
+    int (*cond_wait_locked) (uintptr_t cond, uintptr_t mutex);
+    int (*cond_wait_timeout_locked) (uintptr_t cond, uintptr_t mutex, int timeout_ms);
+#endif
 } DB_functions_t;
 
 // NOTE: an item placement must be selected like this
@@ -71,6 +71,11 @@ int enable_shift_jis_detection = 0;
 #define MAX_ID3V2_FRAME_SIZE 100000
 #define MAX_ID3V2_APIC_FRAME_SIZE 2000000
 
+// junk_read_tags fetches this many bytes from the head and the tail of
+// the file, and only issues more reads when a tag doesn't fit
+#define JUNK_HEAD_WINDOW 0x10000
+#define JUNK_TAIL_WINDOW 0x4000
+
 #define UTF8_STR "utf-8"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
@@ -184,7 +189,7 @@ extract_i32 (const uint8_t *buf)
 }
 
 static inline uint32_t
-extract_i32_le (unsigned char *buf)
+extract_i32_le (const uint8_t *buf)
 {
     uint32_t x;
     // little endian extract
@@ -1630,74 +1635,30 @@ junk_apev2_read_full_mem (playItem_t *it, DB_apev2_tag_t *tag_store, char *mem,
     return 0;
 }
 
-int
-junk_apev2_read_full (playItem_t *it, DB_apev2_tag_t *tag_store, DB_FILE *fp) {
-    // try to read footer, position must be already at the EOF right before
-    // id3v1 (if present)
-
+// parses APEv2 items from memory; mem points to the first item,
+// size is the tag size from the footer minus the footer itself
+static int
+junk_apev2_read_items_mem (playItem_t *it, DB_apev2_tag_t *tag_store, const uint8_t *mem, int size, uint32_t numitems, uint32_t flags) {
     DB_apev2_frame_t *tail = NULL;
-
-    uint8_t header[32];
-    if (deadbeef->fseek (fp, -32, SEEK_END) == -1) {
-        return -1; // something bad happened
-    }
-
-    if (deadbeef->fread (header, 1, 32, fp) != 32) {
-        return -1; // something bad happened
-    }
-    if (strncmp (header, "APETAGEX", 8)) {
-        // try to skip 128 bytes backwards (id3v1)
-        if (deadbeef->fseek (fp, -128-32, SEEK_END) == -1) {
-            return -1; // something bad happened
-        }
-        if (deadbeef->fread (header, 1, 32, fp) != 32) {
-            return -1; // something bad happened
-        }
-        if (strncmp (header, "APETAGEX", 8)) {
-            return -1; // no ape tag here
-        }
-    }
-
-    // end of footer must be 0
-//    if (memcmp (&header[24], "\0\0\0\0\0\0\0\0", 8)) {
-//        trace ("bad footer\n");
-//        return -1;
-//    }
-
-    uint32_t version = extract_i32_le (&header[8]);
-    int32_t size = extract_i32_le (&header[12]);
-    uint32_t numitems = extract_i32_le (&header[16]);
-    uint32_t flags = extract_i32_le (&header[20]);
-
-    trace ("APEv%d, size=%d, items=%d, flags=%x\n", version, size, numitems, flags);
-    if (it) {
-        uint32_t f = pl_get_item_flags (it);
-        f |= DDB_TAG_APEV2;
-        pl_set_item_flags (it, f);
-    }
-
-    // now seek to beginning of the tag (exluding header)
-    if (deadbeef->fseek (fp, -size, SEEK_CUR) == -1) {
-        trace ("failed to seek to tag start (-%d)\n", size);
-        return -1;
-    }
+    const uint8_t *end = mem + size;
 
     int i;
     for (i = 0; i < numitems; i++) {
-        uint8_t buffer[8];
-        if (deadbeef->fread (buffer, 1, 8, fp) != 8) {
+        if (end - mem < 8) {
             return -1;
         }
-        uint32_t itemsize = extract_i32_le (&buffer[0]);
-        uint32_t itemflags = extract_i32_le (&buffer[4]);
+        uint32_t itemsize = extract_i32_le (&mem[0]);
+        uint32_t itemflags = extract_i32_le (&mem[4]);
+        mem += 8;
 
-        // read key until 0 (stupid and slow)
+        // read key until 0
         char key[256];
         int keysize = 0;
         while (keysize <= 255) {
-            if (deadbeef->fread (&key[keysize], 1, 1, fp) != 1) {
+            if (mem >= end) {
                 return -1;
             }
+            key[keysize] = *mem++;
             if (key[keysize] == 0) {
                 break;
             }
@@ -1708,6 +1669,10 @@ junk_apev2_read_full (playItem_t *it, DB_apev2_tag_t *tag_store, DB_FILE *fp) {
         }
         key[255] = 0;
         trace ("item %d, size %d, flags %08x, keysize %d, key %s\n", i, itemsize, itemflags, keysize, key);
+        if (itemsize > end - mem) {
+            trace ("junk_read_ape_full: item %d doesn't fit into the tag\n", i);
+            return -1;
+        }
         // read value
         if (itemsize <= MAX_APEV2_FRAME_SIZE) // just a sanity check
         {
@@ -1716,11 +1681,7 @@ junk_apev2_read_full (playItem_t *it, DB_apev2_tag_t *tag_store, DB_FILE *fp) {
                 trace ("junk_read_ape_full: failed to allocate %d bytes\n", itemsize+1);
                 return -1;
             }
-            if (deadbeef->fread (value, 1, itemsize, fp) != itemsize) {
-                trace ("junk_read_ape_full: failed to read %d bytes from file\n", itemsize);
-                free (value);
-                return -1;
-            }
+            memcpy (value, mem, itemsize);
             value[itemsize] = 0;
 
             if ((flags&6) == 0 && strncasecmp (key, "cover art ", 10)) {
@@ -1737,19 +1698,89 @@ junk_apev2_read_full (playItem_t *it, DB_apev2_tag_t *tag_store, DB_FILE *fp) {
             junk_apev2_add_frame (it, tag_store, &tail, itemsize, itemflags, key, value);
             free (value);
         }
-        else {
-            // try to skip
-            int err = deadbeef->fseek (fp, itemsize, SEEK_CUR);
-            if (0 != err) {
-                perror ("junklib: corrupted APEv2 tag\n");
-                return -1;
-            }
-        }
+        mem += itemsize;
     }
 
     return 0;
 }
 
+// checks the 32 bytes APEv2 footer, returns the size of the items
+// preceding the footer, or -1 if there's no valid footer
+static int
+junk_apev2_parse_footer (playItem_t *it, const uint8_t *footer, uint32_t *numitems, uint32_t *flags) {
+    if (strncmp ((const char *)footer, "APETAGEX", 8)) {
+        return -1; // no ape tag here
+    }
+
+    uint32_t version = extract_i32_le (&footer[8]);
+    int32_t size = extract_i32_le (&footer[12]);
+    *numitems = extract_i32_le (&footer[16]);
+    *flags = extract_i32_le (&footer[20]);
+
+    trace ("APEv%d, size=%d, items=%d, flags=%x\n", version, size, *numitems, *flags);
+    if (size < 32) {
+        trace ("bad APEv2 tag size %d\n", size);
+        return -1;
+    }
+    if (it) {
+        uint32_t f = pl_get_item_flags (it);
+        f |= DDB_TAG_APEV2;
+        pl_set_item_flags (it, f);
+    }
+    return size - 32;
+}
+
+int
+junk_apev2_read_full (playItem_t *it, DB_apev2_tag_t *tag_store, DB_FILE *fp) {
+    // try to read footer, position must be already at the EOF right before
+    // id3v1 (if present)
+
+    uint8_t header[32];
+    if (deadbeef->fseek (fp, -32, SEEK_END) == -1) {
+        return -1; // something bad happened
+    }
+
+    if (deadbeef->fread (header, 1, 32, fp) != 32) {
+        return -1; // something bad happened
+    }
+    if (strncmp (header, "APETAGEX", 8)) {
+        // try to skip 128 bytes backwards (id3v1)
+        if (deadbeef->fseek (fp, -128-32, SEEK_END) == -1) {
+            return -1; // something bad happened
+        }
+        if (deadbeef->fread (header, 1, 32, fp) != 32) {
+            return -1; // something bad happened
+        }
+    }
+
+    uint32_t numitems, flags;
+    int size = junk_apev2_parse_footer (it, header, &numitems, &flags);
+    if (size < 0) {
+        return -1;
+    }
+
+    // now seek to beginning of the tag (exluding header), and read all items at once
+    if (deadbeef->fseek (fp, -size-32, SEEK_CUR) == -1) {
+        trace ("failed to seek to tag start (-%d)\n", size+32);
+        return -1;
+    }
+
+    uint8_t *mem = malloc (size);
+    if (!mem) {
+        trace ("junk_read_ape_full: failed to allocate %d bytes\n", size);
+        return -1;
+    }
+    if (deadbeef->fread (mem, 1, size, fp) != size) {
+        trace ("junk_read_ape_full: failed to read %d bytes from file\n", size);
+        free (mem);
+        return -1;
+    }
+
+    int res = junk_apev2_read_items_mem (it, tag_store, mem, size, numitems, flags);
+    free (mem);
+    return res;
+}
+
 int
 junk_apev2_read (playItem_t *it, DB_FILE *fp) {
     return junk_apev2_read_full (it, NULL, fp);
@@ -3747,26 +3778,16 @@ junk_id3v2_add_genre (playItem_t *it, char *genre) {
     return 0;
 }
 
-int
-junk_id3v2_read_full (playItem_t *it, DB_id3v2_tag_t *tag_store, DB_FILE *fp) {
-    DB_id3v2_frame_t *tail = NULL;
-    int title_added = 0;
-    if (!fp) {
-        trace ("bad call to junk_id3v2_read!\n");
-        return -1;
-    }
-    deadbeef->rewind (fp);
-    uint8_t header[10];
-    if (deadbeef->fread (header, 1, 10, fp) != 10) {
-        return -1; // too short
-    }
-    if (strncmp (header, "ID3", 3)) {
+// parses the 10 bytes id3v2 header, returns the size of the tag data
+// following the header, or -1 if there's no valid tag
+static int
+junk_id3v2_parse_header (const uint8_t *header) {
+    if (strncmp ((const char *)header, "ID3", 3)) {
         return -1; // no tag
     }
     uint8_t version_major = header[3];
-    uint8_t version_minor = header[4];
     if (version_major > 4 || version_major < 2) {
-        trace ("id3v2.%d.%d is unsupported\n", version_major, version_minor);
+        trace ("id3v2.%d.%d is unsupported\n", version_major, header[4]);
         return -1; // unsupported
     }
     uint8_t flags = header[5];
@@ -3774,10 +3795,6 @@ junk_id3v2_read_full (playItem_t *it, DB_id3v2_tag_t *tag_store, DB_FILE *fp) {
         trace ("unrecognized flags: one of low 15 bits is set, value=0x%x\n", (int)flags);
         return -1; // unsupported
     }
-    int unsync = (flags & (1<<7)) ? 1 : 0;
-    int extheader = (flags & (1<<6)) ? 1 : 0;
-    int expindicator = (flags & (1<<5)) ? 1 : 0;
-    int footerpresent = (flags & (1<<4)) ? 1 : 0;
     // check for bad size
     if ((header[9] & 0x80) || (header[8] & 0x80) || (header[7] & 0x80) || (header[6] & 0x80)) {
         trace ("bad header size\n");
@@ -3789,6 +3806,22 @@ junk_id3v2_read_full (playItem_t *it, DB_id3v2_tag_t *tag_store, DB_FILE *fp) {
     if (size == 0) {
         return -1;
     }
+    return size;
+}
+
+// parses the id3v2 tag data, which follows the header;
+// the data may be modified (unsynchronized) in place
+static int
+junk_id3v2_read_tag_mem (playItem_t *it, DB_id3v2_tag_t *tag_store, const uint8_t *header, uint8_t *tag, uint32_t size) {
+    DB_id3v2_frame_t *tail = NULL;
+    int title_added = 0;
+    uint8_t version_major = header[3];
+    uint8_t version_minor = header[4];
+    uint8_t flags = header[5];
+    int unsync = (flags & (1<<7)) ? 1 : 0;
+    int extheader = (flags & (1<<6)) ? 1 : 0;
+    int expindicator = (flags & (1<<5)) ? 1 : 0;
+
     if (tag_store) {
         tag_store->version[0] = version_major;
         tag_store->version[1] = version_minor;
@@ -3797,14 +3830,6 @@ junk_id3v2_read_full (playItem_t *it, DB_id3v2_tag_t *tag_store, DB_FILE *fp) {
         tag_store->flags &= ~ (1<<7);
     }
 
-    uint8_t *tag = malloc (size);
-    if (!tag) {
-        fprintf (stderr, "junklib: out of memory while reading id3v2, tried to alloc %d bytes\n", size);
-        goto error;
-    }
-    if (deadbeef->fread (tag, 1, size, fp) != size) {
-        goto error; // bad size
-    }
     uint8_t *readptr = tag;
     int crcpresent = 0;
     trace ("version: 2.%d.%d, unsync: %d, extheader: %d, experimental: %d\n", version_major, version_minor, unsync, extheader, expindicator);
@@ -4177,9 +4202,6 @@ error:
         trace ("error parsing id3v2\n");
     }
 
-    if (tag) {
-        free (tag);
-    }
     if (tag_store && err != 0) {
         while (tag_store->frames) {
             DB_id3v2_frame_t *next = tag_store->frames->next;
@@ -4190,11 +4212,168 @@ error:
     return err;
 }
 
+int
+junk_id3v2_read_full (playItem_t *it, DB_id3v2_tag_t *tag_store, DB_FILE *fp) {
+    if (!fp) {
+        trace ("bad call to junk_id3v2_read!\n");
+        return -1;
+    }
+    deadbeef->rewind (fp);
+    uint8_t header[10];
+    if (deadbeef->fread (header, 1, 10, fp) != 10) {
+        return -1; // too short
+    }
+    int size = junk_id3v2_parse_header (header);
+    if (size < 0) {
+        return -1;
+    }
+
+    uint8_t *tag = malloc (size);
+    if (!tag) {
+        fprintf (stderr, "junklib: out of memory while reading id3v2, tried to alloc %d bytes\n", size);
+        return -1;
+    }
+    if (deadbeef->fread (tag, 1, size, fp) != size) {
+        free (tag);
+        return -1; // bad size
+    }
+    int err = junk_id3v2_read_tag_mem (it, tag_store, header, tag, size);
+    free (tag);
+    return err;
+}
+
 int
 junk_id3v2_read (playItem_t *it, DB_FILE *fp) {
     return junk_id3v2_read_full (it, NULL, fp);
 }
 
+static int
+junk_read_tags_head (playItem_t *it, DB_FILE *fp, uint8_t *head, int headsize) {
+    if (headsize < 10) {
+        return -1;
+    }
+    int size = junk_id3v2_parse_header (head);
+    if (size < 0) {
+        return -1;
+    }
+    if (size <= headsize - 10) {
+        return junk_id3v2_read_tag_mem (it, NULL, head, head + 10, size);
+    }
+
+    // the tag doesn't fit into the window, fetch the rest
+    uint8_t *tag = malloc (size);
+    if (!tag) {
+        fprintf (stderr, "junklib: out of memory while reading id3v2, tried to alloc %d bytes\n", size);
+        return -1;
+    }
+    int have = headsize - 10;
+    memcpy (tag, head + 10, have);
+    if (deadbeef->fseek (fp, headsize, SEEK_SET) == -1
+            || deadbeef->fread (tag + have, 1, size - have, fp) != size - have) {
+        free (tag);
+        return -1;
+    }
+    int err = junk_id3v2_read_tag_mem (it, NULL, head, tag, size);
+    free (tag);
+    return err;
+}
+
+static int
+junk_read_tags_tail (playItem_t *it, DB_FILE *fp, const uint8_t *tail, int tailsize, int64_t fsize) {
+    const uint8_t *footer = NULL;
+    if (tailsize >= 32 && !strncmp ((const char *)tail + tailsize - 32, "APETAGEX", 8)) {
+        footer = tail + tailsize - 32;
+    }
+    else if (tailsize >= 128+32) {
+        footer = tail + tailsize - 128 - 32;
+    }
+    if (!footer) {
+        return -1;
+    }
+
+    uint32_t numitems, flags;
+    int size = junk_apev2_parse_footer (it, footer, &numitems, &flags);
+    if (size < 0) {
+        return -1;
+    }
+    if (size <= footer - tail) {
+        return junk_apev2_read_items_mem (it, NULL, footer - size, size, numitems, flags);
+    }
+
+    // the tag doesn't fit into the window, read it from the file
+    int64_t offs = fsize - tailsize + (footer - tail) - size;
+    if (offs < 0) {
+        return -1;
+    }
+    uint8_t *mem = malloc (size);
+    if (!mem) {
+        trace ("junk_read_tags: failed to allocate %d bytes\n", size);
+        return -1;
+    }
+    if (deadbeef->fseek (fp, offs, SEEK_SET) == -1
+            || deadbeef->fread (mem, 1, size, fp) != size) {
+        free (mem);
+        return -1;
+    }
+    int res = junk_apev2_read_items_mem (it, NULL, mem, size, numitems, flags);
+    free (mem);
+    return res;
+}
+
+// reads APEv2, ID3v2 and ID3v1 tags (in this order, same as calling
+// junk_apev2_read, junk_id3v2_read and junk_id3v1_read), using one read
+// at the head and one at the tail of the file in most cases
+int
+junk_read_tags (playItem_t *it, DB_FILE *fp) {
+    int64_t fsize = deadbeef->fgetlength (fp);
+    if (fsize <= 0) {
+        // unknown length, use the regular readers
+        int apeerr = junk_apev2_read (it, fp);
+        int v2err = junk_id3v2_read (it, fp);
+        int v1err = junk_id3v1_read (it, fp);
+        return (apeerr && v2err && v1err) ? -1 : 0;
+    }
+
+    // small files are read in one go, and the tail is the end of the head
+    int whole = fsize <= JUNK_HEAD_WINDOW + JUNK_TAIL_WINDOW;
+    int headsize = whole ? (int)fsize : JUNK_HEAD_WINDOW;
+    int tailsize = (int)min (fsize, JUNK_TAIL_WINDOW);
+    uint8_t *buffer = malloc (whole ? headsize : headsize + tailsize);
+    if (!buffer) {
+        return -1;
+    }
+    uint8_t *tail = whole ? buffer + headsize - tailsize : buffer + headsize;
+
+    deadbeef->rewind (fp);
+    if (deadbeef->fread (buffer, 1, headsize, fp) != headsize) {
+        free (buffer);
+        return -1;
+    }
+    if (!whole) {
+        if (deadbeef->fseek (fp, fsize - tailsize, SEEK_SET) == -1
+                || deadbeef->fread (tail, 1, tailsize, fp) != tailsize) {
+            free (buffer);
+            return -1;
+        }
+    }
+
+    // id3v2 is unsynchronized in place, so keep a copy of id3v1 in case the
+    // buffers overlap
+    uint8_t id3v1[128];
+    int have_id3v1 = 0;
+    if (tailsize >= 128) {
+        memcpy (id3v1, tail + tailsize - 128, 128);
+        have_id3v1 = 1;
+    }
+
+    int apeerr = junk_read_tags_tail (it, fp, tail, tailsize, fsize);
+    int v2err = junk_read_tags_head (it, fp, buffer, headsize);
+    int v1err = have_id3v1 ? junk_id3v1_read_int (it, (char *)id3v1, NULL) : -1;
+
+    free (buffer);
+    return (apeerr && v2err && v1err) ? -1 : 0;
+}
+
 const char *
 junk_detect_charset_len (const char *s, int len) {
     // check if that's already utf8
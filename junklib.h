@@ -73,6 +73,9 @@ junk_id3v2_free (DB_id3v2_tag_t *tag);
 int
 junk_id3v2_read (struct playItem_s *it, DB_FILE *fp);
 
+int
+junk_read_tags (struct playItem_s *it, DB_FILE *fp);
+
 int
 junk_apev2_read_full (struct playItem_s *it, DB_apev2_tag_t *tag_store, DB_FILE *fp);
 
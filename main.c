@@ -59,6 +59,9 @@
 #include "playlist.h"
 #include "threading.h"
 #include "messagepump.h"
+#include "threadpool.h"
+#include "bench.h"
+#include "perftrace.h"
 #include "streamer.h"
 #include "conf.h"
 #include "volume.h"
@@ -69,6 +72,7 @@
 #include "cocoautil.h"
 #endif
 #include "playqueue.h"
+#include "server.h"
 
 #ifndef PREFIX
 #error PREFIX must be defined
@@ -116,6 +120,9 @@ print_help (void) {
     fprintf (stdout, _("   --random           Random song in playlist\n"));
     fprintf (stdout, _("   --queue            Append file(s) to existing playlist\n"));
     fprintf (stdout, _("   --gui PLUGIN       Tells which GUI plugin to use, default is \"GTK2\"\n"));
+    fprintf (stdout, _("   --bench FILE(S)    Measure decoder and DSP performance on the files, and exit\n"));
+    fprintf (stdout, _("   --perftrace FILE   Save playback performance trace of the running player\n"
+                "                      to FILE, in Chrome trace format\n"));
     fprintf (stdout, _("   --nowplaying FMT   Print formatted track name to stdout\n"));
     fprintf (stdout, _("                      FMT %%-syntax: [a]rtist, [t]itle, al[b]um,\n"
                 "                      [l]ength, track[n]umber, [y]ear, [c]omment,\n"
@@ -145,16 +152,25 @@ prepare_command_line (int argc, char *argv[], int *size) {
     }
 
     int p = 0;
+    int output_fname = 0;
     for (int i = 1; i < argc; i++) {
         // if argument is a filename, try to resolve it
         char resolved[PATH_MAX];
         char *arg;
-        if (!strncmp ("--", argv[i], 2) && !seen_ddash || !realpath (argv[i], resolved)) {
+        if (output_fname && argv[i][0] != '/' && getcwd (resolved, sizeof (resolved))) {
+            // the file is written by the server, which has its own cwd,
+            // and it doesn't need to exist
+            size_t l = strlen (resolved);
+            snprintf (resolved + l, sizeof (resolved) - l, "/%s", argv[i]);
+            arg = resolved;
+        }
+        else if (!strncmp ("--", argv[i], 2) && !seen_ddash || !realpath (argv[i], resolved)) {
             arg = argv[i];
         }
         else {
             arg = resolved;
         }
+        output_fname = !seen_ddash && !strcmp (argv[i], "--perftrace");
 
         // make sure that there is enough space in the buffer;
         // re-allocate, if needed
@@ -300,6 +316,33 @@ server_exec_command_line (const char *cmdline, int len, char *sendback, int sbsi
             }
             continue;
         }
+        else if (!strcmp (parg, "--perftrace")) {
+            parg += strlen (parg);
+            parg++;
+            if (parg >= pend) {
+                if (sendback) {
+                    snprintf (sendback, sbsize, "error --perftrace expects file name argument\n");
+                    return 0;
+                }
+                else {
+                    fprintf (stderr, "--perftrace expects file name argument\n");
+                    return -1;
+                }
+            }
+            if (!sendback) {
+                fprintf (stderr, "--perftrace: deadbeef is not running\n");
+                return -1;
+            }
+            if (perftrace_export ((const char *)parg) < 0) {
+                snprintf (sendback, sbsize, "error failed to write %s\n", parg);
+            }
+            else {
+                snprintf (sendback, sbsize, "performance trace saved to %s", parg);
+            }
+            parg += strlen (parg);
+            parg++;
+            continue;
+        }
         else if (!strcmp (parg, "--gui")) {
             // need to skip --gui here, it is handled in the client cmdline
             parg += strlen (parg);
@@ -374,63 +417,6 @@ server_exec_command_line (const char *cmdline, int len, char *sendback, int sbsi
     return 0;
 }
 
-static struct sockaddr_un srv_local;
-static struct sockaddr_un srv_remote;
-static unsigned srv_socket;
-
-#if USE_ABSTRACT_SOCKET_NAME
-static char server_id[] = "\0deadbeefplayer";
-#endif
-
-int
-server_start (void) {
-    fprintf (stderr, "server_start\n");
-    srv_socket = socket (AF_UNIX, SOCK_STREAM, 0);
-    int flags;
-    flags = fcntl (srv_socket, F_GETFL,0);
-    if (flags == -1) {
-        perror ("fcntl F_GETFL");
-        return -1;
-    }
-    if (fcntl(srv_socket, F_SETFL, flags | O_NONBLOCK) < 0) {
-        perror ("fcntl F_SETFL");
-        return -1;
-    }
-    memset (&srv_local, 0, sizeof (srv_local));
-    srv_local.sun_family = AF_UNIX;
-
-#if USE_ABSTRACT_SOCKET_NAME
-    memcpy (srv_local.sun_path, server_id, sizeof (server_id));
-    int len = offsetof(struct sockaddr_un, sun_path) + sizeof (server_id)-1;
-#else
-    char *socketdirenv = getenv ("DDB_SOCKET_DIR");
-    snprintf (srv_local.sun_path, sizeof (srv_local.sun_path), "%s/socket", socketdirenv ? socketdirenv : dbruntimedir);
-    if (unlink(srv_local.sun_path) < 0) {
-        perror ("INFO: unlink socket");
-    }
-    int len = offsetof(struct sockaddr_un, sun_path) + strlen (srv_local.sun_path);
-#endif
-
-    if (bind(srv_socket, (struct sockaddr *)&srv_local, len) < 0) {
-        perror ("bind");
-        return -1;
-    }
-
-    if (listen(srv_socket, 5) == -1) {
-        perror("listen");
-        return -1;
-    }
-    return 0;
-}
-
-void
-server_close (void) {
-    if (srv_socket) {
-        close (srv_socket);
-        srv_socket = 0;
-    }
-}
-
 // Read the whole message till end-of-stream
 char*
 read_entire_message (int sockfd, int *size) {
@@ -468,72 +454,7 @@ read_entire_message (int sockfd, int *size) {
     return buf;
 }
 
-int
-server_update (void) {
-    // handle remote stuff
-    int t = sizeof (srv_remote);
-    unsigned s2;
-    s2 = accept(srv_socket, (struct sockaddr *)&srv_remote, &t);
-    if (s2 == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-        perror("accept");
-        return -1;
-    }
-    else if (s2 != -1) {
-        int size = -1;
-        char *buf = read_entire_message(s2, &size);
-        char sendback[1024] = "";
-        if (size > 0) {
-            if (size == 1 && buf[0] == 0) {
-                // FIXME: that should be called right after activation of gui plugin
-                messagepump_push (DB_EV_ACTIVATED, 0, 0, 0);
-            }
-            else {
-                server_exec_command_line (buf, size, sendback, sizeof (sendback));
-            }
-        }
-        if (sendback[0]) {
-            // send nowplaying back to client
-            send (s2, sendback, strlen (sendback)+1, 0);
-        }
-        else {
-            send (s2, "", 1, 0);
-        }
-        close(s2);
-
-        if (buf) {
-            free(buf);
-        }
-    }
-    return 0;
-}
-
 static uintptr_t server_tid;
-static int server_terminate;
-
-void
-server_loop (void *ctx) {
-#ifdef __linux__
-    prctl (PR_SET_NAME, "deadbeef-server", 0, 0, 0, 0);
-#endif
-    fd_set rds;
-    int ret;
-    struct timeval timeout = {0, 0};
-
-    FD_ZERO(&rds);
-    while (!server_terminate) {
-        FD_SET(srv_socket, &rds);
-        timeout.tv_usec = 500000;
-        if ((ret = select(srv_socket + 1, &rds, NULL, NULL, &timeout)) < 0 && errno != EINTR) {
-            perror("select");
-            exit (-1);
-        }
-        if (ret > 0) {
-            if (server_update () < 0) {
-                messagepump_push (DB_EV_TERMINATE, 0, 0, 0);
-            }
-        }
-    }
-}
 
 void
 save_resume_state (void) {
@@ -564,6 +485,10 @@ player_mainloop (void) {
         uint32_t p2;
         int term = 0;
         while (messagepump_pop(&msg, &ctx, &p1, &p2) != -1) {
+            if (msg == DB_EV_CONFIGCHANGED) {
+                // deferred plugins see the change once they're loaded
+                plug_deferred_configchanged ();
+            }
             // broadcast to all plugins
             DB_plugin_t **plugs = plug_get_list ();
             for (int n = 0; plugs[n]; n++) {
@@ -571,6 +496,7 @@ player_mainloop (void) {
                     plugs[n]->message (msg, ctx, p1, p2);
                 }
             }
+            server_message (msg, ctx, p1, p2);
             if (!term) {
                 DB_output_t *output = plug_get_output ();
                 switch (msg) {
@@ -631,6 +557,7 @@ player_mainloop (void) {
                     conf_save ();
                     streamer_configchanged ();
                     junk_configchanged ();
+                    perftrace_configchanged ();
                     break;
                 case DB_EV_SEEK:
                     streamer_set_seek (p1 / 1000.f);
@@ -641,6 +568,7 @@ player_mainloop (void) {
                 messagepump_event_free ((ddb_event_t *)ctx);
             }
         }
+        threadpool_run_completions ();
         if (term) {
             return;
         }
@@ -716,7 +644,7 @@ void
 main_cleanup_and_quit (void) {
     // terminate server and wait for completion
     if (server_tid) {
-        server_terminate = 1;
+        server_stop ();
         thread_join (server_tid);
         server_tid = 0;
     }
@@ -740,6 +668,7 @@ main_cleanup_and_quit (void) {
     // and query configuration in background
     // so unload everything 1st before final cleanup
     plug_disconnect_all ();
+    threadpool_stop ();
     plug_unload_all ();
 
     // at this point we can simply do exit(0), but let's clean up for debugging
@@ -748,6 +677,8 @@ main_cleanup_and_quit (void) {
 
     fprintf (stderr, "messagepump_free\n");
     messagepump_free ();
+    threadpool_free ();
+    perftrace_free ();
     fprintf (stderr, "plug_cleanup\n");
     plug_cleanup ();
 
@@ -954,6 +885,10 @@ main (int argc, char *argv[]) {
             fprintf (stderr, "DeaDBeeF " VERSION " Copyright © 2009-2013 Alexey Yakovenko\n");
             return 0;
         }
+        else if (!strcmp (argv[i], "--bench")) {
+            mkdir (dbconfdir, 0755);
+            return bench_main (argc-i-1, argv+i+1);
+        }
         else if (!strcmp (argv[i], "--gui")) {
             if (i == argc-1) {
                 break;
@@ -984,16 +919,7 @@ main (int argc, char *argv[]) {
         exit(1);
     }
 
-    memset (&remote, 0, sizeof (remote));
-    remote.sun_family = AF_UNIX;
-#if USE_ABSTRACT_SOCKET_NAME
-    memcpy (remote.sun_path, server_id, sizeof (server_id));
-    len = offsetof(struct sockaddr_un, sun_path) + sizeof (server_id)-1;
-#else
-    char *socketdirenv = getenv ("DDB_SOCKET_DIR");
-    snprintf (remote.sun_path, sizeof (remote.sun_path), "%s/socket", socketdirenv ? socketdirenv : dbruntimedir);
-    len = offsetof(struct sockaddr_un, sun_path) + strlen (remote.sun_path);
-#endif
+    len = server_get_address (&remote);
     if (connect(s, (struct sockaddr *)&remote, len) == 0) {
         // pass args to remote and exit
         if (send(s, cmdline, size, 0) == -1) {
@@ -1061,6 +987,9 @@ main (int argc, char *argv[]) {
     volume_set_db (conf_get_float ("playback.volume", 0)); // volume need to be initialized before plugins start
 
     messagepump_init (); // required to push messages while handling commandline
+    threadpool_init ();
+    perftrace_init ();
+    perftrace_configchanged ();
     if (plug_load_all ()) { // required to add files to playlist from commandline
         exit (-1);
     }
@@ -32,21 +32,45 @@
 #include "threading.h"
 #include "playlist.h"
 
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
 typedef struct message_s {
     uint32_t id;
     uintptr_t ctx;
     uint32_t p1;
     uint32_t p2;
     struct message_s *next;
+    struct message_s *hnext; // next pending TRACKINFOCHANGED in the same hash bucket
 } message_t;
 
-enum { MAX_MESSAGES = 100 };
-static message_t pool[MAX_MESSAGES];
+// messages are allocated in blocks, which are kept until messagepump_free
+enum { MESSAGE_BLOCK_SIZE = 256 };
+
+typedef struct message_block_s {
+    message_t messages[MESSAGE_BLOCK_SIZE];
+    struct message_block_s *next;
+} message_block_t;
+
+// pending TRACKINFOCHANGED events are tracked in a hash set keyed by track,
+// so that repeated changes of the same track are delivered once;
+// when too many different tracks are pending, a single PLAYLISTCHANGED is
+// sent instead (see the DB_EV_TRACKINFOCHANGED note in deadbeef.h)
+enum {
+    TRACKINFO_HASH_SIZE = 64,
+    TRACKINFO_MAX_PENDING = 32,
+};
+
+static message_block_t *blocks;
 static message_t *mfree;
 static message_t *mqueue;
 static message_t *mqtail;
+static message_t *trackinfo_hash[TRACKINFO_HASH_SIZE];
+static int trackinfo_pending;
+static messagepump_stats_t stats;
 static uintptr_t mutex;
 static uintptr_t cond;
+static int wakeup_pending; // set by messagepump_wakeup, cleared by messagepump_wait
 
 static void
 messagepump_reset (void);
@@ -62,6 +86,7 @@ messagepump_init (void) {
 void
 messagepump_free () {
     mutex_lock (mutex);
+    trace ("messagepump: %lld enqueued, %lld coalesced, %lld dropped, peak queue length %d\n", (long long)stats.enqueued, (long long)stats.coalesced, (long long)stats.dropped, stats.peak);
     messagepump_reset ();
     mutex_unlock (mutex);
     mutex_free (mutex);
@@ -70,28 +95,129 @@ messagepump_free () {
 
 static void
 messagepump_reset (void) {
+    while (blocks) {
+        message_block_t *next = blocks->next;
+        free (blocks);
+        blocks = next;
+    }
     mqueue = NULL;
     mfree = NULL;
     mqtail = NULL;
-    memset (pool, 0, sizeof (pool));
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        pool[i].next = mfree;
-        mfree = &pool[i];
-    }
+    memset (trackinfo_hash, 0, sizeof (trackinfo_hash));
+    trackinfo_pending = 0;
+    memset (&stats, 0, sizeof (stats));
 }
 
-int
-messagepump_push (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+// must be called with mutex locked
+static message_t *
+messagepump_alloc_message (void) {
     if (!mfree) {
-        //fprintf (stderr, "WARNING: message queue is full! message ignored (%d %p %d %d)\n", id, (void*)ctx, p1, p2);
-        if (id >= DB_EV_FIRST && ctx) {
-            messagepump_event_free ((ddb_event_t *)ctx);
+        message_block_t *block = malloc (sizeof (message_block_t));
+        if (!block) {
+            return NULL;
+        }
+        block->next = blocks;
+        blocks = block;
+        for (int i = 0; i < MESSAGE_BLOCK_SIZE; i++) {
+            block->messages[i].next = mfree;
+            mfree = &block->messages[i];
         }
-        return -1;
     }
-    mutex_lock (mutex);
     message_t *msg = mfree;
     mfree = mfree->next;
+    return msg;
+}
+
+static DB_playItem_t *
+trackinfo_track (uintptr_t ctx) {
+    return ctx ? ((ddb_event_track_t *)ctx)->track : NULL;
+}
+
+static int
+trackinfo_bucket (DB_playItem_t *track) {
+    return (int)(((uintptr_t)track >> 4) % TRACKINFO_HASH_SIZE);
+}
+
+// the events which only tell that some state needs to be re-read,
+// so that consecutive identical ones can be delivered once
+static int
+messagepump_is_idempotent (uint32_t id) {
+    switch (id) {
+    case DB_EV_PLAYLIST_REFRESH:
+    case DB_EV_CONFIGCHANGED:
+    case DB_EV_PLAYLISTCHANGED:
+    case DB_EV_VOLUMECHANGED:
+    case DB_EV_PLAYLISTSWITCHED:
+    case DB_EV_ACTIONSCHANGED:
+    case DB_EV_DSPCHAINCHANGED:
+    case DB_EV_SELCHANGED:
+        return 1;
+    }
+    return 0;
+}
+
+// must be called with mutex locked
+// returns 1 if the message is a duplicate of a pending one
+static int
+messagepump_coalesce (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    if (id == DB_EV_TRACKINFOCHANGED) {
+        DB_playItem_t *track = trackinfo_track (ctx);
+        for (message_t *msg = trackinfo_hash[trackinfo_bucket (track)]; msg; msg = msg->hnext) {
+            if (trackinfo_track (msg->ctx) == track && msg->p1 == p1 && msg->p2 == p2) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (messagepump_is_idempotent (id)) {
+        return mqtail && mqtail->id == id && mqtail->ctx == ctx && mqtail->p1 == p1 && mqtail->p2 == p2;
+    }
+    return 0;
+}
+
+// must be called with mutex locked
+static void
+messagepump_trackinfo_remove (message_t *msg) {
+    message_t **pmsg = &trackinfo_hash[trackinfo_bucket (trackinfo_track (msg->ctx))];
+    while (*pmsg) {
+        if (*pmsg == msg) {
+            *pmsg = msg->hnext;
+            trackinfo_pending--;
+            break;
+        }
+        pmsg = &(*pmsg)->hnext;
+    }
+    msg->hnext = NULL;
+}
+
+// must be called with mutex locked
+// returns 0 if the message was queued, 1 if it was merged into a pending one,
+// 2 if a replacement message was queued, -1 on failure
+static int
+messagepump_enqueue (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    int res = 0;
+    if (messagepump_coalesce (id, ctx, p1, p2)) {
+        stats.coalesced++;
+        return 1;
+    }
+    if (id == DB_EV_TRACKINFOCHANGED && trackinfo_pending >= TRACKINFO_MAX_PENDING) {
+        // too many tracks changed, ask for a full refresh
+        stats.coalesced++;
+        if (messagepump_coalesce (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0)) {
+            return 1;
+        }
+        res = 2;
+        id = DB_EV_PLAYLISTCHANGED;
+        ctx = 0;
+        p1 = DDB_PLAYLIST_CHANGE_CONTENT;
+        p2 = 0;
+    }
+
+    message_t *msg = messagepump_alloc_message ();
+    if (!msg) {
+        stats.dropped++;
+        return -1;
+    }
     if (mqtail) {
         mqtail->next = msg;
     }
@@ -101,18 +227,62 @@ messagepump_push (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
     }
 
     msg->next = NULL;
+    msg->hnext = NULL;
     msg->id = id;
     msg->ctx = ctx;
     msg->p1 = p1;
     msg->p2 = p2;
+
+    if (id == DB_EV_TRACKINFOCHANGED) {
+        int b = trackinfo_bucket (trackinfo_track (ctx));
+        msg->hnext = trackinfo_hash[b];
+        trackinfo_hash[b] = msg;
+        trackinfo_pending++;
+    }
+
+    stats.enqueued++;
+    if (++stats.length > stats.peak) {
+        stats.peak = stats.length;
+    }
+    return res;
+}
+
+int
+messagepump_push (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    mutex_lock (mutex);
+    int res = messagepump_enqueue (id, ctx, p1, p2);
     mutex_unlock (mutex);
-    cond_signal (cond);
-    return 0;
+    if (res < 0) {
+        fprintf (stderr, "messagepump: out of memory, message ignored (%d %p %d %d)\n", id, (void*)ctx, p1, p2);
+    }
+    if (res != 0 && id >= DB_EV_FIRST && ctx) {
+        // the payload is not going to be delivered
+        messagepump_event_free ((ddb_event_t *)ctx);
+    }
+    if (res == 0 || res == 2) {
+        cond_signal (cond);
+    }
+    return res < 0 ? -1 : 0;
 }
 
+// returns when there are messages in the queue, or messagepump_wakeup was called;
+// both are checked under the mutex, so that a wakeup can't be lost before the wait
 void
 messagepump_wait (void) {
-    cond_wait (cond, mutex);
+    mutex_lock (mutex);
+    while (!mqueue && !wakeup_pending) {
+        cond_wait_locked (cond, mutex);
+    }
+    wakeup_pending = 0;
+    mutex_unlock (mutex);
+}
+
+// wakes up the main loop without sending a message
+void
+messagepump_wakeup (void) {
+    mutex_lock (mutex);
+    wakeup_pending = 1;
+    cond_signal (cond);
     mutex_unlock (mutex);
 }
 
@@ -123,6 +293,9 @@ messagepump_pop (uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2) {
         mutex_unlock (mutex);
         return -1;
     }
+    if (mqueue->id == DB_EV_TRACKINFOCHANGED) {
+        messagepump_trackinfo_remove (mqueue);
+    }
     *id = mqueue->id;
     *ctx = mqueue->ctx;
     *p1 = mqueue->p1;
@@ -134,6 +307,7 @@ messagepump_pop (uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2) {
     if (!mqueue) {
         mqtail = NULL;
     }
+    stats.length--;
     mutex_unlock (mutex);
     return 0;
 }
@@ -143,6 +317,13 @@ messagepump_hasmessages (void) {
     return mqueue ? 1 : 0;
 }
 
+void
+messagepump_get_stats (messagepump_stats_t *st) {
+    mutex_lock (mutex);
+    *st = stats;
+    mutex_unlock (mutex);
+}
+
 ddb_event_t *
 messagepump_event_alloc (uint32_t id) {
     int sz = 0;
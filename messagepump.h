@@ -30,11 +30,21 @@
 #include <stdint.h>
 #include "deadbeef.h"
 
+typedef struct {
+    int64_t enqueued; // messages added to the queue
+    int64_t coalesced; // messages merged into a pending one
+    int64_t dropped; // messages lost because the queue could not grow
+    int length; // messages currently in the queue
+    int peak; // maximum queue length seen
+} messagepump_stats_t;
+
 int messagepump_init (void);
 void messagepump_free (void);
 int messagepump_push (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2);
 int messagepump_pop (uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2);
 void messagepump_wait (void);
+void messagepump_wakeup (void);
+void messagepump_get_stats (messagepump_stats_t *stats);
 
 ddb_event_t *messagepump_event_alloc (uint32_t id);
 void messagepump_event_free (ddb_event_t *ev);
@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
 
 typedef struct metacache_str_s {
     struct metacache_str_s *next;
@@ -41,9 +42,13 @@ typedef struct {
     metacache_str_t *chain;
 } metacache_hash_t;
 
+// initial number of buckets; the table doubles when it gets more than
+// 2 strings per bucket on average, so that huge playlists don't end up
+// with long chains
 #define HASH_SIZE 4096
 
-static metacache_hash_t hash[HASH_SIZE];
+static metacache_hash_t *hash;
+static uint32_t hash_size;
 
 uint32_t
 metacache_get_hash_sdbm (const char *str) {
@@ -73,17 +78,43 @@ static int n_strings = 0;
 static int n_inserts = 0;
 static int n_buckets = 0;
 
+static void
+metacache_grow (void) {
+    uint32_t new_size = hash_size ? hash_size * 2 : HASH_SIZE;
+    metacache_hash_t *new_hash = calloc (new_size, sizeof (metacache_hash_t));
+    n_buckets = 0;
+    for (uint32_t i = 0; i < hash_size; i++) {
+        metacache_str_t *chain = hash[i].chain;
+        while (chain) {
+            metacache_str_t *next = chain->next;
+            metacache_hash_t *bucket = &new_hash[metacache_get_hash_sdbm (chain->str) % new_size];
+            if (!bucket->chain) {
+                n_buckets++;
+            }
+            chain->next = bucket->chain;
+            bucket->chain = chain;
+            chain = next;
+        }
+    }
+    free (hash);
+    hash = new_hash;
+    hash_size = new_size;
+}
+
 const char *
 metacache_add_string (const char *str) {
 //    printf ("n_strings=%d, n_inserts=%d, n_buckets=%d\n", n_strings, n_inserts, n_buckets);
+    if (n_strings >= hash_size * 2) {
+        metacache_grow ();
+    }
     uint32_t h = metacache_get_hash_sdbm (str);
-    metacache_str_t *data = metacache_find_in_bucket (h % HASH_SIZE, str);
+    metacache_str_t *data = metacache_find_in_bucket (h % hash_size, str);
     n_inserts++;
     if (data) {
         data->refcount++;
         return data->str;
     }
-    metacache_hash_t *bucket = &hash[h % HASH_SIZE];
+    metacache_hash_t *bucket = &hash[h % hash_size];
     if (!bucket->chain) {
         n_buckets++;
     }
@@ -100,8 +131,11 @@ metacache_add_string (const char *str) {
 
 void
 metacache_remove_string (const char *str) {
+    if (!hash_size) {
+        return;
+    }
     uint32_t h = metacache_get_hash_sdbm (str);
-    metacache_hash_t *bucket = &hash[h % HASH_SIZE];
+    metacache_hash_t *bucket = &hash[h % hash_size];
     metacache_str_t *chain = bucket->chain;
     metacache_str_t *prev = NULL;
     while (chain) {
@@ -115,6 +149,7 @@ metacache_remove_string (const char *str) {
                     bucket->chain = chain->next;
                 }
                 free (chain);
+                n_strings--;
             }
             break;
         }
@@ -134,3 +169,82 @@ metacache_unref (const char *str) {
     uint32_t *refc = (uint32_t *)(str-5);
     *refc--;
 }
+
+// Metadata keys are interned in a separate, case-insensitive table:
+// all spellings of a key share the string of the first one added,
+// which allows comparing keys by pointer.
+
+#define KEY_HASH_SIZE 1024
+
+static metacache_hash_t keyhash[KEY_HASH_SIZE];
+
+static uint32_t
+metacache_get_key_hash (const char *str) {
+    uint32_t hash = 0;
+    int c;
+
+    while ((c = (unsigned char)*str++)) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = c + (hash << 6) + (hash << 16) - hash;
+    }
+
+    return hash;
+}
+
+static metacache_str_t *
+metacache_find_key_in_bucket (uint32_t h, const char *key) {
+    for (metacache_str_t *chain = keyhash[h].chain; chain; chain = chain->next) {
+        if (!strcasecmp (chain->str, key)) {
+            return chain;
+        }
+    }
+    return NULL;
+}
+
+const char *
+metacache_add_key (const char *key) {
+    uint32_t h = metacache_get_key_hash (key) % KEY_HASH_SIZE;
+    metacache_str_t *data = metacache_find_key_in_bucket (h, key);
+    if (data) {
+        data->refcount++;
+        return data->str;
+    }
+    size_t len = strlen (key);
+    data = malloc (sizeof (metacache_str_t) + len);
+    memset (data, 0, sizeof (metacache_str_t) + len);
+    data->refcount = 1;
+    memcpy (data->str, key, len+1);
+    data->next = keyhash[h].chain;
+    keyhash[h].chain = data;
+    return data->str;
+}
+
+const char *
+metacache_find_key (const char *key) {
+    uint32_t h = metacache_get_key_hash (key) % KEY_HASH_SIZE;
+    metacache_str_t *data = metacache_find_key_in_bucket (h, key);
+    return data ? data->str : NULL;
+}
+
+void
+metacache_remove_key (const char *key) {
+    uint32_t h = metacache_get_key_hash (key) % KEY_HASH_SIZE;
+    metacache_str_t *prev = NULL;
+    for (metacache_str_t *chain = keyhash[h].chain; chain; prev = chain, chain = chain->next) {
+        if (chain->str == key || !strcasecmp (chain->str, key)) {
+            chain->refcount--;
+            if (chain->refcount == 0) {
+                if (prev) {
+                    prev->next = chain->next;
+                }
+                else {
+                    keyhash[h].chain = chain->next;
+                }
+                free (chain);
+            }
+            break;
+        }
+    }
+}
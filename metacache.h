@@ -39,4 +39,16 @@ metacache_ref (const char *str);
 void
 metacache_unref (const char *str);
 
+// case-insensitive interning of metadata keys;
+// equal keys (ignoring case) get the same pointer
+const char *
+metacache_add_key (const char *key);
+
+void
+metacache_remove_key (const char *key);
+
+// returns interned key without adding a reference, or NULL if not interned
+const char *
+metacache_find_key (const char *key);
+
 #endif
@@ -0,0 +1,370 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  playback pipeline instrumentation
+
+  Copyright (C) 2009-2013 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+// Every thread which records events gets its own ring buffer, so recording
+// doesn't take any locks, except once per thread to register the buffer.
+// The export reads the buffers while the threads keep writing into them,
+// so the oldest events of a full ring are skipped, as they might be
+// overwritten during the export.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "perftrace.h"
+#include "threading.h"
+#include "conf.h"
+#include "messagepump.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+#define RING_SIZE 16384 // events per thread, power of 2
+#define RING_MARGIN 256 // events skipped at the tail of a full ring on export
+#define MAX_THREADS 32
+#define COUNTER_INTERVAL 10000000 // min ns between two buffer fill counter events
+
+enum {
+    EVENT_FILL = PERFTRACE_STAGE_COUNT,
+    EVENT_UNDERRUN,
+};
+
+typedef struct {
+    int64_t ts;
+    int32_t value; // duration in ns, or fill percentage
+    int32_t type; // stage or EVENT_*
+    const char *name;
+} trace_event_t;
+
+typedef struct {
+    int64_t count;
+    int64_t total;
+    int64_t max;
+} stage_stats_t;
+
+typedef struct {
+    int tid;
+    int alive;
+    char name[20];
+    volatile uint32_t head; // number of events written so far
+    int64_t last_counter;
+    stage_stats_t stats[PERFTRACE_STAGE_COUNT];
+    int64_t fill[PERFTRACE_FILL_BUCKETS];
+    int64_t underruns;
+    trace_event_t events[RING_SIZE];
+} trace_buffer_t;
+
+static const char *stage_names[PERFTRACE_STAGE_COUNT] = {
+    "decode",
+    "pcm_convert",
+    "dsp",
+    "ringbuf_write",
+    "ringbuf_read",
+    "output_read",
+};
+
+static volatile int enabled;
+static uintptr_t mutex;
+static pthread_key_t key;
+static int key_created;
+static trace_buffer_t *buffers[MAX_THREADS];
+static int num_buffers;
+static int next_tid = 1;
+static int64_t base_time;
+
+void
+perftrace_init (void) {
+    mutex = mutex_create_nonrecursive ();
+    base_time = perftrace_time ();
+}
+
+void
+perftrace_free (void) {
+    enabled = 0;
+    if (key_created) {
+        pthread_key_delete (key);
+        key_created = 0;
+    }
+    for (int i = 0; i < num_buffers; i++) {
+        free (buffers[i]);
+        buffers[i] = NULL;
+    }
+    num_buffers = 0;
+    if (mutex) {
+        mutex_free (mutex);
+        mutex = 0;
+    }
+}
+
+static void
+buffer_release (void *data) {
+    trace_buffer_t *buf = data;
+    mutex_lock (mutex);
+    buf->alive = 0;
+    mutex_unlock (mutex);
+}
+
+void
+perftrace_configchanged (void) {
+    int en = conf_get_int ("perftrace.enabled", 1);
+    if (en && !key_created) {
+        if (pthread_key_create (&key, buffer_release)) {
+            return;
+        }
+        key_created = 1;
+    }
+    enabled = en;
+}
+
+int64_t
+perftrace_time (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t
+perftrace_begin (void) {
+    return enabled ? perftrace_time () : 0;
+}
+
+static trace_buffer_t *
+get_buffer (void) {
+    trace_buffer_t *buf = pthread_getspecific (key);
+    if (buf) {
+        return buf;
+    }
+    mutex_lock (mutex);
+    if (num_buffers < MAX_THREADS) {
+        buf = calloc (1, sizeof (trace_buffer_t));
+        if (buf) {
+            buffers[num_buffers++] = buf;
+        }
+    }
+    else {
+        // reuse the oldest buffer of a finished thread
+        for (int i = 0; i < num_buffers; i++) {
+            if (!buffers[i]->alive) {
+                buf = buffers[i];
+                memset (buf, 0, sizeof (trace_buffer_t));
+                break;
+            }
+        }
+    }
+    if (buf) {
+        buf->tid = next_tid++;
+        buf->alive = 1;
+#ifdef __linux__
+        prctl (PR_GET_NAME, buf->name, 0, 0, 0);
+#endif
+        if (!buf->name[0]) {
+            snprintf (buf->name, sizeof (buf->name), "thread %d", buf->tid);
+        }
+    }
+    mutex_unlock (mutex);
+    if (buf) {
+        pthread_setspecific (key, buf);
+    }
+    return buf;
+}
+
+static void
+record (trace_buffer_t *buf, int type, const char *name, int64_t ts, int32_t value) {
+    trace_event_t *ev = &buf->events[buf->head & (RING_SIZE-1)];
+    ev->ts = ts;
+    ev->value = value;
+    ev->type = type;
+    ev->name = name;
+    buf->head++;
+}
+
+void
+perftrace_add (int stage, const char *name, int64_t start, int64_t end) {
+    if (!enabled) {
+        return;
+    }
+    trace_buffer_t *buf = get_buffer ();
+    if (!buf) {
+        return;
+    }
+    int64_t dur = end - start;
+    if (dur > INT32_MAX) {
+        dur = INT32_MAX;
+    }
+    stage_stats_t *s = &buf->stats[stage];
+    s->count++;
+    s->total += dur;
+    if (dur > s->max) {
+        s->max = dur;
+    }
+    record (buf, stage, name, start, (int32_t)dur);
+}
+
+void
+perftrace_end (int stage, const char *name, int64_t start) {
+    if (start) {
+        perftrace_add (stage, name, start, perftrace_time ());
+    }
+}
+
+void
+perftrace_buffer_fill (int percent) {
+    if (!enabled) {
+        return;
+    }
+    trace_buffer_t *buf = get_buffer ();
+    if (!buf) {
+        return;
+    }
+    int bucket = percent * PERFTRACE_FILL_BUCKETS / 100;
+    if (bucket < 0) {
+        bucket = 0;
+    }
+    else if (bucket >= PERFTRACE_FILL_BUCKETS) {
+        bucket = PERFTRACE_FILL_BUCKETS - 1;
+    }
+    buf->fill[bucket]++;
+    int64_t now = perftrace_time ();
+    if (now - buf->last_counter >= COUNTER_INTERVAL) {
+        buf->last_counter = now;
+        record (buf, EVENT_FILL, NULL, now, percent);
+    }
+}
+
+void
+perftrace_underrun (void) {
+    if (!enabled) {
+        return;
+    }
+    trace_buffer_t *buf = get_buffer ();
+    if (!buf) {
+        return;
+    }
+    buf->underruns++;
+    record (buf, EVENT_UNDERRUN, NULL, perftrace_time (), 0);
+}
+
+// thread names and plugin ids, only needs to handle the odd quote
+static void
+write_json_string (FILE *fp, const char *s) {
+    fputc ('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc ('\\', fp);
+        }
+        if ((unsigned char)*s >= 0x20) {
+            fputc (*s, fp);
+        }
+    }
+    fputc ('"', fp);
+}
+
+int
+perftrace_export (const char *fname) {
+    FILE *fp = fopen (fname, "w");
+    if (!fp) {
+        return -1;
+    }
+
+    stage_stats_t stats[PERFTRACE_STAGE_COUNT];
+    int64_t fill[PERFTRACE_FILL_BUCKETS];
+    int64_t underruns = 0;
+    memset (stats, 0, sizeof (stats));
+    memset (fill, 0, sizeof (fill));
+
+    fprintf (fp, "{\"traceEvents\":[\n");
+    const char *sep = "";
+    mutex_lock (mutex);
+    for (int i = 0; i < num_buffers; i++) {
+        trace_buffer_t *buf = buffers[i];
+        fprintf (fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", sep, buf->tid);
+        write_json_string (fp, buf->name);
+        fprintf (fp, "}}");
+        sep = ",\n";
+
+        uint32_t head = buf->head;
+        uint32_t first = head > RING_SIZE ? head - RING_SIZE + RING_MARGIN : 0;
+        for (uint32_t n = first; n != head; n++) {
+            trace_event_t *ev = &buf->events[n & (RING_SIZE-1)];
+            double ts = (ev->ts - base_time) / 1000.0;
+            if (ev->type == EVENT_FILL) {
+                fprintf (fp, "%s{\"name\":\"buffer fill\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"percent\":%d}}", sep, buf->tid, ts, ev->value);
+            }
+            else if (ev->type == EVENT_UNDERRUN) {
+                fprintf (fp, "%s{\"name\":\"underrun\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", sep, buf->tid, ts);
+            }
+            else if (ev->type >= 0 && ev->type < PERFTRACE_STAGE_COUNT) {
+                fprintf (fp, "%s{\"name\":", sep);
+                write_json_string (fp, ev->name ? ev->name : stage_names[ev->type]);
+                fprintf (fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", stage_names[ev->type], buf->tid, ts, ev->value / 1000.0);
+            }
+        }
+
+        for (int s = 0; s < PERFTRACE_STAGE_COUNT; s++) {
+            stats[s].count += buf->stats[s].count;
+            stats[s].total += buf->stats[s].total;
+            if (buf->stats[s].max > stats[s].max) {
+                stats[s].max = buf->stats[s].max;
+            }
+        }
+        for (int b = 0; b < PERFTRACE_FILL_BUCKETS; b++) {
+            fill[b] += buf->fill[b];
+        }
+        underruns += buf->underruns;
+    }
+    mutex_unlock (mutex);
+
+    // totals since startup, including the events which fell out of the rings
+    fprintf (fp, "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{\n");
+    for (int s = 0; s < PERFTRACE_STAGE_COUNT; s++) {
+        fprintf (fp, "\"%s\":{\"count\":%lld,\"total_us\":%.3f,\"avg_us\":%.3f,\"max_us\":%.3f},\n",
+                stage_names[s],
+                (long long)stats[s].count,
+                stats[s].total / 1000.0,
+                stats[s].count ? stats[s].total / 1000.0 / stats[s].count : 0,
+                stats[s].max / 1000.0);
+    }
+    fprintf (fp, "\"buffer_fill_histogram\":[");
+    for (int b = 0; b < PERFTRACE_FILL_BUCKETS; b++) {
+        fprintf (fp, "%s%lld", b ? "," : "", (long long)fill[b]);
+    }
+    fprintf (fp, "],\n\"underruns\":%lld,\n", (long long)underruns);
+    messagepump_stats_t mp;
+    messagepump_get_stats (&mp);
+    fprintf (fp, "\"messagepump\":{\"enqueued\":%lld,\"coalesced\":%lld,\"dropped\":%lld,\"length\":%d,\"peak\":%d}\n}}\n",
+            (long long)mp.enqueued, (long long)mp.coalesced, (long long)mp.dropped, mp.length, mp.peak);
+
+    int err = ferror (fp);
+    if (fclose (fp)) {
+        err = 1;
+    }
+    return err ? -1 : 0;
+}
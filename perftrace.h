@@ -0,0 +1,83 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  playback pipeline instrumentation
+
+  Copyright (C) 2009-2013 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+#ifndef __PERFTRACE_H
+#define __PERFTRACE_H
+
+#include <stdint.h>
+
+enum {
+    PERFTRACE_DECODE,
+    PERFTRACE_PCM_CONVERT,
+    PERFTRACE_DSP, // name is the dsp plugin id
+    PERFTRACE_RINGBUF_WRITE,
+    PERFTRACE_RINGBUF_READ,
+    PERFTRACE_OUTPUT_READ, // streamer_read, called by the output plugin
+    PERFTRACE_STAGE_COUNT
+};
+
+#define PERFTRACE_FILL_BUCKETS 10
+
+void
+perftrace_init (void);
+
+void
+perftrace_free (void);
+
+// reads perftrace.enabled
+void
+perftrace_configchanged (void);
+
+// monotonic time in nanoseconds
+int64_t
+perftrace_time (void);
+
+// returns the start time for perftrace_end, or 0 when tracing is disabled
+int64_t
+perftrace_begin (void);
+
+// records a stage which started at the time returned by perftrace_begin
+void
+perftrace_end (int stage, const char *name, int64_t start);
+
+// records a stage with known start and end times
+void
+perftrace_add (int stage, const char *name, int64_t start, int64_t end);
+
+// adds a sample to the buffer fill histogram, percent is 0..100
+void
+perftrace_buffer_fill (int percent);
+
+void
+perftrace_underrun (void);
+
+// writes the recorded events and the statistics, including the messagepump
+// queue counters, as Chrome trace JSON, viewable in chrome://tracing;
+// returns 0 on success
+int
+perftrace_export (const char *fname);
+
+#endif // __PERFTRACE_H
@@ -1418,11 +1418,16 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
     // match by decoder
     for (int i = 0; decoders[i]; i++) {
         trace ("matching decoder %d(%s)...\n", i, decoders[i]->plugin.id);
-        if (decoders[i]->exts && decoders[i]->insert) {
+        // deferred decoders don't have the callbacks until they're resolved
+        if (decoders[i]->exts) {
             const char **exts = decoders[i]->exts;
             for (int e = 0; exts[e]; e++) {
                 if (!strcasecmp (exts[e], eol)) {
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
+                    DB_decoder_t *dec = plug_resolve_decoder (decoders[i]);
+                    if (!dec || !dec->insert) {
+                        break;
+                    }
+                    playItem_t *inserted = (playItem_t *)dec->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
                     if (inserted != NULL) {
                         if (cb && cb (inserted, user_data) < 0) {
                             *pabort = 1;
@@ -1436,17 +1441,21 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
                                 }
                             }
                         }
-                        trace ("file has been added by decoder: %s\n", decoders[i]->plugin.id);
+                        trace ("file has been added by decoder: %s\n", dec->plugin.id);
                         return inserted;
                     }
                 }
             }
         }
-        if (decoders[i]->prefixes && decoders[i]->insert) {
+        if (decoders[i]->prefixes) {
             const char **prefixes = decoders[i]->prefixes;
             for (int e = 0; prefixes[e]; e++) {
                 if (!strncasecmp (prefixes[e], fn, strlen(prefixes[e])) && *(fn + strlen (prefixes[e])) == '.') {
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
+                    DB_decoder_t *dec = plug_resolve_decoder (decoders[i]);
+                    if (!dec || !dec->insert) {
+                        break;
+                    }
+                    playItem_t *inserted = (playItem_t *)dec->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
                     if (inserted != NULL) {
                         if (cb && cb (inserted, user_data) < 0) {
                             *pabort = 1;
@@ -1754,6 +1763,7 @@ playItem_t *
 plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     LOCK;
     pl_item_ref (it);
+    pl_compact_meta (it);
     if (!after) {
         it->next[PL_MAIN] = playlist->head[PL_MAIN];
         it->prev[PL_MAIN] = NULL;
@@ -1837,23 +1847,7 @@ pl_item_copy (playItem_t *out, playItem_t *it) {
     out->prev[PL_SEARCH] = it->prev[PL_SEARCH];
     out->_refc = 1;
     // copy metainfo
-    DB_metaInfo_t *prev = NULL;
-    DB_metaInfo_t *meta = it->meta;
-    while (meta) {
-        DB_metaInfo_t *m = malloc (sizeof (DB_metaInfo_t));
-        memset (m, 0, sizeof (DB_metaInfo_t));
-        m->key = metacache_add_string (meta->key);
-        m->value = metacache_add_string (meta->value);
-        m->next = NULL;
-        if (prev) {
-            prev->next = m;
-        }
-        else {
-            out->meta = m;
-        }
-        prev = m;
-        meta = meta->next;
-    }
+    pl_copy_meta (out, it);
     UNLOCK;
 }
 
@@ -1886,13 +1880,7 @@ static void
 pl_item_free (playItem_t *it) {
     LOCK;
     if (it) {
-        while (it->meta) {
-            DB_metaInfo_t *m = it->meta;
-            it->meta = m->next;
-            metacache_remove_string (m->key);
-            metacache_remove_string (m->value);
-            free (m);
-        }
+        pl_free_meta_storage (it);
         free (it);
     }
     UNLOCK;
@@ -3550,23 +3538,33 @@ plt_search_reset_int (playlist_t *playlist, int clear_selection) {
 
 void
 plt_search_reset (playlist_t *playlist) {
+    LOCK;
+    playlist->search_serial++;
     plt_search_reset_int (playlist, 1);
+    UNLOCK;
 }
 
-void
-plt_search_process2 (playlist_t *playlist, const char *text, int select_results) {
-    LOCK;
-    plt_search_reset_int (playlist, select_results);
+// a search which is done a chunk of tracks at a time, see plt_search_begin
+struct ddb_search_s {
+    playlist_t *playlist; // referenced
+    playItem_t *next; // the track to search next, referenced
+    int modification_idx;
+    unsigned serial;
+    int cmpidx;
+    int has_text;
+    int select_results;
+    char lc[1000];
+};
 
+static void
+plt_search_init (ddb_search_t *search, playlist_t *playlist, const char *text, int select_results) {
     // convert text to lowercase, to save some cycles
-    char lc[1000];
-    int n = sizeof (lc)-1;
+    int n = sizeof (search->lc)-1;
     const char *p = text;
-    char *out = lc;
+    char *out = search->lc;
     while (*p) {
         int32_t i = 0;
         char s[10];
-        const char *next;
         u8_nextchar (p, &i);
         int l = u8_tolower (p, i, s);
         n -= l;
@@ -3578,81 +3576,148 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
         out += l;
     }
     *out = 0;
+    search->has_text = *text != 0;
+    search->select_results = select_results;
 
     static int cmpidx = 0;
+    LOCK;
     cmpidx++;
     if (cmpidx > 127) {
         cmpidx = 1;
     }
+    search->cmpidx = cmpidx;
 
-    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
-        if (select_results) {
-            it->selected = 0;
+    plt_search_reset_int (playlist, select_results);
+    plt_ref (playlist);
+    search->playlist = playlist;
+    search->next = playlist->head[PL_MAIN];
+    if (search->next) {
+        pl_item_ref (search->next);
+    }
+    search->modification_idx = playlist->modification_idx;
+    search->serial = ++playlist->search_serial;
+    UNLOCK;
+}
+
+static void
+plt_search_free (ddb_search_t *search) {
+    LOCK;
+    if (search->next) {
+        pl_item_unref (search->next);
+        search->next = NULL;
+    }
+    plt_unref (search->playlist);
+    search->playlist = NULL;
+    UNLOCK;
+}
+
+static void
+plt_search_append (playlist_t *playlist, playItem_t *it, int select_results) {
+    it->next[PL_SEARCH] = NULL;
+    it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
+    if (playlist->tail[PL_SEARCH]) {
+        playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
+        playlist->tail[PL_SEARCH] = it;
+    }
+    else {
+        playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
+    }
+    if (select_results) {
+        it->selected = 1;
+    }
+    playlist->count[PL_SEARCH]++;
+}
+
+// the result of comparing each metadata value is remembered in the byte
+// preceding it, so that the values shared by many tracks are compared once
+static int
+plt_search_match (playItem_t *it, const char *lc, int cmpidx) {
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        int is_uri = !strcmp (m->key, ":URI");
+        if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
+            break;
         }
-        if (*text) {
-            DB_metaInfo_t *m = NULL;
-            for (m = it->meta; m; m = m->next) {
-                int is_uri = !strcmp (m->key, ":URI");
-                if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
-                    break;
-                }
-                const char *value = m->value;
-                if (is_uri) {
-                    value = strrchr (value, '/');
-                    if (value) {
-                        value++;
-                    }
-                    else {
-                        value = m->value;
-                    }
-                }
-                if (strcasecmp(m->key, "cuesheet") && strcasecmp (m->key, "log")) {
-                    char cmp = *(m->value-1);
-
-                    if (abs (cmp) == cmpidx) {
-                        if (cmp > 0) {
-                            it->next[PL_SEARCH] = NULL;
-                            it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
-                            if (playlist->tail[PL_SEARCH]) {
-                                playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
-                                playlist->tail[PL_SEARCH] = it;
-                            }
-                            else {
-                                playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
-                            }
-                            if (select_results) {
-                                it->selected = 1;
-                            }
-                            playlist->count[PL_SEARCH]++;
-                            break;
-                        }
-                    }
-                    else if (u8_valid(value, strlen(value), NULL) && u8_valid(lc, strlen(lc), NULL) && utfcasestr_fast (value, lc)) {
-                        //fprintf (stderr, "%s -> %s match (%s.%s)\n", text, value, pl_find_meta_raw (it, ":URI"), m->key);
-                        // add to list
-                        it->next[PL_SEARCH] = NULL;
-                        it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
-                        if (playlist->tail[PL_SEARCH]) {
-                            playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
-                            playlist->tail[PL_SEARCH] = it;
-                        }
-                        else {
-                            playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
-                        }
-                        if (select_results) {
-                            it->selected = 1;
-                        }
-                        playlist->count[PL_SEARCH]++;
-                        *((char *)m->value-1) = cmpidx;
-                        break;
-                    }
-                    else {
-                        *((char *)m->value-1) = -cmpidx;
-                    }
+        const char *value = m->value;
+        if (is_uri) {
+            value = strrchr (value, '/');
+            if (value) {
+                value++;
+            }
+            else {
+                value = m->value;
+            }
+        }
+        if (strcasecmp(m->key, "cuesheet") && strcasecmp (m->key, "log")) {
+            char cmp = *(m->value-1);
+
+            if (abs (cmp) == cmpidx) {
+                if (cmp > 0) {
+                    return 1;
                 }
             }
+            else if (u8_valid(value, strlen(value), NULL) && u8_valid(lc, strlen(lc), NULL) && utfcasestr_fast (value, lc)) {
+                //fprintf (stderr, "%s -> %s match (%s.%s)\n", text, value, pl_find_meta_raw (it, ":URI"), m->key);
+                *((char *)m->value-1) = cmpidx;
+                return 1;
+            }
+            else {
+                *((char *)m->value-1) = -cmpidx;
+            }
+        }
+    }
+    return 0;
+}
+
+ddb_search_t *
+plt_search_begin (playlist_t *playlist, const char *text, int select_results) {
+    ddb_search_t *search = calloc (1, sizeof (ddb_search_t));
+    if (search) {
+        plt_search_init (search, playlist, text, select_results);
+    }
+    return search;
+}
+
+int
+plt_search_continue (ddb_search_t *search, int count) {
+    playlist_t *playlist = search->playlist;
+    LOCK;
+    if (playlist->modification_idx != search->modification_idx || playlist->search_serial != search->serial) {
+        UNLOCK;
+        return -1;
+    }
+    playItem_t *it = search->next;
+    for (; it && count > 0; it = it->next[PL_MAIN], count--) {
+        if (search->select_results) {
+            it->selected = 0;
+        }
+        if (search->has_text && plt_search_match (it, search->lc, search->cmpidx)) {
+            plt_search_append (playlist, it, search->select_results);
         }
     }
+    if (it) {
+        pl_item_ref (it);
+    }
+    if (search->next) {
+        pl_item_unref (search->next);
+    }
+    search->next = it;
+    UNLOCK;
+    return it ? 0 : 1;
+}
+
+void
+plt_search_end (ddb_search_t *search) {
+    plt_search_free (search);
+    free (search);
+}
+
+void
+plt_search_process2 (playlist_t *playlist, const char *text, int select_results) {
+    ddb_search_t search;
+    LOCK;
+    plt_search_init (&search, playlist, text, select_results);
+    plt_search_continue (&search, INT_MAX);
+    plt_search_free (&search);
     UNLOCK;
 }
 
@@ -51,6 +51,7 @@ typedef struct playItem_s {
     struct playItem_s *next[PL_MAX_ITERATORS]; // next item in linked list
     struct playItem_s *prev[PL_MAX_ITERATORS]; // prev item in linked list
     struct DB_metaInfo_s *meta; // linked list storing metainfo
+    struct pl_meta_chunk_s *meta_chunks; // storage for the meta nodes
     unsigned selected : 1;
     unsigned played : 1; // mark as played in shuffle mode
     unsigned in_playlist : 1; // 1 if item is in playlist
@@ -70,6 +71,7 @@ typedef struct playlist_s {
     struct DB_metaInfo_s *meta; // linked list storing metainfo
     int refc;
     int files_add_visibility;
+    unsigned search_serial; // bumped by every search, stops the resumable ones in progress
     unsigned fast_mode : 1;
     unsigned files_adding : 1;
 } playlist_t;
@@ -266,6 +268,21 @@ pl_find_meta (playItem_t *it, const char *key);
 const char *
 pl_find_meta_raw (playItem_t *it, const char *key);
 
+// returns a case-insensitive metadata key handle, which can be passed to
+// pl_find_meta_interned and pl_find_meta_raw_interned for lookups by
+// pointer comparison; must be released with pl_meta_key_release
+const char *
+pl_meta_key_get (const char *key);
+
+void
+pl_meta_key_release (const char *key);
+
+const char *
+pl_find_meta_interned (playItem_t *it, const char *key);
+
+const char *
+pl_find_meta_raw_interned (playItem_t *it, const char *key);
+
 int
 pl_find_meta_int (playItem_t *it, const char *key, int def);
 
@@ -287,6 +304,19 @@ pl_delete_meta (playItem_t *it, const char *key);
 void
 pl_delete_all_meta (playItem_t *it);
 
+// copy all metadata from one item to another, which must have no metadata
+void
+pl_copy_meta (playItem_t *out, playItem_t *it);
+
+// pack the item's metadata into the minimal amount of memory;
+// DB_metaInfo_t pointers obtained before the call become invalid
+void
+pl_compact_meta (playItem_t *it);
+
+// free all metadata of the item, including properties and node storage
+void
+pl_free_meta_storage (playItem_t *it);
+
 // returns index of 1st deleted item
 int
 plt_delete_selected (playlist_t *plt);
@@ -417,6 +447,15 @@ plt_search_process (playlist_t *plt, const char *text);
 void
 plt_search_process2 (playlist_t *plt, const char *text, int select_results);
 
+ddb_search_t *
+plt_search_begin (playlist_t *plt, const char *text, int select_results);
+
+int
+plt_search_continue (ddb_search_t *search, int count);
+
+void
+plt_search_end (ddb_search_t *search);
+
 void
 plt_sort (playlist_t *plt, int iter, int id, const char *format, int order);
 
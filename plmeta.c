@@ -34,6 +34,142 @@
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
 
+// Meta nodes are allocated from per-item chunks instead of one malloc per
+// field. Every new chunk doubles the item's capacity. The nodes don't move
+// while the metadata is edited, so DB_metaInfo_t pointers stay valid while
+// iterating, and the nodes of deleted fields are put on a free list for reuse.
+// pl_compact_meta packs the nodes into a single chunk of the exact size,
+// it's called when the track gets inserted into a playlist.
+#define META_CHUNK_MIN_SIZE 8
+
+typedef struct pl_meta_chunk_s {
+    struct pl_meta_chunk_s *next;
+    DB_metaInfo_t *freelist; // only used in the head chunk
+    int size;
+    int used;
+    DB_metaInfo_t nodes[];
+} pl_meta_chunk_t;
+
+static pl_meta_chunk_t *
+pl_meta_chunk_add (playItem_t *it, int size) {
+    pl_meta_chunk_t *head = it->meta_chunks;
+    pl_meta_chunk_t *chunk = malloc (sizeof (pl_meta_chunk_t) + size * sizeof (DB_metaInfo_t));
+    chunk->next = head;
+    chunk->freelist = head ? head->freelist : NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    it->meta_chunks = chunk;
+    return chunk;
+}
+
+static DB_metaInfo_t *
+pl_meta_node_alloc (playItem_t *it) {
+    pl_meta_chunk_t *head = it->meta_chunks;
+    if (head && head->freelist) {
+        DB_metaInfo_t *m = head->freelist;
+        head->freelist = m->next;
+        m->next = NULL;
+        return m;
+    }
+    if (!head || head->used == head->size) {
+        int capacity = 0;
+        for (pl_meta_chunk_t *c = head; c; c = c->next) {
+            capacity += c->size;
+        }
+        head = pl_meta_chunk_add (it, capacity ? capacity : META_CHUNK_MIN_SIZE);
+    }
+    DB_metaInfo_t *m = &head->nodes[head->used++];
+    memset (m, 0, sizeof (DB_metaInfo_t));
+    return m;
+}
+
+// the node must be already unlinked from it->meta
+static void
+pl_meta_node_free (playItem_t *it, DB_metaInfo_t *m) {
+    metacache_remove_key (m->key);
+    metacache_remove_string (m->value);
+    m->key = NULL;
+    m->value = NULL;
+    m->next = it->meta_chunks->freelist;
+    it->meta_chunks->freelist = m;
+}
+
+void
+pl_copy_meta (playItem_t *out, playItem_t *it) {
+    LOCK;
+    int count = 0;
+    for (DB_metaInfo_t *meta = it->meta; meta; meta = meta->next) {
+        count++;
+    }
+    if (!count) {
+        UNLOCK;
+        return;
+    }
+
+    // allocate all nodes at once
+    pl_meta_chunk_t *chunk = pl_meta_chunk_add (out, count > META_CHUNK_MIN_SIZE ? count : META_CHUNK_MIN_SIZE);
+    chunk->used = count;
+
+    DB_metaInfo_t *m = chunk->nodes;
+    for (DB_metaInfo_t *meta = it->meta; meta; meta = meta->next, m++) {
+        m->key = metacache_add_key (meta->key);
+        m->value = metacache_add_string (meta->value);
+        m->next = meta->next ? m + 1 : NULL;
+    }
+    out->meta = chunk->nodes;
+    UNLOCK;
+}
+
+void
+pl_compact_meta (playItem_t *it) {
+    LOCK;
+    pl_meta_chunk_t *head = it->meta_chunks;
+    if (!head || (!head->next && !head->freelist && head->used == head->size)) {
+        UNLOCK;
+        return;
+    }
+    int count = 0;
+    for (DB_metaInfo_t *meta = it->meta; meta; meta = meta->next) {
+        count++;
+    }
+
+    it->meta_chunks = NULL;
+    if (count) {
+        pl_meta_chunk_t *chunk = pl_meta_chunk_add (it, count);
+        chunk->used = count;
+        DB_metaInfo_t *m = chunk->nodes;
+        for (DB_metaInfo_t *meta = it->meta; meta; meta = meta->next, m++) {
+            m->key = meta->key;
+            m->value = meta->value;
+            m->next = meta->next ? m + 1 : NULL;
+        }
+        it->meta = chunk->nodes;
+    }
+
+    while (head) {
+        pl_meta_chunk_t *next = head->next;
+        free (head);
+        head = next;
+    }
+    UNLOCK;
+}
+
+void
+pl_free_meta_storage (playItem_t *it) {
+    LOCK;
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        metacache_remove_key (m->key);
+        metacache_remove_string (m->value);
+    }
+    it->meta = NULL;
+    while (it->meta_chunks) {
+        pl_meta_chunk_t *next = it->meta_chunks->next;
+        free (it->meta_chunks);
+        it->meta_chunks = next;
+    }
+    UNLOCK;
+}
+
 void
 pl_add_meta (playItem_t *it, const char *key, const char *value) {
     if (!value || !*value) {
@@ -41,12 +177,13 @@ pl_add_meta (playItem_t *it, const char *key, const char *value) {
     }
     LOCK;
     // check if it's already set
+    const char *ikey = metacache_find_key (key);
     DB_metaInfo_t *normaltail = NULL;
     DB_metaInfo_t *propstart = NULL;
     DB_metaInfo_t *tail = NULL;
     DB_metaInfo_t *m = it->meta;
     while (m) {
-        if (!strcasecmp (key, m->key)) {
+        if (m->key == ikey) {
             // duplicate key
             UNLOCK;
             return;
@@ -64,9 +201,8 @@ pl_add_meta (playItem_t *it, const char *key, const char *value) {
         m = m->next;
     }
     // add
-    m = malloc (sizeof (DB_metaInfo_t));
-    memset (m, 0, sizeof (DB_metaInfo_t));
-    m->key = metacache_add_string (key);
+    m = pl_meta_node_alloc (it);
+    m->key = metacache_add_key (key);
     m->value = metacache_add_string (value);
 
     if (key[0] == ':' || key[0] == '_' || key[0] == '!') {
@@ -89,6 +225,20 @@ pl_add_meta (playItem_t *it, const char *key, const char *value) {
     UNLOCK;
 }
 
+// key must be interned with metacache_add_key, or NULL
+static DB_metaInfo_t *
+pl_meta_find_node (playItem_t *it, const char *key) {
+    if (!key) {
+        return NULL;
+    }
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (m->key == key) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
 void
 pl_append_meta (playItem_t *it, const char *key, const char *value) {
     pl_lock ();
@@ -137,13 +287,7 @@ void
 pl_replace_meta (playItem_t *it, const char *key, const char *value) {
     LOCK;
     // check if it's already set
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            break;
-        }
-        m = m->next;
-    }
+    DB_metaInfo_t *m = pl_meta_find_node (it, metacache_find_key (key));
     if (m) {
         metacache_remove_string (m->value);
         m->value = metacache_add_string (value);
@@ -173,19 +317,22 @@ pl_set_meta_float (playItem_t *it, const char *key, float value) {
 void
 pl_delete_meta (playItem_t *it, const char *key) {
     pl_lock ();
+    const char *ikey = metacache_find_key (key);
+    if (!ikey) {
+        pl_unlock ();
+        return;
+    }
     DB_metaInfo_t *prev = NULL;
     DB_metaInfo_t *m = it->meta;
     while (m) {
-        if (!strcasecmp (key, m->key)) {
+        if (m->key == ikey) {
             if (prev) {
                 prev->next = m->next;
             }
             else {
                 it->meta = m->next;
             }
-            metacache_remove_string (m->key);
-            metacache_remove_string (m->value);
-            free (m);
+            pl_meta_node_free (it, m);
             break;
         }
         prev = m;
@@ -195,41 +342,70 @@ pl_delete_meta (playItem_t *it, const char *key) {
 }
 
 const char *
-pl_find_meta (playItem_t *it, const char *key) {
-    pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
+pl_meta_key_get (const char *key) {
+    pl_lock ();
+    const char *ikey = metacache_add_key (key);
+    pl_unlock ();
+    return ikey;
+}
 
-    if (key && key[0] == ':') {
-        // try to find an override
-        while (m) {
-            if (m->key[0] == '!' && !strcasecmp (key+1, m->key+1)) {
-                return m->value;
-            }
-            m = m->next;
-        }
+void
+pl_meta_key_release (const char *key) {
+    pl_lock ();
+    metacache_remove_key (key);
+    pl_unlock ();
+}
+
+const char *
+pl_find_meta_interned (playItem_t *it, const char *key) {
+    pl_ensure_lock ();
+    if (key[0] != ':') {
+        DB_metaInfo_t *m = pl_meta_find_node (it, key);
+        return m ? m->value : NULL;
     }
 
-    m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
+    // properties may be overriden by "!" keys, which are stored after
+    // the ":" ones, so keep looking after a match
+    const char *value = NULL;
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (m->key == key) {
+            value = m->value;
+        }
+        else if (m->key[0] == '!' && !strcasecmp (key+1, m->key+1)) {
             return m->value;
         }
-        m = m->next;
     }
-    return NULL;
+    return value;
 }
 
 const char *
-pl_find_meta_raw (playItem_t *it, const char *key) {
+pl_find_meta_raw_interned (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            return m->value;
+    DB_metaInfo_t *m = pl_meta_find_node (it, key);
+    return m ? m->value : NULL;
+}
+
+const char *
+pl_find_meta (playItem_t *it, const char *key) {
+    pl_ensure_lock ();
+    const char *ikey = metacache_find_key (key);
+    if (!ikey) {
+        if (key[0] == ':') {
+            // no such property anywhere, but there still can be an override
+            char override[strlen (key) + 1];
+            strcpy (override, key);
+            override[0] = '!';
+            return pl_find_meta_raw_interned (it, metacache_find_key (override));
         }
-        m = m->next;
+        return NULL;
     }
-    return NULL;
+    return pl_find_meta_interned (it, ikey);
+}
+
+const char *
+pl_find_meta_raw (playItem_t *it, const char *key) {
+    pl_ensure_lock ();
+    return pl_find_meta_raw_interned (it, metacache_find_key (key));
 }
 
 int
@@ -268,9 +444,7 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
             else {
                 it->meta = m->next;
             }
-            metacache_remove_string (m->key);
-            metacache_remove_string (m->value);
-            free (m);
+            pl_meta_node_free (it, m);
             break;
         }
         prev = m;
@@ -296,9 +470,7 @@ pl_delete_all_meta (playItem_t *it) {
             else {
                 it->meta = next;
             }
-            metacache_remove_string (m->key);
-            metacache_remove_string (m->value);
-            free (m);
+            pl_meta_node_free (it, m);
         }
         m = next;
     }
@@ -58,6 +58,8 @@
 #include "tf.h"
 #include "playqueue.h"
 #include "sort.h"
+#include "escape.h"
+#include "threadpool.h"
 
 #define trace(...) { fprintf(stderr, __VA_ARGS__); }
 //#define trace(fmt,...)
@@ -70,6 +72,9 @@
 #define PLUGINEXT ".so"
 #endif
 
+static struct DB_decoder_s **
+plug_get_loaded_decoder_list (void);
+
 // deadbeef api
 static DB_functions_t deadbeef_api = {
     .vmajor = DB_API_VERSION_MAJOR,
@@ -313,7 +318,7 @@ static DB_functions_t deadbeef_api = {
     .conf_remove_items = conf_remove_items,
     .conf_save = conf_save,
     // plugin communication
-    .plug_get_decoder_list = plug_get_decoder_list,
+    .plug_get_decoder_list = plug_get_loaded_decoder_list,
     .plug_get_vfs_list = plug_get_vfs_list,
     .plug_get_output_list = plug_get_output_list,
     .plug_get_dsp_list = plug_get_dsp_list,
@@ -399,6 +404,25 @@ static DB_functions_t deadbeef_api = {
     .action_get_playlist = action_get_playlist,
 
     .plt_search_process2 = (void (*) (ddb_playlist_t *plt, const char *text, int select_results))plt_search_process2,
+
+    .pl_meta_key_get = pl_meta_key_get,
+    .pl_meta_key_release = pl_meta_key_release,
+    .pl_find_meta_interned = (const char *(*) (DB_playItem_t *it, const char *key))pl_find_meta_interned,
+    .pl_find_meta_raw_interned = (const char *(*) (DB_playItem_t *it, const char *key))pl_find_meta_raw_interned,
+    .junk_read_tags = (int (*)(DB_playItem_t *it, DB_FILE *fp))junk_read_tags,
+    .job_submit = job_submit,
+    .job_cancel = job_cancel,
+    .job_cancelled = job_cancelled,
+    .job_wait = job_wait,
+    .job_release = job_release,
+    .streamer_set_output_latency = streamer_set_output_latency,
+    .streamer_get_perf = streamer_get_perf,
+    .plt_search_begin = (ddb_search_t *(*) (ddb_playlist_t *plt, const char *text, int select_results))plt_search_begin,
+    .plt_search_continue = plt_search_continue,
+    .plt_search_end = plt_search_end,
+    .plug_get_decoder_info_list = plug_get_decoder_list,
+    .cond_wait_locked = cond_wait_locked,
+    .cond_wait_timeout_locked = cond_wait_timeout_locked,
 };
 
 DB_functions_t *deadbeef = &deadbeef_api;
@@ -508,12 +532,73 @@ plug_md5_to_str (char *str, const uint8_t sig[16]) {
 typedef struct plugin_s {
     void *handle;
     DB_plugin_t *plugin;
+    struct plugin_cache_entry_s *cache; // set for plugins loaded from files
     struct plugin_s *next;
 } plugin_t;
 
 plugin_t *plugins;
 plugin_t *plugins_tail;
 
+// plugin cache:
+// decoder plugins which don't need to do anything at startup are described
+// in the plugin cache file, and are only dlopen'd when used for the first
+// time. until then, a stub DB_decoder_t filled from the cache is registered
+// instead of the plugin, which has the metadata but no callbacks.
+#define PLUGIN_CACHE_VERSION 2
+
+typedef struct plugin_cache_entry_s {
+    char *plugdir;
+    char *d_name;
+    int64_t mtime;
+    int64_t size;
+    int has_message;
+    int lazy; // the stub is registered, the plugin is not loaded yet
+    int failed; // the plugin failed to load on first use, the stub stays registered
+    int configchanged; // the config has changed while the plugin was not loaded
+    DB_decoder_t stub;
+    struct plugin_cache_entry_s *next;
+} plugin_cache_entry_t;
+
+// entries read from the cache file, which were not claimed by plugins yet
+static plugin_cache_entry_t *plugin_cache;
+static uintptr_t plugin_cache_mutex;
+// number of stubs registered in this session
+static int plugin_cache_num_stubs;
+
+static void
+plugin_cache_strlist_free (const char **list) {
+    if (!list) {
+        return;
+    }
+    for (int i = 0; list[i]; i++) {
+        free ((char *)list[i]);
+    }
+    free (list);
+}
+
+static void
+plugin_cache_entry_free (plugin_cache_entry_t *e) {
+    free (e->plugdir);
+    free (e->d_name);
+    free ((char *)e->stub.plugin.id);
+    free ((char *)e->stub.plugin.name);
+    free ((char *)e->stub.plugin.descr);
+    free ((char *)e->stub.plugin.copyright);
+    free ((char *)e->stub.plugin.website);
+    free ((char *)e->stub.plugin.configdialog);
+    plugin_cache_strlist_free (e->stub.exts);
+    plugin_cache_strlist_free (e->stub.prefixes);
+    free (e);
+}
+
+static void
+plugin_free (plugin_t *p) {
+    if (p->cache) {
+        plugin_cache_entry_free (p->cache);
+    }
+    free (p);
+}
+
 float
 plug_playback_get_pos (void) {
     playItem_t *trk = streamer_get_playing_track ();
@@ -547,13 +632,8 @@ plug_playback_set_pos (float pos) {
     streamer_set_seek (t);
 }
 
-int
-plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
-    DB_plugin_t *plugin_api = loadfunc (&deadbeef_api);
-    if (!plugin_api) {
-        return -1;
-    }
-
+static int
+plug_register (DB_plugin_t *plugin_api, void *handle, plugin_cache_entry_t *cache) {
     // check if same plugin with the same or bigger version is loaded already
     plugin_t *prev = NULL;
     for (plugin_t *p = plugins; p; prev = p, p = p->next) {
@@ -563,17 +643,20 @@ plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
             if (plugin_api->version_major > p->plugin->version_major || (plugin_api->version_major == p->plugin->version_major && plugin_api->version_minor > p->plugin->version_minor)) {
                 trace ("found newer version of plugin \"%s\" (%s), replacing\n", plugin_api->id, plugin_api->name);
                 // unload older plugin before replacing
-                dlclose (p->handle);
                 if (prev) {
                     prev->next = p->next;
                 }
                 else {
                     plugins = p->next;
                 }
+                if (p == plugins_tail) {
+                    plugins_tail = prev;
+                }
                 if (p->handle) {
                     dlclose (p->handle);
                 }
-                free (p);
+                plugin_free (p);
+                break;
             }
             else {
                 trace ("found copy of plugin \"%s\" (%s), but newer version is already loaded\n", plugin_api->id, plugin_api->name)
@@ -601,6 +684,7 @@ plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
     memset (plug, 0, sizeof (plugin_t));
     plug->plugin = plugin_api;
     plug->handle = handle;
+    plug->cache = cache;
     if (plugins_tail) {
         plugins_tail->next = plug;
         plugins_tail = plug;
@@ -611,6 +695,15 @@ plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
     return 0;
 }
 
+int
+plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
+    DB_plugin_t *plugin_api = loadfunc (&deadbeef_api);
+    if (!plugin_api) {
+        return -1;
+    }
+    return plug_register (plugin_api, handle, NULL);
+}
+
 static int dirent_alphasort (const struct dirent **a, const struct dirent **b) {
     return strcmp ((*a)->d_name, (*b)->d_name);
 }
@@ -655,59 +748,480 @@ plug_remove_plugin (void *p) {
     }
 }
 
-// d_name must be writable w/o sideeffects; contain valid .so name
-// l must be strlen(d_name)
-static int
-load_plugin (const char *plugdir, char *d_name, int l) {
-    // hack for osx to skip *.0.so files
-    if (strstr (d_name, ".0.so")) {
-        return -1;
-    }
+typedef DB_plugin_t *(*plugin_load_func_t) (DB_functions_t *api);
+
+// dlopen the plugin file (or its fallback version), and find its load function
+static plugin_load_func_t
+open_plugin_file (const char *plugdir, const char *d_name, int l, void **phandle) {
     char fullname[PATH_MAX];
     snprintf (fullname, PATH_MAX, "%s/%s", plugdir, d_name);
 
-    // check if the file exists, to avoid printing bogus errors
-    struct stat s;
-    if (0 != stat (fullname, &s)) {
-        return -1;
-    }
-
     trace ("loading plugin %s/%s\n", plugdir, d_name);
     void *handle = dlopen (fullname, RTLD_NOW);
     if (!handle) {
         trace ("dlopen error: %s\n", dlerror ());
 #if defined(ANDROID) || defined(HAVE_COCOAUI)
-        return -1;
+        return NULL;
 #else
         strcpy (fullname + strlen(fullname) - sizeof (PLUGINEXT)+1, ".fallback.so");
         trace ("trying %s...\n", fullname);
         handle = dlopen (fullname, RTLD_NOW);
         if (!handle) {
             //trace ("dlopen error: %s\n", dlerror ());
-            return -1;
+            return NULL;
         }
         else {
             fprintf (stderr, "successfully started fallback plugin %s\n", fullname);
         }
 #endif
     }
-    d_name[l-sizeof (PLUGINEXT)+1] = 0;
-    strcat (d_name, "_load");
+    char sym[256];
+    snprintf (sym, sizeof (sym), "%.*s_load", (int)(l-sizeof (PLUGINEXT)+1), d_name);
 #ifndef ANDROID
-    DB_plugin_t *(*plug_load)(DB_functions_t *api) = dlsym (handle, d_name);
+    plugin_load_func_t plug_load = dlsym (handle, sym);
 #else
-    DB_plugin_t *(*plug_load)(DB_functions_t *api) = dlsym (handle, d_name+3);
+    plugin_load_func_t plug_load = dlsym (handle, sym+3);
 #endif
     if (!plug_load) {
-        trace ("dlsym error: %s (%s)\n", dlerror (), d_name + 3);
+        trace ("dlsym error: %s (%s)\n", dlerror (), sym + 3);
         dlclose (handle);
+        return NULL;
+    }
+    *phandle = handle;
+    return plug_load;
+}
+
+static plugin_cache_entry_t *
+plugin_cache_entry_new (const char *plugdir, const char *d_name, const struct stat *s) {
+    plugin_cache_entry_t *e = calloc (1, sizeof (plugin_cache_entry_t));
+    e->plugdir = strdup (plugdir);
+    e->d_name = strdup (d_name);
+    e->mtime = s->st_mtime;
+    e->size = s->st_size;
+    return e;
+}
+
+// find and remove the cache entry for the plugin file,
+// returns NULL if there's none, or if the file has changed
+static plugin_cache_entry_t *
+plugin_cache_claim (const char *plugdir, const char *d_name, const struct stat *s) {
+    plugin_cache_entry_t *prev = NULL;
+    for (plugin_cache_entry_t *e = plugin_cache; e; prev = e, e = e->next) {
+        if (!strcmp (e->d_name, d_name) && !strcmp (e->plugdir, plugdir)) {
+            if (prev) {
+                prev->next = e->next;
+            }
+            else {
+                plugin_cache = e->next;
+            }
+            e->next = NULL;
+            if (e->mtime != s->st_mtime || e->size != s->st_size) {
+                trace ("plugin %s/%s has changed since it was cached\n", plugdir, d_name);
+                plugin_cache_entry_free (e);
+                return NULL;
+            }
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// only decoders which don't need to run anything at startup can be loaded on
+// first use; messages are not delivered until then
+static int
+plugin_cache_can_defer (DB_plugin_t *p) {
+    return p->type == DB_PLUGIN_DECODER
+        && !p->command
+        && !p->connect
+        && !p->disconnect
+        && !p->exec_cmdline
+        && !p->get_actions
+        && ((DB_decoder_t *)p)->insert // all stubs can be shown in the file chooser
+        && p->id;
+}
+
+// strings are written uri-escaped with a '=' prefix, or as '-' for NULL
+static void
+plugin_cache_write_str (FILE *fp, const char *str, char sep) {
+    if (!str) {
+        fprintf (fp, "-%c", sep);
+        return;
+    }
+    char *esc = uri_escape (str, 0);
+    fprintf (fp, "=%s%c", esc ? esc : "", sep);
+    free (esc);
+}
+
+// lists are written as comma-separated escaped strings
+static void
+plugin_cache_write_strlist (FILE *fp, const char **list, char sep) {
+    if (!list) {
+        fprintf (fp, "-%c", sep);
+        return;
+    }
+    fprintf (fp, "=");
+    for (int i = 0; list[i]; i++) {
+        char *esc = uri_escape (list[i], 0);
+        fprintf (fp, i ? ",%s" : "%s", esc ? esc : "");
+        free (esc);
+    }
+    fprintf (fp, "%c", sep);
+}
+
+static char *
+plugin_cache_read_str (const char *tok) {
+    if (*tok != '=') {
+        return NULL;
+    }
+    return uri_unescape (tok+1, 0);
+}
+
+static const char **
+plugin_cache_read_strlist (const char *tok) {
+    if (*tok != '=') {
+        return NULL;
+    }
+    tok++;
+    int n = *tok ? 1 : 0;
+    for (const char *c = tok; *c; c++) {
+        if (*c == ',') {
+            n++;
+        }
+    }
+    const char **list = calloc (n+1, sizeof (char *));
+    for (int i = 0; i < n; i++) {
+        const char *e = strchr (tok, ',');
+        if (!e) {
+            e = tok + strlen (tok);
+        }
+        list[i] = uri_unescape (tok, (int)(e-tok));
+        tok = *e ? e+1 : e;
+    }
+    return list;
+}
+
+#define PLUGIN_CACHE_NUM_FIELDS 18
+
+static plugin_cache_entry_t *
+plugin_cache_parse_line (char *line) {
+    char *tok[PLUGIN_CACHE_NUM_FIELDS];
+    int n = 0;
+    char *p = line;
+    while (n < PLUGIN_CACHE_NUM_FIELDS) {
+        tok[n++] = p;
+        p = strchr (p, ' ');
+        if (!p) {
+            break;
+        }
+        *p++ = 0;
+    }
+    if (n != PLUGIN_CACHE_NUM_FIELDS || p || tok[10][0] != '=') {
+        return NULL;
+    }
+
+    plugin_cache_entry_t *e = calloc (1, sizeof (plugin_cache_entry_t));
+    e->plugdir = plugin_cache_read_str (tok[0]);
+    e->d_name = plugin_cache_read_str (tok[1]);
+    e->mtime = atoll (tok[2]);
+    e->size = atoll (tok[3]);
+    DB_plugin_t *plug = &e->stub.plugin;
+    plug->type = DB_PLUGIN_DECODER;
+    plug->api_vmajor = atoi (tok[4]);
+    plug->api_vminor = atoi (tok[5]);
+    plug->version_major = atoi (tok[6]);
+    plug->version_minor = atoi (tok[7]);
+    plug->flags = (uint32_t)strtoul (tok[8], NULL, 10);
+    e->has_message = atoi (tok[9]);
+    plug->id = plugin_cache_read_str (tok[10]);
+    plug->name = plugin_cache_read_str (tok[11]);
+    plug->descr = plugin_cache_read_str (tok[12]);
+    plug->copyright = plugin_cache_read_str (tok[13]);
+    plug->website = plugin_cache_read_str (tok[14]);
+    plug->configdialog = plugin_cache_read_str (tok[15]);
+    e->stub.exts = plugin_cache_read_strlist (tok[16]);
+    e->stub.prefixes = plugin_cache_read_strlist (tok[17]);
+    if (!e->plugdir || !e->d_name || !plug->id) {
+        plugin_cache_entry_free (e);
+        return NULL;
+    }
+    return e;
+}
+
+static int
+plugin_cache_get_path (char *path, int size) {
+    if (snprintf (path, size, "%s/plugincache", plug_get_config_dir ()) >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+plugin_cache_load (void) {
+    char path[PATH_MAX];
+    if (plugin_cache_get_path (path, sizeof (path)) < 0) {
+        return;
+    }
+    FILE *fp = fopen (path, "rt");
+    if (!fp) {
+        return;
+    }
+    char *buffer = NULL;
+    if (fseek (fp, 0, SEEK_END) == 0) {
+        long l = ftell (fp);
+        rewind (fp);
+        if (l > 0) {
+            buffer = malloc (l+1);
+            if (buffer && fread (buffer, 1, l, fp) == l) {
+                buffer[l] = 0;
+            }
+            else {
+                free (buffer);
+                buffer = NULL;
+            }
+        }
+    }
+    fclose (fp);
+    if (!buffer) {
+        return;
+    }
+
+    char header[100];
+    snprintf (header, sizeof (header), "plugincache %d %d.%d\n", PLUGIN_CACHE_VERSION, DB_API_VERSION_MAJOR, DB_API_VERSION_MINOR);
+    if (strncmp (buffer, header, strlen (header))) {
+        trace ("plugin cache is outdated, ignoring\n");
+        free (buffer);
+        return;
+    }
+
+    plugin_cache_entry_t *tail = NULL;
+    char *line = buffer + strlen (header);
+    while (*line) {
+        char *e = strchr (line, '\n');
+        if (e) {
+            *e = 0;
+        }
+        plugin_cache_entry_t *entry = plugin_cache_parse_line (line);
+        if (entry) {
+            if (tail) {
+                tail->next = entry;
+            }
+            else {
+                plugin_cache = entry;
+            }
+            tail = entry;
+        }
+        if (!e) {
+            break;
+        }
+        line = e+1;
+    }
+    free (buffer);
+}
+
+static void
+plugin_cache_save (void) {
+    char path[PATH_MAX];
+    char tempfile[PATH_MAX];
+    if (plugin_cache_get_path (path, sizeof (path)) < 0
+        || snprintf (tempfile, sizeof (tempfile), "%s.tmp", path) >= sizeof (tempfile)) {
+        return;
+    }
+    FILE *fp = fopen (tempfile, "w+t");
+    if (!fp) {
+        return;
+    }
+    fprintf (fp, "plugincache %d %d.%d\n", PLUGIN_CACHE_VERSION, DB_API_VERSION_MAJOR, DB_API_VERSION_MINOR);
+    for (plugin_t *p = plugins; p; p = p->next) {
+        plugin_cache_entry_t *e = p->cache;
+        if (!e || e->failed) {
+            continue;
+        }
+        DB_decoder_t *dec;
+        int has_message;
+        if (e->lazy) {
+            dec = &e->stub;
+            has_message = e->has_message;
+        }
+        else if (p->handle && plugin_cache_can_defer (p->plugin)) {
+            dec = (DB_decoder_t *)p->plugin;
+            has_message = p->plugin->message ? 1 : 0;
+        }
+        else {
+            continue;
+        }
+        DB_plugin_t *plug = &dec->plugin;
+        plugin_cache_write_str (fp, e->plugdir, ' ');
+        plugin_cache_write_str (fp, e->d_name, ' ');
+        fprintf (fp, "%lld %lld %d %d %d %d %u %d ", (long long)e->mtime, (long long)e->size, plug->api_vmajor, plug->api_vminor, plug->version_major, plug->version_minor, plug->flags, has_message);
+        plugin_cache_write_str (fp, plug->id, ' ');
+        plugin_cache_write_str (fp, plug->name, ' ');
+        plugin_cache_write_str (fp, plug->descr, ' ');
+        plugin_cache_write_str (fp, plug->copyright, ' ');
+        plugin_cache_write_str (fp, plug->website, ' ');
+        plugin_cache_write_str (fp, plug->configdialog, ' ');
+        plugin_cache_write_strlist (fp, dec->exts, ' ');
+        plugin_cache_write_strlist (fp, dec->prefixes, '\n');
+    }
+    if (fclose (fp) != 0 || rename (tempfile, path) != 0) {
+        fprintf (stderr, "failed to save plugin cache %s\n", path);
+        unlink (tempfile);
+    }
+}
+
+static DB_fileinfo_t *
+plugin_cache_failed_open (uint32_t hints) {
+    return NULL;
+}
+
+// the stub of a plugin which failed to load stays in the plugin lists, as
+// they may be iterated by other threads; it can't open anything, and
+// plug_resolve_decoder returns NULL for it
+static void
+plugin_cache_stub_failed (plugin_cache_entry_t *e) {
+    e->failed = 1;
+    e->stub.open = plugin_cache_failed_open;
+}
+
+// load a plugin registered from the plugin cache, and replace its stub in the
+// plugin lists; plugin_cache_mutex must be locked
+static int
+plug_load_deferred (plugin_t *p) {
+    plugin_cache_entry_t *e = p->cache;
+    e->lazy = 0;
+
+    void *handle = NULL;
+    DB_plugin_t *plugin_api = NULL;
+    plugin_load_func_t plug_load = open_plugin_file (e->plugdir, e->d_name, (int)strlen (e->d_name), &handle);
+    if (plug_load) {
+        plugin_api = plug_load (&deadbeef_api);
+    }
+    if (!plugin_api || plugin_api->type != DB_PLUGIN_DECODER || !plugin_api->id || strcmp (plugin_api->id, e->stub.plugin.id)) {
+        fprintf (stderr, "failed to load plugin %s/%s\n", e->plugdir, e->d_name);
+        if (handle) {
+            dlclose (handle);
+        }
+        plugin_cache_stub_failed (e);
+        return -1;
+    }
+    if (plugin_api->start && plugin_api->start () < 0) {
+        fprintf (stderr, "plugin %s failed to start, deactivated.\n", plugin_api->name);
+        if (plugin_api->stop) {
+            plugin_api->stop ();
+        }
+        dlclose (handle);
+        plugin_cache_stub_failed (e);
+        return -1;
+    }
+    trace ("loaded plugin %s on first use\n", plugin_api->id);
+    if (e->configchanged && plugin_api->message) {
+        // it would have received this while running
+        plugin_api->message (DB_EV_CONFIGCHANGED, 0, 0, 0);
+    }
+
+    p->handle = handle;
+    p->plugin = plugin_api;
+    for (int i = 0; g_plugins[i]; i++) {
+        if (g_plugins[i] == &e->stub.plugin) {
+            g_plugins[i] = plugin_api;
+            break;
+        }
+    }
+    for (int i = 0; g_decoder_plugins[i]; i++) {
+        if (g_decoder_plugins[i] == &e->stub) {
+            g_decoder_plugins[i] = (DB_decoder_t *)plugin_api;
+            break;
+        }
+    }
+    return 0;
+}
+
+static void
+plug_load_all_deferred (void) {
+    if (!plugin_cache_num_stubs) {
+        return;
+    }
+    mutex_lock (plugin_cache_mutex);
+    for (plugin_t *p = plugins; p; p = p->next) {
+        if (p->cache && p->cache->lazy) {
+            plug_load_deferred (p);
+        }
+    }
+    mutex_unlock (plugin_cache_mutex);
+}
+
+DB_decoder_t *
+plug_resolve_decoder (DB_decoder_t *dec) {
+    if (!dec || !plugin_cache_num_stubs) {
+        return dec;
+    }
+    mutex_lock (plugin_cache_mutex);
+    for (plugin_t *p = plugins; p; p = p->next) {
+        if (p->cache && &p->cache->stub == dec) {
+            if (p->cache->lazy) {
+                plug_load_deferred (p);
+            }
+            dec = p->cache->failed ? NULL : (DB_decoder_t *)p->plugin;
+            break;
+        }
+    }
+    mutex_unlock (plugin_cache_mutex);
+    return dec;
+}
+
+void
+plug_deferred_configchanged (void) {
+    if (!plugin_cache_num_stubs) {
+        return;
+    }
+    mutex_lock (plugin_cache_mutex);
+    for (plugin_t *p = plugins; p; p = p->next) {
+        if (p->cache && p->cache->lazy && p->cache->has_message) {
+            p->cache->configchanged = 1;
+        }
+    }
+    mutex_unlock (plugin_cache_mutex);
+}
+
+// d_name must be writable w/o sideeffects; contain valid .so name
+// l must be strlen(d_name)
+static int
+load_plugin (const char *plugdir, char *d_name, int l) {
+    // hack for osx to skip *.0.so files
+    if (strstr (d_name, ".0.so")) {
+        return -1;
+    }
+    char fullname[PATH_MAX];
+    snprintf (fullname, PATH_MAX, "%s/%s", plugdir, d_name);
+
+    // check if the file exists, to avoid printing bogus errors
+    struct stat s;
+    if (0 != stat (fullname, &s)) {
+        return -1;
+    }
+
+    // cached decoders are registered as stubs, and loaded on first use
+    plugin_cache_entry_t *e = plugin_cache_claim (plugdir, d_name, &s);
+    if (e) {
+        trace ("deferring plugin %s/%s\n", plugdir, d_name);
+        if (plug_register (&e->stub.plugin, NULL, e) < 0) {
+            plugin_cache_entry_free (e);
+            return -1;
+        }
+        e->lazy = 1;
+        plugin_cache_num_stubs++;
+        return 0;
+    }
+
+    void *handle = NULL;
+    plugin_load_func_t plug_load = open_plugin_file (plugdir, d_name, l, &handle);
+    if (!plug_load) {
         return -1;
     }
     if (plug_init_plugin (plug_load, handle) < 0) {
-        d_name[l-sizeof (PLUGINEXT)+1] = 0;
         dlclose (handle);
         return -1;
     }
+    plugins_tail->cache = plugin_cache_entry_new (plugdir, d_name, &s);
     return 0;
 }
 
@@ -877,6 +1391,10 @@ plug_load_all (void) {
 #endif
 
     background_jobs_mutex = mutex_create ();
+    plugin_cache_mutex = mutex_create ();
+    if (conf_get_int ("plugins.deferred_loading", 1)) {
+        plugin_cache_load ();
+    }
 
     const char *dirname = deadbeef->get_plugin_dir ();
 
@@ -1061,7 +1579,7 @@ plug_load_all (void) {
                     plugins = plug->next;
                 }
                 plugin_t *next = plug->next;
-                free (plug);
+                plugin_free (plug);
                 plug = next;
                 continue;
             }
@@ -1077,6 +1595,13 @@ plug_load_all (void) {
     g_dsp_plugins[numdsp] = NULL;
     g_playlist_plugins[numplaylist] = NULL;
 
+    // forget cached plugins which were not found
+    while (plugin_cache) {
+        plugin_cache_entry_t *next = plugin_cache->next;
+        plugin_cache_entry_free (plugin_cache);
+        plugin_cache = next;
+    }
+
     // select output plugin
     if (plug_select_output () < 0) {
         trace ("failed to find output plugin!\n");
@@ -1112,7 +1637,7 @@ plug_connect_all (void) {
                     plugins = plug->next;
                 }
                 plugin_t *next = plug->next;
-                free (plug);
+                plugin_free (plug);
                 plug = next;
                 continue;
             }
@@ -1143,6 +1668,7 @@ void
 plug_unload_all (void) {
     action_set_playlist (NULL);
     trace ("plug_unload_all\n");
+    plugin_cache_save ();
     plugin_t *p;
     for (p = plugins; p; p = p->next) {
         if (p->plugin->stop) {
@@ -1162,7 +1688,7 @@ plug_unload_all (void) {
         if (plugins->handle) {
             dlclose (plugins->handle);
         }
-        free (plugins);
+        plugin_free (plugins);
         plugins = next;
     }
     for (int i = 0; g_gui_names[i]; i++) {
@@ -1186,6 +1712,11 @@ plug_unload_all (void) {
         mutex_free (background_jobs_mutex);
         background_jobs_mutex = 0;
     }
+    if (plugin_cache_mutex) {
+        mutex_free (plugin_cache_mutex);
+        plugin_cache_mutex = 0;
+    }
+    plugin_cache_num_stubs = 0;
 }
 
 void
@@ -1198,6 +1729,14 @@ plug_get_decoder_list (void) {
     return g_decoder_plugins;
 }
 
+// plugins may call any of the decoder callbacks,
+// so they get the list with all decoders loaded
+static struct DB_decoder_s **
+plug_get_loaded_decoder_list (void) {
+    plug_load_all_deferred ();
+    return g_decoder_plugins;
+}
+
 struct DB_vfs_s **
 plug_get_vfs_list (void) {
     return g_vfs_plugins;
@@ -1361,7 +1900,7 @@ plug_get_decoder_for_id (const char *id) {
     DB_decoder_t **plugins = plug_get_decoder_list ();
     for (int c = 0; plugins[c]; c++) {
         if (!strcmp (id, plugins[c]->plugin.id)) {
-            return plugins[c];
+            return plug_resolve_decoder (plugins[c]);
         }
     }
     return NULL;
@@ -1372,6 +1911,9 @@ plug_get_for_id (const char *id) {
     DB_plugin_t **plugins = plug_get_list ();
     for (int c = 0; plugins[c]; c++) {
         if (plugins[c]->id && !strcmp (id, plugins[c]->id)) {
+            if (plugins[c]->type == DB_PLUGIN_DECODER) {
+                return (DB_plugin_t *)plug_resolve_decoder ((DB_decoder_t *)plugins[c]);
+            }
             return plugins[c];
         }
     }
@@ -130,6 +130,16 @@ plug_get_decoder_for_id (const char *id);
 DB_plugin_t *
 plug_get_for_id (const char *id);
 
+// returns the loaded decoder for an entry of plug_get_decoder_list,
+// loading it if it was deferred; NULL if it failed to load
+DB_decoder_t *
+plug_resolve_decoder (DB_decoder_t *dec);
+
+// deferred plugins which handle messages get DB_EV_CONFIGCHANGED when they
+// are loaded, instead of being loaded to see the change
+void
+plug_deferred_configchanged (void);
+
 int
 plug_is_local_file (const char *fname);
 
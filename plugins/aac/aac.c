@@ -958,9 +958,7 @@ aac_read_metadata (DB_playItem_t *it) {
         aac_load_tags (it, mp4);
         mp4ff_close (mp4);
     }
-    /*int apeerr = */deadbeef->junk_apev2_read (it, fp);
-    /*int v2err = */deadbeef->junk_id3v2_read (it, fp);
-    /*int v1err = */deadbeef->junk_id3v1_read (it, fp);
+    deadbeef->junk_read_tags (it, fp);
     deadbeef->fclose (fp);
     return 0;
 }
@@ -1170,9 +1168,7 @@ aac_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
                     deadbeef->pl_set_meta_int (it, ":TRACKNUM", i);
                     deadbeef->plt_set_item_duration (plt, it, duration);
                     aac_load_tags (it, mp4);
-                    int apeerr = deadbeef->junk_apev2_read (it, fp);
-                    int v2err = deadbeef->junk_id3v2_read (it, fp);
-                    int v1err = deadbeef->junk_id3v1_read (it, fp);
+                    deadbeef->junk_read_tags (it, fp);
 
                     int64_t fsize = deadbeef->fgetlength (fp);
 
@@ -1262,9 +1258,7 @@ aac_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
     trace ("duration: %f sec\n", duration);
 
     // read tags
-    int apeerr = deadbeef->junk_apev2_read (it, fp);
-    int v2err = deadbeef->junk_id3v2_read (it, fp);
-    int v1err = deadbeef->junk_id3v1_read (it, fp);
+    deadbeef->junk_read_tags (it, fp);
 
     int64_t fsize = deadbeef->fgetlength (fp);
 
@@ -1317,7 +1311,7 @@ static const char * exts[] = { "aac", "mp4", "m4a", "m4b", NULL };
 // define plugin interface
 static DB_decoder_t plugin = {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 0,
+    .plugin.api_vminor = 10,
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DECODER,
@@ -462,9 +462,7 @@ alacplug_read_metadata (DB_playItem_t *it) {
         alacplug_load_tags (it, mp4);
         mp4ff_close (mp4);
     }
-    /*int apeerr = */deadbeef->junk_apev2_read (it, fp);
-    /*int v2err = */deadbeef->junk_id3v2_read (it, fp);
-    /*int v1err = */deadbeef->junk_id3v1_read (it, fp);
+    deadbeef->junk_read_tags (it, fp);
     deadbeef->fclose (fp);
     return 0;
 }
@@ -536,9 +534,7 @@ alacplug_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
         alacplug_load_tags (it, mp4);
     }
 
-    int apeerr = deadbeef->junk_apev2_read (it, fp);
-    int v2err = deadbeef->junk_id3v2_read (it, fp);
-    int v1err = deadbeef->junk_id3v1_read (it, fp);
+    deadbeef->junk_read_tags (it, fp);
 
     int64_t fsize = deadbeef->fgetlength (fp);
 
@@ -614,7 +610,7 @@ static const char * exts[] = { "mp4", "m4a", NULL };
 // define plugin interface
 static DB_decoder_t plugin = {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 0,
+    .plugin.api_vminor = 10,
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DECODER,
@@ -19,6 +19,7 @@
 #include <alsa/asoundlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/prctl.h>
 #include "../../deadbeef.h"
 #include "../../config.h"
@@ -36,6 +37,8 @@
 #define DEFAULT_BUFFER_SIZE_STR "8192"
 #define DEFAULT_PERIOD_SIZE_STR "1024"
 
+#define MAX_POLL_FDS 16
+
 static DB_output_t plugin;
 DB_functions_t *deadbeef;
 
@@ -54,6 +57,20 @@ static snd_pcm_uframes_t req_period_size;
 
 static int conf_alsa_resample = 1;
 static char conf_alsa_soundcard[100] = "default";
+static int conf_alsa_mmap = 0;
+static int conf_alsa_wakeup_periods = 1;
+
+// in mmap mode the streamer writes directly into the device buffer;
+// mmap_mutex is held between snd_pcm_mmap_begin and snd_pcm_mmap_commit,
+// so that the hw params can't be changed while the area is in use
+static int alsa_use_mmap;
+static uintptr_t mmap_mutex;
+
+// protected by the plugin lock; published as alsa.stats.* from palsa_thread,
+// to be shown in the config dialog
+static int alsa_xruns;
+static int alsa_suspends;
+static int alsa_stats_changed;
 
 static int alsa_formatchanged = 0;
 
@@ -121,7 +138,18 @@ retry:
         goto error;
     }
 
-    if ((err = snd_pcm_hw_params_set_access (audio, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+    alsa_use_mmap = 0;
+    if (conf_alsa_mmap) {
+        if ((err = snd_pcm_hw_params_set_access (audio, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0) {
+            fprintf (stderr, "alsa: mmap access is not supported (%s), falling back to read/write\n",
+                    snd_strerror (err));
+        }
+        else {
+            alsa_use_mmap = 1;
+        }
+    }
+
+    if (!alsa_use_mmap && (err = snd_pcm_hw_params_set_access (audio, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
         fprintf (stderr, "cannot set access type (%s)\n",
                 snd_strerror (err));
         goto error;
@@ -331,6 +359,8 @@ palsa_init (void) {
     // get and cache conf variables
     conf_alsa_resample = deadbeef->conf_get_int ("alsa.resample", 1);
     deadbeef->conf_get_str ("alsa_soundcard", "default", conf_alsa_soundcard, sizeof (conf_alsa_soundcard));
+    conf_alsa_mmap = deadbeef->conf_get_int ("alsa.mmap", 0);
+    conf_alsa_wakeup_periods = deadbeef->conf_get_int ("alsa.wakeup_periods", 1);
     trace ("alsa_soundcard: %s\n", conf_alsa_soundcard);
 
     snd_pcm_sw_params_t *sw_params = NULL;
@@ -365,7 +395,16 @@ palsa_init (void) {
 
     snd_pcm_sw_params_set_start_threshold (audio, sw_params, buffer_size - period_size);
 
-    if ((err = snd_pcm_sw_params_set_avail_min (audio, sw_params, period_size)) < 0) {
+    // wake up the writer every N periods, but early enough to avoid underruns
+    snd_pcm_uframes_t avail_min = period_size * (conf_alsa_wakeup_periods > 1 ? conf_alsa_wakeup_periods : 1);
+    if (buffer_size > period_size && avail_min > buffer_size - period_size) {
+        avail_min = buffer_size - period_size;
+    }
+    if (avail_min < period_size) {
+        avail_min = period_size;
+    }
+
+    if ((err = snd_pcm_sw_params_set_avail_min (audio, sw_params, avail_min)) < 0) {
         fprintf (stderr, "cannot set minimum available count (%s)\n",
                 snd_strerror (err));
         goto open_error;
@@ -445,6 +484,7 @@ palsa_setformat (ddb_waveformat_t *fmt) {
         , fmt->channelmask, plugin.fmt.channelmask
         );
     }
+    deadbeef->mutex_lock (mmap_mutex);
     LOCK;
     int s = state;
     state = OUTPUT_STATE_STOPPED;
@@ -455,6 +495,7 @@ palsa_setformat (ddb_waveformat_t *fmt) {
         // even if it failed -- copy the format
         memcpy (&plugin.fmt, &requested_fmt, sizeof (ddb_waveformat_t));
         UNLOCK;
+        deadbeef->mutex_unlock (mmap_mutex);
         return -1;
     }
     trace ("new format %dbit %s %dch %dHz channelmask=%X\n", plugin.fmt.bps, plugin.fmt.is_float ? "float" : "int", plugin.fmt.channels, plugin.fmt.samplerate, plugin.fmt.channelmask);
@@ -479,6 +520,7 @@ palsa_setformat (ddb_waveformat_t *fmt) {
     trace ("alsa_formatchanged=1\n");
     alsa_formatchanged = 1;
     UNLOCK;
+    deadbeef->mutex_unlock (mmap_mutex);
     return res;
 }
 
@@ -615,6 +657,135 @@ palsa_unpause (void) {
     return 0;
 }
 
+// waits until the device can take avail_min frames, instead of sleeping
+// for a computed time; wakes up periodically to notice state changes
+static void
+palsa_wait_for_space (void) {
+    LOCK;
+    if (!audio || state != OUTPUT_STATE_PLAYING || alsa_terminate) {
+        UNLOCK;
+        return;
+    }
+    struct pollfd fds[MAX_POLL_FDS];
+    int count = snd_pcm_poll_descriptors_count (audio);
+    if (count > 0 && count <= MAX_POLL_FDS) {
+        count = snd_pcm_poll_descriptors (audio, fds, count);
+    }
+    else {
+        count = 0;
+    }
+    UNLOCK;
+    if (count <= 0) {
+        usleep (10000);
+        return;
+    }
+    if (poll (fds, count, 100) > 0) {
+        LOCK;
+        unsigned short revents = 0;
+        if (audio) {
+            snd_pcm_poll_descriptors_revents (audio, fds, count, &revents);
+        }
+        UNLOCK;
+        if (revents & POLLERR) {
+            // xrun or suspend, the writer will recover; don't spin meanwhile
+            usleep (1000);
+        }
+    }
+}
+
+// must be called with the lock held
+static void
+palsa_recover (int err) {
+    if (err == -ESTRPIPE) {
+        fprintf (stderr, "alsa: trying to recover from suspend... (error=%d, %s)\n", err,  snd_strerror (err));
+        alsa_suspends++;
+        while ((err = snd_pcm_resume(audio)) == -EAGAIN) {
+            sleep(1); /* wait until the suspend flag is released */
+        }
+        if (err < 0) {
+            snd_pcm_prepare (audio);
+        }
+    }
+    else {
+        if (err == -EPIPE) {
+            alsa_xruns++;
+        }
+        // playback restarts when start_threshold frames are committed
+        snd_pcm_prepare (audio);
+    }
+    alsa_stats_changed = 1;
+}
+
+// stores the xrun/suspend counters in the config after a recovery
+static void
+palsa_update_stats (void) {
+    LOCK;
+    int changed = alsa_stats_changed;
+    int xruns = alsa_xruns;
+    int suspends = alsa_suspends;
+    alsa_stats_changed = 0;
+    UNLOCK;
+    if (changed) {
+        trace ("alsa: %d buffer underruns, %d suspend recoveries since start\n", xruns, suspends);
+        deadbeef->conf_set_int ("alsa.stats.xruns", xruns);
+        deadbeef->conf_set_int ("alsa.stats.suspends", suspends);
+    }
+}
+
+// lets the streamer write whole periods directly into the device buffer
+static void
+palsa_write_mmap (void) {
+    deadbeef->mutex_lock (mmap_mutex);
+    LOCK;
+    if (alsa_formatchanged) {
+        trace ("handled alsa_formatchanged [mmap]\n");
+        alsa_formatchanged = 0;
+        UNLOCK;
+        deadbeef->mutex_unlock (mmap_mutex);
+        return;
+    }
+    int framesize = (plugin.fmt.bps>>3) * plugin.fmt.channels;
+    int starved = 0;
+    snd_pcm_sframes_t avail = snd_pcm_avail_update (audio);
+    if (avail < 0) {
+        palsa_recover (avail);
+    }
+    else if (framesize > 0) {
+        snd_pcm_uframes_t frames = avail - avail % period_size;
+        while (frames > 0 && state == OUTPUT_STATE_PLAYING && !alsa_terminate) {
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t offset;
+            snd_pcm_uframes_t n = frames;
+            int err = snd_pcm_mmap_begin (audio, &areas, &offset, &n);
+            if (err < 0) {
+                palsa_recover (err);
+                break;
+            }
+            // interleaved access: all channels share one area
+            char *ptr = (char *)areas[0].addr + areas[0].first / 8 + offset * (areas[0].step / 8);
+            UNLOCK; // holding a lock here may cause deadlock in the streamer
+            int bytes = palsa_callback (ptr, n * framesize);
+            LOCK;
+            snd_pcm_uframes_t written = bytes > 0 ? bytes / framesize : 0;
+            snd_pcm_sframes_t res = snd_pcm_mmap_commit (audio, offset, written);
+            if (res < 0 || res != written) {
+                palsa_recover (res < 0 ? res : -EPIPE);
+                break;
+            }
+            if (written < n) {
+                starved = 1;
+                break;
+            }
+            frames -= written;
+        }
+    }
+    UNLOCK;
+    deadbeef->mutex_unlock (mmap_mutex);
+    if (starved) {
+        usleep (10000);
+    }
+}
+
 static void
 palsa_thread (void *context) {
     prctl (PR_SET_NAME, "deadbeef-alsa", 0, 0, 0, 0);
@@ -623,10 +794,16 @@ palsa_thread (void *context) {
         if (alsa_terminate) {
             break;
         }
+        palsa_update_stats ();
         if (state != OUTPUT_STATE_PLAYING || !deadbeef->streamer_ok_to_read (-1)) {
             usleep (10000);
             continue;
         }
+        if (alsa_use_mmap) {
+            palsa_write_mmap ();
+            palsa_wait_for_space ();
+            continue;
+        }
         LOCK;
         if (alsa_formatchanged) {
             trace ("handled alsa_formatchanged [1]\n");
@@ -685,8 +862,10 @@ palsa_thread (void *context) {
             }
 
             if (err < 0) {
+                alsa_stats_changed = 1;
                 if (err == -ESTRPIPE) {
                     fprintf (stderr, "alsa: trying to recover from suspend... (error=%d, %s)\n", err,  snd_strerror (err));
+                    alsa_suspends++;
                     while ((err = snd_pcm_resume(audio)) == -EAGAIN) {
                         sleep(1); /* wait until the suspend flag is released */
                     }
@@ -701,6 +880,9 @@ palsa_thread (void *context) {
             //        break;
                 }
                 else {
+                    if (err == -EPIPE) {
+                        alsa_xruns++;
+                    }
                     //if (err != -EPIPE) {
                     //    fprintf (stderr, "alsa: snd_pcm_writei error=%d, %s\n", err, snd_strerror (err));
                     //}
@@ -713,10 +895,7 @@ palsa_thread (void *context) {
             frames_to_deliver = snd_pcm_avail_update (audio);
         }
         UNLOCK;
-        int sleeptime = period_size-frames_to_deliver;
-        if (sleeptime > 0 && plugin.fmt.samplerate > 0 && plugin.fmt.channels > 0) {
-            usleep (sleeptime * 1000 / plugin.fmt.samplerate * 1000);
-        }
+        palsa_wait_for_space ();
     }
 }
 
@@ -732,11 +911,15 @@ alsa_configchanged (void) {
     const char *alsa_soundcard = deadbeef->conf_get_str_fast ("alsa_soundcard", "default");
     int buffer = deadbeef->conf_get_int ("alsa.buffer", DEFAULT_BUFFER_SIZE);
     int period = deadbeef->conf_get_int ("alsa.period", DEFAULT_PERIOD_SIZE);
+    int use_mmap = deadbeef->conf_get_int ("alsa.mmap", 0);
+    int wakeup_periods = deadbeef->conf_get_int ("alsa.wakeup_periods", 1);
     if (audio &&
             (alsa_resample != conf_alsa_resample
             || strcmp (alsa_soundcard, conf_alsa_soundcard)
             || buffer != req_buffer_size
-            || period != req_period_size)) {
+            || period != req_period_size
+            || use_mmap != conf_alsa_mmap
+            || wakeup_periods != conf_alsa_wakeup_periods)) {
         trace ("alsa: config option changed, restarting\n");
         deadbeef->sendmessage (DB_EV_REINIT_SOUND, 0, 0, 0);
     }
@@ -790,11 +973,19 @@ alsa_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
 
 static int
 alsa_start (void) {
+    mmap_mutex = deadbeef->mutex_create ();
+    // the counters are since start, don't show the ones of the previous session
+    deadbeef->conf_set_int ("alsa.stats.xruns", 0);
+    deadbeef->conf_set_int ("alsa.stats.suspends", 0);
     return 0;
 }
 
 static int
 alsa_stop (void) {
+    if (mmap_mutex) {
+        deadbeef->mutex_free (mmap_mutex);
+        mmap_mutex = 0;
+    }
     return 0;
 }
 
@@ -809,6 +1000,10 @@ static const char settings_dlg[] =
     "property \"Release device while stopped\" checkbox alsa.freeonstop 0;\n"
     "property \"Preferred buffer size\" entry alsa.buffer " DEFAULT_BUFFER_SIZE_STR ";\n"
     "property \"Preferred period size\" entry alsa.period " DEFAULT_PERIOD_SIZE_STR ";\n"
+    "property \"Write directly to the device buffer (mmap)\" checkbox alsa.mmap 0;\n"
+    "property \"Wake up every N periods\" entry alsa.wakeup_periods 1;\n"
+    "property \"Buffer underruns since start\" entry readonly alsa.stats.xruns 0;\n"
+    "property \"Suspend recoveries since start\" entry readonly alsa.stats.suspends 0;\n"
 ;
 
 // define plugin interface
@@ -50,9 +50,6 @@
 #endif
 #ifdef USE_IMLIB2
     #include <Imlib2.h>
-#else
-    #include <jpeglib.h>
-    #include <png.h>
 #endif
 #include "../../deadbeef.h"
 #include "artwork_internal.h"
@@ -61,6 +58,7 @@
 #include "albumartorg.h"
 #include "wos.h"
 #include "cache.h"
+#include "scaler.h"
 #include "artwork.h"
 
 //#define trace(...) { fprintf (stderr, __VA_ARGS__); }
@@ -83,14 +81,26 @@ typedef struct cover_query_s {
     char *artist;
     char *album;
     int size;
+    int priority;
+    int running;
     cover_callback_t *callback;
+    struct cover_query_s *prev;
     struct cover_query_s *next;
+    struct cover_query_s *hash_next;
 } cover_query_t;
 
-static cover_query_t *queue;
-static cover_query_t *queue_tail;
+#define FETCHER_THREADS 4
+#define NUM_PRIORITIES (ARTWORK_PRIORITY_HIGH+1)
+#define QUERY_HASH_SIZE 1024
+
+/* One list per priority, newest query first; running queries are only in the hash */
+static cover_query_t *queue[NUM_PRIORITIES];
+static cover_query_t *query_hash[QUERY_HASH_SIZE];
+static cover_query_t *running_queries[FETCHER_THREADS];
+static int num_running;
+static void *pending_reset;
 static int terminate;
-static intptr_t tid;
+static intptr_t tids[FETCHER_THREADS];
 static uintptr_t queue_mutex;
 static uintptr_t queue_cond;
 
@@ -113,733 +123,6 @@ static time_t default_reset_time;
 #define DEFAULT_FILEMASK "*cover*.jpg;*front*.jpg;*folder*.jpg;*cover*.png;*front*.png;*folder*.png"
 static char *artwork_filemask;
 
-static float
-scale_dimensions (int scaled_size, int width, int height, unsigned int *scaled_width, unsigned int *scaled_height)
-{
-    /* Calculate the dimensions of the scaled image */
-    float scaling_ratio;
-    if (scale_towards_longer == width > height) {
-        *scaled_height = scaled_size;
-        scaling_ratio = (float)height / *scaled_height;
-        *scaled_width = width / scaling_ratio + 0.5;
-    }
-    else {
-        *scaled_width = scaled_size;
-        scaling_ratio = (float)width / *scaled_width;
-        *scaled_height = height / scaling_ratio + 0.5;
-    }
-    return scaling_ratio;
-}
-
-#ifndef USE_IMLIB2
-#ifdef USE_BICUBIC
-static float cerp (float p0, float p1, float p2, float p3, float d, float d2, float d3)
-{
-    /* Cubic Hermite spline (a = -0.5, Catmull-Rom) */
-    return p1 - (p0*d3 - 3*p1*d3 + 3*p2*d3 - p3*d3 - 2*p0*d2 + 5*p1*d2 - 4*p2*d2 + p3*d2 + p0*d - p2*d)/2;
-}
-
-static int_fast16_t bcerp (const png_byte *row0, const png_byte *row1, const png_byte *row2, const png_byte *row3,
-                      const uint_fast32_t x0, const uint_fast32_t x1, const uint_fast32_t x2, const uint_fast32_t x3, const uint_fast8_t component,
-                      float dx, float dx2, float dx3, float dy, float dy2, float dy3) {
-    const uint_fast32_t index0 = x0 + component;
-    const uint_fast32_t index1 = x1 + component;
-    const uint_fast32_t index2 = x2 + component;
-    const uint_fast32_t index3 = x3 + component;
-    float p0 = cerp (row0[index0], row1[index0], row2[index0], row3[index0], dy, dy2, dy3);
-    float p1 = cerp (row0[index1], row1[index1], row2[index1], row3[index1], dy, dy2, dy3);
-    float p2 = cerp (row0[index2], row1[index2], row2[index2], row3[index2], dy, dy2, dy3);
-    float p3 = cerp (row0[index3], row1[index3], row2[index3], row3[index3], dy, dy2, dy3);
-    return cerp (p0, p1, p2, p3, dx, dx2, dx3) + 0.5;
-}
-#endif
-static uint_fast32_t blerp_pixel (const png_byte *row, const png_byte *next_row, const uint_fast32_t x_index, const uint_fast32_t next_x_index,
-                                 const uint_fast32_t weight, const uint_fast32_t weightx, const uint_fast32_t weighty, const uint_fast32_t weightxy)
-{
-    return row[x_index]*weight + row[next_x_index]*weightx + next_row[x_index]*weighty + next_row[next_x_index]*weightxy;
-}
-
-static uint_fast32_t *
-calculate_quick_dividers (float scaling_ratio)
-{
-    /* Replace slow divisions by expected numbers with faster multiply/shift combo */
-    const uint16_t max_sample_size = scaling_ratio + 1;
-    uint_fast32_t *dividers = malloc ((max_sample_size * max_sample_size + 1) * sizeof (uint_fast32_t));
-    if (dividers) {
-        for (uint16_t y = max_sample_size; y; y--) {
-            for (uint16_t x = y; x; x--) {
-                const uint32_t num_pixels = x * y;
-                /* Accurate to 1/256 for up to 256 pixels and always for powers of 2 */
-                dividers[num_pixels] = num_pixels <= 256 || !(num_pixels & (num_pixels - 1)) ? 256*256/num_pixels : 0;
-            }
-        }
-    }
-    return dividers;
-}
-
-typedef struct {
-    struct jpeg_error_mgr pub;	/* "public" fields */
-    jmp_buf setjmp_buffer;	/* for return to caller */
-} my_error_mgr_t;
-
-METHODDEF (void)
-my_error_exit (j_common_ptr cinfo)
-{
-  /* cinfo->err really points to a my_error_mgr struct, so coerce pointer */
-  my_error_mgr_t *myerr = (my_error_mgr_t *) cinfo->err;
-
-//  (*cinfo->err->output_message)(cinfo);
-
-  /* Return control to the setjmp point */
-  longjmp (myerr->setjmp_buffer, 1);
-}
-
-
-static int
-jpeg_resize (const char *fname, const char *outname, int scaled_size) {
-    trace ("resizing %s into %s\n", fname, outname);
-    FILE *fp = NULL, *out = NULL;
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_compress_struct cinfo_out;
-    void *sample_rows_buffer = NULL;
-    uint_fast32_t *quick_dividers = NULL;
-    my_error_mgr_t jerr;
-
-    cinfo.mem = cinfo_out.mem = NULL;
-    cinfo_out.err = cinfo.err = jpeg_std_error (&jerr.pub);
-    jerr.pub.error_exit = my_error_exit;
-    if (setjmp (jerr.setjmp_buffer)) {
-        trace ("failed to scale %s as jpeg\n", outname);
-        jpeg_destroy_decompress (&cinfo);
-        jpeg_destroy_compress (&cinfo_out);
-        if (sample_rows_buffer) {
-            free (sample_rows_buffer);
-        }
-        if (quick_dividers) {
-            free (quick_dividers);
-        }
-        if (fp) {
-            fclose (fp);
-        }
-        if (out) {
-            fclose (out);
-        }
-        return -1;
-    }
-
-    fp = fopen (fname, "rb");
-    if (!fp) {
-        return -1;
-    }
-    out = fopen (outname, "w+b");
-    if (!out) {
-        fclose (fp);
-        return -1;
-    }
-
-    jpeg_create_decompress (&cinfo);
-    jpeg_create_compress (&cinfo_out);
-
-    jpeg_stdio_src (&cinfo, fp);
-    jpeg_stdio_dest (&cinfo_out, out);
-
-    jpeg_read_header (&cinfo, TRUE);
-    jpeg_start_decompress (&cinfo);
-
-    const unsigned int num_components = cinfo.output_components;
-    const unsigned int width = cinfo.image_width;
-    const unsigned int height = cinfo.image_height;
-    unsigned int scaled_width, scaled_height;
-    float scaling_ratio = scale_dimensions (scaled_size, width, height, &scaled_width, &scaled_height);
-    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_width > 32767) {
-        trace ("scaling ratio (%g) or scaled image dimensions (%ux%u) are invalid\n", scaling_ratio, scaled_width, scaled_height);
-        my_error_exit ((j_common_ptr)&cinfo);
-    }
-
-    cinfo_out.image_width      = scaled_width;
-    cinfo_out.image_height     = scaled_height;
-    cinfo_out.input_components = num_components;
-    cinfo_out.in_color_space   = cinfo.out_color_space;
-    jpeg_set_defaults (&cinfo_out);
-    jpeg_set_quality (&cinfo_out, 95, TRUE);
-    jpeg_start_compress (&cinfo_out, TRUE);
-
-    const uint_fast32_t row_components = width * num_components;
-    const uint_fast32_t scaled_row_components = scaled_width * num_components;
-    JSAMPLE out_line[scaled_row_components];
-    JSAMPROW out_row = out_line;
-
-    if (scaling_ratio > 2) {
-        /* Simple (unweighted) area sampling for large downscales */
-        quick_dividers = calculate_quick_dividers (scaling_ratio);
-        const uint16_t max_sample_height = scaling_ratio + 1;
-        sample_rows_buffer = malloc (max_sample_height * row_components * sizeof (JSAMPLE));
-        if (!sample_rows_buffer || !quick_dividers) {
-            my_error_exit ((j_common_ptr)&cinfo);
-        }
-        JSAMPROW rows[max_sample_height];
-        for (uint16_t row_index = 0; row_index < max_sample_height; row_index++) {
-            rows[row_index] = sample_rows_buffer + row_index*row_components;
-        }
-
-        /* Loop through all (down-)scaled pixels */
-        float y_interp = 0.5;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++) {
-            const uint_fast32_t y = y_interp;
-            const uint_fast32_t y_limit = y_interp += scaling_ratio;
-            const uint_fast16_t num_y_pixels = (y_limit < height ? y_limit : height) - y;
-
-            for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                jpeg_read_scanlines (&cinfo, &rows[row_index], 1);
-            }
-
-            float x_interp = 0.5;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components) {
-                const uint_fast32_t x = x_interp;
-                x_interp += scaling_ratio;
-                const uint_fast32_t x_limit = x_interp < width ? x_interp : width;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t x_limit_index = x_limit * num_components;
-
-                /* Sum all values where the scaled pixel overlaps at least half a pixel in each direction */
-                const uint_fast32_t num_pixels = num_y_pixels * (x_limit - x);
-                const uint_fast32_t quick_divider = quick_dividers[num_pixels];
-                for (uint_fast8_t component=0; component<num_components; component++) {
-                    uint_fast32_t value = 0;
-                    for (uint_fast32_t pixel_index = x_index+component; pixel_index < x_limit_index; pixel_index+=num_components) {
-                        for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                            value += rows[row_index][pixel_index];
-                        }
-                    }
-                    out_row[scaled_x+component] = quick_divider ? value * quick_divider >> 16 : value / num_pixels;
-                }
-            }
-
-            jpeg_write_scanlines (&cinfo_out, &out_row, 1);
-        }
-
-        free (sample_rows_buffer);
-        free (quick_dividers);
-    }
-    else {
-#ifndef USE_BICUBIC
-        /* Bilinear interpolation for upscales and modest downscales */
-        JSAMPLE scanline[row_components];
-        JSAMPLE next_scanline[row_components];
-        JSAMPROW row = scanline;
-        JSAMPROW next_row = next_scanline;
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            const uint_fast16_t y_diff = (uint_fast32_t)(y_interp*256) - (y<<8);
-            const uint_fast16_t y_remn = 256 - y_diff;
-
-            if (cinfo.output_scanline < y+2) {
-                while (cinfo.output_scanline < y+1) {
-                    jpeg_read_scanlines (&cinfo, &next_row, 1);
-                }
-                memcpy (row, next_row, row_components*sizeof (JSAMPLE));
-                if (y+2 < height) {
-                    jpeg_read_scanlines (&cinfo, &next_row, 1);
-                }
-            }
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t next_x_index = x+1 < width ? x_index+num_components : x_index;
-
-                const uint_fast16_t x_diff = (uint_fast32_t)(x_interp*256) - (x<<8);
-                const uint_fast16_t x_remn = 256 - x_diff;
-                const uint_fast32_t weight = x_remn * y_remn;
-                const uint_fast32_t weightx = x_diff * y_remn;
-                const uint_fast32_t weighty = x_remn * y_diff;
-                const uint_fast32_t weightxy = x_diff * y_diff;
-
-                for (uint_fast8_t component=0; component<num_components; component++) {
-                    out_line[scaled_x + component] = blerp_pixel (row, next_row, x_index+component, next_x_index+component, weight, weightx, weighty, weightxy) >> 16;
-                }
-            }
-
-            jpeg_write_scanlines (&cinfo_out, &out_row, 1);
-        }
-#else
-        /* Bicubic interpolation to improve the scaled image quality */
-        JSAMPLE scanline0[row_components];
-        JSAMPLE scanline1[row_components];
-        JSAMPLE scanline2[row_components];
-        JSAMPLE scanline3[row_components];
-        JSAMPROW row0 = scanline0;
-        JSAMPROW row1 = scanline1;
-        JSAMPROW row2 = scanline2;
-        JSAMPROW row3 = scanline3;
-        jpeg_read_scanlines (&cinfo, &row1, 1);
-        memcpy (row2, row1, row_components*sizeof (JSAMPLE));
-
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            float dy = y_interp - (int_fast32_t)y_interp;
-            float dy2 = dy * dy;
-            float dy3 = dy2 * dy;
-
-            if (cinfo.output_scanline < y+3) {
-                while (cinfo.output_scanline < y) {
-                    jpeg_read_scanlines (&cinfo, &row1, 1);
-                }
-                memcpy (row0, row1, row_components*sizeof (JSAMPLE));
-                if (cinfo.output_scanline < y+1) {
-                    jpeg_read_scanlines (&cinfo, &row2, 1);
-                }
-                memcpy (row1, row2, row_components*sizeof (JSAMPLE));
-                if (y+2 < height && cinfo.output_scanline < y+2) {
-                    jpeg_read_scanlines (&cinfo, &row3, 1);
-                }
-                memcpy (row2, row3, row_components*sizeof (JSAMPLE));
-                if (y+3 < height) {
-                    jpeg_read_scanlines (&cinfo, &row3, 1);
-                }
-            }
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x1 = x * num_components;
-                const uint_fast32_t x0 = x > 0 ? x1-num_components : x1;
-                const uint_fast32_t x2 = x+1 < width ? x1+num_components : x1;
-                const uint_fast32_t x3 = x+2 < width ? x2+num_components : x2;
-
-                float dx = x_interp - (int_fast32_t)x_interp;
-                float dx2 = dx * dx;
-                float dx3 = dx2 * dx;
-
-                for (uint_fast8_t component=0; component<num_components; component++) {
-                    const int_fast16_t pixel = bcerp (row0, row1, row2, row3, x0, x1, x2, x3, component, dx, dx2, dx3, dy, dy2, dy3);
-                    out_row[scaled_x + component] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
-                }
-            }
-
-            jpeg_write_scanlines (&cinfo_out, &out_row, 1);
-        }
-#endif
-    }
-
-    jpeg_finish_compress (&cinfo_out);
-
-    jpeg_destroy_compress (&cinfo_out);
-    jpeg_destroy_decompress (&cinfo);
-
-    fclose (fp);
-    fclose (out);
-
-    return 0;
-}
-
-static int
-png_resize (const char *fname, const char *outname, int scaled_size) {
-    png_structp png_ptr = NULL, new_png_ptr = NULL;
-    png_infop info_ptr = NULL, new_info_ptr = NULL;
-    png_uint_32 height, width;
-    int bit_depth, color_type;
-    int err = -1;
-    FILE *fp = NULL;
-    FILE *out = NULL;
-    png_byte *out_row = NULL;
-    uint_fast32_t *quick_dividers = NULL;
-
-    fp = fopen (fname, "rb");
-    if (!fp) {
-        trace ("failed to open %s for reading\n", fname);
-        goto error;
-    }
-
-    png_ptr = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png_ptr) {
-        trace ("failed to create PNG read struct\n");
-        goto error;
-    }
-
-    if (setjmp (png_jmpbuf ((png_ptr))))
-    {
-        trace ("failed to read %s as png\n", fname);
-        goto error;
-    }
-
-    png_init_io (png_ptr, fp);
-
-    info_ptr = png_create_info_struct (png_ptr);
-    if (!info_ptr) {
-        trace ("failed to create PNG info struct\n");
-        goto error;
-    }
-
-    png_read_png (png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16|PNG_TRANSFORM_PACKING|PNG_TRANSFORM_EXPAND, NULL);
-    png_bytep *row_pointers = png_get_rows (png_ptr, info_ptr);
-    png_get_IHDR (png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
-
-    unsigned int scaled_width, scaled_height;
-    float scaling_ratio = scale_dimensions (scaled_size, width, height, &scaled_width, &scaled_height);
-    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_width > 32767) {
-        trace ("scaling ratio (%g) or scaled image dimensions (%ux%u) are invalid\n", scaling_ratio, scaled_width, scaled_height);
-        goto error;
-    }
-
-    out = fopen (outname, "w+b");
-    if (!out) {
-        trace ("failed to open %s for writing\n", outname);
-        goto error;
-    }
-
-    new_png_ptr = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!new_png_ptr) {
-        trace ("failed to create png write struct\n");
-        goto error;
-    }
-
-    if (setjmp (png_jmpbuf ((new_png_ptr))))
-    {
-        trace ("failed to write %s as png\n", outname);
-        goto error;
-    }
-
-    png_init_io (new_png_ptr, out);
-
-    new_info_ptr = png_create_info_struct (new_png_ptr);
-    if (!new_info_ptr) {
-        trace ("failed to create png info struct for writing\n");
-        goto error;
-    }
-
-    png_set_IHDR (new_png_ptr, new_info_ptr, scaled_width, scaled_height, bit_depth, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-    png_write_info (new_png_ptr, new_info_ptr);
-    png_set_packing (new_png_ptr);
-
-    const uint8_t has_alpha = color_type & PNG_COLOR_MASK_ALPHA;
-    const uint8_t num_values = color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA ? 1 : 3;
-    const uint8_t num_components = num_values + (has_alpha ? 1 : 0);
-    const uint_fast32_t scaled_row_components = scaled_width * num_components;
-    out_row = malloc (scaled_row_components * sizeof (png_byte));
-    if (!out_row) {
-        goto error;
-    }
-
-    if (scaling_ratio > 2) {
-        /* Simple (unweighted) area sampling for large downscales */
-        quick_dividers = calculate_quick_dividers (scaling_ratio);
-        if (!quick_dividers) {
-            goto error;
-        }
-
-        /* Loop through all (down-)scaled pixels */
-        float y_interp = 0.5;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++) {
-            const uint_fast32_t y = y_interp;
-            const uint_fast32_t y_limit = y_interp += scaling_ratio;
-            const uint_fast16_t num_y_pixels = (y_limit < height ? y_limit : height) - y;
-            png_byte *rows[num_y_pixels];
-            for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                rows[row_index] = row_pointers[y+row_index];
-            }
-
-            float x_interp = 0.5;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components) {
-                const uint_fast32_t x = x_interp;
-                x_interp += scaling_ratio;
-                const uint_fast32_t x_limit = x_interp < width ? x_interp : width;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t x_limit_index = x_limit * num_components;
-                const uint_fast32_t num_pixels = num_y_pixels * (x_limit - x);
-
-                /* Sum all values where the scaled pixel overlaps at least half an original pixel in each direction */
-                const uint_fast32_t quick_divider = quick_dividers[num_pixels];
-                if (has_alpha) {
-                    /* Alpha weight possible transparent pixels */
-                    uint_fast32_t greyred_value = 0;
-                    uint_fast32_t green_value = 0;
-                    uint_fast32_t blue_value = 0;
-                    uint_fast32_t alpha_value = 0;
-                    for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                        const png_byte *start = rows[row_index] + x_index;
-                        png_byte *ptr = rows[row_index] + x_limit_index;
-                        do {
-                            const png_byte alpha = *--ptr;
-                            alpha_value += alpha;
-                            if (num_values == 3) {
-                                blue_value += *--ptr * alpha;
-                                green_value += *--ptr * alpha;
-                            }
-                            greyred_value += *--ptr * alpha;
-                        } while (ptr > start);
-                    }
-                    if (alpha_value < num_pixels) {
-                        for (uint_fast8_t component = 0; component < num_components; component++) {
-                            out_row[scaled_x+component] = 0;
-                        }
-                    }
-                    else {
-                        out_row[scaled_x+num_values] = alpha_value > 254*num_pixels ? 255 : quick_divider ? alpha_value*quick_divider>>16 : alpha_value/num_pixels;
-                        if (quick_divider && out_row[scaled_x+num_values] == 255) {
-                            out_row[scaled_x] = greyred_value * quick_divider >> 24;
-                            if (num_values == 3) {
-                                out_row[scaled_x+1] = green_value * quick_divider >> 24;
-                                out_row[scaled_x+2] = blue_value * quick_divider >> 24;
-                            }
-                        }
-                        else {
-                            out_row[scaled_x] = greyred_value / alpha_value;
-                            if (num_values == 3) {
-                                out_row[scaled_x+1] = green_value / alpha_value;
-                                out_row[scaled_x+2] = blue_value / alpha_value;
-                            }
-                        }
-                    }
-                }
-                else if (num_values == 3) {
-                    /* For opaque RGB pixels, use a simple average on each colour component */
-                    uint_fast32_t red_value = 0;
-                    uint_fast32_t green_value = 0;
-                    uint_fast32_t blue_value = 0;
-                    for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                        const png_byte *start = rows[row_index] + x_index;
-                        png_byte *ptr = rows[row_index] + x_limit_index;
-                        do {
-                            blue_value += *--ptr;
-                            green_value += *--ptr;
-                            red_value += *--ptr;
-                        } while (ptr > start);
-
-                    }
-                    out_row[scaled_x] = quick_divider ? red_value * quick_divider >> 16 : red_value / num_pixels;
-                    out_row[scaled_x+1] = quick_divider ? green_value * quick_divider >> 16 : green_value / num_pixels;
-                    out_row[scaled_x+2] = quick_divider ? blue_value * quick_divider >> 16 : blue_value / num_pixels;
-                }
-                else {
-                    /* For opaque grey pixels, use a simple average of the values */
-                    uint_fast32_t grey_value = 0;
-                    for (uint_fast16_t row_index = 0; row_index < num_y_pixels; row_index++) {
-                        for (uint_fast32_t pixel_index = x_index; pixel_index < x_limit_index; pixel_index++) {
-                            grey_value += rows[row_index][pixel_index];
-                        }
-                    }
-                    out_row[scaled_x] = quick_divider ? grey_value * quick_divider >> 16 : grey_value / num_pixels;
-                }
-            }
-
-            png_write_row (new_png_ptr, out_row);
-        }
-    }
-    else {
-#ifndef USE_BICUBIC
-        /* Bilinear interpolation for upscales and modest downscales */
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        uint_fast32_t scaled_alpha = 255 << 16;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            const png_byte *row = row_pointers[y];
-            const png_byte *next_row = y+1 < height ? row_pointers[y+1] : row;
-
-            const uint_fast16_t y_diff = (uint_fast32_t)(y_interp*256) - (y<<8);
-            const uint_fast16_t y_remn = 256 - y_diff;
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x_index = x * num_components;
-                const uint_fast32_t next_x_index = x < width ? x_index+num_components : x_index;
-
-                const uint_fast16_t x_diff = (uint_fast32_t)(x_interp*256) - (x<<8);
-                const uint_fast16_t x_remn = 256 - x_diff;
-                const uint_fast32_t weight = x_remn * y_remn;
-                const uint_fast32_t weightx = x_diff * y_remn;
-                const uint_fast32_t weighty = x_remn * y_diff;
-                const uint_fast32_t weightxy = x_diff * y_diff;
-
-                uint_fast32_t alpha, alphax, alphay, alphaxy;
-                if (has_alpha) {
-                    /* Interpolate alpha channel and weight pixels by their alpha */
-                    alpha = weight * row[x_index + num_values];
-                    alphax = weightx * row[next_x_index + num_values];
-                    alphay = weighty * next_row[x_index + num_values];
-                    alphaxy = weightxy * next_row[next_x_index + num_values];
-                    scaled_alpha = alpha + alphax + alphay + alphaxy;
-                    out_row[scaled_x + num_values] = scaled_alpha >> 16;
-                }
-
-                if (scaled_alpha == 255 << 16) {
-                    /* Simplified calculation for fully opaque pixels */
-                    for (uint_fast8_t component=0; component<num_values; component++) {
-                        out_row[scaled_x + component] = blerp_pixel (row, next_row, x_index+component, next_x_index+component, weight, weightx, weighty, weightxy) >> 16;
-                    }
-                }
-                else if (scaled_alpha == 0) {
-                    /* For speed, don't preserve the values of fully transparent pixels */
-                    for (uint_fast8_t component=0; component<num_values; component++) {
-                        out_row[scaled_x + component] = 0;
-                    }
-                }
-                else {
-                    /* Alpha-weight partially transparent pixels to avoid background colour bleeding */
-                    for (uint_fast8_t component=0; component<num_values; component++) {
-                        out_row[scaled_x + component] = blerp_pixel (row, next_row, x_index+component, next_x_index+component, alpha, alphax, alphay, alphaxy) / scaled_alpha;
-                    }
-                }
-            }
-
-            png_write_row (new_png_ptr, out_row);
-        }
-#else
-        /* Bicubic interpolation to improve the scaled image quality */
-        if (has_alpha) {
-            for (uint_fast16_t y = 0; y < height; y++) {
-                png_byte *row = row_pointers[y];
-                for (uint_fast16_t x_index = 0; x_index < width*4; x_index+=4) {
-                    const png_byte alpha = row[x_index + 3];
-                    if (alpha < 255) {
-                        for (uint_fast8_t component=0; component<3; component++) {
-                            row[x_index + component] = row[x_index + component]*alpha >> 8;
-                        }
-                    }
-                }
-            }
-        }
-
-        float downscale_offset = scaling_ratio < 1 ? 0 : (scaling_ratio - 1) / 2;
-        int_fast16_t scaled_alpha = 255;
-        float y_interp = downscale_offset;
-        for (uint_fast16_t scaled_y = 0; scaled_y < scaled_height; scaled_y++, y_interp+=scaling_ratio) {
-            const uint_fast32_t y = y_interp;
-            const png_byte *row1 = row_pointers[y];
-            const png_byte *row0 = y > 0 ? row_pointers[y-1] : row1;
-            const png_byte *row2 = y+1 < height ? row_pointers[y+1] : row1;
-            const png_byte *row3 = y+2 < height ? row_pointers[y+2] : row2;
-
-            float dy = y_interp - (int_fast32_t)y_interp;
-            float dy2 = dy * dy;
-            float dy3 = dy2 * dy;
-
-            float x_interp = downscale_offset;
-            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components, x_interp+=scaling_ratio) {
-                const uint_fast32_t x = x_interp;
-                const uint_fast32_t x1 = x * num_components;
-                const uint_fast32_t x0 = x > 0 ? x1-num_components : x1;
-                const uint_fast32_t x2 = x+1 < width ? x1+num_components : x1;
-                const uint_fast32_t x3 = x+2 < width ? x2+num_components : x2;
-
-                float dx = x_interp - (int_fast32_t)x_interp;
-                float dx2 = dx * dx;
-                float dx3 = dx2 * dx;
-
-                if (has_alpha) {
-                    scaled_alpha = bcerp (row0, row1, row2, row3, x0, x1, x2, x3, 3, dx, dx2, dx3, dy, dy2, dy3);
-                    out_row[scaled_x + 3] = scaled_alpha < 0 ? 0 : scaled_alpha > 255 ? 255 : scaled_alpha;
-                }
-
-                if (scaled_alpha == 255) {
-                    for (uint_fast8_t component=0; component<3; component++) {
-                        const int_fast16_t pixel = bcerp (row0, row1, row2, row3, x0, x1, x2, x3, component, dx, dx2, dx3, dy, dy2, dy3);
-                        out_row[scaled_x + component] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
-                    }
-                }
-                else if (scaled_alpha == 0) {
-                    for (uint_fast8_t component=0; component<3; component++) {
-                        out_row[scaled_x + component] = 0;
-                    }
-                }
-                else {
-                    for (uint_fast8_t component=0; component<3; component++) {
-                        const int_fast16_t pixel = (bcerp (row0, row1, row2, row3, x0, x1, x2, x3, component, dx, dx2, dx3, dy, dy2, dy3)<<8) / scaled_alpha;
-                        out_row[scaled_x + component] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
-                    }
-                }
-            }
-
-            png_write_row (new_png_ptr, out_row);
-        }
-#endif
-    }
-
-    png_write_end (new_png_ptr, new_info_ptr);
-
-    err = 0;
-error:
-    if (out) {
-        fclose (out);
-    }
-    if (fp) {
-        fclose (fp);
-    }
-    if (png_ptr) {
-        png_destroy_read_struct (&png_ptr, &info_ptr, NULL);
-    }
-    if (new_png_ptr) {
-        png_destroy_write_struct (&new_png_ptr, &new_info_ptr);
-    }
-    if (out_row) {
-        free (out_row);
-    }
-    if (quick_dividers) {
-        free (quick_dividers);
-    }
-
-    return err;
-}
-
-#endif
-
-#ifdef USE_IMLIB2
-static int
-imlib_resize (const char *in, const char *out, int img_size)
-{
-    Imlib_Image img = imlib_load_image_immediately (in);
-    if (!img) {
-        trace ("file %s not found, or imlib2 can't load it\n", in);
-        return -1;
-    }
-    imlib_context_set_image (img);
-
-    int w = imlib_image_get_width ();
-    int h = imlib_image_get_height ();
-    int sw, sh;
-    scale_dimensions (img_size, w, h, &sw, &sh);
-    if (sw < 1 || sw > 32767 || sh < 1 || sh > 32767) {
-        trace ("%d/%d scaled image is too large\n", sw, sh);
-        imlib_free_image ();
-        return -1;
-    }
-
-    int is_jpeg = imlib_image_format () && imlib_image_format ()[0] == 'j';
-    Imlib_Image scaled = imlib_create_cropped_scaled_image (0, 0, w, h, sw, sh);
-    if (!scaled) {
-        trace ("imlib2 can't create scaled image from %s\n", in);
-        imlib_free_image ();
-        return -1;
-    }
-    imlib_context_set_image (scaled);
-
-    imlib_image_set_format (is_jpeg ? "jpg" : "png");
-    if (is_jpeg)
-        imlib_image_attach_data_value ("quality", NULL, 95, NULL);
-    Imlib_Load_Error err = 0;
-    imlib_save_image_with_error_return (out, &err);
-    if (err != 0) {
-        trace ("imlib save %s returned %d\n", out, err);
-        imlib_free_image ();
-        imlib_context_set_image (img);
-        imlib_free_image ();
-        return -1;
-    }
-
-    imlib_free_image ();
-    imlib_context_set_image (img);
-    imlib_free_image ();
-    return 0;
-}
-#endif
-
 static int
 scale_file (const char *in, const char *out, int img_size)
 {
@@ -854,23 +137,7 @@ scale_file (const char *in, const char *out, int img_size)
         return -1;
     }
 
-    cache_lock ();
-#ifdef USE_IMLIB2
-    int imlib_err = imlib_resize (in, out, img_size);
-    cache_unlock ();
-    return imlib_err;
-#else
-    int err = jpeg_resize (in, out, img_size);
-    if (err != 0) {
-        unlink (out);
-        err = png_resize (in, out, img_size);
-        if (err != 0) {
-            unlink (out);
-        }
-    }
-    cache_unlock ();
-    return err;
-#endif
+    return scale_image (in, out, img_size, scale_towards_longer);
 }
 
 static char
@@ -1069,31 +336,141 @@ strings_match (const char *s1, const char *s2)
     return s1 == s2 || s1 && s2 && !strcasecmp (s1, s2);
 }
 
+static unsigned int
+query_hash_key (const char *artist, const char *album)
+{
+    /* Case-insensitive, like strings_match, and the same for all sizes of an album */
+    unsigned int h = 5381;
+    for (const char *s = artist ? artist : ""; *s; s++) {
+        h = h * 33 + tolower ((unsigned char)*s);
+    }
+    h = h * 33 + '/';
+    for (const char *s = album ? album : ""; *s; s++) {
+        h = h * 33 + tolower ((unsigned char)*s);
+    }
+    return h & (QUERY_HASH_SIZE-1);
+}
+
+static cover_query_t *
+find_query (const char *artist, const char *album, const int img_size)
+{
+    for (cover_query_t *q = query_hash[query_hash_key (artist, album)]; q; q = q->hash_next) {
+        if (q->size == img_size && strings_match (artist, q->artist) && strings_match (album, q->album)) {
+            return q;
+        }
+    }
+    return NULL;
+}
+
+static void
+hash_remove (cover_query_t *query)
+{
+    cover_query_t **q = &query_hash[query_hash_key (query->artist, query->album)];
+    while (*q && *q != query) {
+        q = &(*q)->hash_next;
+    }
+    if (*q) {
+        *q = query->hash_next;
+    }
+}
+
 static void
-enqueue_query (const char *fname, const char *artist, const char *album, int img_size, const artwork_callback cb, void *ud)
+queue_push (cover_query_t *query)
+{
+    query->prev = NULL;
+    query->next = queue[query->priority];
+    if (query->next) {
+        query->next->prev = query;
+    }
+    queue[query->priority] = query;
+}
+
+static void
+queue_unlink (cover_query_t *query)
+{
+    if (query->prev) {
+        query->prev->next = query->next;
+    }
+    else {
+        queue[query->priority] = query->next;
+    }
+    if (query->next) {
+        query->next->prev = query->prev;
+    }
+    query->prev = query->next = NULL;
+}
+
+static int
+unscaled_pending (const cover_query_t *query)
+{
+    /* A scaled query has to wait until the unscaled image is made */
+    return query->size != -1 && find_query (query->artist, query->album, -1);
+}
+
+static int
+scaled_waiting (const cover_query_t *query)
 {
-    for (cover_query_t *q = queue; q; q = q->next) {
-        if (strings_match (artist, q->artist) && strings_match (album, q->album) && q->size == img_size) {
-            trace ("artwork queue: %s %s %s %d already in queue - add to callbacks\n", fname, artist, album, img_size);
-            cover_callback_t **last_callback = &q->callback;
-            while (*last_callback && (*last_callback)->cb != cache_reset_callback) {
-                last_callback = & (*last_callback)->next;
+    for (cover_query_t *q = query_hash[query_hash_key (query->artist, query->album)]; q; q = q->hash_next) {
+        if (q->size != -1 && !q->running && strings_match (query->artist, q->artist) && strings_match (query->album, q->album)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static cover_query_t *
+next_query (void)
+{
+    for (int p = NUM_PRIORITIES-1; p >= 0; p--) {
+        for (cover_query_t *q = queue[p]; q; q = q->next) {
+            if (!unscaled_pending (q)) {
+                return q;
             }
-            if (!*last_callback) {
-                *last_callback = new_query_callback (cb, ud);
-                return;
+        }
+    }
+    return NULL;
+}
+
+static void
+enqueue_query (const char *fname, const char *artist, const char *album, int img_size, int priority, const artwork_callback cb, void *ud)
+{
+    if (priority < 0) {
+        priority = 0;
+    }
+    else if (priority >= NUM_PRIORITIES) {
+        priority = NUM_PRIORITIES-1;
+    }
+
+    /* The result of a query started before a cache reset will be obsolete */
+    cover_query_t *q = find_query (artist, album, img_size);
+    if (q && !(q->running && pending_reset)) {
+        trace ("artwork queue: %s %s %s %d already in queue - add to callbacks\n", fname, artist, album, img_size);
+        cover_callback_t **last_callback = &q->callback;
+        while (*last_callback) {
+            last_callback = &(*last_callback)->next;
+        }
+        *last_callback = new_query_callback (cb, ud);
+
+        /* The newest request wins */
+        if (!q->running) {
+            queue_unlink (q);
+            if (priority > q->priority) {
+                q->priority = priority;
             }
+            queue_push (q);
         }
+        return;
     }
 
     trace ("artwork queue: enqueue_query %s %s %s %d\n", fname, artist, album, img_size);
-    cover_query_t *q = malloc (sizeof (cover_query_t));
+    q = malloc (sizeof (cover_query_t));
     if (q) {
         q->fname = fname && *fname ? strdup (fname) : NULL;
         q->artist = artist ? strdup (artist) : NULL;
         q->album = album ? strdup (album) : NULL;
         q->size = img_size;
-        q->next = NULL;
+        q->priority = priority;
+        q->running = 0;
         q->callback = new_query_callback (cb, ud);
 
         if (fname && !q->fname || artist && !q->artist || album && !q->album) {
@@ -1109,17 +486,17 @@ enqueue_query (const char *fname, const char *artist, const char *album, int img
         return;
     }
 
-    if (queue_tail) {
-        queue_tail->next = q;
-    }
-    else {
-        queue = q;
-    }
-    queue_tail = q;
+    /* Ahead of any running query with the same key */
+    const unsigned int key = query_hash_key (artist, album);
+    q->hash_next = query_hash[key];
+    query_hash[key] = q;
+    queue_push (q);
     deadbeef->cond_signal (queue_cond);
 }
 
+/* scandir filters have no user data, so the workers take turns with the mask */
 static char *filter_custom_mask = NULL;
+static uintptr_t filter_mutex;
 
 static int
 filter_custom (const struct dirent *f)
@@ -1171,13 +548,18 @@ dir_scan_results (struct dirent **files, int files_count, const char *container)
 static int
 scan_local_path (char *mask, const char *cache_path, const char *local_path, const char *uri, DB_vfs_t *vfsplug)
 {
-    filter_custom_mask = mask;
     struct dirent **files;
     int (* custom_scandir)(const char *, struct dirent ***, int (*)(const struct dirent *), int (*)(const struct dirent **, const struct dirent **));
     custom_scandir = vfsplug ? vfsplug->scandir : scandir;
+    deadbeef->mutex_lock (filter_mutex);
+    filter_custom_mask = mask;
     int files_count = custom_scandir (local_path, &files, filter_custom, NULL);
+    char *artwork_path = files_count > 0 && uri ? vfs_scan_results (files[0], uri) : NULL;
+    deadbeef->mutex_unlock (filter_mutex);
     if (files_count > 0) {
-        char *artwork_path = uri ? vfs_scan_results (files[0], uri) : dir_scan_results (files, files_count, local_path);
+        if (!uri) {
+            artwork_path = dir_scan_results (files, files_count, local_path);
+        }
 
         for (size_t i = 0; i < files_count; i++) {
             free (files[i]);
@@ -1542,23 +924,92 @@ web_lookups (const char *artist, const char *album, const char *cache_path)
     return -1;
 }
 
+static int
+find_image (const char *cache_path, uint64_t *hash)
+{
+    time_t checked;
+    if (cache_get_mapping (cache_path, hash, &checked)) {
+        trace ("artwork: %s not in cache\n", cache_path);
+        return 0;
+    }
+
+    deadbeef->mutex_lock (queue_mutex);
+    const time_t reset_time = *hash ? cache_reset_time : max (cache_reset_time, default_reset_time);
+    deadbeef->mutex_unlock (queue_mutex);
+    if (checked <= reset_time) {
+        trace ("artwork: deleting %s after reset\n", cache_path);
+        cache_remove_mapping (cache_path);
+        *hash = 0;
+        return 0;
+    }
+
+    return *hash != 0;
+}
+
+static int
+find_scaled_image (const uint64_t hash, const int img_size, char *scaled_path, const size_t size)
+{
+    time_t created;
+    if (cache_scaled_path (scaled_path, size, hash, img_size) || cache_get_scaled (hash, img_size, &created)) {
+        return 0;
+    }
+
+    deadbeef->mutex_lock (queue_mutex);
+    const time_t reset_time = scaled_cache_reset_time;
+    deadbeef->mutex_unlock (queue_mutex);
+    if (created <= reset_time) {
+        trace ("artwork: deleting %s after reset\n", scaled_path);
+        cache_remove_scaled (hash, img_size);
+        return 0;
+    }
+
+    return 1;
+}
+
 static int
 process_scaled_query (const cover_query_t *query)
 {
     char unscaled_path[PATH_MAX];
     make_cache_path2 (unscaled_path, sizeof (unscaled_path), query->fname, query->album, query->artist, -1);
+    uint64_t hash;
+    if (!find_image (unscaled_path, &hash)) {
+        return 0;
+    }
 
-    struct stat stat_buf;
-    if (!stat (unscaled_path, &stat_buf) && S_ISREG (stat_buf.st_mode) && stat_buf.st_size > 0) {
-        char scaled_path[PATH_MAX];
-        make_cache_path2 (scaled_path, sizeof (scaled_path), query->fname, query->album, query->artist, query->size);
-        trace ("artwork: scaling %s into %s (%d pixels)\n", unscaled_path, scaled_path, query->size);
-        if (*scaled_path && !scale_file (unscaled_path, scaled_path, query->size)) {
-            return 1;
-        }
+    /* Albums sharing the same image share the scaled copies too */
+    char scaled_path[PATH_MAX];
+    if (find_scaled_image (hash, query->size, scaled_path, sizeof (scaled_path))) {
+        return 1;
     }
 
-    return 0;
+    /* Scale without holding the cache lock, so that the fetchers can scale in parallel */
+    char tmp_path[PATH_MAX];
+    if (snprintf (tmp_path, sizeof (tmp_path), "%s.XXXXXX", scaled_path) >= sizeof (tmp_path) || !ensure_dir (tmp_path)) {
+        return 0;
+    }
+    const int fd = mkstemp (tmp_path);
+    if (fd < 0) {
+        return 0;
+    }
+    close (fd);
+    trace ("artwork: scaling %s into %s (%d pixels)\n", unscaled_path, scaled_path, query->size);
+    if (scale_file (unscaled_path, tmp_path, query->size)) {
+        unlink (tmp_path);
+        return 0;
+    }
+
+    /* Another fetcher might have scaled the same image meanwhile */
+    cache_lock ();
+    int res = find_scaled_image (hash, query->size, scaled_path, sizeof (scaled_path));
+    if (res) {
+        unlink (tmp_path);
+    }
+    else {
+        res = !cache_add_scaled (tmp_path, hash, query->size);
+    }
+    cache_unlock ();
+
+    return res;
 }
 
 static char *
@@ -1622,22 +1073,15 @@ recheck_missing_artwork (char *fname, const time_t placeholder_mtime)
 }
 
 static int
-process_query (const cover_query_t *query)
+fetch_image (const cover_query_t *query, const char *cache_path)
 {
-    if (!query->fname) {
-        return 0;
-    }
-
-    char cache_path[PATH_MAX];
-    make_cache_path2 (cache_path, sizeof (cache_path), query->fname, query->album, query->artist, -1);
-    trace ("artwork: query cover for %s %s to %s\n", query->album, query->artist, cache_path);
-
     /* Flood control, don't retry missing artwork for an hour unless something changes */
-    struct stat placeholder_stat;
-    if (!stat (cache_path, &placeholder_stat) && placeholder_stat.st_mtime + 60*60 > time (NULL)) {
+    uint64_t hash;
+    time_t checked;
+    if (!cache_get_mapping (cache_path, &hash, &checked) && checked + 60*60 > time (NULL)) {
         char *fname_copy = strdup (query->fname);
         if (fname_copy) {
-            int recheck = recheck_missing_artwork (fname_copy, placeholder_stat.st_mtime);
+            int recheck = recheck_missing_artwork (fname_copy, checked);
             free (fname_copy);
             if (!recheck) {
                 return 0;
@@ -1707,13 +1151,14 @@ process_query (const cover_query_t *query)
     }
 
     if (query->album) {
-        /* Try stripping parenthesised text off the end of the album name */
-        char *p = strpbrk (query->album, "([");
+        /* Try stripping parenthesised text off the end of the album name,
+           on a copy as other threads can look at the query meanwhile */
+        char album[strlen (query->album)+1];
+        strcpy (album, query->album);
+        char *p = strpbrk (album, "([");
         if (p) {
-            char parenthesis = *p;
             *p = '\0';
-            int res = web_lookups (query->artist, query->album, cache_path);
-            *p = '(';
+            int res = web_lookups (query->artist, album, cache_path);
             if (res >= 0) {
                 return res;
             }
@@ -1721,9 +1166,42 @@ process_query (const cover_query_t *query)
     }
 #endif
 
-    /* Touch placeholder */
-    write_file (cache_path, NULL, 0);
+    return -1;
+}
+
+static int
+process_query (const cover_query_t *query)
+{
+    if (!query->fname) {
+        return 0;
+    }
+
+    char cache_path[PATH_MAX];
+    make_cache_path2 (cache_path, sizeof (cache_path), query->fname, query->album, query->artist, -1);
+    trace ("artwork: query cover for %s %s to %s\n", query->album, query->artist, cache_path);
 
+    /* Another query might have got there first */
+    uint64_t hash;
+    time_t checked;
+    if (find_image (cache_path, &hash)) {
+        return 1;
+    }
+
+    /* Adopt artwork cached by older versions */
+    struct stat stat_buf;
+    if (cache_get_mapping (cache_path, &hash, &checked) && !stat (cache_path, &stat_buf) &&
+        S_ISREG (stat_buf.st_mode) && stat_buf.st_size > 0 && stat_buf.st_mtime > cache_reset_time && !cache_store (cache_path)) {
+        return 1;
+    }
+
+    int res = fetch_image (query, cache_path);
+    if (res > 0) {
+        return !cache_store (cache_path);
+    }
+    if (res < 0) {
+        /* Touch placeholder */
+        cache_store_placeholder (cache_path);
+    }
     return 0;
 }
 
@@ -1738,35 +1216,31 @@ send_query_callbacks (cover_callback_t *callback, const char *fname, const char
     }
 }
 
-static cover_query_t *
-dequeue_query (void)
+static void
+remove_query (cover_query_t *query)
 {
-    cover_query_t *query = queue;
-    queue = queue->next;
-    if (!queue) {
-        queue_tail = NULL;
-    }
-    return query;
+    queue_unlink (query);
+    hash_remove (query);
 }
 
 static void
 queue_clear (void)
 {
-    /* Remove everything except the first query */
-    if (queue) {
-        while (queue->next) {
-            cover_query_t *query = queue->next;
-            queue->next = query->next;
+    /* Remove everything except the running queries */
+    for (int p = 0; p < NUM_PRIORITIES; p++) {
+        while (queue[p]) {
+            cover_query_t *query = queue[p];
+            remove_query (query);
             send_query_callbacks (query->callback, NULL, NULL, NULL);
             clear_query (query);
         }
-        queue_tail = queue;
     }
 }
 
 static void
-fetcher_thread (void *none)
+fetcher_thread (void *ctx)
 {
+    const int slot = (intptr_t)ctx;
 #ifdef __linux__
     prctl (PR_SET_NAME, "deadbeef-artwork", 0, 0, 0, 0);
 #endif
@@ -1774,102 +1248,147 @@ fetcher_thread (void *none)
     /* Loop until external terminate command */
     deadbeef->mutex_lock (queue_mutex);
     while (!terminate) {
-        trace ("artwork fetcher: waiting for signal ...\n");
-        pthread_cond_wait ((pthread_cond_t *)queue_cond, (pthread_mutex_t *)queue_mutex);
-        trace ("artwork fetcher: cond signalled, process queue\n");
-
-        /* Loop until queue is empty */
-        while (queue) {
+        /* A cache reset waits for the running queries and holds back the queued ones */
+        if (pending_reset && !num_running) {
+            void *reset = pending_reset;
+            pending_reset = NULL;
             deadbeef->mutex_unlock (queue_mutex);
-
-            /* Process this query, hopefully writing a file into cache */
-            int cached_art = queue->size == -1 ? process_query (queue) : process_scaled_query (queue);
+            cache_reset_callback (NULL, NULL, NULL, reset);
             deadbeef->mutex_lock (queue_mutex);
-            cover_query_t *query = dequeue_query ();
-            deadbeef->mutex_unlock (queue_mutex);
+            deadbeef->cond_broadcast (queue_cond);
+            continue;
+        }
 
-            /* Make all the callbacks (and free the chain), with data if a file was written */
-            if (cached_art) {
-                trace ("artwork fetcher: cover art file cached\n");
-                send_query_callbacks (query->callback, query->fname, query->artist, query->album);
-            }
-            else {
-                trace ("artwork fetcher: no cover art found\n");
-                send_query_callbacks (query->callback, NULL, NULL, NULL);
-            }
-            clear_query (query);
+        cover_query_t *query = pending_reset ? NULL : next_query ();
+        if (!query) {
+            trace ("artwork fetcher: waiting for signal ...\n");
+            pthread_cond_wait ((pthread_cond_t *)queue_cond, (pthread_mutex_t *)queue_mutex);
+            continue;
+        }
 
-            /* Look for what to do next */
-            deadbeef->mutex_lock (queue_mutex);
+        queue_unlink (query);
+        query->running = 1;
+        running_queries[slot] = query;
+        num_running++;
+        deadbeef->mutex_unlock (queue_mutex);
+
+        /* Process this query, hopefully writing a file into cache */
+        int cached_art = query->size == -1 ? process_query (query) : process_scaled_query (query);
+
+        deadbeef->mutex_lock (queue_mutex);
+        hash_remove (query);
+        running_queries[slot] = NULL;
+        num_running--;
+        cover_callback_t *callback = query->callback;
+        query->callback = NULL;
+        if (query->size == -1 || pending_reset) {
+            /* Scaled queries for this album, or a reset, might be waiting */
+            deadbeef->cond_broadcast (queue_cond);
+        }
+        deadbeef->mutex_unlock (queue_mutex);
+
+        /* Make all the callbacks (and free the chain), with data if a file was written */
+        if (cached_art) {
+            trace ("artwork fetcher: cover art file cached\n");
+            send_query_callbacks (callback, query->fname, query->artist, query->album);
         }
+        else {
+            trace ("artwork fetcher: no cover art found\n");
+            send_query_callbacks (callback, NULL, NULL, NULL);
+        }
+        clear_query (query);
+
+        deadbeef->mutex_lock (queue_mutex);
     }
     deadbeef->mutex_unlock (queue_mutex);
     trace ("artwork fetcher: terminate thread\n");
 }
 
-static int
-check_file_age (const char *path, const time_t mtime, const time_t reset_time)
-{
-    if (mtime <= reset_time) {
-        trace ("artwork: deleting cached file %s after reset\n", path);
-        unlink (path);
-        return 0;
-    }
-
-    return 1;
-}
-
-static const char *
-find_image (const char *path, const time_t reset_time)
+static char *
+get_album_art2 (const char *fname, const char *artist, const char *album, int size, int priority, artwork_callback callback, void *user_data)
 {
-    struct stat stat_buf;
-    if (stat (path, &stat_buf) || !S_ISREG (stat_buf.st_mode)) {
-        trace ("artwork: %s not found or not regular file\n", path);
-        return NULL;
+    /* Check if the image is already cached, the index is in memory */
+    char cache_path[PATH_MAX];
+    make_cache_path2 (cache_path, sizeof (cache_path), fname, album, artist, -1);
+    uint64_t hash;
+    const int cached = find_image (cache_path, &hash);
+    if (cached && size == -1) {
+        trace ("Found cached image %s\n", cache_path);
+        return strdup (cache_path);
     }
-
-    if (stat_buf.st_size == 0 && !check_file_age (path, stat_buf.st_mtime, default_reset_time)) {
-        trace ("artwork: %s invalidated after default artwork reset\n", path);
-        return NULL;
+    char scaled_path[PATH_MAX];
+    if (cached && find_scaled_image (hash, size, scaled_path, sizeof (scaled_path))) {
+        trace ("Found cached image %s\n", scaled_path);
+        return strdup (scaled_path);
     }
 
-    if (!check_file_age (path, stat_buf.st_mtime, reset_time) || stat_buf.st_size == 0) {
-        trace ("artwork: %s is a placeholder or was invalidated after cache reset\n", path);
-        return NULL;
+    /* See if we need to make an unscaled image before we make a scaled one */
+    deadbeef->mutex_lock (queue_mutex);
+    if (size != -1 && !cached) {
+        enqueue_query (fname, artist, album, -1, priority, NULL, NULL);
     }
 
-    return path;
+    /* Request to fetch the image */
+    enqueue_query (fname, artist, album, size, priority, callback, user_data);
+    deadbeef->mutex_unlock (queue_mutex);
+    return NULL;
 }
 
 static char *
 get_album_art (const char *fname, const char *artist, const char *album, int size, artwork_callback callback, void *user_data)
 {
-    /* Check if the image is already cached */
-    char cache_path[PATH_MAX];
-    make_cache_path2 (cache_path, sizeof (cache_path), fname, album, artist, size);
-    deadbeef->mutex_lock (queue_mutex);
-    const time_t reset_time = size == -1 ? cache_reset_time : scaled_cache_reset_time;
-    deadbeef->mutex_unlock (queue_mutex);
-    const char *p = find_image (cache_path, reset_time);
-    if (p) {
-        trace ("Found cached image %s\n", cache_path);
-        return strdup (p);
+    return get_album_art2 (fname, artist, album, size, ARTWORK_PRIORITY_NORMAL, callback, user_data);
+}
+
+static cover_callback_t *
+remove_callbacks (cover_query_t *query, artwork_callback cb, cover_callback_t *removed)
+{
+    cover_callback_t **callback = &query->callback;
+    while (*callback) {
+        if ((*callback)->cb == cb) {
+            cover_callback_t *c = *callback;
+            *callback = c->next;
+            c->next = removed;
+            removed = c;
+        }
+        else {
+            callback = &(*callback)->next;
+        }
     }
+    return removed;
+}
 
-    /* See if we need to make an unscaled image before we make a scaled one */
+static void
+cancel_queries (artwork_callback callback, int priority)
+{
+    trace ("artwork: cancel queries below priority %d\n", priority);
+    cover_callback_t *cancelled = NULL;
     deadbeef->mutex_lock (queue_mutex);
-    if (size != -1) {
-        char unscaled_path[PATH_MAX];
-        make_cache_path2 (unscaled_path, sizeof (unscaled_path), fname, album, artist, -1);
-        if (!find_image (unscaled_path, cache_reset_time)) {
-            enqueue_query (fname, artist, album, -1, NULL, NULL);
+    for (int p = 0; p < priority && p < NUM_PRIORITIES; p++) {
+        cover_query_t *q = queue[p];
+        while (q) {
+            cover_query_t *next = q->next;
+            cover_callback_t *removed = remove_callbacks (q, callback, cancelled);
+            if (removed != cancelled && !q->callback && !(q->size == -1 && scaled_waiting (q))) {
+                /* Nobody wants this any more, nor the unscaled image it was waiting for */
+                remove_query (q);
+                cover_query_t *unscaled = q->size != -1 ? find_query (q->artist, q->album, -1) : NULL;
+                if (unscaled && !unscaled->running && !unscaled->callback && !scaled_waiting (unscaled)) {
+                    if (unscaled == next) {
+                        next = next->next;
+                    }
+                    remove_query (unscaled);
+                    clear_query (unscaled);
+                }
+                clear_query (q);
+            }
+            cancelled = removed;
+            q = next;
         }
     }
-
-    /* Request to fetch the image */
-    enqueue_query (fname, artist, album, size, callback, user_data);
     deadbeef->mutex_unlock (queue_mutex);
-    return NULL;
+
+    send_query_callbacks (cancelled, NULL, NULL, NULL);
 }
 
 static void
@@ -1877,10 +1396,12 @@ artwork_reset (int fast) {
     trace ("artwork:%s reset queue\n", fast ? " fast" : "");
     deadbeef->mutex_lock (queue_mutex);
     queue_clear ();
-    if (!fast && queue && queue->callback) {
-        cover_callback_t *callback_chain = queue->callback;
-        queue->callback = NULL;
-        send_query_callbacks (callback_chain, NULL, NULL, NULL);
+    for (int i = 0; !fast && i < FETCHER_THREADS; i++) {
+        if (running_queries[i] && running_queries[i]->callback) {
+            cover_callback_t *callback_chain = running_queries[i]->callback;
+            running_queries[i]->callback = NULL;
+            send_query_callbacks (callback_chain, NULL, NULL, NULL);
+        }
     }
     deadbeef->mutex_unlock (queue_mutex);
 }
@@ -1936,26 +1457,11 @@ insert_cache_reset (void *user_data)
         return;
     }
 
-    /* Submit a dummy query to set the cache reset time in a callback */
-    if (!queue) {
-        enqueue_query (NULL, NULL, NULL, -1, cache_reset_callback, user_data);
-        return;
-    }
-
-    cover_callback_t **last_callback = &queue->callback;
-    while (*last_callback) {
-        if ((*last_callback)->cb == cache_reset_callback) {
-            /* Set an existing callback to do the right resets */
-            if ((*last_callback)->ud == &scaled_cache_reset_time && user_data == &cache_reset_time) {
-                (*last_callback)->ud = user_data;
-            }
-            return;
-        }
-        last_callback = & (*last_callback)->next;
+    /* The fetcher threads make the reset once the running queries are done */
+    if (!pending_reset || user_data == &cache_reset_time) {
+        pending_reset = user_data;
     }
-
-    /* Add a new callback at the end of the chain */
-    *last_callback = new_query_callback (cache_reset_callback, user_data);
+    deadbeef->cond_signal (queue_cond);
 }
 
 static void
@@ -2035,12 +1541,8 @@ invalidate_playitem_cache (DB_plugin_action_t *action, int ctx)
             const char *title = album ? album : deadbeef->pl_find_meta (it, "title");
             char cache_path[PATH_MAX];
             if (!make_cache_path2 (cache_path, PATH_MAX, url, title, artist, -1)) {
-                char subdir_path[PATH_MAX];
-                make_cache_dir_path (subdir_path, PATH_MAX, artist, -1);
-                const char *subdir_name = basename (subdir_path);
-                const char *entry_name = basename (cache_path);
                 trace ("Expire %s from cache\n", cache_path);
-                remove_cache_item (cache_path, subdir_path, subdir_name, entry_name);
+                cache_remove_mapping (cache_path);
             }
             deadbeef->pl_unlock ();
         }
@@ -2076,22 +1578,24 @@ artwork_get_actions (DB_playItem_t *it)
 static int
 artwork_plugin_stop (void)
 {
-    if (tid) {
-        trace ("Stopping fetcher thread ... \n");
+    if (tids[0]) {
+        trace ("Stopping fetcher threads ... \n");
         deadbeef->mutex_lock (queue_mutex);
         queue_clear ();
         terminate = 1;
-        deadbeef->cond_signal (queue_cond);
-        while (queue) {
+        deadbeef->cond_broadcast (queue_cond);
+        while (num_running) {
             artwork_abort_http_request ();
             deadbeef->mutex_unlock (queue_mutex);
             usleep (10000);
             deadbeef->mutex_lock (queue_mutex);
         }
         deadbeef->mutex_unlock (queue_mutex);
-        deadbeef->thread_join (tid);
-        tid = 0;
-        trace ("Fetcher thread stopped\n");
+        for (int i = 0; i < FETCHER_THREADS && tids[i]; i++) {
+            deadbeef->thread_join (tids[i]);
+            tids[i] = 0;
+        }
+        trace ("Fetcher threads stopped\n");
     }
     if (queue_mutex) {
         deadbeef->mutex_free (queue_mutex);
@@ -2101,6 +1605,11 @@ artwork_plugin_stop (void)
         deadbeef->cond_free (queue_cond);
         queue_cond = 0;
     }
+    if (filter_mutex) {
+        deadbeef->mutex_free (filter_mutex);
+        filter_mutex = 0;
+    }
+    artwork_http_free ();
 
     if (artwork_filemask) {
         free (artwork_filemask);
@@ -2126,25 +1635,34 @@ artwork_plugin_start (void)
     imlib_set_cache_size (0);
 #endif
 
+    if (start_cache_cleaner ()) {
+        return -1;
+    }
+
     terminate = 0;
     queue_mutex = deadbeef->mutex_create_nonrecursive ();
     queue_cond = deadbeef->cond_create ();
-    if (queue_mutex && queue_cond) {
-        tid = deadbeef->thread_start_low_priority (fetcher_thread, NULL);
+    filter_mutex = deadbeef->mutex_create_nonrecursive ();
+    if (queue_mutex && queue_cond && filter_mutex && !artwork_http_init ()) {
+        for (int i = 0; i < FETCHER_THREADS; i++) {
+            tids[i] = deadbeef->thread_start_low_priority (fetcher_thread, (void *)(intptr_t)i);
+            if (!tids[i]) {
+                break;
+            }
+        }
     }
-    if (!tid) {
+    if (!tids[0]) {
         artwork_plugin_stop ();
         return -1;
     }
 
-    start_cache_cleaner ();
-
     return 0;
 }
 
 static const char settings_dlg[] =
     "property box hbox[1] border=8 height=-1;\n"
     "property \"Cache update period (in hours, 0=never)\" entry artwork.cache.period 48;\n"
+    "property \"Cache size limit (in MB, 0=unlimited)\" entry artwork.cache.max_size 100;\n"
     "property \"Fetch from embedded tags\" checkbox artwork.enable_embedded 1;\n"
     "property box hbox[2] spacing=0 height=-1;\n"
     "property \"Fetch from local folder\" checkbox artwork.enable_localfolder 1;\n"
@@ -2169,7 +1687,7 @@ static DB_artwork_plugin_t plugin = {
     .plugin.plugin.api_vmajor = 1,
     .plugin.plugin.api_vminor = 0,
     .plugin.plugin.version_major = 1,
-    .plugin.plugin.version_minor = 2,
+    .plugin.plugin.version_minor = 3,
     .plugin.plugin.type = DB_PLUGIN_MISC,
     .plugin.plugin.id = "artwork",
     .plugin.plugin.name = "Album Artwork",
@@ -2209,6 +1727,8 @@ static DB_artwork_plugin_t plugin = {
     .get_album_art_sync = NULL,
     .make_cache_path = make_cache_path,
     .make_cache_path2 = make_cache_path2,
+    .get_album_art2 = get_album_art2,
+    .cancel_queries = cancel_queries,
 };
 
 DB_plugin_t *
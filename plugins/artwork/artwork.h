@@ -26,6 +26,11 @@
 
 #include "../../deadbeef.h"
 
+// request priorities for get_album_art2, get_album_art uses ARTWORK_PRIORITY_NORMAL
+#define ARTWORK_PRIORITY_LOW 0
+#define ARTWORK_PRIORITY_NORMAL 1
+#define ARTWORK_PRIORITY_HIGH 2
+
 typedef void (*artwork_callback) (const char *fname, const char *artist, const char *album, void *user_data);
 
 typedef struct {
@@ -48,6 +53,17 @@ typedef struct {
 
     // creates full path string for cache storage
     int (*make_cache_path2) (char *path, int size, const char *fname, const char *album, const char *artist, int img_size);
+
+    // since 1.3
+    // same as get_album_art, the queued requests with a higher priority are
+    // processed first, and the newest request first within the same priority;
+    // repeating a queued request moves it to the front
+    char* (*get_album_art2) (const char *fname, const char *artist, const char *album, int size, int priority, artwork_callback callback, void *user_data);
+
+    // cancels the queued requests made with `callback' and a priority below
+    // `priority', e.g. for rows which were scrolled out of view;
+    // the cancelled callbacks are called with NULL fname
+    void (*cancel_queries) (artwork_callback callback, int priority);
 } DB_artwork_plugin_t;
 
 #endif /*__ARTWORK_H*/
@@ -40,33 +40,58 @@
 
 extern DB_functions_t *deadbeef;
 
-static DB_FILE *http_request;
+/* One request at a time for each fetcher thread */
+#define MAX_HTTP_REQUESTS 8
+static DB_FILE *http_requests[MAX_HTTP_REQUESTS];
 static uintptr_t http_mutex;
 
+int artwork_http_init (void)
+{
+    http_mutex = deadbeef->mutex_create_nonrecursive ();
+    return http_mutex ? 0 : -1;
+}
+
+void artwork_http_free (void)
+{
+    if (http_mutex) {
+        deadbeef->mutex_free (http_mutex);
+        http_mutex = 0;
+    }
+}
+
 static DB_FILE *
 new_http_request (const char *url)
 {
     errno = 0;
 
     if (!http_mutex) {
-        http_mutex = deadbeef->mutex_create_nonrecursive ();
-        if (!http_mutex) {
-            return NULL;
-        }
+        return NULL;
     }
 
-    deadbeef->mutex_lock (http_mutex);
-    http_request = deadbeef->fopen (url);
-    deadbeef->mutex_unlock (http_mutex);
-    return http_request;
+    DB_FILE *request = deadbeef->fopen (url);
+    if (request) {
+        deadbeef->mutex_lock (http_mutex);
+        for (int i = 0; i < MAX_HTTP_REQUESTS; i++) {
+            if (!http_requests[i]) {
+                http_requests[i] = request;
+                break;
+            }
+        }
+        deadbeef->mutex_unlock (http_mutex);
+    }
+    return request;
 }
 
 static void
 close_http_request (DB_FILE *request)
 {
     deadbeef->mutex_lock (http_mutex);
+    for (int i = 0; i < MAX_HTTP_REQUESTS; i++) {
+        if (http_requests[i] == request) {
+            http_requests[i] = NULL;
+        }
+    }
     deadbeef->fclose (request);
-    http_request = NULL;
     deadbeef->mutex_unlock (http_mutex);
 }
 
@@ -89,10 +114,12 @@ void artwork_abort_http_request (void)
 {
     if (http_mutex) {
         deadbeef->mutex_lock (http_mutex);
-        if (http_request) {
-            deadbeef->fabort (http_request);
+        for (int i = 0; i < MAX_HTTP_REQUESTS; i++) {
+            if (http_requests[i]) {
+                deadbeef->fabort (http_requests[i]);
+                http_requests[i] = NULL;
+            }
         }
-        http_request = NULL;
         deadbeef->mutex_unlock (http_mutex);
     }
 }
@@ -29,6 +29,8 @@
 #define min(x,y) ((x)<(y)?(x):(y))
 #define max(x,y) ((x)>(y)?(x):(y))
 
+int artwork_http_init(void);
+void artwork_http_free(void);
 size_t artwork_http_request(const char *url, char *buffer, const size_t max_bytes);
 void artwork_abort_http_request(void);
 
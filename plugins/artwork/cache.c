@@ -21,18 +21,28 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
+/* Each distinct image is stored once, named by the hash of its bytes, in
+   covers-data/, along with its scaled copies (<hash>-<size>.jpg).  The
+   covers/<artist>/<album>.jpg paths which the callers know about are hard
+   links to these images, or empty placeholders for missing artwork.  The
+   index of images and artist/album mappings is kept in memory, so finding
+   cached artwork doesn't touch the disk, and saved in covers-data/index. */
+
 #ifdef HAVE_CONFIG_H
     #include "../../config.h"
 #endif
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <time.h>
-#include <libgen.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <utime.h>
 #include <pthread.h>
 #include <sys/stat.h>
 #include "artwork_internal.h"
+#include "cache.h"
 #include "../../deadbeef.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
@@ -40,12 +50,57 @@
 
 extern DB_functions_t *deadbeef;
 
+#define DATA_DIR "covers-data/"
+#define INDEX_NAME "index"
+#define INDEX_HEADER "# deadbeef artwork cache 1"
+#define INDEX_HASH_SIZE 4096
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+typedef struct scaled_image_s {
+    int size;
+    int64_t bytes;
+    time_t created;
+    struct scaled_image_s *next;
+} scaled_image_t;
+
+typedef struct cache_image_s {
+    uint64_t hash;
+    int64_t bytes; /* including the scaled copies */
+    time_t created;
+    time_t last_used;
+    int refs;
+    scaled_image_t *scaled;
+    struct cache_image_s *prev; /* LRU list, most recently used first */
+    struct cache_image_s *next;
+    struct cache_image_s *hash_next;
+} cache_image_t;
+
+typedef struct cache_mapping_s {
+    char *key; /* path relative to the cache root */
+    uint64_t hash; /* 0 for missing artwork */
+    time_t checked;
+    struct cache_mapping_s *hash_next;
+} cache_mapping_t;
+
 static uintptr_t files_mutex;
+static uintptr_t index_mutex;
 static intptr_t tid;
 static uintptr_t thread_mutex;
 static uintptr_t thread_cond;
 static int terminate;
+static int wake_pending;
 static int32_t cache_expiry_seconds;
+static int64_t cache_max_bytes;
+
+static char cache_root[PATH_MAX];
+static size_t cache_root_length;
+static cache_image_t *images[INDEX_HASH_SIZE];
+static cache_mapping_t *mappings[INDEX_HASH_SIZE];
+static cache_image_t *lru_head;
+static cache_image_t *lru_tail;
+static int64_t total_bytes;
+static int index_dirty;
 
 void cache_lock (void)
 {
@@ -60,48 +115,600 @@ void cache_unlock (void)
 int make_cache_root_path (char *path, const size_t size)
 {
     const char *xdg_cache = getenv ("XDG_CACHE_HOME");
-    const char *cache_root = xdg_cache ? xdg_cache : getenv ("HOME");
-    if (snprintf (path, size, xdg_cache ? "%s/deadbeef/" : "%s/.cache/deadbeef/", cache_root) >= size) {
+    const char *root = xdg_cache ? xdg_cache : getenv ("HOME");
+    if (snprintf (path, size, xdg_cache ? "%s/deadbeef/" : "%s/.cache/deadbeef/", root) >= size) {
         trace ("Cache root path truncated at %d bytes\n", (int)size);
         return -1;
     }
     return 0;
 }
 
+static uint64_t
+fnv1a (uint64_t hash, const uint8_t *data, const size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static int
+data_path (char *path, const size_t size, const uint64_t hash, const int img_size)
+{
+    int length;
+    if (img_size == -1) {
+        length = snprintf (path, size, "%s" DATA_DIR "%016" PRIx64 ".jpg", cache_root, hash);
+    }
+    else {
+        length = snprintf (path, size, "%s" DATA_DIR "%016" PRIx64 "-%d.jpg", cache_root, hash, img_size);
+    }
+    return length >= size ? -1 : 0;
+}
+
+static const char *
+mapping_key (const char *cache_path)
+{
+    return strncmp (cache_path, cache_root, cache_root_length) ? cache_path : cache_path + cache_root_length;
+}
+
+static int
+mapping_path (char *path, const size_t size, const cache_mapping_t *mapping)
+{
+    return snprintf (path, size, "%s%s", mapping->key[0] == '/' ? "" : cache_root, mapping->key) >= size ? -1 : 0;
+}
+
+static void
+signal_cleaner (void)
+{
+    deadbeef->mutex_lock (thread_mutex);
+    wake_pending = 1;
+    deadbeef->cond_signal (thread_cond);
+    deadbeef->mutex_unlock (thread_mutex);
+}
+
+static int
+over_budget (void)
+{
+    return cache_max_bytes > 0 && total_bytes > cache_max_bytes;
+}
+
+/* The index functions below are called with index_mutex held */
+
+static cache_image_t *
+find_image (const uint64_t hash)
+{
+    cache_image_t *image = images[hash % INDEX_HASH_SIZE];
+    while (image && image->hash != hash) {
+        image = image->hash_next;
+    }
+    return image;
+}
+
+static void
+lru_unlink (cache_image_t *image)
+{
+    if (image->prev) {
+        image->prev->next = image->next;
+    }
+    else {
+        lru_head = image->next;
+    }
+    if (image->next) {
+        image->next->prev = image->prev;
+    }
+    else {
+        lru_tail = image->prev;
+    }
+    image->prev = image->next = NULL;
+}
+
+static void
+lru_push (cache_image_t *image)
+{
+    image->next = lru_head;
+    if (lru_head) {
+        lru_head->prev = image;
+    }
+    else {
+        lru_tail = image;
+    }
+    lru_head = image;
+}
+
+static void
+touch_image (cache_image_t *image)
+{
+    image->last_used = time (NULL);
+    if (image != lru_head) {
+        lru_unlink (image);
+        lru_push (image);
+    }
+    index_dirty = 1;
+}
+
+static cache_image_t *
+add_image (const uint64_t hash, const int64_t bytes, const time_t created, const time_t last_used)
+{
+    cache_image_t *image = calloc (1, sizeof (cache_image_t));
+    if (!image) {
+        return NULL;
+    }
+    image->hash = hash;
+    image->bytes = bytes;
+    image->created = created;
+    image->last_used = last_used;
+    image->hash_next = images[hash % INDEX_HASH_SIZE];
+    images[hash % INDEX_HASH_SIZE] = image;
+    lru_push (image);
+    total_bytes += bytes;
+    index_dirty = 1;
+    return image;
+}
+
+static scaled_image_t *
+find_scaled (const cache_image_t *image, const int img_size)
+{
+    scaled_image_t *scaled = image->scaled;
+    while (scaled && scaled->size != img_size) {
+        scaled = scaled->next;
+    }
+    return scaled;
+}
+
+static scaled_image_t *
+add_scaled (cache_image_t *image, const int img_size, const int64_t bytes, const time_t created)
+{
+    scaled_image_t *scaled = find_scaled (image, img_size);
+    if (!scaled) {
+        scaled = calloc (1, sizeof (scaled_image_t));
+        if (!scaled) {
+            return NULL;
+        }
+        scaled->size = img_size;
+        scaled->next = image->scaled;
+        image->scaled = scaled;
+    }
+    image->bytes += bytes - scaled->bytes;
+    total_bytes += bytes - scaled->bytes;
+    scaled->bytes = bytes;
+    scaled->created = created;
+    index_dirty = 1;
+    return scaled;
+}
+
+static void
+remove_scaled (cache_image_t *image, scaled_image_t *scaled)
+{
+    char path[PATH_MAX];
+    if (!data_path (path, sizeof (path), image->hash, scaled->size)) {
+        unlink (path);
+    }
+    scaled_image_t **prev = &image->scaled;
+    while (*prev != scaled) {
+        prev = &(*prev)->next;
+    }
+    *prev = scaled->next;
+    image->bytes -= scaled->bytes;
+    total_bytes -= scaled->bytes;
+    free (scaled);
+    index_dirty = 1;
+}
+
+/* Deletes the image and its scaled copies, the mappings are left dangling */
+static void
+remove_image (cache_image_t *image)
+{
+    trace ("Evict %016" PRIx64 " (%lld bytes) from cache\n", image->hash, (long long)image->bytes);
+    while (image->scaled) {
+        remove_scaled (image, image->scaled);
+    }
+    char path[PATH_MAX];
+    if (!data_path (path, sizeof (path), image->hash, -1)) {
+        unlink (path);
+    }
+
+    cache_image_t **prev = &images[image->hash % INDEX_HASH_SIZE];
+    while (*prev != image) {
+        prev = &(*prev)->hash_next;
+    }
+    *prev = image->hash_next;
+    lru_unlink (image);
+    total_bytes -= image->bytes;
+    free (image);
+    index_dirty = 1;
+}
+
+static uint32_t
+key_hash (const char *key)
+{
+    return fnv1a (FNV_OFFSET, (const uint8_t *)key, strlen (key)) % INDEX_HASH_SIZE;
+}
+
+static cache_mapping_t *
+find_mapping (const char *key)
+{
+    cache_mapping_t *mapping = mappings[key_hash (key)];
+    while (mapping && strcmp (mapping->key, key)) {
+        mapping = mapping->hash_next;
+    }
+    return mapping;
+}
+
+static cache_mapping_t *
+set_mapping (const char *key, const uint64_t hash, const time_t checked)
+{
+    cache_mapping_t *mapping = find_mapping (key);
+    if (!mapping) {
+        mapping = calloc (1, sizeof (cache_mapping_t));
+        if (!mapping) {
+            return NULL;
+        }
+        mapping->key = strdup (key);
+        if (!mapping->key) {
+            free (mapping);
+            return NULL;
+        }
+        const uint32_t bucket = key_hash (key);
+        mapping->hash_next = mappings[bucket];
+        mappings[bucket] = mapping;
+    }
+    mapping->hash = hash;
+    mapping->checked = checked;
+    index_dirty = 1;
+    return mapping;
+}
+
+static void
+remove_mapping (cache_mapping_t *mapping, const int unlink_file)
+{
+    if (unlink_file) {
+        char path[PATH_MAX];
+        if (!mapping_path (path, sizeof (path), mapping)) {
+            unlink (path);
+            char *dir = strrchr (path, '/');
+            if (dir) {
+                /* Remove the artist directory if it is now empty */
+                *dir = '\0';
+                rmdir (path);
+            }
+        }
+    }
+
+    cache_mapping_t **prev = &mappings[key_hash (mapping->key)];
+    while (*prev != mapping) {
+        prev = &(*prev)->hash_next;
+    }
+    *prev = mapping->hash_next;
+    free (mapping->key);
+    free (mapping);
+    index_dirty = 1;
+}
+
+static void
+remove_dangling_mappings (void)
+{
+    for (size_t i = 0; i < INDEX_HASH_SIZE; i++) {
+        cache_mapping_t *mapping = mappings[i];
+        while (mapping) {
+            cache_mapping_t *next = mapping->hash_next;
+            if (mapping->hash && !find_image (mapping->hash)) {
+                remove_mapping (mapping, 1);
+            }
+            mapping = next;
+        }
+    }
+}
+
+static int
+expired (const cache_mapping_t *mapping, const time_t now)
+{
+    return cache_expiry_seconds > 0 && mapping->checked + cache_expiry_seconds <= now;
+}
+
+int cache_get_mapping (const char *cache_path, uint64_t *hash, time_t *checked)
+{
+    deadbeef->mutex_lock (index_mutex);
+    cache_mapping_t *mapping = find_mapping (mapping_key (cache_path));
+    cache_image_t *image = mapping && mapping->hash ? find_image (mapping->hash) : NULL;
+    if (mapping && (expired (mapping, time (NULL)) || (mapping->hash && !image))) {
+        trace ("%s expired from cache\n", cache_path);
+        remove_mapping (mapping, 1);
+        mapping = NULL;
+    }
+    if (mapping) {
+        if (image) {
+            touch_image (image);
+        }
+        *hash = mapping->hash;
+        *checked = mapping->checked;
+    }
+    deadbeef->mutex_unlock (index_mutex);
+    return mapping ? 0 : -1;
+}
+
+void cache_remove_mapping (const char *cache_path)
+{
+    deadbeef->mutex_lock (index_mutex);
+    cache_mapping_t *mapping = find_mapping (mapping_key (cache_path));
+    if (mapping) {
+        remove_mapping (mapping, 1);
+    }
+    else {
+        unlink (cache_path);
+    }
+    deadbeef->mutex_unlock (index_mutex);
+}
+
 static int
-filter_scaled_dirs (const struct dirent *f)
+replace_with_link (const char *target, const char *path)
 {
-    return !strncasecmp (f->d_name, "covers-", 7);
+    /* Hard link where possible, the copies don't count towards the cache size */
+    char tmp_path[PATH_MAX];
+    if (snprintf (tmp_path, sizeof (tmp_path), "%s.part", path) >= sizeof (tmp_path)) {
+        return -1;
+    }
+    unlink (tmp_path);
+    if (link (target, tmp_path) && copy_file (target, tmp_path)) {
+        trace ("artwork: failed to link %s to %s\n", path, target);
+        return -1;
+    }
+    int err = rename (tmp_path, path);
+    unlink (tmp_path);
+    return err;
 }
 
-void remove_cache_item (const char *entry_path, const char *subdir_path, const char *subdir_name, const char *entry_name)
+static int
+store_file (const char *cache_path, const time_t checked)
 {
-    /* Unlink the expired file, and the artist directory if it is empty */
-    cache_lock ();
-    unlink (entry_path);
-    rmdir (subdir_path);
+    FILE *fp = fopen (cache_path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    uint64_t hash = FNV_OFFSET;
+    int64_t bytes = 0;
+    uint8_t buffer[4096];
+    size_t bytes_read;
+    while ((bytes_read = fread (buffer, 1, sizeof (buffer), fp)) > 0) {
+        hash = fnv1a (hash, buffer, bytes_read);
+        bytes += bytes_read;
+    }
+    const int err = ferror (fp);
+    fclose (fp);
+    if (err || !bytes) {
+        return -1;
+    }
+    if (!hash) {
+        hash = 1;
+    }
 
-    /* Remove any scaled copies of this file, plus parent directories that are now empty */
-    char cache_root_path[PATH_MAX];
-    make_cache_root_path (cache_root_path, PATH_MAX);
-    struct dirent **scaled_dirs = NULL;
-    int scaled_dirs_count = scandir (cache_root_path, &scaled_dirs, filter_scaled_dirs, NULL);
-    if (scaled_dirs_count < 0) {
-        cache_unlock ();
+    char path[PATH_MAX];
+    if (data_path (path, sizeof (path), hash, -1)) {
+        return -1;
+    }
+
+    deadbeef->mutex_lock (index_mutex);
+    int res = -1;
+    const time_t now = time (NULL);
+    cache_image_t *image = find_image (hash);
+    if (image) {
+        /* The same image is already cached for another album */
+        trace ("%s is a copy of %s\n", cache_path, path);
+        if (!replace_with_link (path, cache_path)) {
+            /* Shared with the other mappings, but the callers compare mtimes */
+            utime (cache_path, NULL);
+            res = 0;
+        }
+    }
+    else if (ensure_dir (path) && !replace_with_link (cache_path, path)) {
+        image = add_image (hash, bytes, now, now);
+        res = image ? 0 : -1;
+    }
+    if (!res && set_mapping (mapping_key (cache_path), hash, checked)) {
+        touch_image (image);
+    }
+    else {
+        res = -1;
+    }
+    const int full = over_budget ();
+    deadbeef->mutex_unlock (index_mutex);
+
+    if (full) {
+        signal_cleaner ();
+    }
+    return res;
+}
+
+int cache_store (const char *cache_path)
+{
+    return store_file (cache_path, time (NULL));
+}
+
+void cache_store_placeholder (const char *cache_path)
+{
+    write_file (cache_path, NULL, 0);
+    deadbeef->mutex_lock (index_mutex);
+    set_mapping (mapping_key (cache_path), 0, time (NULL));
+    deadbeef->mutex_unlock (index_mutex);
+}
+
+int cache_scaled_path (char *path, const size_t size, const uint64_t hash, const int img_size)
+{
+    return data_path (path, size, hash, img_size);
+}
+
+int cache_get_scaled (const uint64_t hash, const int img_size, time_t *created)
+{
+    deadbeef->mutex_lock (index_mutex);
+    cache_image_t *image = find_image (hash);
+    scaled_image_t *scaled = image ? find_scaled (image, img_size) : NULL;
+    if (scaled) {
+        touch_image (image);
+        *created = scaled->created;
+    }
+    deadbeef->mutex_unlock (index_mutex);
+    return scaled ? 0 : -1;
+}
+
+int cache_add_scaled (const char *tmp_path, const uint64_t hash, const int img_size)
+{
+    char path[PATH_MAX];
+    struct stat stat_buf;
+    if (data_path (path, sizeof (path), hash, img_size) || stat (tmp_path, &stat_buf)) {
+        unlink (tmp_path);
+        return -1;
+    }
+
+    deadbeef->mutex_lock (index_mutex);
+    cache_image_t *image = find_image (hash);
+    int res = -1;
+    if (image && !rename (tmp_path, path)) {
+        /* Unless the image was evicted meanwhile */
+        if (add_scaled (image, img_size, stat_buf.st_size, time (NULL))) {
+            touch_image (image);
+            res = 0;
+        }
+        else {
+            unlink (path);
+        }
+    }
+    const int full = over_budget ();
+    deadbeef->mutex_unlock (index_mutex);
+
+    unlink (tmp_path);
+    if (full) {
+        signal_cleaner ();
+    }
+    return res;
+}
+
+void cache_remove_scaled (const uint64_t hash, const int img_size)
+{
+    deadbeef->mutex_lock (index_mutex);
+    cache_image_t *image = find_image (hash);
+    scaled_image_t *scaled = image ? find_scaled (image, img_size) : NULL;
+    if (scaled) {
+        remove_scaled (image, scaled);
+    }
+    deadbeef->mutex_unlock (index_mutex);
+}
+
+static void
+load_index (void)
+{
+    char path[PATH_MAX];
+    if (snprintf (path, sizeof (path), "%s" DATA_DIR INDEX_NAME, cache_root) >= sizeof (path)) {
+        return;
+    }
+    FILE *fp = fopen (path, "r");
+    if (!fp) {
+        return;
+    }
+
+    char line[PATH_MAX+100];
+    if (!fgets (line, sizeof (line), fp) || strncmp (line, INDEX_HEADER, sizeof (INDEX_HEADER)-1)) {
+        trace ("artwork: ignoring cache index %s\n", path);
+        fclose (fp);
+        return;
+    }
+
+    /* The images are saved least recently used first */
+    cache_image_t *image = NULL;
+    while (fgets (line, sizeof (line), fp)) {
+        line[strcspn (line, "\n")] = '\0';
+        uint64_t hash;
+        long long t1, t2, bytes;
+        int size, key_pos;
+        if (sscanf (line, "I %" SCNx64 " %lld %lld %lld", &hash, &t1, &t2, &bytes) == 4 && hash && !find_image (hash)) {
+            image = add_image (hash, bytes, t1, t2);
+        }
+        else if (sscanf (line, "S %" SCNx64 " %d %lld %lld", &hash, &size, &t1, &bytes) == 4 && image && image->hash == hash) {
+            add_scaled (image, size, bytes, t1);
+        }
+        else if (sscanf (line, "M %" SCNx64 " %lld %n", &hash, &t1, &key_pos) == 2 && line[key_pos] && (!hash || find_image (hash))) {
+            set_mapping (line+key_pos, hash, t1);
+        }
+    }
+    fclose (fp);
+    index_dirty = 0;
+}
+
+static void
+save_index (void)
+{
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (snprintf (path, sizeof (path), "%s" DATA_DIR INDEX_NAME, cache_root) >= sizeof (path) ||
+        snprintf (tmp_path, sizeof (tmp_path), "%s.part", path) >= sizeof (tmp_path) ||
+        !ensure_dir (path)) {
+        return;
+    }
+
+    deadbeef->mutex_lock (index_mutex);
+    if (!index_dirty) {
+        deadbeef->mutex_unlock (index_mutex);
         return;
     }
-    for (int i = 0; i < scaled_dirs_count; i++) {
-        char scaled_entry_path[PATH_MAX];
-        if (snprintf (scaled_entry_path, PATH_MAX, "%s%s/%s/%s", cache_root_path, scaled_dirs[i]->d_name, subdir_name, entry_name) < PATH_MAX) {
-            unlink (scaled_entry_path);
-            char *scaled_entry_dir = dirname (scaled_entry_path);
-            rmdir (scaled_entry_dir);
-            rmdir (dirname (scaled_entry_dir));
+    FILE *fp = fopen (tmp_path, "w");
+    if (!fp) {
+        deadbeef->mutex_unlock (index_mutex);
+        return;
+    }
+
+    fprintf (fp, INDEX_HEADER "\n");
+    for (cache_image_t *image = lru_tail; image; image = image->prev) {
+        int64_t bytes = image->bytes;
+        for (scaled_image_t *scaled = image->scaled; scaled; scaled = scaled->next) {
+            bytes -= scaled->bytes;
+        }
+        fprintf (fp, "I %016" PRIx64 " %lld %lld %lld\n", image->hash, (long long)image->created, (long long)image->last_used, (long long)bytes);
+        for (scaled_image_t *scaled = image->scaled; scaled; scaled = scaled->next) {
+            fprintf (fp, "S %016" PRIx64 " %d %lld %lld\n", image->hash, scaled->size, (long long)scaled->created, (long long)scaled->bytes);
+        }
+    }
+    for (size_t i = 0; i < INDEX_HASH_SIZE; i++) {
+        for (cache_mapping_t *mapping = mappings[i]; mapping; mapping = mapping->hash_next) {
+            if (!strchr (mapping->key, '\n')) {
+                fprintf (fp, "M %016" PRIx64 " %lld %s\n", mapping->hash, (long long)mapping->checked, mapping->key);
+            }
         }
-        free (scaled_dirs[i]);
     }
-    free (scaled_dirs);
-    cache_unlock ();
+
+    int err = ferror (fp);
+    if (fclose (fp) || err || rename (tmp_path, path)) {
+        trace ("artwork: failed to save cache index %s\n", path);
+        unlink (tmp_path);
+    }
+    else {
+        index_dirty = 0;
+    }
+    deadbeef->mutex_unlock (index_mutex);
+}
+
+static void
+free_index (void)
+{
+    while (lru_head) {
+        cache_image_t *image = lru_head;
+        lru_head = image->next;
+        while (image->scaled) {
+            scaled_image_t *next = image->scaled->next;
+            free (image->scaled);
+            image->scaled = next;
+        }
+        free (image);
+    }
+    lru_tail = NULL;
+    memset (images, 0, sizeof (images));
+    for (size_t i = 0; i < INDEX_HASH_SIZE; i++) {
+        while (mappings[i]) {
+            cache_mapping_t *next = mappings[i]->hash_next;
+            free (mappings[i]->key);
+            free (mappings[i]);
+            mappings[i] = next;
+        }
+    }
+    total_bytes = 0;
+    index_dirty = 0;
 }
 
 static int
@@ -111,75 +718,224 @@ path_ok (const size_t dir_length, const char *entry)
 }
 
 static void
-cache_cleaner_thread (void *none)
+remove_dir_files (const char *dir_path, const int depth, const time_t older_than, int (*keep)(const char *path, const struct stat *stat_buf))
 {
-    /* Find where it all happens */
-    char covers_path[PATH_MAX];
-    if (make_cache_root_path (covers_path, PATH_MAX-10)) {
-        return;
+    const size_t dir_path_length = strlen (dir_path);
+    DIR *dir = opendir (dir_path);
+    struct dirent *entry;
+    while (!terminate && dir && (entry = readdir (dir))) {
+        if (path_ok (dir_path_length, entry->d_name)) {
+            char entry_path[PATH_MAX];
+            sprintf (entry_path, "%s/%s", dir_path, entry->d_name);
+            struct stat stat_buf;
+            if (!lstat (entry_path, &stat_buf)) {
+                if (S_ISDIR (stat_buf.st_mode) && depth > 0) {
+                    remove_dir_files (entry_path, depth-1, older_than, keep);
+                    rmdir (entry_path);
+                }
+                else if (S_ISREG (stat_buf.st_mode) && stat_buf.st_mtime < older_than && (!keep || !keep (entry_path, &stat_buf))) {
+                    trace ("Remove stray cache file %s\n", entry_path);
+                    unlink (entry_path);
+                }
+            }
+        }
+    }
+    if (dir) {
+        closedir (dir);
     }
-    strcat (covers_path, "covers");
-    const size_t covers_path_length = strlen (covers_path);
+}
 
-    deadbeef->mutex_lock (thread_mutex);
-    while (!terminate) {
-        time_t oldest_mtime = time (NULL);
-
-        /* Loop through the artist directories */
-        DIR *covers_dir = opendir (covers_path);
-        struct dirent *covers_subdir;
-        while (!terminate && covers_dir && (covers_subdir = readdir (covers_dir))) {
-            const int32_t cache_secs = cache_expiry_seconds;
-            deadbeef->mutex_unlock (thread_mutex);
-            if (cache_secs > 0 && path_ok (covers_path_length, covers_subdir->d_name)) {
-                trace ("Analyse %s for expired files\n", covers_subdir->d_name);
-                const time_t cache_expiry = time (NULL) - cache_secs;
-
-                /* Loop through the image files in this artist directory */
-                char subdir_path[PATH_MAX];
-                sprintf (subdir_path, "%s/%s", covers_path, covers_subdir->d_name);
-                const size_t subdir_path_length = strlen (subdir_path);
-                DIR *subdir = opendir (subdir_path);
-                struct dirent *entry;
-                while (subdir && (entry = readdir (subdir))) {
-                    if (path_ok (subdir_path_length, entry->d_name)) {
-                        char entry_path[PATH_MAX];
-                        sprintf (entry_path, "%s/%s", subdir_path, entry->d_name);
-
-                        /* Test against the cache expiry time (cache invalidation resets are not handled here) */
-                        struct stat stat_buf;
-                        if (!stat (entry_path, &stat_buf)) {
-                            if (stat_buf.st_mtime <= cache_expiry) {
-                                trace ("%s expired from cache\n", entry_path);
-                                remove_cache_item (entry_path, subdir_path, covers_subdir->d_name, entry->d_name);
-                            }
-                            else if (stat_buf.st_mtime < oldest_mtime) {
-                                oldest_mtime = stat_buf.st_mtime;
-                            }
-                        }
+static int
+indexed_file (const char *path, const struct stat *stat_buf)
+{
+    /* Called for the files in covers-data/ and covers/ */
+    const char *name = strrchr (path, '/') + 1;
+    uint64_t hash;
+    int size = -1;
+    int name_length = 0;
+    deadbeef->mutex_lock (index_mutex);
+    int indexed = !strcmp (name, INDEX_NAME) || find_mapping (mapping_key (path));
+    if (!indexed && (sscanf (name, "%16" SCNx64 ".jpg%n", &hash, &name_length) == 1 ||
+        sscanf (name, "%16" SCNx64 "-%d.jpg%n", &hash, &size, &name_length) == 2) && !name[name_length]) {
+        cache_image_t *image = find_image (hash);
+        indexed = image && (size == -1 || find_scaled (image, size));
+    }
+    deadbeef->mutex_unlock (index_mutex);
+    return indexed;
+}
+
+static int
+adopt_legacy_file (const char *path, const struct stat *stat_buf)
+{
+    /* Called for the files in covers/, artwork cached by older versions is
+       added to the store as if it was fetched when the file was written */
+    if (indexed_file (path, stat_buf)) {
+        return 1;
+    }
+    const char *ext = strrchr (path, '.');
+    if (!ext || strcmp (ext, ".jpg")) {
+        return 0;
+    }
+    if (!stat_buf->st_size) {
+        deadbeef->mutex_lock (index_mutex);
+        const int res = set_mapping (mapping_key (path), 0, stat_buf->st_mtime) != NULL;
+        deadbeef->mutex_unlock (index_mutex);
+        return res;
+    }
+    trace ("artwork: adopting %s\n", path);
+    return !store_file (path, stat_buf->st_mtime);
+}
+
+static void
+check_index (void)
+{
+    /* Forget anything that was deleted since the index was saved */
+    for (size_t i = 0; i < INDEX_HASH_SIZE && !terminate; i++) {
+        char path[PATH_MAX];
+        struct stat stat_buf;
+        deadbeef->mutex_lock (index_mutex);
+        cache_image_t *image = images[i];
+        while (image) {
+            cache_image_t *next = image->hash_next;
+            if (data_path (path, sizeof (path), image->hash, -1) || stat (path, &stat_buf)) {
+                remove_image (image);
+            }
+            else {
+                scaled_image_t *scaled = image->scaled;
+                while (scaled) {
+                    scaled_image_t *next_scaled = scaled->next;
+                    if (data_path (path, sizeof (path), image->hash, scaled->size) || stat (path, &stat_buf)) {
+                        remove_scaled (image, scaled);
                     }
+                    scaled = next_scaled;
                 }
-                closedir (subdir);
             }
-            usleep (100000);
-            deadbeef->mutex_lock (thread_mutex);
+            image = next;
         }
-        closedir (covers_dir);
+        deadbeef->mutex_unlock (index_mutex);
+    }
+
+    deadbeef->mutex_lock (index_mutex);
+    remove_dangling_mappings ();
+    deadbeef->mutex_unlock (index_mutex);
+    for (size_t i = 0; i < INDEX_HASH_SIZE && !terminate; i++) {
+        deadbeef->mutex_lock (index_mutex);
+        cache_mapping_t *mapping = mappings[i];
+        while (mapping) {
+            cache_mapping_t *next = mapping->hash_next;
+            char path[PATH_MAX];
+            struct stat stat_buf;
+            if (mapping_path (path, sizeof (path), mapping) || stat (path, &stat_buf)) {
+                remove_mapping (mapping, 0);
+            }
+            mapping = next;
+        }
+        deadbeef->mutex_unlock (index_mutex);
+    }
 
-        /* Sleep until just after the oldest file expires */
-        if (cache_expiry_seconds > 0 && !terminate) {
+    /* Files which never made it into the index, ignoring the ones being written right now */
+    const time_t an_hour_ago = time (NULL) - 60*60;
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s" DATA_DIR, cache_root);
+    remove_dir_files (path, 0, an_hour_ago, indexed_file);
+
+    /* Adopt artwork cached by older versions, and remove stray files */
+    snprintf (path, sizeof (path), "%scovers", cache_root);
+    remove_dir_files (path, 1, an_hour_ago, adopt_legacy_file);
+
+    /* Scaled copies made by older versions */
+    DIR *dir = opendir (cache_root);
+    struct dirent *entry;
+    while (!terminate && dir && (entry = readdir (dir))) {
+        int size;
+        if (sscanf (entry->d_name, "covers-%d", &size) == 1 && path_ok (cache_root_length, entry->d_name)) {
+            snprintf (path, sizeof (path), "%s%s", cache_root, entry->d_name);
+            remove_dir_files (path, 1, time (NULL) + 1, NULL);
+            rmdir (path);
+        }
+    }
+    if (dir) {
+        closedir (dir);
+    }
+}
+
+static time_t
+clean_index (void)
+{
+    const time_t now = time (NULL);
+    time_t next_check = now + 60*60;
+
+    deadbeef->mutex_lock (index_mutex);
+
+    /* Forget expired artwork, so that it gets fetched again */
+    for (size_t i = 0; i < INDEX_HASH_SIZE; i++) {
+        cache_mapping_t *mapping = mappings[i];
+        while (mapping) {
+            cache_mapping_t *next = mapping->hash_next;
+            if (expired (mapping, now)) {
+                trace ("%s expired from cache\n", mapping->key);
+                remove_mapping (mapping, 1);
+            }
+            else {
+                if (cache_expiry_seconds > 0 && mapping->checked + cache_expiry_seconds < next_check) {
+                    next_check = mapping->checked + cache_expiry_seconds;
+                }
+                cache_image_t *image = mapping->hash ? find_image (mapping->hash) : NULL;
+                if (image) {
+                    image->refs++;
+                }
+            }
+            mapping = next;
+        }
+    }
+
+    /* Then the images which are no longer used for any album */
+    cache_image_t *image = lru_head;
+    while (image) {
+        cache_image_t *next = image->next;
+        if (!image->refs) {
+            remove_image (image);
+        }
+        else {
+            image->refs = 0;
+        }
+        image = next;
+    }
+
+    /* And then the least recently used images, leaving some room for new ones */
+    if (over_budget ()) {
+        while (lru_tail && total_bytes > cache_max_bytes / 10 * 9) {
+            remove_image (lru_tail);
+        }
+        remove_dangling_mappings ();
+    }
+
+    trace ("artwork cache: %lld bytes\n", (long long)total_bytes);
+    deadbeef->mutex_unlock (index_mutex);
+    return next_check;
+}
+
+static void
+cache_cleaner_thread (void *none)
+{
+    check_index ();
+
+    deadbeef->mutex_lock (thread_mutex);
+    while (!terminate) {
+        wake_pending = 0;
+        deadbeef->mutex_unlock (thread_mutex);
+        const time_t next_check = clean_index ();
+        save_index ();
+        deadbeef->mutex_lock (thread_mutex);
+
+        /* Sleep until the next mapping expires, the cache is full, or an hour passes */
+        if (!terminate && !wake_pending) {
             struct timespec wake_time = {
-                .tv_sec = time (NULL) + max (60, oldest_mtime - time (NULL) + cache_expiry_seconds),
+                .tv_sec = max (time (NULL) + 60, next_check),
                 .tv_nsec = 999999
             };
-            trace ("Cache cleaner sleeping for %d seconds\n", max (60, oldest_mtime - time (NULL) + cache_expiry_seconds));
-            pthread_cond_timedwait ( (pthread_cond_t *)thread_cond, (pthread_mutex_t *)thread_mutex, &wake_time);
-        }
-
-        /* Just go back to sleep if cache expiry is disabled */
-        while (cache_expiry_seconds <= 0 && !terminate) {
-            trace ("Cache cleaner sleeping forever\n");
-            pthread_cond_wait ( (pthread_cond_t *)thread_cond, (pthread_mutex_t *)thread_mutex);
+            trace ("Cache cleaner sleeping for %d seconds\n", (int)(wake_time.tv_sec - time (NULL)));
+            pthread_cond_timedwait ((pthread_cond_t *)thread_cond, (pthread_mutex_t *)thread_mutex, &wake_time);
         }
     }
     deadbeef->mutex_unlock (thread_mutex);
@@ -188,9 +944,12 @@ cache_cleaner_thread (void *none)
 void cache_configchanged (void)
 {
     const int32_t new_cache_expiry_seconds = deadbeef->conf_get_int ("artwork.cache.period", 48) * 60 * 60;
-    if (new_cache_expiry_seconds != cache_expiry_seconds) {
+    const int64_t new_cache_max_bytes = (int64_t)deadbeef->conf_get_int ("artwork.cache.max_size", 100) * 1024 * 1024;
+    if (new_cache_expiry_seconds != cache_expiry_seconds || new_cache_max_bytes != cache_max_bytes) {
         deadbeef->mutex_lock (thread_mutex);
         cache_expiry_seconds = new_cache_expiry_seconds;
+        cache_max_bytes = new_cache_max_bytes;
+        wake_pending = 1;
         deadbeef->cond_signal (thread_cond);
         deadbeef->mutex_unlock (thread_mutex);
     }
@@ -208,6 +967,13 @@ void stop_cache_cleaner (void)
         trace ("Cache cleaner thread stopped\n");
     }
 
+    if (index_mutex) {
+        save_index ();
+        free_index ();
+        deadbeef->mutex_free (index_mutex);
+        index_mutex = 0;
+    }
+
     if (thread_mutex) {
         deadbeef->mutex_free (thread_mutex);
         thread_mutex = 0;
@@ -228,10 +994,14 @@ int start_cache_cleaner (void)
 {
     terminate = 0;
     cache_expiry_seconds = deadbeef->conf_get_int ("artwork.cache.period", 48) * 60 * 60;
+    cache_max_bytes = (int64_t)deadbeef->conf_get_int ("artwork.cache.max_size", 100) * 1024 * 1024;
     files_mutex = deadbeef->mutex_create_nonrecursive ();
+    index_mutex = deadbeef->mutex_create_nonrecursive ();
     thread_mutex = deadbeef->mutex_create_nonrecursive ();
     thread_cond = deadbeef->cond_create ();
-    if (files_mutex && thread_mutex && thread_cond) {
+    if (files_mutex && index_mutex && thread_mutex && thread_cond && !make_cache_root_path (cache_root, sizeof (cache_root) - 100)) {
+        cache_root_length = strlen (cache_root);
+        load_index ();
         tid = deadbeef->thread_start_low_priority (cache_cleaner_thread, NULL);
         trace ("Cache cleaner thread started\n");
     }
@@ -24,12 +24,29 @@
 #ifndef __ARTWORK_CACHE_H
 #define __ARTWORK_CACHE_H
 
+#include <stdint.h>
+#include <time.h>
+
 void cache_lock(void);
 void cache_unlock(void);
 int make_cache_root_path(char *path, const size_t size);
-void remove_cache_item(const char *entry_path, const char *subdir_path, const char *subdir_name, const char *entry_name);
+
+// artwork cached for an album path from make_cache_path2, returns 0 if known,
+// with hash 0 if no artwork was found when it was checked
+int cache_get_mapping(const char *cache_path, uint64_t *hash, time_t *checked);
+void cache_remove_mapping(const char *cache_path);
+// adds the image just written to cache_path, sharing the bytes with any identical image
+int cache_store(const char *cache_path);
+void cache_store_placeholder(const char *cache_path);
+
+int cache_scaled_path(char *path, const size_t size, const uint64_t hash, const int img_size);
+int cache_get_scaled(const uint64_t hash, const int img_size, time_t *created);
+// moves the scaled image from tmp_path into the cache
+int cache_add_scaled(const char *tmp_path, const uint64_t hash, const int img_size);
+void cache_remove_scaled(const uint64_t hash, const int img_size);
+
 void cache_configchanged(void);
-void start_cache_cleaner(void);
+int start_cache_cleaner(void);
 void stop_cache_cleaner(void);
 
 #endif /*__ARTWORK_CACHE_H*/
@@ -0,0 +1,622 @@
+/*
+    Album Art plugin for DeaDBeeF
+    Copyright (C) 2009-2011 Viktor Semykin <thesame.ml@gmail.com>
+    Copyright (C) 2009-2013 Alexey Yakovenko <waker@users.sourceforge.net>
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifdef HAVE_CONFIG_H
+    #include "../../config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <setjmp.h>
+#ifdef USE_IMLIB2
+    #include <Imlib2.h>
+#else
+    #include <jpeglib.h>
+    #include <png.h>
+    #ifdef __SSE2__
+        #include <emmintrin.h>
+    #endif
+#endif
+#include "scaler.h"
+
+//#define trace(...) { fprintf (stderr, __VA_ARGS__); }
+#define trace(...)
+
+static float
+scale_dimensions (int scaled_size, int towards_longer, int width, int height, unsigned int *scaled_width, unsigned int *scaled_height)
+{
+    /* Calculate the dimensions of the scaled image */
+    float scaling_ratio;
+    if (towards_longer == width > height) {
+        *scaled_height = scaled_size;
+        scaling_ratio = (float)height / *scaled_height;
+        *scaled_width = width / scaling_ratio + 0.5;
+    }
+    else {
+        *scaled_width = scaled_size;
+        scaling_ratio = (float)width / *scaled_width;
+        *scaled_height = height / scaling_ratio + 0.5;
+    }
+    return scaling_ratio;
+}
+
+static int
+invalid_dimensions (float scaling_ratio, unsigned int scaled_width, unsigned int scaled_height)
+{
+    if (scaling_ratio >= 65535 || scaled_width < 1 || scaled_width > 32767 || scaled_height < 1 || scaled_height > 32767) {
+        trace ("scaling ratio (%g) or scaled image dimensions (%ux%u) are invalid\n", scaling_ratio, scaled_width, scaled_height);
+        return 1;
+    }
+    return 0;
+}
+
+#ifndef USE_IMLIB2
+/* Separable resampling with fixed point weights: each scaled row is first
+   filtered vertically from the source rows, which is where most of the work is
+   and what the SIMD code does, and then horizontally to the scaled width. */
+#define WEIGHT_BITS 14
+
+#ifdef USE_BICUBIC
+#define FILTER_SUPPORT 2.0
+static double
+filter_kernel (double x)
+{
+    /* Cubic Hermite spline (a = -0.5, Catmull-Rom) */
+    const double a = -0.5;
+    x = fabs (x);
+    if (x < 1) {
+        return ((a + 2) * x - (a + 3)) * x * x + 1;
+    }
+    if (x < 2) {
+        return (((x - 5) * x + 8) * x - 4) * a;
+    }
+    return 0;
+}
+#else
+#define FILTER_SUPPORT 1.0
+static double
+filter_kernel (double x)
+{
+    /* Triangle, bilinear interpolation for upscales */
+    x = fabs (x);
+    return x < 1 ? 1 - x : 0;
+}
+#endif
+
+typedef struct {
+    unsigned int *bounds; /* first source pixel and number of source pixels for each scaled pixel */
+    int16_t *weights; /* num_taps for each scaled pixel */
+    unsigned int num_taps;
+} filter_t;
+
+typedef struct {
+    filter_t x;
+    filter_t y;
+    unsigned int num_components;
+    unsigned int width;
+    unsigned int scaled_width;
+    uint8_t *column; /* vertically filtered row, at the source width */
+} resampler_t;
+
+static void
+filter_free (filter_t *f)
+{
+    free (f->bounds);
+    free (f->weights);
+}
+
+static int
+filter_init (filter_t *f, unsigned int size, unsigned int scaled_size)
+{
+    /* Widen the kernel for downscales, so that all source pixels contribute */
+    const double ratio = (double)size / scaled_size;
+    const double filter_scale = ratio > 1 ? ratio : 1;
+    const double support = FILTER_SUPPORT * filter_scale;
+    f->num_taps = (unsigned int)ceil (support) * 2 + 1;
+    f->bounds = malloc (scaled_size * 2 * sizeof (unsigned int));
+    f->weights = calloc (scaled_size * f->num_taps, sizeof (int16_t));
+    double *w = malloc (f->num_taps * sizeof (double));
+    if (!f->bounds || !f->weights || !w) {
+        free (w);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < scaled_size; i++) {
+        const double center = (i + 0.5) * ratio;
+        int first = center - support + 0.5;
+        int last = center + support + 0.5;
+        if (first < 0) {
+            first = 0;
+        }
+        if (last > (int)size) {
+            last = size;
+        }
+        if (last <= first) {
+            last = first + 1;
+        }
+
+        double total = 0;
+        for (int j = 0; j < last - first; j++) {
+            w[j] = filter_kernel ((first + j - center + 0.5) / filter_scale);
+            total += w[j];
+        }
+        int16_t *weights = f->weights + i * f->num_taps;
+        for (int j = 0; j < last - first; j++) {
+            weights[j] = total ? floor (w[j] / total * (1 << WEIGHT_BITS) + 0.5) : j ? 0 : 1 << WEIGHT_BITS;
+        }
+        f->bounds[i*2] = first;
+        f->bounds[i*2+1] = last - first;
+    }
+
+    free (w);
+    return 0;
+}
+
+static void
+resampler_free (resampler_t *r)
+{
+    filter_free (&r->x);
+    filter_free (&r->y);
+    free (r->column);
+}
+
+static int
+resampler_init (resampler_t *r, unsigned int width, unsigned int height, unsigned int scaled_width, unsigned int scaled_height, unsigned int num_components)
+{
+    memset (r, 0, sizeof (resampler_t));
+    if (num_components < 1 || num_components > 4) {
+        return -1;
+    }
+    r->num_components = num_components;
+    r->width = width;
+    r->scaled_width = scaled_width;
+    r->column = malloc (width * num_components);
+    if (!r->column || filter_init (&r->x, width, scaled_width) || filter_init (&r->y, height, scaled_height)) {
+        resampler_free (r);
+        return -1;
+    }
+    return 0;
+}
+
+static inline uint8_t
+clamp_pixel (int32_t value)
+{
+    value >>= WEIGHT_BITS;
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static void
+filter_vertical (const filter_t *f, uint8_t **rows, unsigned int scaled_y, uint8_t *out, size_t row_size)
+{
+    uint8_t **in = rows + f->bounds[scaled_y*2];
+    const unsigned int n = f->bounds[scaled_y*2+1];
+    const int16_t *weights = f->weights + scaled_y * f->num_taps;
+    size_t i = 0;
+#ifdef __SSE2__
+    /* 8 pixel components at a time, multiplying and adding 2 rows per instruction */
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i rounding = _mm_set1_epi32 (1 << (WEIGHT_BITS-1));
+    for (; i + 8 <= row_size; i += 8) {
+        __m128i lo = rounding;
+        __m128i hi = rounding;
+        unsigned int j = 0;
+        for (; j + 1 < n; j += 2) {
+            const __m128i w = _mm_set1_epi32 ((uint16_t)weights[j] | (uint32_t)(uint16_t)weights[j+1] << 16);
+            const __m128i a = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)(in[j] + i)), zero);
+            const __m128i b = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)(in[j+1] + i)), zero);
+            lo = _mm_add_epi32 (lo, _mm_madd_epi16 (_mm_unpacklo_epi16 (a, b), w));
+            hi = _mm_add_epi32 (hi, _mm_madd_epi16 (_mm_unpackhi_epi16 (a, b), w));
+        }
+        if (j < n) {
+            const __m128i w = _mm_set1_epi32 ((uint16_t)weights[j]);
+            const __m128i a = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)(in[j] + i)), zero);
+            lo = _mm_add_epi32 (lo, _mm_madd_epi16 (_mm_unpacklo_epi16 (a, zero), w));
+            hi = _mm_add_epi32 (hi, _mm_madd_epi16 (_mm_unpackhi_epi16 (a, zero), w));
+        }
+        lo = _mm_srai_epi32 (lo, WEIGHT_BITS);
+        hi = _mm_srai_epi32 (hi, WEIGHT_BITS);
+        _mm_storel_epi64 ((__m128i *)(out + i), _mm_packus_epi16 (_mm_packs_epi32 (lo, hi), zero));
+    }
+#endif
+    for (; i < row_size; i++) {
+        int32_t value = 1 << (WEIGHT_BITS-1);
+        for (unsigned int j = 0; j < n; j++) {
+            value += in[j][i] * weights[j];
+        }
+        out[i] = clamp_pixel (value);
+    }
+}
+
+static void
+filter_horizontal (const filter_t *f, const uint8_t *row, uint8_t *out, unsigned int scaled_width, unsigned int num_components)
+{
+    for (unsigned int x = 0; x < scaled_width; x++) {
+        const uint8_t *in = row + f->bounds[x*2] * num_components;
+        const unsigned int n = f->bounds[x*2+1];
+        const int16_t *weights = f->weights + x * f->num_taps;
+        int32_t value[4] = {1 << (WEIGHT_BITS-1), 1 << (WEIGHT_BITS-1), 1 << (WEIGHT_BITS-1), 1 << (WEIGHT_BITS-1)};
+        for (unsigned int j = 0; j < n; j++, in += num_components) {
+            for (unsigned int component = 0; component < num_components; component++) {
+                value[component] += in[component] * weights[j];
+            }
+        }
+        for (unsigned int component = 0; component < num_components; component++) {
+            *out++ = clamp_pixel (value[component]);
+        }
+    }
+}
+
+static void
+resampler_row (resampler_t *r, uint8_t **rows, unsigned int scaled_y, uint8_t *out)
+{
+    filter_vertical (&r->y, rows, scaled_y, r->column, r->width * r->num_components);
+    filter_horizontal (&r->x, r->column, out, r->scaled_width, r->num_components);
+}
+
+typedef struct {
+    struct jpeg_error_mgr pub;	/* "public" fields */
+    jmp_buf setjmp_buffer;	/* for return to caller */
+} my_error_mgr_t;
+
+METHODDEF (void)
+my_error_exit (j_common_ptr cinfo)
+{
+  /* cinfo->err really points to a my_error_mgr struct, so coerce pointer */
+  my_error_mgr_t *myerr = (my_error_mgr_t *) cinfo->err;
+
+//  (*cinfo->err->output_message)(cinfo);
+
+  /* Return control to the setjmp point */
+  longjmp (myerr->setjmp_buffer, 1);
+}
+
+static int
+jpeg_resize (const char *fname, const char *outname, int scaled_size, int towards_longer) {
+    trace ("resizing %s into %s\n", fname, outname);
+    FILE *volatile fp = NULL;
+    FILE *volatile out = NULL;
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_compress_struct cinfo_out;
+    JSAMPLE *volatile pixels = NULL;
+    JSAMPROW *volatile rows = NULL;
+    JSAMPLE *volatile out_row = NULL;
+    resampler_t resampler;
+    my_error_mgr_t jerr;
+
+    memset (&resampler, 0, sizeof (resampler));
+    cinfo.mem = cinfo_out.mem = NULL;
+    cinfo_out.err = cinfo.err = jpeg_std_error (&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+    if (setjmp (jerr.setjmp_buffer)) {
+        trace ("failed to scale %s as jpeg\n", outname);
+        jpeg_destroy_decompress (&cinfo);
+        jpeg_destroy_compress (&cinfo_out);
+        resampler_free (&resampler);
+        free (pixels);
+        free (rows);
+        free (out_row);
+        if (fp) {
+            fclose (fp);
+        }
+        if (out) {
+            fclose (out);
+        }
+        return -1;
+    }
+
+    fp = fopen (fname, "rb");
+    if (!fp) {
+        return -1;
+    }
+    out = fopen (outname, "w+b");
+    if (!out) {
+        fclose (fp);
+        return -1;
+    }
+
+    jpeg_create_decompress (&cinfo);
+    jpeg_create_compress (&cinfo_out);
+
+    jpeg_stdio_src (&cinfo, fp);
+    jpeg_stdio_dest (&cinfo_out, out);
+
+    jpeg_read_header (&cinfo, TRUE);
+
+    unsigned int scaled_width, scaled_height;
+    float scaling_ratio = scale_dimensions (scaled_size, towards_longer, cinfo.image_width, cinfo.image_height, &scaled_width, &scaled_height);
+    if (invalid_dimensions (scaling_ratio, scaled_width, scaled_height)) {
+        my_error_exit ((j_common_ptr)&cinfo);
+    }
+
+    /* Let libjpeg do the bulk of a large downscale in the DCT domain, decoding at 1/2, 1/4 or 1/8 size */
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1;
+    while (cinfo.scale_denom < 8 && cinfo.image_width >= scaled_width * cinfo.scale_denom * 2 && cinfo.image_height >= scaled_height * cinfo.scale_denom * 2) {
+        cinfo.scale_denom *= 2;
+    }
+    jpeg_start_decompress (&cinfo);
+
+    const unsigned int num_components = cinfo.output_components;
+    const unsigned int width = cinfo.output_width;
+    const unsigned int height = cinfo.output_height;
+    trace ("decoding %ux%u at 1/%u: %ux%u\n", cinfo.image_width, cinfo.image_height, cinfo.scale_denom, width, height);
+
+    const size_t row_size = width * num_components;
+    pixels = malloc (height * row_size * sizeof (JSAMPLE));
+    rows = malloc (height * sizeof (JSAMPROW));
+    out_row = malloc (scaled_width * num_components * sizeof (JSAMPLE));
+    if (!pixels || !rows || !out_row || resampler_init (&resampler, width, height, scaled_width, scaled_height, num_components)) {
+        my_error_exit ((j_common_ptr)&cinfo);
+    }
+    for (unsigned int y = 0; y < height; y++) {
+        rows[y] = pixels + y * row_size;
+    }
+    while (cinfo.output_scanline < height) {
+        jpeg_read_scanlines (&cinfo, rows + cinfo.output_scanline, height - cinfo.output_scanline);
+    }
+
+    cinfo_out.image_width      = scaled_width;
+    cinfo_out.image_height     = scaled_height;
+    cinfo_out.input_components = num_components;
+    cinfo_out.in_color_space   = cinfo.out_color_space;
+    jpeg_set_defaults (&cinfo_out);
+    jpeg_set_quality (&cinfo_out, 95, TRUE);
+    jpeg_start_compress (&cinfo_out, TRUE);
+
+    JSAMPROW row = out_row;
+    for (unsigned int scaled_y = 0; scaled_y < scaled_height; scaled_y++) {
+        resampler_row (&resampler, rows, scaled_y, row);
+        jpeg_write_scanlines (&cinfo_out, &row, 1);
+    }
+
+    jpeg_finish_compress (&cinfo_out);
+    jpeg_finish_decompress (&cinfo);
+
+    jpeg_destroy_compress (&cinfo_out);
+    jpeg_destroy_decompress (&cinfo);
+    resampler_free (&resampler);
+    free (pixels);
+    free (rows);
+    free (out_row);
+
+    fclose (fp);
+    fclose (out);
+
+    return 0;
+}
+
+static int
+png_resize (const char *fname, const char *outname, int scaled_size, int towards_longer) {
+    png_structp png_ptr = NULL, new_png_ptr = NULL;
+    png_infop info_ptr = NULL, new_info_ptr = NULL;
+    png_uint_32 height, width;
+    int bit_depth, color_type;
+    int err = -1;
+    FILE *fp = NULL;
+    FILE *out = NULL;
+    png_byte *out_row = NULL;
+    resampler_t resampler;
+
+    memset (&resampler, 0, sizeof (resampler));
+    fp = fopen (fname, "rb");
+    if (!fp) {
+        trace ("failed to open %s for reading\n", fname);
+        goto error;
+    }
+
+    png_ptr = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr) {
+        trace ("failed to create PNG read struct\n");
+        goto error;
+    }
+
+    if (setjmp (png_jmpbuf ((png_ptr))))
+    {
+        trace ("failed to read %s as png\n", fname);
+        goto error;
+    }
+
+    png_init_io (png_ptr, fp);
+
+    info_ptr = png_create_info_struct (png_ptr);
+    if (!info_ptr) {
+        trace ("failed to create PNG info struct\n");
+        goto error;
+    }
+
+    png_read_png (png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16|PNG_TRANSFORM_PACKING|PNG_TRANSFORM_EXPAND, NULL);
+    png_bytep *row_pointers = png_get_rows (png_ptr, info_ptr);
+    png_get_IHDR (png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
+
+    unsigned int scaled_width, scaled_height;
+    float scaling_ratio = scale_dimensions (scaled_size, towards_longer, width, height, &scaled_width, &scaled_height);
+    if (invalid_dimensions (scaling_ratio, scaled_width, scaled_height)) {
+        goto error;
+    }
+
+    out = fopen (outname, "w+b");
+    if (!out) {
+        trace ("failed to open %s for writing\n", outname);
+        goto error;
+    }
+
+    new_png_ptr = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!new_png_ptr) {
+        trace ("failed to create png write struct\n");
+        goto error;
+    }
+
+    if (setjmp (png_jmpbuf ((new_png_ptr))))
+    {
+        trace ("failed to write %s as png\n", outname);
+        goto error;
+    }
+
+    png_init_io (new_png_ptr, out);
+
+    new_info_ptr = png_create_info_struct (new_png_ptr);
+    if (!new_info_ptr) {
+        trace ("failed to create png info struct for writing\n");
+        goto error;
+    }
+
+    png_set_IHDR (new_png_ptr, new_info_ptr, scaled_width, scaled_height, bit_depth, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info (new_png_ptr, new_info_ptr);
+    png_set_packing (new_png_ptr);
+
+    const uint8_t has_alpha = color_type & PNG_COLOR_MASK_ALPHA;
+    const uint8_t num_values = color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA ? 1 : 3;
+    const uint8_t num_components = num_values + (has_alpha ? 1 : 0);
+    const uint_fast32_t scaled_row_components = scaled_width * num_components;
+    out_row = malloc (scaled_row_components * sizeof (png_byte));
+    if (!out_row || resampler_init (&resampler, width, height, scaled_width, scaled_height, num_components)) {
+        goto error;
+    }
+
+    if (has_alpha) {
+        /* Alpha-weight partially transparent pixels to avoid background colour bleeding */
+        for (png_uint_32 y = 0; y < height; y++) {
+            png_byte *row = row_pointers[y];
+            for (uint_fast32_t x_index = 0; x_index < width*num_components; x_index+=num_components) {
+                const png_byte alpha = row[x_index + num_values];
+                if (alpha < 255) {
+                    for (uint_fast8_t component = 0; component < num_values; component++) {
+                        row[x_index + component] = (row[x_index + component] * alpha + 127) / 255;
+                    }
+                }
+            }
+        }
+    }
+
+    for (unsigned int scaled_y = 0; scaled_y < scaled_height; scaled_y++) {
+        resampler_row (&resampler, row_pointers, scaled_y, out_row);
+        if (has_alpha) {
+            for (uint_fast32_t scaled_x = 0; scaled_x < scaled_row_components; scaled_x+=num_components) {
+                const png_byte alpha = out_row[scaled_x + num_values];
+                if (alpha < 255) {
+                    for (uint_fast8_t component = 0; component < num_values; component++) {
+                        /* Fully transparent pixels come out black */
+                        const uint_fast32_t value = alpha ? (out_row[scaled_x + component] * 255 + alpha/2) / alpha : 0;
+                        out_row[scaled_x + component] = value > 255 ? 255 : value;
+                    }
+                }
+            }
+        }
+        png_write_row (new_png_ptr, out_row);
+    }
+
+    png_write_end (new_png_ptr, new_info_ptr);
+
+    err = 0;
+error:
+    if (out) {
+        fclose (out);
+    }
+    if (fp) {
+        fclose (fp);
+    }
+    if (png_ptr) {
+        png_destroy_read_struct (&png_ptr, &info_ptr, NULL);
+    }
+    if (new_png_ptr) {
+        png_destroy_write_struct (&new_png_ptr, &new_info_ptr);
+    }
+    if (out_row) {
+        free (out_row);
+    }
+    resampler_free (&resampler);
+
+    return err;
+}
+
+#else
+
+static int
+imlib_resize (const char *in, const char *out, int img_size, int towards_longer)
+{
+    Imlib_Image img = imlib_load_image_immediately (in);
+    if (!img) {
+        trace ("file %s not found, or imlib2 can't load it\n", in);
+        return -1;
+    }
+    imlib_context_set_image (img);
+
+    int w = imlib_image_get_width ();
+    int h = imlib_image_get_height ();
+    unsigned int sw, sh;
+    float scaling_ratio = scale_dimensions (img_size, towards_longer, w, h, &sw, &sh);
+    if (invalid_dimensions (scaling_ratio, sw, sh)) {
+        imlib_free_image ();
+        return -1;
+    }
+
+    int is_jpeg = imlib_image_format () && imlib_image_format ()[0] == 'j';
+    Imlib_Image scaled = imlib_create_cropped_scaled_image (0, 0, w, h, sw, sh);
+    if (!scaled) {
+        trace ("imlib2 can't create scaled image from %s\n", in);
+        imlib_free_image ();
+        return -1;
+    }
+    imlib_context_set_image (scaled);
+
+    imlib_image_set_format (is_jpeg ? "jpg" : "png");
+    if (is_jpeg)
+        imlib_image_attach_data_value ("quality", NULL, 95, NULL);
+    Imlib_Load_Error err = 0;
+    imlib_save_image_with_error_return (out, &err);
+    if (err != 0) {
+        trace ("imlib save %s returned %d\n", out, err);
+        imlib_free_image ();
+        imlib_context_set_image (img);
+        imlib_free_image ();
+        return -1;
+    }
+
+    imlib_free_image ();
+    imlib_context_set_image (img);
+    imlib_free_image ();
+    return 0;
+}
+#endif
+
+int
+scale_image (const char *in, const char *out, int scaled_size, int towards_longer)
+{
+#ifdef USE_IMLIB2
+    return imlib_resize (in, out, scaled_size, towards_longer);
+#else
+    int err = jpeg_resize (in, out, scaled_size, towards_longer);
+    if (err != 0) {
+        unlink (out);
+        err = png_resize (in, out, scaled_size, towards_longer);
+        if (err != 0) {
+            unlink (out);
+        }
+    }
+    return err;
+#endif
+}
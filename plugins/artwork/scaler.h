@@ -0,0 +1,32 @@
+/*
+    Album Art plugin for DeaDBeeF
+    Copyright (C) 2009-2011 Viktor Semykin <thesame.ml@gmail.com>
+    Copyright (C) 2009-2013 Alexey Yakovenko <waker@users.sourceforge.net>
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef __ARTWORK_SCALER_H
+#define __ARTWORK_SCALER_H
+
+// scales a jpeg or png file so that the shorter side (or the longer side, if
+// towards_longer is set) is scaled_size pixels, and writes it to out in the
+// same format; returns 0 on success
+int scale_image(const char *in, const char *out, int scaled_size, int towards_longer);
+
+#endif /*__ARTWORK_SCALER_H*/
@@ -0,0 +1,234 @@
+/*
+    Album Art plugin for DeaDBeeF
+    Copyright (C) 2009-2013 Alexey Yakovenko <waker@users.sourceforge.net>
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+// Cover art scaling benchmark, run by "make bench".
+// Every cover is scaled to each of the usual display sizes several times,
+// and the fastest run is reported.
+
+#ifdef HAVE_CONFIG_H
+    #include "../../config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef USE_IMLIB2
+    #include <jpeglib.h>
+    #include <png.h>
+#endif
+#include "scaler.h"
+
+#define BENCH_DEFAULT_REPEAT 5
+
+static const int scaled_sizes[] = { 64, 128, 300 };
+static int repeat = BENCH_DEFAULT_REPEAT;
+
+static int64_t
+bench_time (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifndef USE_IMLIB2
+// gradients, hard edges and some noise, so that neither the encoders nor the
+// filters get an easy ride
+static void
+fill_row (uint8_t *row, int y, int size, int num_components, uint32_t *seed) {
+    for (int x = 0; x < size; x++) {
+        const int cell = ((x * 8 / size) ^ (y * 8 / size)) & 1;
+        *seed = *seed * 1103515245 + 12345;
+        const int noise = (*seed >> 16) & 15;
+        row[0] = x * 255 / size;
+        row[1] = cell ? 200 + noise : 40 + noise;
+        row[2] = y * 255 / size;
+        if (num_components == 4) {
+            row[3] = cell ? 255 : x * 255 / size;
+        }
+        row += num_components;
+    }
+}
+
+static int
+write_jpeg (const char *fname, int size) {
+    FILE *fp = fopen (fname, "wb");
+    if (!fp) {
+        return -1;
+    }
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error (&jerr);
+    jpeg_create_compress (&cinfo);
+    jpeg_stdio_dest (&cinfo, fp);
+    cinfo.image_width = size;
+    cinfo.image_height = size;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults (&cinfo);
+    jpeg_set_quality (&cinfo, 90, TRUE);
+    jpeg_start_compress (&cinfo, TRUE);
+    JSAMPROW row = malloc (size * 3);
+    uint32_t seed = size;
+    for (int y = 0; y < size; y++) {
+        fill_row (row, y, size, 3, &seed);
+        jpeg_write_scanlines (&cinfo, &row, 1);
+    }
+    free (row);
+    jpeg_finish_compress (&cinfo);
+    jpeg_destroy_compress (&cinfo);
+    return fclose (fp) ? -1 : 0;
+}
+
+static int
+write_png (const char *fname, int size) {
+    FILE *fp = fopen (fname, "wb");
+    if (!fp) {
+        return -1;
+    }
+    png_structp png_ptr = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_ptr = png_ptr ? png_create_info_struct (png_ptr) : NULL;
+    png_bytep row = malloc (size * 4);
+    if (!info_ptr || !row || setjmp (png_jmpbuf (png_ptr))) {
+        png_destroy_write_struct (&png_ptr, &info_ptr);
+        free (row);
+        fclose (fp);
+        return -1;
+    }
+    png_init_io (png_ptr, fp);
+    png_set_IHDR (png_ptr, info_ptr, size, size, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info (png_ptr, info_ptr);
+    uint32_t seed = size;
+    for (int y = 0; y < size; y++) {
+        fill_row (row, y, size, 4, &seed);
+        png_write_row (png_ptr, row);
+    }
+    png_write_end (png_ptr, info_ptr);
+    png_destroy_write_struct (&png_ptr, &info_ptr);
+    free (row);
+    return fclose (fp) ? -1 : 0;
+}
+
+static int
+write_covers (const char *dir) {
+    static const int jpeg_sizes[] = { 500, 1000, 1500, 3000 };
+    static const int png_sizes[] = { 500, 1500 };
+    char fname[PATH_MAX];
+    for (int i = 0; i < sizeof (jpeg_sizes) / sizeof (jpeg_sizes[0]); i++) {
+        snprintf (fname, sizeof (fname), "%s/cover-%d.jpg", dir, jpeg_sizes[i]);
+        if (write_jpeg (fname, jpeg_sizes[i])) {
+            fprintf (stderr, "scaler_bench: failed to write %s\n", fname);
+            return -1;
+        }
+    }
+    for (int i = 0; i < sizeof (png_sizes) / sizeof (png_sizes[0]); i++) {
+        snprintf (fname, sizeof (fname), "%s/cover-%d.png", dir, png_sizes[i]);
+        if (write_png (fname, png_sizes[i])) {
+            fprintf (stderr, "scaler_bench: failed to write %s\n", fname);
+            return -1;
+        }
+    }
+    return 0;
+}
+#else
+static int
+write_covers (const char *dir) {
+    fprintf (stderr, "scaler_bench: generating covers requires the libjpeg/libpng build\n");
+    return -1;
+}
+#endif
+
+static int
+bench_file (const char *fname, const char *out) {
+    const char *name = strrchr (fname, '/');
+    name = name ? name + 1 : fname;
+    int res = 0;
+    for (int i = 0; i < sizeof (scaled_sizes) / sizeof (scaled_sizes[0]); i++) {
+        int64_t best = -1;
+        for (int r = 0; r < repeat; r++) {
+            int64_t start = bench_time ();
+            int err = scale_image (fname, out, scaled_sizes[i], 0);
+            int64_t ns = bench_time () - start;
+            unlink (out);
+            if (err) {
+                best = -1;
+                break;
+            }
+            if (best < 0 || ns < best) {
+                best = ns;
+            }
+        }
+        if (best < 0) {
+            printf ("%-24s %5d px %12s\n", name, scaled_sizes[i], "failed");
+            res = 1;
+            break;
+        }
+        printf ("%-24s %5d px %12.2f ms\n", name, scaled_sizes[i], best / 1000000.0);
+    }
+    return res;
+}
+
+static void
+print_usage (void) {
+    fprintf (stderr, "usage: scaler_bench [-r REPEAT] cover(s)\n");
+    fprintf (stderr, "       scaler_bench -w directory\n");
+}
+
+int
+main (int argc, char *argv[]) {
+    int first = 1;
+    while (first < argc && argv[first][0] == '-') {
+        if (!strcmp (argv[first], "-w") && first + 1 < argc) {
+            return write_covers (argv[first+1]) ? 1 : 0;
+        }
+        else if (!strcmp (argv[first], "-r") && first + 1 < argc) {
+            repeat = atoi (argv[first+1]);
+            if (repeat < 1) {
+                repeat = 1;
+            }
+            first += 2;
+        }
+        else {
+            print_usage ();
+            return 1;
+        }
+    }
+    if (first >= argc) {
+        print_usage ();
+        return 1;
+    }
+
+    const char *tmpdir = getenv ("TMPDIR");
+    char out[PATH_MAX];
+    snprintf (out, sizeof (out), "%s/scaler_bench.%d", tmpdir ? tmpdir : "/tmp", (int)getpid ());
+
+    int res = 0;
+    for (int i = first; i < argc; i++) {
+        if (bench_file (argv[i], out)) {
+            res = 1;
+        }
+    }
+    return res;
+}
@@ -1874,9 +1874,7 @@ static int ffap_read_metadata (DB_playItem_t *it) {
         return -1;
     }
     deadbeef->pl_delete_all_meta (it);
-    /*int apeerr = */deadbeef->junk_apev2_read (it, fp);
-    /*int v2err = */deadbeef->junk_id3v2_read (it, fp);
-    /*int v1err = */deadbeef->junk_id3v1_read (it, fp);
+    deadbeef->junk_read_tags (it, fp);
     deadbeef->pl_add_meta (it, "title", NULL);
     deadbeef->fclose (fp);
     return 0;
@@ -1919,7 +1917,7 @@ static const char *exts[] = { "ape", NULL };
 // define plugin interface
 static DB_decoder_t plugin = {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 0,
+    .plugin.api_vminor = 10,
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DECODER,
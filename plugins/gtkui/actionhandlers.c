@@ -66,9 +66,12 @@ file_filter_func (const GtkFileFilterInfo *filter_info, gpointer data) {
     }
 
 
-    DB_decoder_t **codecs = deadbeef->plug_get_decoder_list ();
+    // the decoders which are loaded on first use don't need to be loaded here,
+    // their stubs have no callbacks, but all of them can insert files
+    DB_decoder_t **codecs = deadbeef->plug_get_decoder_info_list ();
     for (int i = 0; codecs[i]; i++) {
-        if (codecs[i]->exts && codecs[i]->insert) {
+        int can_insert = codecs[i]->insert || !codecs[i]->open;
+        if (codecs[i]->exts && can_insert) {
             const char **exts = codecs[i]->exts;
             for (int e = 0; exts[e]; e++) {
                 if (!strcasecmp (exts[e], p)) {
@@ -76,7 +79,7 @@ file_filter_func (const GtkFileFilterInfo *filter_info, gpointer data) {
                 }
             }
         }
-        if (codecs[i]->prefixes && codecs[i]->insert) {
+        if (codecs[i]->prefixes && can_insert) {
             const char **prefixes = codecs[i]->prefixes;
             for (int e = 0; prefixes[e]; e++) {
                 if (!strncasecmp (prefixes[e], fn, strlen(prefixes[e])) && *(fn + strlen (prefixes[e])) == '.') {
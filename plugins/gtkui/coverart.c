@@ -21,7 +21,8 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
-#include <sys/time.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -39,13 +40,16 @@
 
 static DB_artwork_plugin_t *artwork_plugin;
 
-typedef struct {
-    struct timeval tm;
+typedef struct cached_pixbuf_s {
     time_t file_time;
     char *fname;
     int width;
     int height;
+    size_t bytes;
     GdkPixbuf *pixbuf;
+    struct cached_pixbuf_s *bucket_next;
+    struct cached_pixbuf_s *lru_prev; // more recently used
+    struct cached_pixbuf_s *lru_next; // less recently used
 } cached_pixbuf_t;
 
 typedef enum {
@@ -53,12 +57,26 @@ typedef enum {
     CACHE_TYPE_THUMB
 } cache_type_t;
 
-#define PRIMARY_CACHE_SIZE 1
-static size_t thumb_cache_size;
-static cached_pixbuf_t primary_cache[PRIMARY_CACHE_SIZE];
-static cached_pixbuf_t *thumb_cache;
+#define CACHE_HASH_SIZE 1024
+#define DEFAULT_THUMB_CACHE_MB 32
+
+/* Pixbufs are hashed by file name, all the sizes of one file are in the same bucket */
+typedef struct {
+    cached_pixbuf_t *buckets[CACHE_HASH_SIZE];
+    cached_pixbuf_t *lru_head;
+    cached_pixbuf_t *lru_tail;
+    size_t entries;
+    size_t bytes;
+    size_t peak_bytes;
+    size_t max_bytes;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} pixbuf_cache_t;
+
+/* The primary cache has no byte budget, so it only keeps the most recent pixbuf */
+static pixbuf_cache_t pixbuf_caches[2];
 static GdkPixbuf *pixbuf_default;
-static size_t thrash_count;
 
 typedef struct cover_callback_s {
     cover_avail_callback_t cb;
@@ -237,122 +255,133 @@ queue_pop (void)
     }
 }
 
-static cached_pixbuf_t *
+static pixbuf_cache_t *
 cache_location(cache_type_t cache_type)
 {
-    return cache_type == CACHE_TYPE_PRIMARY ? primary_cache : thumb_cache;
+    return &pixbuf_caches[cache_type == CACHE_TYPE_PRIMARY ? CACHE_TYPE_PRIMARY : CACHE_TYPE_THUMB];
 }
 
-static size_t
-cache_elements(cache_type_t cache_type)
+static cached_pixbuf_t **
+cache_bucket(pixbuf_cache_t *cache, const char *fname)
 {
-    return cache_type == CACHE_TYPE_PRIMARY ? PRIMARY_CACHE_SIZE : thumb_cache_size;
+    return &cache->buckets[g_str_hash(fname) & (CACHE_HASH_SIZE-1)];
 }
 
-static int
-cache_qsort(const void *a, const void *b)
+static void
+lru_unlink(pixbuf_cache_t *cache, cached_pixbuf_t *cached)
 {
-    const cached_pixbuf_t *x = (cached_pixbuf_t *)a;
-    const cached_pixbuf_t *y = (cached_pixbuf_t *)b;
-    if (x->pixbuf && y->pixbuf) {
-        const int cmp = strcmp(x->fname, y->fname);
-        if (cmp) {
-            return cmp;
-        }
-
-        if (y->width != x->width) {
-            return y->width - x->width;
-        }
-
-        return y->height - x->height;
+    if (cached->lru_prev) {
+        cached->lru_prev->lru_next = cached->lru_next;
+    }
+    else {
+        cache->lru_head = cached->lru_next;
+    }
+    if (cached->lru_next) {
+        cached->lru_next->lru_prev = cached->lru_prev;
+    }
+    else {
+        cache->lru_tail = cached->lru_prev;
     }
-
-    return x->pixbuf ? -1 : y->pixbuf ? 1 : 0;
 }
 
-static int
-timeval_older(const struct timeval *tm1, const struct timeval *tm2)
+static void
+lru_push(pixbuf_cache_t *cache, cached_pixbuf_t *cached)
 {
-    return tm1->tv_sec < tm2->tv_sec || tm1->tv_sec == tm2->tv_sec && tm1->tv_usec < tm2->tv_usec;
+    cached->lru_prev = NULL;
+    cached->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = cached;
+    }
+    else {
+        cache->lru_tail = cached;
+    }
+    cache->lru_head = cached;
 }
 
 static void
-evict_pixbuf(cached_pixbuf_t *cached)
+touch_pixbuf(pixbuf_cache_t *cache, cached_pixbuf_t *cached)
 {
-    trace("covercache: evict %s\n", cached->fname);
-    g_object_unref(cached->pixbuf);
-    cached->pixbuf = NULL;
-    free(cached->fname);
+    if (cache->lru_head != cached) {
+        lru_unlink(cache, cached);
+        lru_push(cache, cached);
+    }
 }
 
-static cached_pixbuf_t *
-oldest_slot(cached_pixbuf_t *cache, const size_t cache_size)
+static size_t
+pixbuf_bytes(GdkPixbuf *pixbuf, const char *fname)
 {
-    cached_pixbuf_t *oldest_slot = cache;
-    for (size_t i = 1; i < cache_size; i++) {
-        if (timeval_older(&cache[i].tm, &oldest_slot->tm)) {
-            oldest_slot = cache + i;
-        }
+    /* The default pixbuf is shared, only the bookkeeping is charged for it */
+    size_t bytes = sizeof(cached_pixbuf_t) + strlen(fname) + 1;
+    if (pixbuf != pixbuf_default) {
+        bytes += (size_t)gdk_pixbuf_get_rowstride(pixbuf) * gdk_pixbuf_get_height(pixbuf);
     }
-    return oldest_slot;
+    return bytes;
 }
 
-static int
-adjust_cache(struct timeval *oldest)
+static void
+evict_pixbuf(pixbuf_cache_t *cache, cached_pixbuf_t *cached)
 {
-    /* A possible thrash is when the oldest pixbuf is still fresh */
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    now.tv_sec -= 2 + thumb_cache_size / 10;
-    thrash_count = timeval_older(&now, oldest) ? thrash_count+1 : 0;
-
-    /* Grab more space more quickly at small cache sizes */
-    if (thrash_count*2 >= thumb_cache_size) {
-        cached_pixbuf_t *new_thumb_cache = realloc(thumb_cache, sizeof(cached_pixbuf_t) * thumb_cache_size * 2);
-        if (new_thumb_cache) {
-            memset(&new_thumb_cache[thumb_cache_size], '\0', sizeof(cached_pixbuf_t) * thumb_cache_size);
-            thumb_cache_size *= 2;
-            thumb_cache = new_thumb_cache;
-            trace("coverart: pixbuf cache size increased to %d\n", (int)thumb_cache_size);
-            return 1;
-        }
+    trace("covercache: evict %s\n", cached->fname);
+    cached_pixbuf_t **prev = cache_bucket(cache, cached->fname);
+    while (*prev != cached) {
+        prev = &(*prev)->bucket_next;
     }
+    *prev = cached->bucket_next;
+    lru_unlink(cache, cached);
+    cache->entries--;
+    cache->bytes -= cached->bytes;
 
-    return 0;
+    g_object_unref(cached->pixbuf);
+    free(cached->fname);
+    free(cached);
+}
+
+/* Evict the least recently used pixbufs until the cache is back within its budget, never evicting keep */
+static void
+cache_trim(pixbuf_cache_t *cache, const cached_pixbuf_t *keep)
+{
+    while (cache->bytes > cache->max_bytes && cache->lru_tail && cache->lru_tail != keep) {
+        evict_pixbuf(cache, cache->lru_tail);
+        cache->evictions++;
+    }
 }
 
 static void
 cache_add(cache_type_t cache_type, GdkPixbuf *pixbuf, char *fname, const time_t file_time, int width, int height)
 {
-    cached_pixbuf_t *cache = cache_location(cache_type);
-    size_t cache_size = cache_elements(cache_type);
-    cached_pixbuf_t *cache_slot = &cache[cache_size-1];
-
-    /* If the last slot is filled then evict the oldest entry */
-    if (cache_slot->pixbuf) {
-        if (cache_type == CACHE_TYPE_THUMB) {
-            cache_slot = oldest_slot(cache, cache_size);
-            if (adjust_cache(&cache_slot->tm)) {
-                cache = cache_location(cache_type);
-                cache_slot = &cache[cache_size];
-                cache_size = cache_elements(cache_type);
-            }
-        }
-        if (cache_slot->pixbuf) {
-            evict_pixbuf(cache_slot);
+    pixbuf_cache_t *cache = cache_location(cache_type);
+    cached_pixbuf_t **bucket = cache_bucket(cache, fname);
+
+    /* Replace any pixbuf of the same size which was loaded meanwhile */
+    for (cached_pixbuf_t *cached = *bucket; cached; cached = cached->bucket_next) {
+        if (cached->width == width && cached->height == height && !strcmp(cached->fname, fname)) {
+            evict_pixbuf(cache, cached);
+            break;
         }
     }
 
-    /* Set the pixbuf in the cache slot */
-    cache_slot->pixbuf = pixbuf;
-    cache_slot->fname = fname;
-    cache_slot->file_time = file_time;
-    gettimeofday(&cache_slot->tm, NULL);
-    cache_slot->width = width;
-    cache_slot->height = height;
+    cached_pixbuf_t *cached = malloc(sizeof(cached_pixbuf_t));
+    if (!cached) {
+        g_object_unref(pixbuf);
+        free(fname);
+        return;
+    }
+    cached->pixbuf = pixbuf;
+    cached->fname = fname;
+    cached->file_time = file_time;
+    cached->width = width;
+    cached->height = height;
+    cached->bytes = pixbuf_bytes(pixbuf, fname);
+    cached->bucket_next = *bucket;
+    *bucket = cached;
+    lru_push(cache, cached);
+    cache->entries++;
+    cache->bytes += cached->bytes;
+    if (cache->bytes > cache->peak_bytes) {
+        cache->peak_bytes = cache->bytes;
+    }
 
-    /* Sort by fname, largest first, with empty slots at the end */
-    qsort(cache, cache_size, sizeof(cached_pixbuf_t), cache_qsort);
+    cache_trim(cache, cached);
 }
 
 static void
@@ -422,24 +451,25 @@ loading_thread (void *none) {
 static GdkPixbuf *
 get_pixbuf (cache_type_t cache_type, const char *fname, int width, int height) {
     /* Look in the pixbuf cache */
-    cached_pixbuf_t *cache = cache_location(cache_type);
-    const size_t cache_size = cache_elements(cache_type);
-    for (size_t i = 0; i < cache_size && cache[i].pixbuf; i++) {
+    pixbuf_cache_t *cache = cache_location(cache_type);
+    for (cached_pixbuf_t *cached = *cache_bucket(cache, fname); cached; cached = cached->bucket_next) {
         /* Look for a cached pixbuf that matches the filename and size required */
-        if (!strcmp(cache[i].fname, fname) && (cache[i].width == -1 || cache[i].width == width && cache[i].height == height)) {
+        if (!strcmp(cached->fname, fname) && (cached->width == -1 || cached->width == width && cached->height == height)) {
             struct stat stat_buf;
             /* Keep the pixbuf for now if the disk file is missing */
-            if (stat(fname, &stat_buf) || stat_buf.st_mtime == cache[i].file_time) {
-                gettimeofday(&cache[i].tm, NULL);
-                return cache[i].pixbuf;
+            if (stat(fname, &stat_buf) || stat_buf.st_mtime == cached->file_time) {
+                touch_pixbuf(cache, cached);
+                return cached->pixbuf;
             }
             /* Discard all pixbufs for this file if the disk modification time doesn't match */
-            for (size_t j = 0; j < cache_size && cache[j].pixbuf; j++) {
-                if (!strcmp(cache[j].fname, fname)) {
-                    evict_pixbuf(&cache[j]);
+            cached_pixbuf_t *next;
+            for (cached = *cache_bucket(cache, fname); cached; cached = next) {
+                next = cached->bucket_next;
+                if (!strcmp(cached->fname, fname)) {
+                    evict_pixbuf(cache, cached);
                 }
             }
-            qsort(cache, cache_size, sizeof(cached_pixbuf_t), cache_qsort);
+            return NULL;
         }
     }
     return NULL;
@@ -499,15 +529,18 @@ static GdkPixbuf *
 best_cached_pixbuf(cache_type_t cache_type, const char *path)
 {
     /* Find the largest pixbuf in the cache for this file */
-    cached_pixbuf_t *cache = cache_location(cache_type);
-    const size_t cache_size = cache_elements(cache_type);
-    for (size_t i = 0; i < cache_size && cache[i].pixbuf; i++) {
-        if (!strcmp(cache[i].fname, path)) {
-            g_object_ref(cache[i].pixbuf);
-            return cache[i].pixbuf;
+    pixbuf_cache_t *cache = cache_location(cache_type);
+    cached_pixbuf_t *best = NULL;
+    for (cached_pixbuf_t *cached = *cache_bucket(cache, path); cached; cached = cached->bucket_next) {
+        if (!strcmp(cached->fname, path) && (!best || cached->width > best->width)) {
+            best = cached;
         }
     }
 
+    if (best) {
+        g_object_ref(best->pixbuf);
+        return best->pixbuf;
+    }
     return NULL;
 }
 
@@ -555,7 +588,15 @@ get_cover_art_int(cache_type_t cache_type, const char *fname, const char *artist
     /* Get a pixbuf of an exact size (or the default pixbuf) */
     trace("coverart: get_album_art for %s %s %s %ix%i\n", fname, artist, album, width, height);
     cover_avail_info_t *dt = cover_avail_info(cache_type, strdup(cache_path), width, height, callback, user_data);
-    char *image_fname = artwork_plugin->get_album_art(fname, artist, album, -1, album_art_avail_callback, dt);
+    char *image_fname;
+    if (PLUG_TEST_COMPAT(&artwork_plugin->plugin.plugin, 1, 3)) {
+        /* The now playing cover goes ahead of the playlist thumbnails */
+        const int priority = cache_type == CACHE_TYPE_PRIMARY ? ARTWORK_PRIORITY_HIGH : ARTWORK_PRIORITY_NORMAL;
+        image_fname = artwork_plugin->get_album_art2(fname, artist, album, -1, priority, album_art_avail_callback, dt);
+    }
+    else {
+        image_fname = artwork_plugin->get_album_art(fname, artist, album, -1, album_art_avail_callback, dt);
+    }
     if (image_fname) {
         /* There will be no callback */
         free(dt->cache_path);
@@ -564,14 +605,19 @@ get_cover_art_int(cache_type_t cache_type, const char *fname, const char *artist
 
     deadbeef->mutex_lock(mutex);
     GdkPixbuf *pb = get_pixbuf(cache_type, cache_path, width, height);
+    pixbuf_cache_t *cache = cache_location(cache_type);
     if (pb) {
         /* We already have the proper pixbuf in memory */
+        cache->hits++;
         g_object_ref(pb);
         if (image_fname) {
             free(image_fname);
         }
     }
-    else if (image_fname) {
+    else {
+        cache->misses++;
+    }
+    if (!pb && image_fname) {
         /* Got a cached file, need to load a pixbuf into memory */
         queue_add_load(cache_type, image_fname, width, height, callback, user_data);
     }
@@ -642,10 +688,13 @@ coverart_reset_queue (void) {
             tail = queue;
         }
     }
-    thrash_count /= 2;
     deadbeef->mutex_unlock (mutex);
 
-    if (artwork_plugin) {
+    /* Thumbnails scrolled out of view are no longer needed, keep the primary requests */
+    if (artwork_plugin && PLUG_TEST_COMPAT(&artwork_plugin->plugin.plugin, 1, 3)) {
+        artwork_plugin->cancel_queries(album_art_avail_callback, ARTWORK_PRIORITY_HIGH);
+    }
+    else if (artwork_plugin) {
         artwork_plugin->reset (1);
     }
 }
@@ -659,11 +708,7 @@ cover_art_init (void) {
     if (!artwork_plugin) {
         return;
     }
-    thumb_cache_size = 2;
-    thumb_cache = calloc(2, sizeof(cached_pixbuf_t));
-    if (!thumb_cache) {
-        return;
-    }
+    cover_art_configchanged();
 
     terminate = 0;
     mutex = deadbeef->mutex_create_nonrecursive ();
@@ -684,10 +729,52 @@ cover_art_disconnect (void) {
 }
 
 static void
-clear_pixbuf_cache(cached_pixbuf_t *cache, const size_t cache_size)
+clear_pixbuf_cache(pixbuf_cache_t *cache)
 {
-    for (size_t i = 0; i < cache_size && cache[i].pixbuf; i++) {
-        evict_pixbuf(cache+i);
+    while (cache->lru_tail) {
+        evict_pixbuf(cache, cache->lru_tail);
+    }
+}
+
+void
+cover_art_configchanged (void) {
+    const int max_mb = deadbeef->conf_get_int("gtkui.coverart_cache_size", DEFAULT_THUMB_CACHE_MB);
+    const size_t max_bytes = max_mb > 0 ? (size_t)max_mb * 1024 * 1024 : SIZE_MAX;
+    if (mutex) {
+        deadbeef->mutex_lock(mutex);
+    }
+    pixbuf_caches[CACHE_TYPE_THUMB].max_bytes = max_bytes;
+    cache_trim(&pixbuf_caches[CACHE_TYPE_THUMB], NULL);
+    if (mutex) {
+        deadbeef->mutex_unlock(mutex);
+    }
+}
+
+static void
+get_cache_stats(const pixbuf_cache_t *cache, coverart_cache_stats_t *stats)
+{
+    stats->entries = cache->entries;
+    stats->bytes = cache->bytes;
+    stats->peak_bytes = cache->peak_bytes;
+    stats->max_bytes = cache->max_bytes;
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+}
+
+void
+cover_art_cache_stats (coverart_cache_stats_t *thumbs, coverart_cache_stats_t *primary) {
+    if (mutex) {
+        deadbeef->mutex_lock(mutex);
+    }
+    if (thumbs) {
+        get_cache_stats(&pixbuf_caches[CACHE_TYPE_THUMB], thumbs);
+    }
+    if (primary) {
+        get_cache_stats(&pixbuf_caches[CACHE_TYPE_PRIMARY], primary);
+    }
+    if (mutex) {
+        deadbeef->mutex_unlock(mutex);
     }
 }
 
@@ -719,10 +806,9 @@ cover_art_free (void) {
         mutex = 0;
     }
 
-    clear_pixbuf_cache(primary_cache, PRIMARY_CACHE_SIZE);
-    clear_pixbuf_cache(thumb_cache, thumb_cache_size);
-    free(thumb_cache);
-    thumb_cache_size = 0;
+    clear_pixbuf_cache(&pixbuf_caches[CACHE_TYPE_PRIMARY]);
+    clear_pixbuf_cache(&pixbuf_caches[CACHE_TYPE_THUMB]);
+    memset(pixbuf_caches, 0, sizeof(pixbuf_caches));
 
     if (pixbuf_default) {
         g_object_unref(pixbuf_default);
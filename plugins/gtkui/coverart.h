@@ -57,6 +57,24 @@ cover_art_disconnect (void);
 void
 cover_art_free (void);
 
+// re-reads gtkui.coverart_cache_size, the thumbnail pixbuf budget in MB (0 = unlimited)
+void
+cover_art_configchanged (void);
+
+typedef struct {
+    size_t entries;
+    size_t bytes;
+    size_t peak_bytes;
+    size_t max_bytes; // SIZE_MAX when unlimited
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} coverart_cache_stats_t;
+
+// pixbuf cache counters, for sizing the cache; either pointer may be NULL
+void
+cover_art_cache_stats (coverart_cache_stats_t *thumbs, coverart_cache_stats_t *primary);
+
 // simply inserts callback point into queue
 // the callback will be called when the loading queue reaches this request
 void
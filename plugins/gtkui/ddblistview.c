@@ -33,7 +33,11 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
 #include <sys/time.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 #include "ddblistview.h"
 #include "drawing.h"
 #include "gtkui.h"
@@ -106,6 +110,17 @@ static void
 ddb_listview_resize_groups (DdbListview *listview);
 static void
 ddb_listview_free_groups (DdbListview *listview);
+static void
+ddb_listview_cancel_group_build (DdbListview *listview);
+static int
+ddb_listview_groups_outdated (DdbListview *listview);
+static DdbListviewGroup *
+ddb_listview_group_for_row (DdbListview *listview, int row, int *grp_y, int *idx);
+static DdbListviewIter
+ddb_listview_get_row_iter (DdbListview *listview, int row);
+struct _DdbListviewGroupTitles;
+static void
+group_titles_clear (DdbListviewBinding *binding, struct _DdbListviewGroupTitles *titles);
 
 static void
 ddb_listview_update_fonts (DdbListview *ps);
@@ -353,6 +368,8 @@ ddb_listview_init(DdbListview *listview)
     listview->lock_columns = -1;
     listview->groups = NULL;
     listview->plt = NULL;
+    listview->group_build = NULL;
+    listview->group_titles = calloc (1, sizeof (struct _DdbListviewGroupTitles));
 
     listview->calculated_grouptitle_height = DEFAULT_GROUP_TITLE_HEIGHT;
 
@@ -365,6 +382,9 @@ ddb_listview_init(DdbListview *listview)
     listview->tf_redraw_timeout_id = 0;
     listview->tf_redraw_track_idx = -1;
 
+    listview->prefetch_id = 0;
+    listview->prefetch_scrollpos = -1;
+
     GtkWidget *hbox;
     GtkWidget *vbox;
 
@@ -525,7 +545,15 @@ ddb_listview_destroy(GObject *object)
 
     listview = DDB_LISTVIEW(object);
 
+    ddb_listview_cancel_group_build (listview);
     ddb_listview_free_groups (listview);
+    if (listview->group_titles) {
+        deadbeef->pl_lock ();
+        group_titles_clear (listview->binding, listview->group_titles);
+        deadbeef->pl_unlock ();
+        free (listview->group_titles);
+        listview->group_titles = NULL;
+    }
 
     while (listview->columns) {
         DdbListviewColumn *next = listview->columns->next;
@@ -558,6 +586,10 @@ ddb_listview_destroy(GObject *object)
         listview->binding->unref (listview->tf_redraw_track);
         listview->tf_redraw_track = NULL;
     }
+    if (listview->prefetch_id) {
+        g_source_remove (listview->prefetch_id);
+        listview->prefetch_id = 0;
+    }
     draw_free (&listview->listctx);
     draw_free (&listview->grpctx);
     draw_free (&listview->hdrctx);
@@ -632,14 +664,6 @@ next_playitem (DdbListview *listview, DdbListviewIter it) {
     return next;
 }
 
-void
-ddb_listview_groupcheck (DdbListview *listview) {
-    int idx = listview->binding->modification_idx ();
-    if (idx != listview->groups_build_idx) {
-        ddb_listview_build_groups (listview);
-    }
-}
-
 // returns 1 if X coordinate in list belongs to album art column and 0 if not
 static int
 ddb_listview_is_album_art_column (DdbListview *listview, int x)
@@ -657,20 +681,12 @@ ddb_listview_is_album_art_column (DdbListview *listview, int x)
 // returns Y coordinate of an item by its index
 int
 ddb_listview_get_row_pos (DdbListview *listview, int row_idx) {
-    int y = 0;
-    int idx = 0;
+    int y;
+    int idx;
     deadbeef->pl_lock ();
-    ddb_listview_groupcheck (listview);
-    DdbListviewGroup *grp = listview->groups;
-    while (grp) {
-        if (idx + grp->num_items > row_idx) {
-            int i = y + listview->grouptitle_height + (row_idx - idx) * listview->rowheight;
-            deadbeef->pl_unlock ();
-            return i;
-        }
-        y += grp->height;
-        idx += grp->num_items;
-        grp = grp->next;
+    ddb_listview_groupcheck_async (listview);
+    if (ddb_listview_group_for_row (listview, row_idx, &y, &idx)) {
+        y += listview->grouptitle_height + (row_idx - idx) * listview->rowheight;
     }
     deadbeef->pl_unlock ();
     return y;
@@ -681,9 +697,8 @@ ddb_listview_get_row_pos (DdbListview *listview, int row_idx) {
 // item idx may be set to -1 if group title was hit
 static void
 ddb_listview_list_pickpoint (DdbListview *listview, int x, int y, DdbListviewPickContext *pick_ctx) {
-    int idx = 0;
-    int grp_y = 0;
-    int gidx = 0;
+    int idx;
+    int grp_y;
     const int ey = y;
     const int ry = ey - listview->scrollpos;
     const int grp_title_height = listview->grouptitle_height;
@@ -714,53 +729,54 @@ ddb_listview_list_pickpoint (DdbListview *listview, int x, int y, DdbListviewPic
 
     const int is_album_art_column = ddb_listview_is_album_art_column (listview, x);
 
-    ddb_listview_groupcheck (listview);
-    DdbListviewGroup *grp = listview->groups;
-    while (grp) {
-        const int h = grp->height;
-        if (y >= grp_y && y < grp_y + h) {
-            pick_ctx->grp = grp;
-            y -= grp_y;
-            if (y < grp_title_height || (0 < ry && ry < grp_title_height && gtkui_groups_pinned)) {
-                // group title
-                pick_ctx->type = PICK_GROUP_TITLE;
-                pick_ctx->item_grp_idx = idx;
-                pick_ctx->item_idx = idx;
-                pick_ctx->grp_idx = 0;
-            }
-            else if (is_album_art_column) {
-                pick_ctx->type = PICK_ALBUM_ART;
-                pick_ctx->item_grp_idx = idx;
-                pick_ctx->grp_idx = min ((y - grp_title_height) / rowheight, grp->num_items - 1);
-                pick_ctx->item_idx = idx + pick_ctx->grp_idx;
-            }
-            else if (y >= grp_title_height + grp->num_items * rowheight) {
-                // whitespace after tracks
-                pick_ctx->type = PICK_EMPTY_SPACE;
-                pick_ctx->item_grp_idx = idx;
-                pick_ctx->grp_idx = grp->num_items - 1;
-                pick_ctx->item_idx = idx + pick_ctx->grp_idx;
-            }
-            else {
-                pick_ctx->type = PICK_ITEM;
-                pick_ctx->item_grp_idx = idx;
-                pick_ctx->grp_idx = (y - grp_title_height) / rowheight;
-                pick_ctx->item_idx = idx + pick_ctx->grp_idx;
-            }
-            deadbeef->pl_unlock ();
-            return;
+    // while a build is pending, the current groups are used even if they are
+    // stale, the rows past the end of the playlist count as empty space
+    ddb_listview_groupcheck_async (listview);
+    const int count = listview->binding->count ();
+    DdbListviewGroup *grp = ddb_listview_group_at_y (listview, y, &grp_y, &idx);
+    if (grp && idx < count) {
+        pick_ctx->grp = grp;
+        y -= grp_y;
+        if (y < grp_title_height || (0 < ry && ry < grp_title_height && gtkui_groups_pinned)) {
+            // group title
+            pick_ctx->type = PICK_GROUP_TITLE;
+            pick_ctx->item_grp_idx = idx;
+            pick_ctx->item_idx = idx;
+            pick_ctx->grp_idx = 0;
+        }
+        else if (is_album_art_column) {
+            pick_ctx->type = PICK_ALBUM_ART;
+            pick_ctx->item_grp_idx = idx;
+            pick_ctx->grp_idx = min ((y - grp_title_height) / rowheight, grp->num_items - 1);
+            pick_ctx->item_idx = idx + pick_ctx->grp_idx;
+        }
+        else if (y >= grp_title_height + grp->num_items * rowheight) {
+            // whitespace after tracks
+            pick_ctx->type = PICK_EMPTY_SPACE;
+            pick_ctx->item_grp_idx = idx;
+            pick_ctx->grp_idx = grp->num_items - 1;
+            pick_ctx->item_idx = idx + pick_ctx->grp_idx;
         }
-        grp_y += grp->height;
-        idx += grp->num_items;
-        grp = grp->next;
-        gidx++;
+        else {
+            pick_ctx->type = PICK_ITEM;
+            pick_ctx->item_grp_idx = idx;
+            pick_ctx->grp_idx = (y - grp_title_height) / rowheight;
+            pick_ctx->item_idx = idx + pick_ctx->grp_idx;
+        }
+        if (pick_ctx->item_idx >= count) {
+            pick_ctx->type = PICK_EMPTY_SPACE;
+            pick_ctx->grp_idx = count - 1 - idx;
+            pick_ctx->item_idx = count - 1;
+        }
+        deadbeef->pl_unlock ();
+        return;
     }
 
     // area at the end of playlist or unknown
     pick_ctx->type = PICK_EMPTY_SPACE;
     pick_ctx->item_grp_idx = -1;
     pick_ctx->grp_idx = -1;
-    pick_ctx->item_idx = listview->binding->count () - 1;
+    pick_ctx->item_idx = count - 1;
     pick_ctx->grp = NULL;
 
     deadbeef->pl_unlock ();
@@ -846,13 +862,40 @@ fill_list_background (DdbListview *listview, cairo_t *cr, int x, int y, int w, i
     render_treeview_background(listview, cr, FALSE, TRUE, x, y, w, h, clip);
 }
 
+// loads the album art of the next screenful in the scrolling direction
+static gboolean
+ddb_listview_prefetch_cb (gpointer user_data) {
+    DdbListview *listview = user_data;
+    listview->prefetch_id = 0;
+    int down = listview->scrollpos >= listview->prefetch_scrollpos;
+    listview->prefetch_scrollpos = listview->scrollpos;
+    int y = down ? listview->scrollpos + listview->list_height : listview->scrollpos - listview->list_height;
+    int end_y = y + listview->list_height;
+
+    deadbeef->pl_lock ();
+    if (!ddb_listview_groups_outdated (listview)) {
+        int grp_y;
+        int idx;
+        DdbListviewGroup *grp = ddb_listview_group_at_y (listview, max (y, 0), &grp_y, &idx);
+        for (; grp && grp_y < end_y; grp_y += grp->height, grp = grp->next) {
+            for (DdbListviewColumn *c = listview->columns; c; c = c->next) {
+                if (listview->binding->is_album_art_column (c->user_data)) {
+                    listview->binding->prefetch_album_art (listview, grp->head, c->user_data, c->width);
+                }
+            }
+        }
+    }
+    deadbeef->pl_unlock ();
+    return FALSE;
+}
+
 static void
 ddb_listview_list_render (DdbListview *listview, cairo_t *cr, GdkRectangle *clip) {
     if (listview->scrollpos == -1) {
         return; // too early
     }
     deadbeef->pl_lock ();
-    ddb_listview_groupcheck (listview);
+    ddb_listview_groupcheck_async (listview);
     int scrollx = -listview->hscrollpos;
     int title_height = listview->grouptitle_height;
     int row_height = listview->rowheight;
@@ -864,31 +907,35 @@ ddb_listview_list_render (DdbListview *listview, cairo_t *cr, GdkRectangle *clip
     fill_list_background(listview, cr, scrollx, -listview->scrollpos, total_width, max(listview->fullheight, listview->list_height), clip);
 
     // find 1st group
-    DdbListviewGroup *grp = listview->groups;
-    int idx = 0;
-    int grp_y = -listview->scrollpos;
-    while (grp && grp_y + grp->height < clip->y) {
-        grp_y += grp->height;
-        idx += grp->num_items;
-        grp = grp->next;
-    }
+    int idx;
+    int grp_y;
+    DdbListviewGroup *grp = ddb_listview_group_at_y (listview, listview->scrollpos + clip->y - 1, &grp_y, &idx);
+    grp_y -= listview->scrollpos;
     DdbListviewGroup *pin_grp = gtkui_groups_pinned && grp && grp_y < 0 && grp_y + grp->height >= 0 ? grp : NULL;
 
+    // the tracks are walked across the groups, starting from the 1st visible
+    // row: the groups may be left over from before a playlist change, while
+    // the new ones are being built, and then their heads are no longer a safe
+    // place to start from
+    DdbListviewIter it = NULL;
+    int first_row = 0;
+    if (grp) {
+        if (row_height > 0 && clip->y > grp_y + title_height) {
+            first_row = min ((clip->y - grp_y - title_height - 1) / row_height, grp->num_items);
+        }
+        it = ddb_listview_get_row_iter (listview, idx + first_row);
+    }
+
     while (grp && grp_y < clip->y + clip->height) {
         int grp_height = title_height + grp->num_items * row_height;
 
-        DdbListviewIter it = grp->head;
-        listview->binding->ref(it);
-        for (int i = 0, yy = grp_y + title_height; it && i < grp->num_items && yy < clip->y + clip->height; i++, yy += row_height) {
+        for (int i = first_row, yy = grp_y + title_height + first_row * row_height; it && i < grp->num_items && yy < clip->y + clip->height; i++, yy += row_height) {
             if (yy + row_height >= clip->y) {
                 ddb_listview_list_render_row_background(listview, cr, it, i & 1, idx+i == cursor_index, scrollx, yy, total_width, row_height, clip);
                 ddb_listview_list_render_row_foreground(listview, cr, it, idx+i, yy, total_width, row_height, clip->x, clip->x+clip->width);
             }
             it = next_playitem(listview, it);
         }
-        if (it) {
-            listview->binding->unref(it);
-        }
 //        if (grp->height > grp_height) {
 //            render_treeview_background(listview, cr, FALSE, TRUE, scrollx, grp_y+grp_height, total_width, grp->height-grp_height, clip);
 //        }
@@ -916,6 +963,14 @@ ddb_listview_list_render (DdbListview *listview, cairo_t *cr, GdkRectangle *clip
         idx += grp->num_items;
         grp_y += grp->height;
         grp = grp->next;
+        first_row = 0;
+    }
+    if (it) {
+        listview->binding->unref(it);
+    }
+
+    if (!listview->prefetch_id && listview->scrollpos != listview->prefetch_scrollpos && listview->binding->prefetch_album_art) {
+        listview->prefetch_id = g_idle_add_full (G_PRIORITY_LOW, ddb_listview_prefetch_cb, listview, NULL);
     }
 
 //    if (grp_y < clip->y + clip->height) {
@@ -1086,17 +1141,14 @@ invalidate_album_art_cells (DdbListview *listview, int x1, int x2, int y, int h)
 static void
 invalidate_group (DdbListview *ps, int at_y)
 {
-    DdbListviewGroup *group = ps->groups;
+    int group_y;
+    int idx;
+    DdbListviewGroup *group = ddb_listview_group_at_y (ps, at_y - 1, &group_y, &idx);
     if (!group) {
         return;
     }
 
-    int next_group_y = group->height;
-    while (group->next && next_group_y < at_y) {
-        group = group->next;
-        next_group_y += group->height;
-    }
-
+    int next_group_y = group_y + group->height;
     int group_height = next_group_y - at_y;
     if (next_group_y > at_y) {
         gtk_widget_queue_draw_area (ps->list, 0, 0, ps->list_width, min(ps->grouptitle_height, group_height));
@@ -1358,7 +1410,7 @@ adjust_scrollbar (GtkWidget *scrollbar, int upper, int page_size) {
 static gboolean
 ddb_listview_list_setup_vscroll (void *user_data) {
     DdbListview *ps = user_data;
-    ddb_listview_groupcheck (ps);
+    ddb_listview_groupcheck_async (ps);
     adjust_scrollbar (ps->scrollbar, ps->fullheight, ps->list_height);
     return FALSE;
 }
@@ -1661,7 +1713,7 @@ void
 ddb_listview_click_selection (DdbListview *ps, int ex, int ey, DdbListviewPickContext *pick_ctx, int dnd, int button) {
     deadbeef->pl_lock ();
     ps->areaselect = 0;
-    ddb_listview_groupcheck (ps);
+    ddb_listview_groupcheck_async (ps);
 
     if (dnd) {
         // prepare area selection or drag
@@ -1670,7 +1722,7 @@ ddb_listview_click_selection (DdbListview *ps, int ex, int ey, DdbListviewPickCo
             selected = ddb_listview_is_group_selected (ps, pick_ctx->grp);
         }
         else {
-            DdbListviewIter it = ps->binding->get_for_idx (pick_ctx->item_idx);
+            DdbListviewIter it = ddb_listview_get_row_iter (ps, pick_ctx->item_idx);
             if (it) {
                 selected = ps->binding->is_selected (it);
                 UNREF (it);
@@ -1701,7 +1753,7 @@ ddb_listview_click_selection (DdbListview *ps, int ex, int ey, DdbListviewPickCo
     }
     else if (pick_ctx->item_idx != -1 && pick_ctx->type == PICK_ITEM) {
         // clicked specific item - select, or start drag-n-drop
-        DdbListviewIter it = ps->binding->get_for_idx (pick_ctx->item_idx);
+        DdbListviewIter it = ddb_listview_get_row_iter (ps, pick_ctx->item_idx);
         if (it) {
             if (!ps->binding->is_selected (it)) {
                 // reset selection, and set it to single item
@@ -1735,7 +1787,7 @@ void
 ddb_listview_list_mouse1_pressed (DdbListview *ps, int state, int ex, int ey, GdkEventType type) {
     // cursor must be set here, but selection must be handled in keyrelease
     deadbeef->pl_lock ();
-    ddb_listview_groupcheck (ps);
+    ddb_listview_groupcheck_async (ps);
     int cnt = ps->binding->count ();
     if (cnt == 0) {
         deadbeef->pl_unlock ();
@@ -1812,7 +1864,7 @@ ddb_listview_list_mouse1_pressed (DdbListview *ps, int state, int ex, int ey, Gd
             }
             else if (pick_ctx.type == PICK_ITEM) {
                 // toggle single item
-                DdbListviewIter it = ps->binding->get_for_idx (pick_ctx.item_idx);
+                DdbListviewIter it = ddb_listview_get_row_iter (ps, pick_ctx.item_idx);
                 if (it) {
                     ps->binding->select (it, 1 - ps->binding->is_selected (it));
                     ddb_listview_draw_row (ps, pick_ctx.item_idx, it);
@@ -2510,24 +2562,17 @@ ddb_listview_column_size_changed (DdbListview *listview, DdbListviewColumn *c)
 void
 ddb_listview_update_scroll_ref_point (DdbListview *ps)
 {
-    ddb_listview_groupcheck (ps);
-    DdbListviewGroup *grp = ps->groups;
-    DdbListviewGroup *grp_next;
+    ddb_listview_groupcheck_async (ps);
+    int abs_idx;
+    int grp_y;
+    // find 1st group
+    DdbListviewGroup *grp = ddb_listview_group_at_y (ps, ps->scrollpos - 1, &grp_y, &abs_idx);
 
     if (grp) {
-        int abs_idx = 0;
-        int grp_y = 0;
-
         int cursor_pos = ddb_listview_get_row_pos (ps, ps->binding->cursor ());
         ps->ref_point = 0;
         ps->ref_point_offset = 0;
 
-        // find 1st group
-        while (grp && grp_y + grp->height < ps->scrollpos) {
-            grp_y += grp->height;
-            abs_idx += grp->num_items;
-            grp = grp->next;
-        }
         int grp_content_pos = grp_y + ps->grouptitle_height;
         int grp_end_pos = grp_content_pos + (grp->num_items * ps->rowheight);
         // choose cursor_pos as anchor
@@ -2960,7 +3005,7 @@ ddb_listview_list_button_press_event         (GtkWidget       *widget,
         ddb_listview_update_cursor (ps, cursor);
 
         if (pick_ctx.type != PICK_EMPTY_SPACE) {
-            DdbListviewIter it = ps->binding->get_for_idx (pick_ctx.item_idx);
+            DdbListviewIter it = ddb_listview_get_row_iter (ps, pick_ctx.item_idx);
             if (it) {
                 ps->binding->list_context_menu (ps, it, pick_ctx.item_idx);
                 UNREF (it);
@@ -3203,23 +3248,344 @@ ddb_listview_invalidate_album_art_columns (DdbListview *listview) {
 /////// end of column management code
 
 /////// grouping /////
+// Group titles are cached per track, so after a change only the new and the
+// invalidated tracks have to be formatted again. When the playlist changes,
+// the groups are rebuilt on a background thread in chunks of
+// GROUP_BUILD_CHUNK tracks, taking pl_lock for one chunk at a time, while the
+// list keeps rendering the previous groups.
+// Every ROW_ANCHOR_STRIDE-th track is kept with the groups, so that a row is
+// reached without walking the playlist from its start, and the groups are
+// indexed by position for binary search.
+#define GROUP_BUILD_CHUNK 2000
+#define ROW_ANCHOR_STRIDE 256
+
+typedef struct {
+    int refc;
+    char str[];
+} group_title_t;
+
+typedef struct {
+    DdbListviewIter it; // referenced, NULL for a free slot
+    group_title_t *title;
+    unsigned epoch; // the title is valid while this matches the cache epoch
+    unsigned checked; // the title is known to be current while this matches the cache recheck count
+    uint32_t hash; // get_group_hash of the track when the title was formatted
+    unsigned serial; // the last build which has seen the track
+} group_title_entry_t;
+
+// open addressing hash table keyed by track, protected by pl_lock
+struct _DdbListviewGroupTitles {
+    group_title_entry_t *entries;
+    size_t size; // a power of 2
+    size_t count;
+    unsigned epoch;
+    unsigned rechecks;
+    unsigned serial;
+    unsigned changes; // bumped on every invalidation, restarts the builds in progress
+};
+
+typedef struct {
+    DdbListviewBinding *binding;
+    DdbListviewGroup *groups;
+    DdbListviewGroup *last;
+    DdbListviewIter it; // next track to group, referenced
+    group_title_t *title; // title of the last group, referenced
+    ddb_playlist_t *plt;
+    int modification_idx;
+    int has_titles;
+    unsigned serial;
+    unsigned changes;
+    size_t seen;
+    DdbListviewIter *anchors; // referenced
+    int anchor_count;
+    int anchor_size;
+    int row; // index of b->it
+} group_builder_t;
+
+struct _DdbListviewGroupBuild {
+    DdbListview *listview;
+    intptr_t tid;
+    int cancel; // set by the gui thread under pl_lock
+    group_builder_t builder;
+};
+
+struct _DdbListviewGroupPos {
+    DdbListviewGroup *grp;
+    int y;
+    int idx;
+};
+
 static void
-ddb_listview_free_groups (DdbListview *listview) {
-    DdbListviewGroup *next;
-    while (listview->groups) {
-        next = listview->groups->next;
-        if (listview->groups->head) {
-            listview->binding->unref (listview->groups->head);
+ddb_listview_free_row_anchors (DdbListviewBinding *binding, DdbListviewIter *anchors, int count) {
+    for (int i = 0; i < count; i++) {
+        binding->unref (anchors[i]);
+    }
+    free (anchors);
+}
+
+static void
+ddb_listview_free_group_list (DdbListviewBinding *binding, DdbListviewGroup *groups) {
+    while (groups) {
+        DdbListviewGroup *next = groups->next;
+        if (groups->head) {
+            binding->unref (groups->head);
         }
-        free (listview->groups);
-        listview->groups = next;
+        free (groups);
+        groups = next;
     }
+}
+
+static void
+ddb_listview_free_groups (DdbListview *listview) {
+    ddb_listview_free_group_list (listview->binding, listview->groups);
+    listview->groups = NULL;
+    free (listview->group_index);
+    listview->group_index = NULL;
+    listview->group_count = 0;
+    ddb_listview_free_row_anchors (listview->binding, listview->row_anchors, listview->row_anchor_count);
+    listview->row_anchors = NULL;
+    listview->row_anchor_count = 0;
     if (listview->plt) {
         deadbeef->plt_unref (listview->plt);
         listview->plt = NULL;
     }
 }
 
+static void
+group_title_release (group_title_t *title) {
+    if (title && !--title->refc) {
+        free (title);
+    }
+}
+
+static size_t
+group_titles_slot (group_title_entry_t *entries, size_t size, DdbListviewIter it) {
+    size_t i = ((uintptr_t)it >> 4) * 2654435761u & (size - 1);
+    while (entries[i].it && entries[i].it != it) {
+        i = (i + 1) & (size - 1);
+    }
+    return i;
+}
+
+// moves the entries into a new table, dropping the tracks which the last
+// build has not seen if `sweep' is set
+static int
+group_titles_rehash (DdbListviewBinding *binding, struct _DdbListviewGroupTitles *titles, size_t size, int sweep) {
+    group_title_entry_t *entries = calloc (size, sizeof (group_title_entry_t));
+    if (!entries) {
+        return -1;
+    }
+    titles->count = 0;
+    for (size_t i = 0; i < titles->size; i++) {
+        group_title_entry_t *e = &titles->entries[i];
+        if (!e->it) {
+            continue;
+        }
+        if (sweep && e->serial != titles->serial) {
+            binding->unref (e->it);
+            group_title_release (e->title);
+            continue;
+        }
+        entries[group_titles_slot (entries, size, e->it)] = *e;
+        titles->count++;
+    }
+    free (titles->entries);
+    titles->entries = entries;
+    titles->size = size;
+    return 0;
+}
+
+static void
+group_titles_clear (DdbListviewBinding *binding, struct _DdbListviewGroupTitles *titles) {
+    for (size_t i = 0; i < titles->size; i++) {
+        if (titles->entries[i].it) {
+            binding->unref (titles->entries[i].it);
+            group_title_release (titles->entries[i].title);
+        }
+    }
+    free (titles->entries);
+    titles->entries = NULL;
+    titles->size = 0;
+    titles->count = 0;
+    titles->changes++;
+}
+
+// returns a reference to the title of the track, formatting it if it's not
+// cached; equal titles of consecutive tracks share the memory
+static group_title_t *
+group_title (DdbListview *listview, group_builder_t *b, DdbListviewIter it) {
+    struct _DdbListviewGroupTitles *titles = listview->group_titles;
+    int cached = 1;
+    if ((titles->count + 1) * 2 > titles->size
+        && group_titles_rehash (listview->binding, titles, titles->size ? titles->size * 2 : 1024, 0) < 0
+        && titles->count + 1 >= titles->size) {
+        cached = 0; // out of memory, format without caching
+    }
+
+    group_title_entry_t *e = NULL;
+    uint32_t hash = 0;
+    int hashed = 0;
+    if (cached) {
+        e = &titles->entries[group_titles_slot (titles->entries, titles->size, it)];
+        if (!e->it) {
+            listview->binding->ref (it);
+            e->it = it;
+            titles->count++;
+        }
+        if (e->serial != b->serial) {
+            e->serial = b->serial;
+            b->seen++;
+        }
+        if (e->title && e->epoch == titles->epoch && e->checked != titles->rechecks && listview->binding->get_group_hash) {
+            // the list has changed since the title was formatted, which doesn't mean the track has
+            hash = listview->binding->get_group_hash (it);
+            hashed = 1;
+            if (hash == e->hash) {
+                e->checked = titles->rechecks;
+            }
+        }
+        if (e->title && e->epoch == titles->epoch && e->checked == titles->rechecks) {
+            e->title->refc++;
+            return e->title;
+        }
+    }
+
+    char str[1024] = "";
+    listview->binding->get_group (listview, it, str, sizeof (str));
+    group_title_t *title;
+    if (b->title && !strcmp (b->title->str, str)) {
+        title = b->title;
+        title->refc++;
+    }
+    else {
+        size_t len = strlen (str);
+        title = malloc (sizeof (group_title_t) + len + 1);
+        if (!title) {
+            return NULL;
+        }
+        title->refc = 1;
+        memcpy (title->str, str, len + 1);
+    }
+
+    if (e) {
+        group_title_release (e->title);
+        e->title = title;
+        e->epoch = titles->epoch;
+        e->checked = titles->rechecks;
+        if (!hashed && listview->binding->get_group_hash) {
+            hash = listview->binding->get_group_hash (it);
+        }
+        e->hash = hash;
+        title->refc++;
+    }
+    return title;
+}
+
+static void
+group_builder_free (group_builder_t *b) {
+    ddb_listview_free_group_list (b->binding, b->groups);
+    b->groups = b->last = NULL;
+    ddb_listview_free_row_anchors (b->binding, b->anchors, b->anchor_count);
+    b->anchors = NULL;
+    b->anchor_count = b->anchor_size = 0;
+    if (b->it) {
+        b->binding->unref (b->it);
+        b->it = NULL;
+    }
+    group_title_release (b->title);
+    b->title = NULL;
+    if (b->plt) {
+        deadbeef->plt_unref (b->plt);
+        b->plt = NULL;
+    }
+}
+
+// must be called with pl_lock held, like all the group_builder functions
+static void
+group_builder_start (DdbListview *listview, group_builder_t *b) {
+    group_builder_free (b);
+    b->binding = listview->binding;
+    b->plt = deadbeef->plt_get_curr ();
+    b->modification_idx = listview->binding->modification_idx ();
+    b->has_titles = listview->group_format && listview->group_format[0];
+    b->serial = ++listview->group_titles->serial;
+    b->changes = listview->group_titles->changes;
+    b->seen = 0;
+    b->row = 0;
+    b->it = listview->binding->head ();
+}
+
+// the playlist or the titles have changed since the build started
+static int
+group_builder_outdated (DdbListview *listview, group_builder_t *b) {
+    ddb_playlist_t *plt = deadbeef->plt_get_curr ();
+    if (plt) {
+        deadbeef->plt_unref (plt);
+    }
+    return plt != b->plt
+        || b->modification_idx != listview->binding->modification_idx ()
+        || b->changes != listview->group_titles->changes;
+}
+
+// groups up to `count' more tracks, returns 1 when all tracks are grouped
+static int
+group_builder_step (DdbListview *listview, group_builder_t *b, int count) {
+    while (b->it && count-- > 0) {
+        // once an anchor is missing, the following ones would be misplaced
+        if (b->row == b->anchor_count * ROW_ANCHOR_STRIDE) {
+            if (b->anchor_count == b->anchor_size) {
+                int size = b->anchor_size ? b->anchor_size * 2 : 64;
+                DdbListviewIter *anchors = realloc (b->anchors, size * sizeof (DdbListviewIter));
+                if (anchors) {
+                    b->anchors = anchors;
+                    b->anchor_size = size;
+                }
+            }
+            if (b->anchor_count < b->anchor_size) {
+                listview->binding->ref (b->it);
+                b->anchors[b->anchor_count++] = b->it;
+            }
+        }
+        // without a format, all tracks go into one group
+        group_title_t *title = b->has_titles ? group_title (listview, b, b->it) : NULL;
+        if (!b->last || (b->has_titles && (!title || !b->title || (title != b->title && strcmp (title->str, b->title->str))))) {
+            DdbListviewGroup *grp = calloc (1, sizeof (DdbListviewGroup));
+            if (!grp) {
+                group_title_release (title);
+                break;
+            }
+            listview->binding->ref (b->it);
+            grp->head = b->it;
+            if (b->last) {
+                b->last->next = grp;
+            }
+            else {
+                b->groups = grp;
+            }
+            b->last = grp;
+        }
+        group_title_release (b->title);
+        b->title = title;
+        b->last->num_items++;
+        b->it = next_playitem (listview, b->it);
+        b->row++;
+    }
+    if (b->it) {
+        return 0;
+    }
+
+    // forget the tracks which are no longer in the playlist
+    struct _DdbListviewGroupTitles *titles = listview->group_titles;
+    if (b->has_titles && titles->count > b->seen + b->seen / 4 + 1024) {
+        size_t size = titles->size;
+        while (size > 1024 && b->seen * 4 < size) {
+            size /= 2;
+        }
+        group_titles_rehash (listview->binding, titles, size, 1);
+    }
+    return 1;
+}
+
 static int
 ddb_listview_min_group_height(DdbListviewColumn *columns) {
     int min_height = 0;
@@ -3234,72 +3600,334 @@ ddb_listview_min_group_height(DdbListviewColumn *columns) {
     return min_height;
 }
 
-static DdbListviewGroup *
-new_group (DdbListview *listview, DdbListviewIter it) {
-    listview->binding->ref(it);
-    DdbListviewGroup *grp = calloc(1, sizeof(DdbListviewGroup));
-    grp->head = it;
-    return grp;
-}
-
+// updates the heights and the position index, returns the full height
 static int
-build_groups (DdbListview *listview) {
-    listview->groups_build_idx = listview->binding->modification_idx();
-    ddb_listview_free_groups(listview);
-    listview->plt = deadbeef->plt_get_curr();
-
-    DdbListviewIter it = listview->binding->head();
-    if (!it) {
-        return 0;
+ddb_listview_group_heights (DdbListview *listview) {
+    int min_height = listview->grouptitle_height ? ddb_listview_min_group_height(listview->columns) : 0;
+    int count = 0;
+    for (DdbListviewGroup *grp = listview->groups; grp; grp = grp->next) {
+        count++;
+    }
+    struct _DdbListviewGroupPos *index = realloc (listview->group_index, (count + 1) * sizeof (struct _DdbListviewGroupPos));
+    if (!index) {
+        // the lookups fall back to walking the groups
+        free (listview->group_index);
     }
-    if (!listview->group_format || !listview->group_format[0]) {
-        listview->grouptitle_height = 0;
-        listview->groups = calloc(1, sizeof(DdbListviewGroup));
-        listview->groups->head = it;
-        listview->groups->num_items = listview->binding->count();
-        listview->groups->height = listview->groups->num_items * listview->rowheight;
-        return listview->groups->height;
-    }
-    listview->grouptitle_height = listview->calculated_grouptitle_height;
-    listview->groups = new_group(listview, it);
-    int min_height = ddb_listview_min_group_height(listview->columns);
+    listview->group_index = index;
+    listview->group_count = count;
+
     int full_height = 0;
+    int idx = 0;
     for (DdbListviewGroup *grp = listview->groups; grp; grp = grp->next) {
-        char group_title[1024];
-        char next_title[1024];
-        listview->binding->get_group(listview, it, group_title, sizeof(group_title));
-        do {
-            grp->num_items++;
-            it = next_playitem(listview, it);
-        } while (it && listview->binding->get_group(listview, it, next_title, sizeof(next_title)) != -1 && !strcmp(group_title, next_title));
         grp->height = listview->grouptitle_height + max(grp->num_items * listview->rowheight, min_height);
+        if (index) {
+            index->grp = grp;
+            index->y = full_height;
+            index->idx = idx;
+            index++;
+        }
         full_height += grp->height;
-        grp->next = it ? new_group(listview, it) : NULL;
+        idx += grp->num_items;
+    }
+    if (index) {
+        // terminator
+        index->grp = NULL;
+        index->y = full_height;
+        index->idx = idx;
     }
     return full_height;
 }
 
+// returns the group which ends below y, or NULL if y is past the last one;
+// grp_y and idx are set to the position of the group and of its first row
+DdbListviewGroup *
+ddb_listview_group_at_y (DdbListview *listview, int y, int *grp_y, int *idx) {
+    struct _DdbListviewGroupPos *index = listview->group_index;
+    if (!index) {
+        int yy = 0, i = 0;
+        DdbListviewGroup *grp = listview->groups;
+        while (grp && yy + grp->height <= y) {
+            yy += grp->height;
+            i += grp->num_items;
+            grp = grp->next;
+        }
+        *grp_y = yy;
+        *idx = i;
+        return grp;
+    }
+    // the first group whose end is below y
+    int lo = 0, hi = listview->group_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index[mid+1].y <= y) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *grp_y = index[lo].y;
+    *idx = index[lo].idx;
+    return index[lo].grp;
+}
+
+// returns the group containing the row, or NULL if there's no such row;
+// grp_y and idx are set to the position of the group and of its first row
+static DdbListviewGroup *
+ddb_listview_group_for_row (DdbListview *listview, int row, int *grp_y, int *idx) {
+    struct _DdbListviewGroupPos *index = listview->group_index;
+    if (!index) {
+        int yy = 0, i = 0;
+        DdbListviewGroup *grp = listview->groups;
+        while (grp && i + grp->num_items <= row) {
+            yy += grp->height;
+            i += grp->num_items;
+            grp = grp->next;
+        }
+        *grp_y = yy;
+        *idx = i;
+        return grp;
+    }
+    int lo = 0, hi = listview->group_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index[mid+1].idx <= row) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *grp_y = index[lo].y;
+    *idx = index[lo].idx;
+    return index[lo].grp;
+}
+
+// returns a reference to the track in the row, starting from the nearest
+// anchor while the groups are up to date
+static DdbListviewIter
+ddb_listview_get_row_iter (DdbListview *listview, int row) {
+    if (row < 0) {
+        return NULL;
+    }
+    int anchor = row / ROW_ANCHOR_STRIDE;
+    deadbeef->pl_lock ();
+    DdbListviewIter it;
+    if (ddb_listview_groups_outdated (listview) || anchor >= listview->row_anchor_count) {
+        it = listview->binding->get_for_idx (row);
+    }
+    else {
+        it = listview->row_anchors[anchor];
+        listview->binding->ref (it);
+        for (int i = anchor * ROW_ANCHOR_STRIDE; it && i < row; i++) {
+            it = next_playitem (listview, it);
+        }
+    }
+    deadbeef->pl_unlock ();
+    return it;
+}
+
+// replaces the groups with the ones from a finished build, returns the full height
+static int
+ddb_listview_install_groups (DdbListview *listview, group_builder_t *b) {
+    ddb_listview_free_groups (listview);
+    listview->groups = b->groups;
+    listview->plt = b->plt;
+    listview->groups_build_idx = b->modification_idx;
+    listview->grouptitle_height = b->has_titles ? listview->calculated_grouptitle_height : 0;
+    listview->row_anchors = b->anchors;
+    listview->row_anchor_count = b->anchor_count;
+    b->groups = b->last = NULL;
+    b->plt = NULL;
+    b->anchors = NULL;
+    b->anchor_count = b->anchor_size = 0;
+    group_builder_free (b);
+    return ddb_listview_group_heights (listview);
+}
+
+static int
+ddb_listview_groups_outdated (DdbListview *listview) {
+    return listview->groups_build_idx != listview->binding->modification_idx ();
+}
+
 static void
-ddb_listview_build_groups (DdbListview *listview) {
-    deadbeef->pl_lock();
-    int height = build_groups(listview);
+ddb_listview_cancel_group_build (DdbListview *listview) {
+    if (listview->group_build) {
+        deadbeef->pl_lock ();
+        listview->group_build->cancel = 1;
+        deadbeef->pl_unlock ();
+        // the thread finishes on its own and group_build_done_cb cleans up
+        listview->group_build = NULL;
+    }
+}
+
+// builds the groups on the calling thread
+static int
+build_groups (DdbListview *listview) {
+    ddb_listview_cancel_group_build (listview);
+    group_builder_t b = { 0 };
+    group_builder_start (listview, &b);
+    group_builder_step (listview, &b, INT_MAX);
+    return ddb_listview_install_groups (listview, &b);
+}
+
+static void
+ddb_listview_groups_install_height (DdbListview *listview, int height) {
     if (height != listview->fullheight) {
         listview->fullheight = height;
         g_idle_add_full(GTK_PRIORITY_RESIZE, ddb_listview_list_setup_vscroll, listview, NULL);
     }
-    deadbeef->pl_unlock();
+}
+
+static gboolean
+group_build_done_cb (gpointer data) {
+    struct _DdbListviewGroupBuild *job = data;
+    if (job->tid) {
+        deadbeef->thread_join (job->tid);
+    }
+    DdbListview *listview = job->listview;
+    if (!job->cancel) {
+        listview->group_build = NULL;
+        deadbeef->pl_lock ();
+        if (!group_builder_outdated (listview, &job->builder)) {
+            ddb_listview_groups_install_height (listview, ddb_listview_install_groups (listview, &job->builder));
+            gtk_widget_queue_draw (listview->list);
+        }
+        deadbeef->pl_unlock ();
+        // start over if anything has changed meanwhile
+        ddb_listview_groupcheck_async (listview);
+    }
+    deadbeef->pl_lock ();
+    group_builder_free (&job->builder);
+    deadbeef->pl_unlock ();
+    free (job);
+    return FALSE;
 }
 
 static void
-ddb_listview_resize_groups (DdbListview *listview) {
+group_build_thread (void *ctx) {
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-gtkui-groups", 0, 0, 0, 0);
+#endif
+    struct _DdbListviewGroupBuild *job = ctx;
+    deadbeef->pl_lock ();
+    while (!job->cancel) {
+        if (group_builder_outdated (job->listview, &job->builder)) {
+            group_builder_start (job->listview, &job->builder);
+        }
+        // without titles to format, a track costs next to nothing
+        if (group_builder_step (job->listview, &job->builder, job->builder.has_titles ? GROUP_BUILD_CHUNK : GROUP_BUILD_CHUNK * 16)) {
+            break;
+        }
+        // let the gui thread in between the chunks
+        deadbeef->pl_unlock ();
+        usleep (1000);
+        deadbeef->pl_lock ();
+    }
+    deadbeef->pl_unlock ();
+    g_idle_add (group_build_done_cb, job);
+}
 
-    int min_height = ddb_listview_min_group_height(listview->columns);
-    int full_height = 0;
-    for (DdbListviewGroup *grp = listview->groups; grp; grp = grp->next) {
-        grp->height = listview->grouptitle_height + max(grp->num_items * listview->rowheight, min_height);
-        full_height += grp->height;
+void
+ddb_listview_groupcheck_async (DdbListview *listview) {
+    if (listview->group_build || !ddb_listview_groups_outdated (listview)) {
+        // a build in progress restarts by itself when the playlist changes
+        return;
+    }
+    if ((!listview->group_format || !listview->group_format[0]) && listview->binding->count () <= GROUP_BUILD_CHUNK * 16) {
+        // nothing to format, only the anchors to collect, this is quick
+        deadbeef->pl_lock ();
+        ddb_listview_groups_install_height (listview, build_groups (listview));
+        deadbeef->pl_unlock ();
+        return;
+    }
+    struct _DdbListviewGroupBuild *job = calloc (1, sizeof (struct _DdbListviewGroupBuild));
+    if (!job) {
+        return;
+    }
+    job->listview = listview;
+    job->builder.binding = listview->binding;
+    job->builder.modification_idx = -1; // outdated, starts on the thread
+    listview->group_build = job;
+    job->tid = deadbeef->thread_start_low_priority (group_build_thread, job);
+    if (!job->tid) {
+        listview->group_build = NULL;
+        free (job);
+        ddb_listview_groupcheck (listview);
+    }
+}
+
+void
+ddb_listview_groupcheck (DdbListview *listview) {
+    if (ddb_listview_groups_outdated (listview)) {
+        deadbeef->pl_lock ();
+        ddb_listview_groups_install_height (listview, build_groups (listview));
+        deadbeef->pl_unlock ();
+    }
+}
+
+void
+ddb_listview_groups_invalidate (DdbListview *listview, DdbListviewIter it) {
+    struct _DdbListviewGroupTitles *titles = listview->group_titles;
+    deadbeef->pl_lock ();
+    if (!it) {
+        titles->epoch++;
+    }
+    else if (titles->entries) {
+        group_title_entry_t *e = &titles->entries[group_titles_slot (titles->entries, titles->size, it)];
+        if (e->it) {
+            e->epoch = titles->epoch - 1;
+        }
+    }
+    titles->changes++;
+    listview->groups_build_idx = -1;
+    deadbeef->pl_unlock ();
+}
+
+void
+ddb_listview_groups_recheck (DdbListview *listview) {
+    if (!listview->binding->get_group_hash) {
+        ddb_listview_groups_invalidate (listview, NULL);
+        return;
+    }
+    struct _DdbListviewGroupTitles *titles = listview->group_titles;
+    deadbeef->pl_lock ();
+    titles->rechecks++;
+    titles->changes++;
+    listview->groups_build_idx = -1;
+    deadbeef->pl_unlock ();
+}
+
+void
+ddb_listview_set_group_format (DdbListview *listview, const char *format) {
+    deadbeef->pl_lock ();
+    ddb_listview_cancel_group_build (listview);
+    if (listview->group_format) {
+        free (listview->group_format);
+    }
+    if (listview->group_title_bytecode) {
+        free (listview->group_title_bytecode);
+        listview->group_title_bytecode = NULL;
     }
+    listview->group_format = strdup (format);
+    listview->group_title_bytecode = deadbeef->tf_compile (listview->group_format);
+    group_titles_clear (listview->binding, listview->group_titles);
+    listview->groups_build_idx = -1;
+    deadbeef->pl_unlock ();
+}
 
+// the groups need to be rebuilt, e.g. after a font change; keep showing the
+// current ones resized until the new ones are ready
+static void
+ddb_listview_build_groups (DdbListview *listview) {
+    listview->groups_build_idx = -1;
+    ddb_listview_resize_groups (listview);
+    ddb_listview_groupcheck_async (listview);
+}
+
+static void
+ddb_listview_resize_groups (DdbListview *listview) {
+    int full_height = ddb_listview_group_heights (listview);
     if (full_height != listview->fullheight) {
         listview->fullheight = full_height;
         adjust_scrollbar (listview->scrollbar, listview->fullheight, listview->list_height);
@@ -3322,6 +3950,8 @@ ddb_listview_list_setup (DdbListview *listview, int scroll_to) {
         listview->scrollpos = 0;
     }
     deadbeef->pl_lock();
+    // a different playlist or new search results: format all the titles again
+    ddb_listview_groups_invalidate (listview, NULL);
     listview->fullheight = build_groups(listview);
     deadbeef->pl_unlock();
     adjust_scrollbar (listview->scrollbar, listview->fullheight, listview->list_height);
@@ -87,6 +87,9 @@ typedef struct {
     int (*is_selected) (DdbListviewIter);
 
     int (*get_group) (DdbListview *listview, DdbListviewIter it, char *str, int size);
+    // optional, a hash of everything get_group depends on, lets the group
+    // titles outlive the changes to the list which don't touch the tracks
+    uint32_t (*get_group_hash) (DdbListviewIter it);
 
     void (*drag_n_drop) (DdbListviewIter before, DdbPlaylistHandle playlist_from, uint32_t *indices, int length, int copy);
     void (*external_drag_n_drop) (DdbListviewIter before, char *mem, int length);
@@ -94,6 +97,8 @@ typedef struct {
     void (*draw_group_title) (DdbListview *listview, cairo_t *drawable, DdbListviewIter iter, int x, int y, int width, int height);
     void (*draw_album_art) (DdbListview *listview, cairo_t *cr, DB_playItem_t *it, void *user_data, int pinned, int next_y, int x, int y, int width, int height);
     void (*draw_column_data) (DdbListview *listview, cairo_t *cr, DdbListviewIter it, int idx, int align, void *user_data, GdkColor *fg_clr, int x, int y, int width, int height);
+    // optional, loads the album art of a group which is about to be scrolled into view
+    void (*prefetch_album_art) (DdbListview *listview, DB_playItem_t *it, void *user_data, int width);
 
     // cols
     int (*is_album_art_column) (void *user_data);
@@ -115,6 +120,9 @@ typedef struct {
 
 struct _DdbListviewColumn;
 struct _DdbListviewGroup;
+struct _DdbListviewGroupBuild;
+struct _DdbListviewGroupTitles;
+struct _DdbListviewGroupPos;
 
 struct _DdbListview {
     GtkTable parent;
@@ -177,6 +185,12 @@ struct _DdbListview {
     ddb_playlist_t *plt; // current playlist (refcounted), must be unreffed with the group
     struct _DdbListviewGroup *groups;
     int groups_build_idx; // must be the same as playlist modification idx
+    struct _DdbListviewGroupBuild *group_build; // background build in progress
+    struct _DdbListviewGroupTitles *group_titles; // formatted group titles by track
+    struct _DdbListviewGroupPos *group_index; // y and row of each group, for binary search
+    int group_count;
+    DdbListviewIter *row_anchors; // every ROW_ANCHOR_STRIDE-th track of the groups (referenced)
+    int row_anchor_count;
     int grouptitle_height;
     int calculated_grouptitle_height;
 
@@ -200,6 +214,9 @@ struct _DdbListview {
     guint tf_redraw_timeout_id;
     int tf_redraw_track_idx;
     DdbListviewIter tf_redraw_track;
+
+    guint prefetch_id;
+    int prefetch_scrollpos; // where the last prefetch was done from
 };
 
 struct _DdbListviewClass {
@@ -266,9 +283,32 @@ ddb_listview_clear_sort (DdbListview *listview);
 int
 ddb_listview_get_row_pos (DdbListview *listview, int row_idx);
 
+// rebuilds the groups right away if the playlist has changed since they were built
 void
 ddb_listview_groupcheck (DdbListview *listview);
 
+// same, but the groups are rebuilt in the background, and the list keeps
+// showing the old ones until the new ones are ready
+void
+ddb_listview_groupcheck_async (DdbListview *listview);
+
+// returns the group which ends below y, or NULL past the last group;
+// grp_y and idx receive the position of the group and of its first row
+DdbListviewGroup *
+ddb_listview_group_at_y (DdbListview *listview, int y, int *grp_y, int *idx);
+
+// the group title of the track has to be formatted again, NULL for all tracks
+void
+ddb_listview_groups_invalidate (DdbListview *listview, DdbListviewIter it);
+
+// the list has changed, and some of the tracks might have changed too; the
+// titles are kept for the tracks whose get_group_hash is still the same
+void
+ddb_listview_groups_recheck (DdbListview *listview);
+
+void
+ddb_listview_set_group_format (DdbListview *listview, const char *format);
+
 G_END_DECLS
 
 #endif // __DDBLISTVIEW_H
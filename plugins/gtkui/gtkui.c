@@ -552,6 +552,9 @@ gtkui_on_configchanged (void *data) {
     gtkui_tabstrip_embolden_selected = deadbeef->conf_get_int ("gtkui.tabstrip_embolden_selected", 0);
     gtkui_tabstrip_italic_selected = deadbeef->conf_get_int ("gtkui.tabstrip_italic_selected", 0);
 
+    // album art thumbnail cache budget
+    cover_art_configchanged ();
+
     // titlebar tf
     gtkui_titlebar_tf_init ();
 
@@ -1139,6 +1142,14 @@ gtkui_thread (void *ctx) {
         g_source_remove (refresh_timeout);
         refresh_timeout = 0;
     }
+    if (deadbeef->conf_get_int ("gtkui.coverart_cache_stats", 0)) {
+        // for sizing gtkui.coverart_cache_size
+        coverart_cache_stats_t thumbs;
+        cover_art_cache_stats (&thumbs, NULL);
+        fprintf (stderr, "coverart: thumbnail cache: %zu hits, %zu misses, %zu evictions, peak %zu KB of %zu MB\n",
+                thumbs.hits, thumbs.misses, thumbs.evictions, thumbs.peak_bytes / 1024,
+                thumbs.max_bytes == SIZE_MAX ? 0 : thumbs.max_bytes / (1024 * 1024));
+    }
     cover_art_free ();
     eq_window_destroy ();
     trkproperties_destroy ();
@@ -1640,7 +1651,7 @@ static const char settings_dlg[] =
 // define plugin interface
 static ddb_gtkui_t plugin = {
     .gui.plugin.api_vmajor = 1,
-    .gui.plugin.api_vminor = 6,
+    .gui.plugin.api_vminor = 10,
     .gui.plugin.version_major = DDB_GTKUI_API_VERSION_MAJOR,
     .gui.plugin.version_minor = DDB_GTKUI_API_VERSION_MINOR,
     .gui.plugin.type = DB_PLUGIN_GUI,
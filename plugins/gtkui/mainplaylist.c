@@ -180,6 +180,7 @@ static DdbListviewBinding main_binding = {
     .prev = main_prev,
 
     .get_group = pl_common_get_group,
+    .get_group_hash = pl_common_get_group_hash,
     .groups_changed = main_groups_changed,
 
     .drag_n_drop = main_drag_n_drop,
@@ -187,6 +188,7 @@ static DdbListviewBinding main_binding = {
 
     .draw_column_data = main_draw_column_data,
     .draw_album_art = pl_common_draw_album_art,
+    .prefetch_album_art = pl_common_prefetch_album_art,
     .draw_group_title = main_draw_group_title,
 
     // columns
@@ -210,14 +210,25 @@ pl_common_is_album_art_column (void *user_data) {
     return info->id == DB_COLUMN_ALBUM_ART;
 }
 
+static const char *key_uri;
+static const char *key_album;
+static const char *key_artist;
+static const char *key_title;
+
 static GdkPixbuf *
 get_cover_art (DB_playItem_t *it, int width, int height, void (*callback)(void *), void *user_data) {
+    if (!key_uri) {
+        key_uri = deadbeef->pl_meta_key_get (":URI");
+        key_album = deadbeef->pl_meta_key_get ("album");
+        key_artist = deadbeef->pl_meta_key_get ("artist");
+        key_title = deadbeef->pl_meta_key_get ("title");
+    }
     deadbeef->pl_lock();
-    const char *uri = deadbeef->pl_find_meta(it, ":URI");
-    const char *album = deadbeef->pl_find_meta(it, "album");
-    const char *artist = deadbeef->pl_find_meta(it, "artist");
+    const char *uri = deadbeef->pl_find_meta_interned(it, key_uri);
+    const char *album = deadbeef->pl_find_meta_interned(it, key_album);
+    const char *artist = deadbeef->pl_find_meta_interned(it, key_artist);
     if (!album || !*album) {
-        album = deadbeef->pl_find_meta(it, "title");
+        album = deadbeef->pl_find_meta_interned(it, key_title);
     }
     GdkPixbuf *pixbuf = get_cover_art_thumb_by_size(uri, artist, album, width, height, callback, user_data);
     deadbeef->pl_unlock();
@@ -242,13 +253,10 @@ cover_load (void *user_data) {
     col_info_t *info = user_data;
     info->cover_load_timeout_id = 0;
 
-    ddb_listview_groupcheck(info->listview);
-    DdbListviewGroup *group = info->listview->groups;
-    int group_y = 0;
-    while (group && group_y + group->height < info->listview->scrollpos) {
-        group_y += group->height;
-        group = group->next;
-    }
+    ddb_listview_groupcheck_async(info->listview);
+    int group_y;
+    int idx;
+    DdbListviewGroup *group = ddb_listview_group_at_y(info->listview, info->listview->scrollpos - 1, &group_y, &idx);
 
     GtkAllocation a;
     gtk_widget_get_allocation(info->listview->list, &a);
@@ -335,6 +343,21 @@ pl_common_draw_album_art (DdbListview *listview, cairo_t *cr, DB_playItem_t *it,
     }
 }
 
+void
+pl_common_prefetch_album_art (DdbListview *listview, DB_playItem_t *it, void *user_data, int width) {
+    col_info_t *info = user_data;
+    int art_width = width - ART_PADDING_HORZ * 2;
+    if (art_width < 8 || !it || info->cover_size != art_width) {
+        // cover_load takes care of the covers while the column is resized
+        return;
+    }
+    // no callback, nothing on screen waits for it
+    GdkPixbuf *pixbuf = get_cover_art(it, art_width, art_width, NULL, NULL);
+    if (pixbuf) {
+        g_object_unref(pixbuf);
+    }
+}
+
 void
 pl_common_draw_column_data (DdbListview *listview, cairo_t *cr, DdbListviewIter it, int idx, int iter, int align, void *user_data, GdkColor *fg_clr, int x, int y, int width, int height) {
     col_info_t *info = user_data;
@@ -978,20 +1001,12 @@ groups_changed (DdbListview *listview, const char *format)
     if (!format) {
         return;
     }
-    if (listview->group_format) {
-        free(listview->group_format);
-    }
-    if (listview->group_title_bytecode) {
-        free(listview->group_title_bytecode);
-        listview->group_title_bytecode = NULL;
-    }
     char *esc_format = parser_escape_string (format);
     char quoted_format[strlen (esc_format) + 3];
     snprintf (quoted_format, sizeof (quoted_format), "\"%s\"", esc_format);
     listview->binding->groups_changed (quoted_format);
     free (esc_format);
-    listview->group_format = strdup (format);
-    listview->group_title_bytecode = deadbeef->tf_compile (listview->group_format);
+    ddb_listview_set_group_format (listview, format);
     ddb_listview_refresh (listview, DDB_LIST_CHANGED | DDB_REFRESH_LIST);
 }
 
@@ -1623,6 +1638,24 @@ pl_common_get_group (DdbListview *listview, DdbListviewIter it, char *str, int s
     return 0;
 }
 
+// FNV-1a of the metadata and properties of the track, which is far cheaper
+// than formatting the group title; must be called with pl_lock held
+uint32_t
+pl_common_get_group_hash (DdbListviewIter it) {
+    uint32_t hash = 2166136261u;
+    for (DB_metaInfo_t *meta = deadbeef->pl_get_metadata_head (it); meta; meta = meta->next) {
+        for (const char *s = meta->key; *s; s++) {
+            hash = (hash ^ (uint8_t)*s) * 16777619u;
+        }
+        hash = (hash ^ '=') * 16777619u;
+        for (const char *s = meta->value; *s; s++) {
+            hash = (hash ^ (uint8_t)*s) * 16777619u;
+        }
+        hash = (hash ^ '\n') * 16777619u;
+    }
+    return hash;
+}
+
 void
 pl_common_draw_group_title (DdbListview *listview, cairo_t *drawable, DdbListviewIter it, int iter, int x, int y, int width, int height) {
     if (listview->group_format && listview->group_format[0]) {
@@ -1701,6 +1734,6 @@ pl_common_set_group_format (DdbListview *listview, char *format_conf) {
     char *format = strdup (deadbeef->conf_get_str_fast (format_conf, ""));
     deadbeef->conf_unlock ();
     parser_unescape_quoted_string (format);
-    listview->group_format = format;
-    listview->group_title_bytecode = deadbeef->tf_compile (listview->group_format);
+    ddb_listview_set_group_format (listview, format);
+    free (format);
 }
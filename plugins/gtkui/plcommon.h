@@ -43,6 +43,9 @@ pl_common_is_album_art_column (void *user_data);
 void
 pl_common_draw_album_art (DdbListview *listview, cairo_t *cr, DB_playItem_t *it, void *user_data, int pinned, int next_y, int x, int y, int width, int height);
 
+void
+pl_common_prefetch_album_art (DdbListview *listview, DB_playItem_t *it, void *user_data, int width);
+
 void
 pl_common_draw_column_data (DdbListview *listview, cairo_t *cr, DdbListviewIter it, int idx, int iter, int align, void *user_data, GdkColor *fg_clr, int x, int y, int width, int height);
 
@@ -70,6 +73,9 @@ pl_common_free_col_info (void *data);
 int
 pl_common_get_group (DdbListview *listview, DdbListviewIter it, char *str, int size);
 
+uint32_t
+pl_common_get_group_hash (DdbListviewIter it);
+
 void
 pl_common_draw_group_title (DdbListview *listview, cairo_t *drawable, DdbListviewIter it, int iter, int x, int y, int width, int height);
 
@@ -108,7 +108,8 @@ static void apply_conf (GtkWidget *w, ddb_dialog_t *conf) {
 
         // ignore layout options
         char key[MAX_TOKEN];
-        const char *skiptokens[] = { "vert", NULL };
+        const char *skiptokens[] = { "vert", "readonly", NULL };
+        int readonly = 0;
         for (;;) {
             script = gettoken_warn_eof (script, key);
             int i = 0;
@@ -120,6 +121,9 @@ static void apply_conf (GtkWidget *w, ddb_dialog_t *conf) {
             if (!skiptokens[i]) {
                 break;
             }
+            if (!strcmp (key, "readonly")) {
+                readonly = 1;
+            }
         }
         if (!script) {
             break;
@@ -130,8 +134,8 @@ static void apply_conf (GtkWidget *w, ddb_dialog_t *conf) {
             break;
         }
 
-        // fetch data
-        GtkWidget *widget = lookup_widget (w, key);
+        // fetch data, read-only values are owned by the plugin
+        GtkWidget *widget = readonly ? NULL : lookup_widget (w, key);
         if (widget) {
             if (!strcmp (type, "entry") || !strcmp (type, "password")) {
                 conf->set_param (key, gtk_entry_get_text (GTK_ENTRY (widget)));
@@ -356,6 +360,7 @@ gtkui_run_dialog (GtkWidget *parentwin, ddb_dialog_t *conf, uint32_t buttons, in
         }
 
         int vertical = 0;
+        int readonly = 0;
 
         char key[MAX_TOKEN];
         for (;;) {
@@ -366,6 +371,9 @@ gtkui_run_dialog (GtkWidget *parentwin, ddb_dialog_t *conf, uint32_t buttons, in
             if (!strcmp (key, "vert")) {
                 vertical = 1;
             }
+            else if (!strcmp (key, "readonly")) {
+                readonly = 1;
+            }
             else {
                 break;
             }
@@ -388,7 +396,12 @@ gtkui_run_dialog (GtkWidget *parentwin, ddb_dialog_t *conf, uint32_t buttons, in
             gtk_widget_show (label);
             prop = gtk_entry_new ();
             gtk_entry_set_activates_default (GTK_ENTRY (prop), TRUE);
-            g_signal_connect (G_OBJECT (prop), "changed", G_CALLBACK (prop_changed), win);
+            if (readonly) {
+                gtk_editable_set_editable (GTK_EDITABLE (prop), FALSE);
+            }
+            else {
+                g_signal_connect (G_OBJECT (prop), "changed", G_CALLBACK (prop_changed), win);
+            }
             gtk_widget_show (prop);
             gtk_entry_set_text (GTK_ENTRY (prop), value);
 
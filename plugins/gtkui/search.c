@@ -30,6 +30,7 @@
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "../../gettext.h"
 
 #include "callbacks.h"
@@ -52,9 +53,31 @@
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
 
+// Searching a big playlist is done on the thread pool, a chunk of tracks at
+// a time, so that pl_lock is not held for the whole search. The search starts
+// after a pause in typing, and the results are shown as soon as there are
+// enough of them to fill the window, then updated while the search goes on.
+#define SEARCH_CHUNK 5000 // tracks searched per pl_lock hold, and the size of a playlist searched right away
+#define SEARCH_DELAY 150 // ms
+#define SEARCH_FIRST_RESULTS 100
+#define SEARCH_UPDATE_INTERVAL 200000 // us
+
+typedef struct {
+    ddb_playlist_t *plt;
+    char *text;
+    int select_results;
+    int generation;
+    int complete;
+} search_query_t;
+
 static GtkWidget *searchwin;
 static int refresh_source_id = 0;
 static char *window_title_bytecode = NULL;
+static ddb_job_t *search_job;
+static int search_generation; // results of the older queries are ignored
+static guint search_delay_id;
+static int search_select_pending; // the query in progress was typed in, its results are to be selected
+static int search_results_idx; // bumped under pl_lock whenever the results change
 
 static DdbListview *
 playlist_visible () {
@@ -69,20 +92,25 @@ playlist_visible () {
     return NULL;
 }
 
+// updates the list after the results have changed
 static void
-search_process (DdbListview *listview, ddb_playlist_t *plt) {
-    GtkEntry *entry = GTK_ENTRY(lookup_widget(searchwin, "searchentry"));
-    const gchar *text = gtk_entry_get_text(entry);
-    deadbeef->plt_search_process2 (plt, text, 0);
-    ddb_listview_col_sort_update (listview);
+search_show_results (DdbListview *listview, int done) {
+    if (done) {
+        ddb_listview_col_sort_update (listview);
+    }
     deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_SEARCHRESULT, 0);
 
     int row = deadbeef->pl_get_cursor (PL_SEARCH);
     if (row >= deadbeef->pl_getcount (PL_SEARCH)) {
         deadbeef->pl_set_cursor (PL_SEARCH, deadbeef->pl_getcount (PL_SEARCH) - 1);
     }
-    ddb_listview_list_setup (listview, listview->scrollpos);
-    ddb_listview_refresh (listview, DDB_REFRESH_LIST);
+    if (done) {
+        ddb_listview_groupcheck (listview);
+    }
+    else {
+        ddb_listview_groupcheck_async (listview);
+    }
+    ddb_listview_refresh (listview, DDB_REFRESH_LIST | DDB_REFRESH_VSCROLL);
 
     char title[1024] = "";
     ddb_tf_context_t ctx = {
@@ -91,8 +119,175 @@ search_process (DdbListview *listview, ddb_playlist_t *plt) {
         .iter = PL_SEARCH
     };
     deadbeef->tf_eval (&ctx, window_title_bytecode, title, sizeof (title));
+    if (ctx.plt) {
+        deadbeef->plt_unref (ctx.plt);
+    }
     gtk_window_set_title (GTK_WINDOW (searchwin), title);
+}
 
+// the results of a query typed in are selected, and the cursor goes to the 1st one
+static void
+search_select_results (void) {
+    deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_SELECTION, 0);
+    DB_playItem_t *head = deadbeef->pl_get_first (PL_SEARCH);
+    if (head) {
+        ddb_event_track_t *event = (ddb_event_track_t *)deadbeef->event_alloc(DB_EV_CURSOR_MOVED);
+        event->track = head;
+        deadbeef->event_send ((ddb_event_t *)event, PL_SEARCH, 0);
+    }
+}
+
+static void
+search_query_free (search_query_t *q) {
+    deadbeef->plt_unref (q->plt);
+    free (q->text);
+    free (q);
+}
+
+static gboolean
+search_update_cb (gpointer p) {
+    DdbListview *listview = playlist_visible ();
+    if (listview && GPOINTER_TO_INT (p) == search_generation) {
+        search_show_results (listview, 0);
+    }
+    return FALSE;
+}
+
+static gboolean
+search_finished_cb (gpointer p) {
+    search_query_t *q = p;
+    if (q->generation == search_generation && search_job) {
+        deadbeef->job_release (search_job);
+        search_job = NULL;
+        search_select_pending = 0;
+        DdbListview *listview = playlist_visible ();
+        if (listview && q->complete) {
+            search_show_results (listview, 1);
+            if (q->select_results) {
+                search_select_results ();
+            }
+        }
+    }
+    search_query_free (q);
+    return FALSE;
+}
+
+static int64_t
+search_time (void) {
+    struct timeval tm;
+    gettimeofday (&tm, NULL);
+    return (int64_t)tm.tv_sec * 1000000 + tm.tv_usec;
+}
+
+static void
+search_work (ddb_job_t *job, void *ctx) {
+    search_query_t *q = ctx;
+    ddb_search_t *search = NULL;
+    int shown = 0;
+    int64_t shown_time = 0;
+    while (!deadbeef->job_cancelled (job)) {
+        if (!search) {
+            search = deadbeef->plt_search_begin (q->plt, q->text, q->select_results);
+            if (!search) {
+                break;
+            }
+        }
+        int res = deadbeef->plt_search_continue (search, SEARCH_CHUNK);
+        if (res < 0) {
+            // the playlist has changed, start over
+            deadbeef->plt_search_end (search);
+            search = NULL;
+            continue;
+        }
+        deadbeef->pl_lock ();
+        search_results_idx++;
+        deadbeef->pl_unlock ();
+        if (res > 0) {
+            q->complete = 1;
+            break;
+        }
+        int64_t now = search_time ();
+        if (shown ? now - shown_time >= SEARCH_UPDATE_INTERVAL : deadbeef->plt_get_item_count (q->plt, PL_SEARCH) >= SEARCH_FIRST_RESULTS) {
+            g_idle_add (search_update_cb, GINT_TO_POINTER (q->generation));
+            shown = 1;
+            shown_time = now;
+        }
+    }
+    if (search) {
+        deadbeef->plt_search_end (search);
+    }
+}
+
+static void
+search_work_done (ddb_job_t *job, void *ctx, int cancelled) {
+    // called on the main thread, the query belongs to the gui thread
+    g_idle_add (search_finished_cb, ctx);
+}
+
+// stops the query in progress, its results won't be shown
+static void
+search_cancel (void) {
+    if (search_delay_id) {
+        g_source_remove (search_delay_id);
+        search_delay_id = 0;
+    }
+    if (search_job) {
+        deadbeef->job_cancel (search_job);
+        deadbeef->job_release (search_job);
+        search_job = NULL;
+    }
+    search_select_pending = 0;
+    search_generation++;
+}
+
+static void
+search_process (DdbListview *listview, int select_results) {
+    search_cancel ();
+    ddb_playlist_t *plt = deadbeef->plt_get_curr ();
+    if (!plt) {
+        return;
+    }
+    GtkEntry *entry = GTK_ENTRY(lookup_widget(searchwin, "searchentry"));
+    const gchar *text = gtk_entry_get_text(entry);
+
+    if (deadbeef->plt_get_item_count (plt, PL_MAIN) > SEARCH_CHUNK) {
+        search_query_t *q = calloc (1, sizeof (search_query_t));
+        if (q) {
+            q->plt = plt;
+            q->text = strdup (text);
+            q->select_results = select_results;
+            q->generation = search_generation;
+            search_job = deadbeef->job_submit (DDB_JOB_PRIORITY_INTERACTIVE, search_work, search_work_done, q);
+            if (search_job) {
+                search_select_pending = select_results;
+                return;
+            }
+            free (q->text);
+            free (q);
+        }
+    }
+
+    // small enough to search right away
+    search_select_pending = 0;
+    deadbeef->pl_lock ();
+    deadbeef->plt_search_process2 (plt, text, select_results);
+    search_results_idx++;
+    deadbeef->pl_unlock ();
+    deadbeef->plt_unref (plt);
+    search_show_results (listview, 1);
+    if (select_results) {
+        search_select_results ();
+    }
+}
+
+static gboolean
+search_delay_cb (gpointer p) {
+    search_delay_id = 0;
+    DdbListview *listview = playlist_visible();
+    if (listview) {
+        search_process (listview, 1);
+    }
+    return FALSE;
 }
 
 static gboolean
@@ -102,6 +297,7 @@ search_start_cb (gpointer p) {
         DdbListview *listview = DDB_LISTVIEW (lookup_widget (searchwin, "searchlist"));
         refresh_source_id = 0;
         ddb_listview_clear_sort (listview);
+        search_cancel ();
         ddb_playlist_t *plt = deadbeef->plt_get_curr ();
         if (plt) {
             deadbeef->plt_search_reset (plt);
@@ -128,6 +324,7 @@ search_start (void) {
 
 void
 search_destroy (void) {
+    search_cancel ();
     if (searchwin) {
         ddb_listview_size_columns_without_scrollbar (DDB_LISTVIEW (lookup_widget (searchwin, "searchlist")));
         gtk_widget_destroy (searchwin);
@@ -283,11 +480,9 @@ refresh_cb (gpointer p) {
     refresh_source_id = 0;
     DdbListview *listview = playlist_visible();
     if (listview) {
-        ddb_playlist_t *plt = deadbeef->plt_get_curr ();
-        if (plt) {
-            search_process (listview, plt);
-            deadbeef->plt_unref (plt);
-        }
+        // the tracks or the playlist have changed
+        ddb_listview_groups_recheck (listview);
+        search_process (listview, search_select_pending);
     }
     return FALSE;
 }
@@ -404,21 +599,14 @@ on_searchentry_changed                 (GtkEditable     *editable,
 {
     DdbListview *listview = playlist_visible();
     if (listview) {
-        ddb_playlist_t *plt = deadbeef->plt_get_curr ();
-        if (plt) {
-            deadbeef->plt_deselect_all (plt);
-            search_process (listview, plt);
-            for (DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_SEARCH); it; it = next_playitem (it)) {
-                deadbeef->pl_set_selected (it, 1);
-            }
-            deadbeef->plt_unref (plt);
+        if (deadbeef->pl_getcount (PL_MAIN) > SEARCH_CHUNK) {
+            // wait for a pause in typing
+            search_cancel ();
+            search_delay_id = g_timeout_add (SEARCH_DELAY, search_delay_cb, NULL);
+            search_select_pending = 1;
         }
-        deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_SELECTION, 0);
-        DB_playItem_t *head = deadbeef->pl_get_first (PL_SEARCH);
-        if (head) {
-            ddb_event_track_t *event = (ddb_event_track_t *)deadbeef->event_alloc(DB_EV_CURSOR_MOVED);
-            event->track = head;
-            deadbeef->event_send ((ddb_event_t *)event, PL_SEARCH, 0);
+        else {
+            search_process (listview, 1);
         }
     }
 }
@@ -527,6 +715,11 @@ search_col_sort (int sort_order, void *user_data) {
     }
 }
 
+static int
+search_get_modification_idx (void) {
+    return gtkui_get_curr_playlist_mod () + search_results_idx;
+}
+
 static void
 search_groups_changed (const char *format) {
     deadbeef->conf_set_str ("gtkui.search.group_by_tf", format);
@@ -592,6 +785,7 @@ static DdbListviewBinding search_binding = {
     .get_idx = search_get_idx,
 
     .get_group = pl_common_get_group,
+    .get_group_hash = pl_common_get_group_hash,
     .groups_changed = search_groups_changed,
 
     .drag_n_drop = NULL,
@@ -599,6 +793,7 @@ static DdbListviewBinding search_binding = {
 
     .draw_column_data = search_draw_column_data,
     .draw_album_art = pl_common_draw_album_art,
+    .prefetch_album_art = pl_common_prefetch_album_art,
     .draw_group_title = search_draw_group_title,
 
     // columns
@@ -613,7 +808,7 @@ static DdbListviewBinding search_binding = {
     .header_context_menu = pl_common_header_context_menu,
     .list_context_menu = pl_common_list_context_menu,
     .delete_selected = search_delete_selected,
-    .modification_idx = gtkui_get_curr_playlist_mod,
+    .modification_idx = search_get_modification_idx,
 };
 
 void
@@ -2052,6 +2052,14 @@ trackinfochanged_cb (gpointer data) {
     return FALSE;
 }
 
+// the metadata may have changed, which can move the track to another group
+static gboolean
+trackinfo_content_changed_cb (gpointer data) {
+    w_trackdata_t *d = data;
+    ddb_listview_groups_invalidate (d->listview, d->trk);
+    return trackinfochanged_cb (data);
+}
+
 static gboolean
 paused_cb (gpointer data) {
     DB_playItem_t *it = deadbeef->streamer_get_playing_track ();
@@ -2083,6 +2091,15 @@ playlist_list_refresh_cb (gpointer data) {
     return FALSE;
 }
 
+static gboolean
+playlist_content_changed_cb (gpointer data) {
+    // tracks were added, removed or moved, or it's sent instead of
+    // DB_EV_TRACKINFOCHANGED when many tracks have changed
+    ddb_listview_groups_recheck (DDB_LISTVIEW(data));
+    ddb_listview_refresh (DDB_LISTVIEW(data), DDB_REFRESH_LIST);
+    return FALSE;
+}
+
 static gboolean
 playlist_header_refresh_cb (gpointer data) {
     ddb_listview_refresh (DDB_LISTVIEW(data), DDB_REFRESH_COLUMNS);
@@ -2246,7 +2263,7 @@ w_playlist_message (ddb_gtkui_widget_t *w, uint32_t id, uintptr_t ctx, uint32_t
         if (p1 == DDB_PLAYLIST_CHANGE_CONTENT || p1 == DDB_PLAYLIST_CHANGE_SELECTION && p2 != PL_MAIN || p1 == DDB_PLAYLIST_CHANGE_PLAYQUEUE) {
             ddb_event_track_t *ev = (ddb_event_track_t *)ctx;
             if (ev->track) {
-                g_idle_add (trackinfochanged_cb, playlist_trackdata(p->list, ev->track));
+                g_idle_add (p1 == DDB_PLAYLIST_CHANGE_CONTENT ? trackinfo_content_changed_cb : trackinfochanged_cb, playlist_trackdata(p->list, ev->track));
             }
         }
         break;
@@ -2254,8 +2271,10 @@ w_playlist_message (ddb_gtkui_widget_t *w, uint32_t id, uintptr_t ctx, uint32_t
         if (p1 == DDB_PLAYLIST_CHANGE_CONTENT || p1 == DDB_PLAYLIST_CHANGE_PLAYQUEUE) {
             g_idle_add (playlist_sort_reset_cb, p->list);
         }
-        if (p1 == DDB_PLAYLIST_CHANGE_CONTENT ||
-            p1 == DDB_PLAYLIST_CHANGE_SELECTION && (p2 != PL_MAIN || (DdbListview *)ctx != p->list) ||
+        if (p1 == DDB_PLAYLIST_CHANGE_CONTENT) {
+            g_idle_add (playlist_content_changed_cb, p->list);
+        }
+        else if (p1 == DDB_PLAYLIST_CHANGE_SELECTION && (p2 != PL_MAIN || (DdbListview *)ctx != p->list) ||
             p1 == DDB_PLAYLIST_CHANGE_PLAYQUEUE) {
             g_idle_add (playlist_list_refresh_cb, p->list);
         }
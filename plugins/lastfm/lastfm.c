@@ -20,6 +20,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
 #include <curl/curl.h>
 #include <math.h>
 #include "../../deadbeef.h"
@@ -66,15 +70,30 @@ static int lfm_reply_sz;
 static char lfm_err[CURL_ERROR_SIZE];
 
 static char lfm_nowplaying[2048]; // packet for nowplaying, or ""
-#define LFM_SUBMISSION_QUEUE_SIZE 50
 
-typedef struct {
-    DB_playItem_t *it;
-    time_t started_timestamp;
-    float playtime;
-} subm_item_t;
+// AudioScrobbler 1.2 accepts up to 50 submissions per request
+#define LFM_SUBMISSION_BATCH_SIZE 50
 
-static subm_item_t lfm_subm_queue[LFM_SUBMISSION_QUEUE_SIZE];
+// retry delays after a failed submission, per protocol spec: 1 min, doubling up to 2 hours
+#define LFM_BACKOFF_MIN 60
+#define LFM_BACKOFF_MAX 7200
+
+// pending scrobbles, in the order they were played.
+// each record is a single journal line (without the newline):
+// "<timestamp> <length> <artist> <title> <album> <tracknum> <mbid>",
+// where the strings are uri-encoded, and empty strings are written as "-"
+typedef struct lfm_scrobble_s {
+    char *rec;
+    struct lfm_scrobble_s *next;
+} lfm_scrobble_t;
+
+static lfm_scrobble_t *lfm_scrobbles;
+static lfm_scrobble_t *lfm_scrobbles_tail;
+static int lfm_num_scrobbles;
+
+static int lfm_wakeup; // set by event handlers, to interrupt backoff wait
+static time_t lfm_retry_at; // 0 if not backing off
+static int lfm_backoff;
 
 static void
 lfm_update_auth (void) {
@@ -440,14 +459,10 @@ lfm_add_keyvalue_uri_encoded (char **out, int *outl, const char *key, const char
     return ll - *outl;
 }
 
-// subm is submission idx, or -1 for nowplaying
+// formats nowplaying request parameters
 // returns number of bytes added, or -1
 static int
-lfm_format_uri (int subm, DB_playItem_t *song, char *out, int outl, time_t started_timestamp, float playtime) {
-    if (subm > 50) {
-        trace ("lastfm: it's only allowed to send up to 50 submissions at once (got idx=%d)\n", subm);
-        return -1;
-    }
+lfm_format_uri (DB_playItem_t *song, char *out, int outl, float playtime) {
     int sz = outl;
     char a[META_FIELD_SIZE]; // artist
     char t[META_FIELD_SIZE]; // title
@@ -456,22 +471,6 @@ lfm_format_uri (int subm, DB_playItem_t *song, char *out, int outl, time_t start
     char n[META_FIELD_SIZE]; // tracknum
     char m[META_FIELD_SIZE]; // muzicbrainz id
 
-    char ka[6] = "a";
-    char kt[6] = "t";
-    char kb[6] = "b";
-    char kl[6] = "l";
-    char kn[6] = "n";
-    char km[6] = "m";
-
-    if (subm >= 0) {
-        snprintf (ka+1, 5, "[%d]", subm);
-        strcpy (kt+1, ka+1);
-        strcpy (kb+1, ka+1);
-        strcpy (kl+1, ka+1);
-        strcpy (kn+1, ka+1);
-        strcpy (km+1, ka+1);
-    }
-
     if (lfm_fetch_song_info (song, playtime, a, t, b, &l, n, m) == 0) {
 //        trace ("playtime: %f\nartist: %s\ntitle: %s\nalbum: %s\nduration: %f\ntracknum: %s\n---\n", song->playtime, a, t, b, l, n);
     }
@@ -480,45 +479,234 @@ lfm_format_uri (int subm, DB_playItem_t *song, char *out, int outl, time_t start
         return -1;
     }
 
-    if (lfm_add_keyvalue_uri_encoded (&out, &outl, ka, a) < 0) {
-//        trace ("failed to add %s=%s\n", ka, a);
+    if (lfm_add_keyvalue_uri_encoded (&out, &outl, "a", a) < 0) {
+        return -1;
+    }
+    if (lfm_add_keyvalue_uri_encoded (&out, &outl, "t", t) < 0) {
         return -1;
     }
-    if (lfm_add_keyvalue_uri_encoded (&out, &outl, kt, t) < 0) {
-//        trace ("failed to add %s=%s\n", kt, t);
+    if (lfm_add_keyvalue_uri_encoded (&out, &outl, "b", b) < 0) {
         return -1;
     }
-    if (lfm_add_keyvalue_uri_encoded (&out, &outl, kb, b) < 0) {
-//        trace ("failed to add %s=%s\n", kb, b);
+    if (lfm_add_keyvalue_uri_encoded (&out, &outl, "n", n) < 0) {
         return -1;
     }
-    if (lfm_add_keyvalue_uri_encoded (&out, &outl, kn, n) < 0) {
-//        trace ("failed to add %s=%s\n", kn, n);
+    if (lfm_add_keyvalue_uri_encoded (&out, &outl, "m", m) < 0) {
         return -1;
     }
-    if (lfm_add_keyvalue_uri_encoded (&out, &outl, km, m) < 0) {
-//        trace ("failed to add %s=%s\n", km, m);
+    int processed = snprintf (out, outl, "l=%d&", (int)l);
+    if (processed >= outl) {
+        return -1;
+    }
+    outl -= processed;
+
+    return sz - outl;
+}
+
+// appends uri-encoded string to a journal record, followed by separator
+// returns 0 on success, -1 if it doesn't fit
+static int
+lfm_rec_add_field (char **out, int *outl, const char *value, char sep) {
+    int l;
+    if (*value) {
+        l = lfm_uri_encode (*out, *outl, value);
+        if (l < 0) {
+            return -1;
+        }
+    }
+    else {
+        // '-' is always escaped by lfm_uri_encode, so it can't clash with a value
+        if (*outl <= 1) {
+            return -1;
+        }
+        **out = '-';
+        l = 1;
+    }
+    *out += l;
+    *outl -= l;
+    if (*outl <= 1) {
+        return -1;
+    }
+    **out = sep;
+    (*out)[1] = 0;
+    *out += 1;
+    *outl -= 1;
+    return 0;
+}
+
+// formats journal record for a finished track, see lfm_scrobble_t
+static int
+lfm_format_scrobble (DB_playItem_t *song, char *out, int outl, time_t started_timestamp, float playtime) {
+    char a[META_FIELD_SIZE];
+    char t[META_FIELD_SIZE];
+    char b[META_FIELD_SIZE];
+    float l;
+    char n[META_FIELD_SIZE];
+    char m[META_FIELD_SIZE];
+
+    if (lfm_fetch_song_info (song, playtime, a, t, b, &l, n, m) < 0) {
         return -1;
     }
-    int processed;
-    processed = snprintf (out, outl, "%s=%d&", kl, (int)l);
-    if (processed > outl) {
-//        trace ("failed to add %s=%d\n", kl, (int)l);
+
+    int processed = snprintf (out, outl, "%d %d ", (int)started_timestamp, (int)l);
+    if (processed >= outl) {
         return -1;
     }
     out += processed;
     outl -= processed;
-    if (subm >= 0) {
-        processed = snprintf (out, outl, "i[%d]=%d&o[%d]=P&r[%d]=&", subm, (int)started_timestamp, subm, subm);
-        if (processed > outl) {
-//            trace ("failed to add i[%d]=%d&o[%d]=P&r[%d]=&\n", subm, (int)song->started_timestamp, subm, subm);
+    if (lfm_rec_add_field (&out, &outl, a, ' ') < 0
+            || lfm_rec_add_field (&out, &outl, t, ' ') < 0
+            || lfm_rec_add_field (&out, &outl, b, ' ') < 0
+            || lfm_rec_add_field (&out, &outl, n, ' ') < 0
+            || lfm_rec_add_field (&out, &outl, m, 0) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// appends submission parameters with index subm for a journal record
+// returns number of bytes added, or -1
+static int
+lfm_format_submission (int subm, const char *rec, char *out, int outl) {
+    char fields[7][META_FIELD_SIZE*3];
+    int nf = 0;
+    const char *p = rec;
+    while (nf < 7) {
+        const char *e = strchr (p, ' ');
+        if (!e) {
+            e = p + strlen (p);
+        }
+        if (e - p >= sizeof (fields[0])) {
             return -1;
         }
-        out += processed;
-        outl -= processed;
+        if (e - p == 1 && *p == '-') {
+            fields[nf][0] = 0;
+        }
+        else {
+            memcpy (fields[nf], p, e-p);
+            fields[nf][e-p] = 0;
+        }
+        nf++;
+        if (!*e) {
+            break;
+        }
+        p = e + 1;
+    }
+    if (nf != 7) {
+        return -1;
     }
 
-    return sz - outl;
+    int processed = snprintf (out, outl, "a[%d]=%s&t[%d]=%s&b[%d]=%s&n[%d]=%s&m[%d]=%s&l[%d]=%s&i[%d]=%s&o[%d]=P&r[%d]=&",
+            subm, fields[2], subm, fields[3], subm, fields[4], subm, fields[5], subm, fields[6],
+            subm, fields[1], subm, fields[0], subm, subm);
+    if (processed >= outl) {
+        return -1;
+    }
+    return processed;
+}
+
+static void
+lfm_get_journal_path (char *path, int size) {
+    snprintf (path, size, "%s/lastfm_journal", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+}
+
+// must be called with lfm_mutex locked
+static void
+lfm_queue_scrobble (const char *rec) {
+    lfm_scrobble_t *s = malloc (sizeof (lfm_scrobble_t));
+    s->rec = strdup (rec);
+    s->next = NULL;
+    if (lfm_scrobbles_tail) {
+        lfm_scrobbles_tail->next = s;
+    }
+    else {
+        lfm_scrobbles = s;
+    }
+    lfm_scrobbles_tail = s;
+    lfm_num_scrobbles++;
+}
+
+// must be called with lfm_mutex locked
+static void
+lfm_free_scrobbles (int count) {
+    while (lfm_scrobbles && count--) {
+        lfm_scrobble_t *next = lfm_scrobbles->next;
+        free (lfm_scrobbles->rec);
+        free (lfm_scrobbles);
+        lfm_scrobbles = next;
+        lfm_num_scrobbles--;
+    }
+    if (!lfm_scrobbles) {
+        lfm_scrobbles_tail = NULL;
+    }
+}
+
+static void
+lfm_journal_load (void) {
+    char path[PATH_MAX];
+    lfm_get_journal_path (path, sizeof (path));
+    FILE *fp = fopen (path, "rt");
+    if (!fp) {
+        return;
+    }
+    char line[META_FIELD_SIZE*3*5+100];
+    while (fgets (line, sizeof (line), fp)) {
+        size_t l = strlen (line);
+        if (l == 0 || line[l-1] != '\n') {
+            // truncated record, e.g. the player was killed while writing it
+            trace ("lfm: skipping incomplete journal record\n");
+            continue;
+        }
+        line[l-1] = 0;
+        lfm_queue_scrobble (line);
+    }
+    fclose (fp);
+    trace ("lfm: loaded %d scrobbles from journal\n", lfm_num_scrobbles);
+}
+
+// must be called with lfm_mutex locked
+static void
+lfm_journal_append (const char *rec) {
+    char path[PATH_MAX];
+    lfm_get_journal_path (path, sizeof (path));
+    FILE *fp = fopen (path, "at");
+    if (!fp) {
+        fprintf (stderr, "lastfm: failed to open %s for writing\n", path);
+        return;
+    }
+    fprintf (fp, "%s\n", rec);
+    fclose (fp);
+}
+
+// rewrites journal with the scrobbles still in queue
+// must be called with lfm_mutex locked
+static void
+lfm_journal_compact (void) {
+    char path[PATH_MAX];
+    lfm_get_journal_path (path, sizeof (path));
+    if (!lfm_scrobbles) {
+        unlink (path);
+        return;
+    }
+    char tempfile[PATH_MAX];
+    snprintf (tempfile, sizeof (tempfile), "%s.tmp", path);
+    FILE *fp = fopen (tempfile, "w+t");
+    if (!fp) {
+        fprintf (stderr, "lastfm: failed to open %s for writing\n", tempfile);
+        return;
+    }
+    for (lfm_scrobble_t *s = lfm_scrobbles; s; s = s->next) {
+        if (fprintf (fp, "%s\n", s->rec) < 0) {
+            fclose (fp);
+            unlink (tempfile);
+            return;
+        }
+    }
+    fclose (fp);
+    if (rename (tempfile, path) != 0) {
+        fprintf (stderr, "lastfm: failed to move %s to %s: %s\n", tempfile, path, strerror (errno));
+        unlink (tempfile);
+    }
 }
 
 static int
@@ -528,10 +716,11 @@ lastfm_songstarted (ddb_event_track_t *ev, uintptr_t data) {
         return 0;
     }
     deadbeef->mutex_lock (lfm_mutex);
-    if (lfm_format_uri (-1, ev->track, lfm_nowplaying, sizeof (lfm_nowplaying), ev->started_timestamp, 120) < 0) {
+    if (lfm_format_uri (ev->track, lfm_nowplaying, sizeof (lfm_nowplaying), 120) < 0) {
         lfm_nowplaying[0] = 0;
     }
 //    trace ("%s\n", lfm_nowplaying);
+    lfm_wakeup = 1;
     deadbeef->mutex_unlock (lfm_mutex);
     if (lfm_nowplaying[0]) {
         deadbeef->cond_signal (lfm_cond);
@@ -576,18 +765,16 @@ lastfm_songchanged (ddb_event_trackchange_t *ev, uintptr_t data) {
         trace ("lfm: not enough metadata for submission, artist=%s, title=%s, album=%s\n", deadbeef->pl_find_meta (ev->from, "artist"), deadbeef->pl_find_meta (ev->from, "title"), deadbeef->pl_find_meta (ev->from, "album"));
         return 0;
     }
-    deadbeef->mutex_lock (lfm_mutex);
-    // find free place in queue
-    for (int i = 0; i < LFM_SUBMISSION_QUEUE_SIZE; i++) {
-        if (!lfm_subm_queue[i].it) {
-            trace ("lfm: song is now in queue for submission\n");
-            lfm_subm_queue[i].it = ev->from;
-            lfm_subm_queue[i].started_timestamp = ev->started_timestamp;
-            lfm_subm_queue[i].playtime = ev->playtime;
-            deadbeef->pl_item_ref (ev->from);
-            break;
-        }
+    char rec[META_FIELD_SIZE*3*5+100];
+    if (lfm_format_scrobble (ev->from, rec, sizeof (rec), ev->started_timestamp, ev->playtime) < 0) {
+        trace ("lfm: failed to format scrobble\n");
+        return 0;
     }
+    deadbeef->mutex_lock (lfm_mutex);
+    trace ("lfm: song is now in queue for submission\n");
+    lfm_journal_append (rec);
+    lfm_queue_scrobble (rec);
+    lfm_wakeup = 1;
     deadbeef->mutex_unlock (lfm_mutex);
     deadbeef->cond_signal (lfm_cond);
 
@@ -638,38 +825,59 @@ lfm_send_nowplaying (void) {
     lfm_nowplaying[0] = 0;
 }
 
-static void
+// sends up to LFM_SUBMISSION_BATCH_SIZE queued scrobbles in one request
+// returns 1 if more scrobbles remain to be sent, 0 if done, -1 on failure
+static int
 lfm_send_submissions (void) {
     trace ("lfm_send_submissions\n");
-    int i;
-    char req[1024*50];
     int idx = 0;
-    char *r = req;
-    int len = sizeof (req);
-    int res;
+    int res = 0;
     deadbeef->mutex_lock (lfm_mutex);
-    for (i = 0; i < LFM_SUBMISSION_QUEUE_SIZE; i++) {
-        if (lfm_subm_queue[i].it) {
-            res = lfm_format_uri (idx, lfm_subm_queue[i].it, r, len, lfm_subm_queue[i].started_timestamp, lfm_subm_queue[i].playtime);
-            if (res < 0) {
-                trace ("lfm: failed to format uri\n");
-                return;
-            }
-            len -= res;
-            r += res;
-            idx++;
+    size_t len = SESS_ID_MAX + 10;
+    lfm_scrobble_t *s;
+    for (s = lfm_scrobbles; s && idx < LFM_SUBMISSION_BATCH_SIZE; s = s->next, idx++) {
+        // record length + keys/indices
+        len += strlen (s->rec) + 100;
+    }
+    if (!idx) {
+        deadbeef->mutex_unlock (lfm_mutex);
+        return 0;
+    }
+    char *req = malloc (len);
+    char *r = req;
+    idx = 0;
+    for (s = lfm_scrobbles; s && idx < LFM_SUBMISSION_BATCH_SIZE; s = s->next, idx++) {
+        res = lfm_format_submission (idx, s->rec, r, len);
+        if (res < 0) {
+            trace ("lfm: failed to format uri\n");
+            break;
         }
+        len -= res;
+        r += res;
     }
     deadbeef->mutex_unlock (lfm_mutex);
-    if (!idx) {
-        return;
+    if (res < 0) {
+        if (idx == 0) {
+            // malformed record on top of the queue, nothing else can be sent past it
+            fprintf (stderr, "lastfm: dropping malformed journal record\n");
+            deadbeef->mutex_lock (lfm_mutex);
+            lfm_free_scrobbles (1);
+            lfm_journal_compact ();
+            deadbeef->mutex_unlock (lfm_mutex);
+            free (req);
+            return 1;
+        }
+        // send the records before the bad one
     }
+    int success = 0;
     if (auth () < 0) {
-        return;
+        free (req);
+        return -1;
     }
     res = snprintf (r, len, "s=%s&", lfm_sess);
-    if (res > len) {
-        return;
+    if (res >= len) {
+        free (req);
+        return -1;
     }
     trace ("submission req string:\n%s\n", req);
 #if !LFM_NOSEND
@@ -693,15 +901,7 @@ lfm_send_submissions (void) {
             }
             else {
                 trace ("submission successful, response:\n%s\n", lfm_reply);
-                deadbeef->mutex_lock (lfm_mutex);
-                for (i = 0; i < LFM_SUBMISSION_QUEUE_SIZE; i++) {
-                    if (lfm_subm_queue[i].it) {
-                        deadbeef->pl_item_unref (lfm_subm_queue[i].it);
-                        lfm_subm_queue[i].it = NULL;
-                        lfm_subm_queue[i].started_timestamp = 0;
-                    }
-                }
-                deadbeef->mutex_unlock (lfm_mutex);
+                success = 1;
             }
         }
         curl_req_cleanup ();
@@ -709,17 +909,19 @@ lfm_send_submissions (void) {
     }
 #else
     trace ("submission successful (NOSEND=1):\n");
-    deadbeef->mutex_lock (lfm_mutex);
-    for (i = 0; i < LFM_SUBMISSION_QUEUE_SIZE; i++) {
-        if (lfm_subm_queue[i].it) {
-            deadbeef->pl_item_unref (lfm_subm_queue[i].it);
-            lfm_subm_queue[i].it = NULL;
-            lfm_subm_queue[i].started_timestamp = 0;
-
-        }
+    success = 1;
+#endif
+    free (req);
+    if (!success) {
+        return -1;
     }
+    deadbeef->mutex_lock (lfm_mutex);
+    // new scrobbles are only ever appended, so the sent ones are still on top
+    lfm_free_scrobbles (idx);
+    lfm_journal_compact ();
+    int more = lfm_scrobbles != NULL;
     deadbeef->mutex_unlock (lfm_mutex);
-#endif
+    return more;
 }
 
 static void
@@ -727,26 +929,54 @@ lfm_thread (void *ctx) {
     //trace ("lfm_thread started\n");
     for (;;) {
         if (lfm_stopthread) {
-            deadbeef->mutex_unlock (lfm_mutex);
             trace ("lfm_thread end\n");
             return;
         }
-        trace ("lfm wating for cond...\n");
-        deadbeef->cond_wait (lfm_cond, lfm_mutex);
+        deadbeef->mutex_lock (lfm_mutex);
+        while (!lfm_stopthread && !lfm_wakeup) {
+            if (lfm_retry_at) {
+                // backing off after a failed submission: the retry happens
+                // even if nothing is played meanwhile
+                time_t now = time (NULL);
+                if (now >= lfm_retry_at) {
+                    break;
+                }
+                deadbeef->cond_wait_timeout_locked (lfm_cond, lfm_mutex, (int)(lfm_retry_at - now) * 1000);
+            }
+            else {
+                trace ("lfm wating for cond...\n");
+                deadbeef->cond_wait_locked (lfm_cond, lfm_mutex);
+            }
+        }
+        lfm_wakeup = 0;
+        deadbeef->mutex_unlock (lfm_mutex);
         if (lfm_stopthread) {
-            deadbeef->mutex_unlock (lfm_mutex);
             trace ("lfm_thread end[2]\n");
             return;
         }
         trace ("cond signalled!\n");
-        deadbeef->mutex_unlock (lfm_mutex);
 
         if (!deadbeef->conf_get_int ("lastfm.enable", 0)) {
             continue;
         }
-        trace ("lfm sending nowplaying...\n");
-        lfm_send_submissions ();
+        if (!lfm_retry_at || time (NULL) >= lfm_retry_at) {
+            int res;
+            while ((res = lfm_send_submissions ()) > 0 && !lfm_stopthread);
+            if (res < 0) {
+                lfm_backoff = lfm_backoff ? lfm_backoff * 2 : LFM_BACKOFF_MIN;
+                if (lfm_backoff > LFM_BACKOFF_MAX) {
+                    lfm_backoff = LFM_BACKOFF_MAX;
+                }
+                lfm_retry_at = time (NULL) + lfm_backoff;
+                trace ("lfm: submission failed, retrying in %d seconds\n", lfm_backoff);
+            }
+            else {
+                lfm_backoff = 0;
+                lfm_retry_at = 0;
+            }
+        }
         // try to send nowplaying
+        trace ("lfm sending nowplaying...\n");
         if (lfm_nowplaying[0] && !deadbeef->conf_get_int ("lastfm.disable_np", 0)) {
             lfm_send_nowplaying ();
         }
@@ -774,6 +1004,9 @@ lastfm_start (void) {
     lfm_stopthread = 0;
     lfm_mutex = deadbeef->mutex_create_nonrecursive ();
     lfm_cond = deadbeef->cond_create ();
+    lfm_journal_load ();
+    // retry scrobbles left over from the previous session
+    lfm_wakeup = lfm_scrobbles != NULL;
     lfm_tid = deadbeef->thread_start (lfm_thread, NULL);
 
     return 0;
@@ -783,13 +1016,16 @@ static int
 lastfm_stop (void) {
     trace ("lastfm_stop\n");
     if (lfm_mutex) {
+        deadbeef->mutex_lock (lfm_mutex);
         lfm_stopthread = 1;
-
         trace ("lfm_stop signalling cond\n");
         deadbeef->cond_signal (lfm_cond);
+        deadbeef->mutex_unlock (lfm_mutex);
         trace ("waiting for thread to finish\n");
         deadbeef->thread_join (lfm_tid);
         lfm_tid = 0;
+        // the journal keeps whatever wasn't sent
+        lfm_free_scrobbles (lfm_num_scrobbles);
         deadbeef->cond_free (lfm_cond);
         deadbeef->mutex_free (lfm_mutex);
     }
@@ -902,7 +1138,7 @@ static const char settings_dlg[] =
 // define plugin interface
 static DB_misc_t plugin = {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 5,
+    .plugin.api_vminor = 10,
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_MISC,
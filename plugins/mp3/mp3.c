@@ -1154,9 +1154,7 @@ cmp3_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
     uint32_t f = deadbeef->pl_get_item_flags (it);
     f &= ~DDB_TAG_MASK;
     deadbeef->pl_set_item_flags (it, f);
-    /*int apeerr = */deadbeef->junk_apev2_read (it, fp);
-    /*int v2err = */deadbeef->junk_id3v2_read (it, fp);
-    /*int v1err = */deadbeef->junk_id3v1_read (it, fp);
+    deadbeef->junk_read_tags (it, fp);
     deadbeef->pl_set_meta_int (it, ":MP3_DELAY", buffer.delay);
     deadbeef->pl_set_meta_int (it, ":MP3_PADDING", buffer.padding);
 
@@ -1205,9 +1203,7 @@ cmp3_read_metadata (DB_playItem_t *it) {
     }
     deadbeef->pl_delete_all_meta (it);
     // FIXME: reload and apply the Xing header
-    /*int apeerr = */deadbeef->junk_apev2_read (it, fp);
-    /*int v2err = */deadbeef->junk_id3v2_read (it, fp);
-    /*int v1err = */deadbeef->junk_id3v1_read (it, fp);
+    deadbeef->junk_read_tags (it, fp);
     deadbeef->pl_add_meta (it, "title", NULL);
     deadbeef->fclose (fp);
     return 0;
@@ -1267,7 +1263,7 @@ static const char settings_dlg[] =
 // define plugin interface
 static DB_decoder_t plugin = {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 0,
+    .plugin.api_vminor = 10,
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DECODER,
@@ -28,6 +28,7 @@
 #endif
 #include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
 #include "../../deadbeef.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
@@ -40,7 +41,25 @@ static intptr_t null_tid;
 static int null_terminate;
 static int state;
 
-static void
+// benchmark mode: consume the audio as fast as the streamer can produce it,
+// and print decoding and dsp throughput to stderr
+static int benchmark;
+
+typedef struct {
+    double walltime;
+    double audiotime;
+    int64_t bytes;
+    ddb_streamer_perf_t perf;
+} bench_snapshot_t;
+
+static uintptr_t bench_mutex;
+static double bench_audiotime; // protected by bench_mutex
+static int64_t bench_bytes; // protected by bench_mutex
+static bench_snapshot_t bench_start;
+static bench_snapshot_t bench_track_start;
+static int bench_tracks;
+
+static int
 pnull_callback (char *stream, int len);
 
 static void
@@ -67,6 +86,51 @@ pnull_pause (void);
 static int
 pnull_unpause (void);
 
+static double
+bench_now (void) {
+    struct timeval tm;
+    gettimeofday (&tm, NULL);
+    return tm.tv_sec + tm.tv_usec / 1000000.0;
+}
+
+static void
+bench_snapshot (bench_snapshot_t *s) {
+    s->walltime = bench_now ();
+    deadbeef->mutex_lock (bench_mutex);
+    s->audiotime = bench_audiotime;
+    s->bytes = bench_bytes;
+    deadbeef->mutex_unlock (bench_mutex);
+    deadbeef->streamer_get_perf (&s->perf);
+}
+
+static void
+bench_report (const char *name, const bench_snapshot_t *from) {
+    bench_snapshot_t to;
+    bench_snapshot (&to);
+    double audio = to.audiotime - from->audiotime;
+    double wall = to.walltime - from->walltime;
+    if (audio <= 0 || wall <= 0) {
+        return;
+    }
+    double decode = to.perf.decode_time - from->perf.decode_time;
+    double dsp = to.perf.dsp_time - from->perf.dsp_time;
+    fprintf (stderr, "nullout: %s: %.2fs of audio in %.3fs (%.1fx realtime, %.0f bytes/s), decode %.3fs (%.1fx realtime), dsp %.3fs (%.2f%% of audio time)\n",
+            name, audio, wall, audio / wall, (to.bytes - from->bytes) / wall,
+            decode, decode > 0 ? audio / decode : 0,
+            dsp, dsp * 100 / audio);
+}
+
+static void
+bench_track_finished (DB_playItem_t *it) {
+    char title[200];
+    deadbeef->pl_get_meta (it, "title", title, sizeof (title));
+    if (!title[0]) {
+        deadbeef->pl_get_meta (it, ":URI", title, sizeof (title));
+    }
+    bench_report (title, &bench_track_start);
+    bench_tracks++;
+}
+
 int
 pnull_init (void) {
     trace ("pnull_init\n");
@@ -102,12 +166,25 @@ pnull_play (void) {
     if (!null_tid) {
         pnull_init ();
     }
+    if (benchmark && state == OUTPUT_STATE_STOPPED) {
+        if (!deadbeef->conf_get_int ("streamer.nosleep", 0)) {
+            fprintf (stderr, "nullout: benchmark mode is limited by the streamer read-ahead, set streamer.nosleep=1 to remove the limit\n");
+        }
+        bench_tracks = 0;
+        bench_snapshot (&bench_start);
+        bench_track_start = bench_start;
+    }
     state = OUTPUT_STATE_PLAYING;
     return 0;
 }
 
 int
 pnull_stop (void) {
+    if (benchmark && state != OUTPUT_STATE_STOPPED) {
+        char name[50];
+        snprintf (name, sizeof (name), "total (%d tracks)", bench_tracks);
+        bench_report (name, &bench_start);
+    }
     state = OUTPUT_STATE_STOPPED;
     deadbeef->streamer_reset (1);
     return 0;
@@ -156,21 +233,59 @@ pnull_thread (void *context) {
         }
         
         char buf[4096];
-        pnull_callback (buf, 1024);
+        // read whole frames only, frames of 24 bit or multichannel audio
+        // don't divide the buffer size
+        int framesize = (plugin.fmt.bps >> 3) * plugin.fmt.channels;
+        if (framesize <= 0 || framesize > (int)sizeof (buf)) {
+            usleep (10000);
+            continue;
+        }
+        int bufsize = sizeof (buf) / framesize * framesize;
+        if (benchmark) {
+            if (pnull_callback (buf, bufsize) <= 0) {
+                // the streamer is not keeping up, or buffering
+                usleep (1000);
+            }
+            continue;
+        }
+
+        // play at the real time
+        int bytespersec = plugin.fmt.samplerate * framesize;
+        if (bytespersec <= 0) {
+            usleep (10000);
+            continue;
+        }
+        int len = bytespersec / 100 / framesize * framesize; // 10ms of audio
+        if (len <= 0 || len > bufsize) {
+            len = bufsize;
+        }
+        pnull_callback (buf, len);
+        usleep ((int64_t)len * 1000000 / bytespersec);
     }
 }
 
-static void
+static int
 pnull_callback (char *stream, int len) {
     if (!deadbeef->streamer_ok_to_read (len)) {
         memset (stream, 0, len);
-        return;
+        return 0;
     }
     int bytesread = deadbeef->streamer_read (stream, len);
 
+    if (bytesread > 0) {
+        int bytespersec = plugin.fmt.samplerate * (plugin.fmt.bps >> 3) * plugin.fmt.channels;
+        deadbeef->mutex_lock (bench_mutex);
+        bench_bytes += bytesread;
+        if (bytespersec > 0) {
+            bench_audiotime += (double)bytesread / bytespersec;
+        }
+        deadbeef->mutex_unlock (bench_mutex);
+    }
+
     if (bytesread < len) {
-        memset (stream + bytesread, 0, len-bytesread);
+        memset (stream + (bytesread > 0 ? bytesread : 0), 0, len - (bytesread > 0 ? bytesread : 0));
     }
+    return bytesread;
 }
 
 int
@@ -180,14 +295,44 @@ pnull_get_state (void) {
 
 int
 null_start (void) {
+    bench_mutex = deadbeef->mutex_create_nonrecursive ();
+    benchmark = deadbeef->conf_get_int ("nullout.benchmark", 0);
     return 0;
 }
 
 int
 null_stop (void) {
+    if (bench_mutex) {
+        deadbeef->mutex_free (bench_mutex);
+        bench_mutex = 0;
+    }
     return 0;
 }
 
+static int
+null_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    switch (id) {
+    case DB_EV_CONFIGCHANGED:
+        benchmark = deadbeef->conf_get_int ("nullout.benchmark", 0);
+        break;
+    case DB_EV_SONGSTARTED:
+        if (benchmark) {
+            bench_snapshot (&bench_track_start);
+        }
+        break;
+    case DB_EV_SONGFINISHED:
+        if (benchmark && state != OUTPUT_STATE_STOPPED) {
+            bench_track_finished (((ddb_event_track_t *)ctx)->track);
+        }
+        break;
+    }
+    return 0;
+}
+
+static const char settings_dlg[] =
+    "property \"Benchmark mode (decode as fast as possible, print stats to stderr)\" checkbox nullout.benchmark 0;\n"
+;
+
 DB_plugin_t *
 nullout_load (DB_functions_t *api) {
     deadbeef = api;
@@ -197,7 +342,7 @@ nullout_load (DB_functions_t *api) {
 // define plugin interface
 static DB_output_t plugin = {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 0,
+    .plugin.api_vminor = 10,
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_OUTPUT,
@@ -229,6 +374,8 @@ static DB_output_t plugin = {
     .plugin.website = "http://deadbeef.sf.net",
     .plugin.start = null_start,
     .plugin.stop = null_stop,
+    .plugin.message = null_message,
+    .plugin.configdialog = settings_dlg,
     .init = pnull_init,
     .free = pnull_free,
     .setformat = pnull_setformat,
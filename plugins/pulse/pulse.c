@@ -23,6 +23,7 @@
 #endif
 
 #include <pulse/simple.h>
+#include <pulse/pulseaudio.h>
 
 #include <stdint.h>
 #include <unistd.h>
@@ -45,6 +46,10 @@ DB_functions_t * deadbeef;
 #define CONFSTR_PULSE_SERVERADDR "pulse.serveraddr"
 #define CONFSTR_PULSE_BUFFERSIZE "pulse.buffersize"
 #define PULSE_DEFAULT_BUFFERSIZE 4096
+#define CONFSTR_PULSE_ASYNC "pulse.async"
+#define CONFSTR_PULSE_LATENCY "pulse.latency"
+#define PULSE_DEFAULT_LATENCY 100
+#define PULSE_ASYNC_CHUNK 32768
 
 static intptr_t pulse_tid;
 static int pulse_terminate;
@@ -57,8 +62,23 @@ static uintptr_t mutex;
 
 static int buffer_size;
 
+// asynchronous mode: the stream is driven by a threaded mainloop,
+// which wakes up the pulse thread when the server wants more data
+static int async_mode;
+static pa_threaded_mainloop *mainloop;
+static pa_context *context;
+static pa_stream *stream;
+
 static void pulse_thread(void *context);
 
+static void pulse_async_thread(void *context);
+
+static int pulse_async_open(const char *server, pa_channel_map *channel_map);
+
+static void pulse_async_close(void);
+
+static void pulse_async_cork(int cork);
+
 static void pulse_callback(char *stream, int len);
 
 static int pulse_init();
@@ -124,6 +144,18 @@ static int pulse_set_spec(ddb_waveformat_t *fmt)
 
     if (s) {
         pa_simple_free(s);
+        s = NULL;
+    }
+    pulse_async_close();
+
+    if (async_mode) {
+        char server[256];
+        deadbeef->conf_get_str (CONFSTR_PULSE_SERVERADDR, "", server, sizeof (server));
+        if (0 != pulse_async_open((server[0] && strcmp(server, "default")) ? server : NULL, &channel_map)) {
+            trace ("pulse_init failed\n");
+            return -1;
+        }
+        return 0;
     }
 
     pa_buffer_attr * attr = NULL;
@@ -171,11 +203,13 @@ static int pulse_init(void)
         memcpy (&plugin.fmt, &requested_fmt, sizeof (ddb_waveformat_t));
     }
 
+    async_mode = deadbeef->conf_get_int(CONFSTR_PULSE_ASYNC, 1);
+
     if (0 != pulse_set_spec(&plugin.fmt)) {
         return -1;
     }
 
-    pulse_tid = deadbeef->thread_start(pulse_thread, NULL);
+    pulse_tid = deadbeef->thread_start(async_mode ? pulse_async_thread : pulse_thread, NULL);
 
     return 0;
 }
@@ -183,7 +217,7 @@ static int pulse_init(void)
 static int pulse_setformat (ddb_waveformat_t *fmt)
 {
     memcpy (&requested_fmt, fmt, sizeof (ddb_waveformat_t));
-    if (!s) {
+    if (!s && !stream) {
         return -1;
     }
     if (!memcmp (fmt, &plugin.fmt, sizeof (ddb_waveformat_t))) {
@@ -227,6 +261,13 @@ static int pulse_free(void)
     intptr_t tid = pulse_tid;
     pulse_tid = 0;
     pulse_terminate = 1;
+    if (mainloop)
+    {
+        // wake up the pulse thread if it's waiting for a write request
+        pa_threaded_mainloop_lock(mainloop);
+        pa_threaded_mainloop_signal(mainloop, 0);
+        pa_threaded_mainloop_unlock(mainloop);
+    }
     deadbeef->thread_join(tid);
 
     state = OUTPUT_STATE_STOPPED;
@@ -235,6 +276,8 @@ static int pulse_free(void)
         pa_simple_free(s);
         s = NULL;
     }
+    pulse_async_close();
+    deadbeef->streamer_set_output_latency(0);
 
     return 0;
 }
@@ -250,6 +293,15 @@ static int pulse_play(void)
         }
     }
 
+    if (stream)
+    {
+        pa_threaded_mainloop_lock(mainloop);
+        pulse_async_cork(0);
+        state = OUTPUT_STATE_PLAYING;
+        pa_threaded_mainloop_unlock(mainloop);
+        return 0;
+    }
+
     state = OUTPUT_STATE_PLAYING;
     return 0;
 }
@@ -271,6 +323,16 @@ static int pulse_pause(void)
         return -1;
     }
 
+    if (stream)
+    {
+        // keep the stream and its buffered audio, just stop playing it
+        pa_threaded_mainloop_lock(mainloop);
+        pulse_async_cork(1);
+        state = OUTPUT_STATE_PAUSED;
+        pa_threaded_mainloop_unlock(mainloop);
+        return 0;
+    }
+
     pulse_free();
     state = OUTPUT_STATE_PAUSED;
     return 0;
@@ -279,7 +341,14 @@ static int pulse_pause(void)
 static int pulse_unpause(void)
 {
     trace ("pulse_unpause\n");
-    if (state == OUTPUT_STATE_PAUSED)
+    if (state == OUTPUT_STATE_PAUSED && stream)
+    {
+        pa_threaded_mainloop_lock(mainloop);
+        pulse_async_cork(0);
+        state = OUTPUT_STATE_PLAYING;
+        pa_threaded_mainloop_unlock(mainloop);
+    }
+    else if (state == OUTPUT_STATE_PAUSED)
     {
         if (pulse_init () < 0)
         {
@@ -331,6 +400,236 @@ static void pulse_thread(void *context)
     trace ("pulse_thread finished\n");
 }
 
+static void pulse_async_context_state_cb(pa_context *c, void *userdata)
+{
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void pulse_async_stream_state_cb(pa_stream *p, void *userdata)
+{
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void pulse_async_stream_request_cb(pa_stream *p, size_t nbytes, void *userdata)
+{
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+// must be called with the mainloop locked
+static void pulse_async_update_latency(void)
+{
+    pa_usec_t usec;
+    int negative;
+    if (pa_stream_get_latency(stream, &usec, &negative) >= 0)
+    {
+        deadbeef->streamer_set_output_latency(negative ? 0 : usec / 1000000.f);
+    }
+}
+
+static void pulse_async_stream_latency_cb(pa_stream *p, void *userdata)
+{
+    pulse_async_update_latency();
+}
+
+static int pulse_async_open(const char *server, pa_channel_map *channel_map)
+{
+    mainloop = pa_threaded_mainloop_new();
+    if (!mainloop)
+    {
+        return -1;
+    }
+    context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "Deadbeef");
+    if (!context)
+    {
+        goto error;
+    }
+    pa_context_set_state_callback(context, pulse_async_context_state_cb, NULL);
+    if (pa_context_connect(context, server, 0, NULL) < 0)
+    {
+        goto error;
+    }
+
+    pa_threaded_mainloop_lock(mainloop);
+    if (pa_threaded_mainloop_start(mainloop) < 0)
+    {
+        goto error_locked;
+    }
+
+    for (;;)
+    {
+        pa_context_state_t cs = pa_context_get_state(context);
+        if (cs == PA_CONTEXT_READY)
+        {
+            break;
+        }
+        if (!PA_CONTEXT_IS_GOOD(cs))
+        {
+            goto error_locked;
+        }
+        pa_threaded_mainloop_wait(mainloop);
+    }
+
+    stream = pa_stream_new(context, "Music", &ss, channel_map);
+    if (!stream)
+    {
+        goto error_locked;
+    }
+    pa_stream_set_state_callback(stream, pulse_async_stream_state_cb, NULL);
+    pa_stream_set_write_callback(stream, pulse_async_stream_request_cb, NULL);
+    pa_stream_set_latency_update_callback(stream, pulse_async_stream_latency_cb, NULL);
+
+    // let the server pick everything but the total buffer length
+    int latency = deadbeef->conf_get_int(CONFSTR_PULSE_LATENCY, PULSE_DEFAULT_LATENCY);
+    if (latency < 10)
+    {
+        latency = 10;
+    }
+    pa_buffer_attr attr;
+    attr.maxlength = (uint32_t)-1;
+    attr.tlength = pa_usec_to_bytes(latency * PA_USEC_PER_MSEC, &ss);
+    attr.prebuf = (uint32_t)-1;
+    attr.minreq = (uint32_t)-1;
+    attr.fragsize = (uint32_t)-1;
+
+    pa_stream_flags_t flags = PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_ADJUST_LATENCY;
+    if (pa_stream_connect_playback(stream, NULL, &attr, flags, NULL, NULL) < 0)
+    {
+        goto error_locked;
+    }
+
+    for (;;)
+    {
+        pa_stream_state_t st = pa_stream_get_state(stream);
+        if (st == PA_STREAM_READY)
+        {
+            break;
+        }
+        if (!PA_STREAM_IS_GOOD(st))
+        {
+            goto error_locked;
+        }
+        pa_threaded_mainloop_wait(mainloop);
+    }
+    pa_threaded_mainloop_unlock(mainloop);
+
+    trace ("pulse: connected, target latency %d ms\n", latency);
+    return 0;
+
+error_locked:
+    fprintf(stderr, "pulse: failed to open stream: %s\n", pa_strerror(pa_context_errno(context)));
+    pa_threaded_mainloop_unlock(mainloop);
+error:
+    pulse_async_close();
+    return -1;
+}
+
+static void pulse_async_close(void)
+{
+    if (!mainloop)
+    {
+        return;
+    }
+    pa_threaded_mainloop_stop(mainloop);
+    if (stream)
+    {
+        pa_stream_disconnect(stream);
+        pa_stream_unref(stream);
+        stream = NULL;
+    }
+    if (context)
+    {
+        pa_context_disconnect(context);
+        pa_context_unref(context);
+        context = NULL;
+    }
+    pa_threaded_mainloop_free(mainloop);
+    mainloop = NULL;
+}
+
+// must be called with the mainloop locked
+static void pulse_async_cork(int cork)
+{
+    pa_operation *o = pa_stream_cork(stream, cork, NULL, NULL);
+    if (o)
+    {
+        pa_operation_unref(o);
+    }
+    // the pulse thread needs to re-check the state
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void pulse_async_thread(void *ctx)
+{
+#ifdef __linux__
+    prctl(PR_SET_NAME, "deadbeef-pulse", 0, 0, 0, 0);
+#endif
+
+    char buf[PULSE_ASYNC_CHUNK];
+
+    while (!pulse_terminate)
+    {
+        if (state != OUTPUT_STATE_PLAYING || !deadbeef->streamer_ok_to_read (-1))
+        {
+            usleep(10000);
+            continue;
+        }
+
+        int sample_size = plugin.fmt.channels * (plugin.fmt.bps / 8);
+
+        // wait until the server asks for more data
+        pa_threaded_mainloop_lock(mainloop);
+        size_t avail = 0;
+        while (!pulse_terminate && state == OUTPUT_STATE_PLAYING)
+        {
+            avail = pa_stream_writable_size(stream);
+            if (avail == (size_t)-1 || avail >= sample_size)
+            {
+                break;
+            }
+            pa_threaded_mainloop_wait(mainloop);
+        }
+        if (avail == (size_t)-1)
+        {
+            fprintf(stderr, "pulse: stream error: %s\n", pa_strerror(pa_context_errno(context)));
+        }
+        else
+        {
+            pulse_async_update_latency();
+        }
+        pa_threaded_mainloop_unlock(mainloop);
+
+        if (avail == (size_t)-1)
+        {
+            usleep(10000);
+            continue;
+        }
+        if (pulse_terminate || state != OUTPUT_STATE_PLAYING || avail < sample_size)
+        {
+            continue;
+        }
+
+        if (avail > sizeof (buf))
+        {
+            avail = sizeof (buf);
+        }
+        avail -= avail % sample_size;
+
+        // read from the streamer without holding the mainloop lock,
+        // the streamer may be calling into the plugin meanwhile
+        pulse_callback(buf, (int)avail);
+
+        pa_threaded_mainloop_lock(mainloop);
+        if (pa_stream_write(stream, buf, avail, NULL, 0, PA_SEEK_RELATIVE) < 0)
+        {
+            fprintf(stderr, "pulse: failed to write buffer\n");
+        }
+        pa_threaded_mainloop_unlock(mainloop);
+    }
+
+    pulse_terminate = 0;
+    trace ("pulse_async_thread finished\n");
+}
+
 static void pulse_callback(char *stream, int len)
 {
     int bytesread = deadbeef->streamer_read(stream, len);
@@ -370,12 +669,14 @@ DB_plugin_t * pulse_load(DB_functions_t *api)
 
 static const char settings_dlg[] =
     "property \"PulseAudio server\" entry " CONFSTR_PULSE_SERVERADDR " default;\n"
-    "property \"Preferred buffer size\" entry " CONFSTR_PULSE_BUFFERSIZE " " STR(PULSE_DEFAULT_BUFFERSIZE) ";\n";
+    "property \"Use asynchronous API\" checkbox " CONFSTR_PULSE_ASYNC " 1;\n"
+    "property \"Target latency (ms, asynchronous API)\" entry " CONFSTR_PULSE_LATENCY " " STR(PULSE_DEFAULT_LATENCY) ";\n"
+    "property \"Preferred buffer size (synchronous API)\" entry " CONFSTR_PULSE_BUFFERSIZE " " STR(PULSE_DEFAULT_BUFFERSIZE) ";\n";
 
 static DB_output_t plugin =
 {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 0,
+    .plugin.api_vminor = 10,
     .plugin.version_major = 0,
     .plugin.version_minor = 1,
     .plugin.type = DB_PLUGIN_OUTPUT,
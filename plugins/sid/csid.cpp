@@ -20,6 +20,10 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
@@ -61,18 +65,38 @@ le_int16 (int16_t in, unsigned char *out) {
 #endif
 }
 
-// SLDB support costs ~1M!!!
-// current hvsc sldb size is ~35k songs
-#define SLDB_MAX_SONGS 40000
-// ~50k subsongs in current sldb
-#define SLDB_POOL_SIZE 55000
+// HVSC song length database, indexed by tune md5.
+// songs are sorted by digest (and by file order for duplicates), subsong lengths
+// of each song are stored contiguously in the pool.
 typedef struct {
-    uint8_t sldb_digests[SLDB_MAX_SONGS][16];
-    int16_t sldb_pool[SLDB_POOL_SIZE];
-    int sldb_poolmark;
-    int16_t *sldb_lengths[SLDB_MAX_SONGS];
-    int sldb_size;
+    uint8_t digest[16];
+    int32_t offset; // index of the first subsong length in the pool
+    int32_t count; // number of subsong lengths
+} sldb_entry_t;
+
+typedef struct {
+    sldb_entry_t *songs;
+    int numsongs;
+    int allocsongs;
+    int16_t *pool;
+    int poolsize;
+    int allocpool;
+    // when loaded from the cache file, songs and pool point into this mapping
+    void *map;
+    size_t mapsize;
 } sldb_t;
+
+// preprocessed sldb cache file, in native byte order:
+// header, followed by numsongs entries, followed by poolsize lengths
+#define SLDB_CACHE_MAGIC "DDBSLDB1"
+typedef struct {
+    char magic[8];
+    int64_t src_mtime;
+    int64_t src_size;
+    int32_t numsongs;
+    int32_t poolsize;
+} sldb_cache_header_t;
+
 static int sldb_loaded;
 static sldb_t *sldb;
 static int sldb_disable;
@@ -83,49 +107,152 @@ static int chip_voices_changed = 0;
 static int conf_hvsc_enable = 0;
 
 static void
-sldb_load()
-{
-    if (sldb_disable) {
-        return;
+sldb_free (sldb_t *db) {
+    if (db->map) {
+        munmap (db->map, db->mapsize);
     }
-    trace ("sldb_load\n");
-    if (sldb_loaded || !conf_hvsc_enable) {
-        sldb_disable = 1;
-        return;
+    else {
+        free (db->songs);
+        free (db->pool);
     }
-    char conf_hvsc_path[1000];
-    deadbeef->conf_get_str ("hvsc_path", "", conf_hvsc_path, sizeof (conf_hvsc_path));
-    if (!conf_hvsc_path[0]) {
-        sldb_disable = 1;
-        return;
+    free (db);
+}
+
+static int
+sldb_add_song (sldb_t *db, const uint8_t *digest) {
+    if (db->numsongs >= db->allocsongs) {
+        int alloc = db->allocsongs ? db->allocsongs * 2 : 4096;
+        sldb_entry_t *songs = (sldb_entry_t *)realloc (db->songs, alloc * sizeof (sldb_entry_t));
+        if (!songs) {
+            return -1;
+        }
+        db->songs = songs;
+        db->allocsongs = alloc;
     }
-    sldb_loaded = 1;
-    const char *fname = conf_hvsc_path;
-    FILE *fp = fopen (fname, "r");
+    sldb_entry_t *e = &db->songs[db->numsongs++];
+    memcpy (e->digest, digest, 16);
+    e->offset = db->poolsize;
+    e->count = 0;
+    return 0;
+}
+
+static int
+sldb_add_length (sldb_t *db, int16_t time) {
+    if (db->poolsize >= db->allocpool) {
+        int alloc = db->allocpool ? db->allocpool * 2 : 8192;
+        int16_t *pool = (int16_t *)realloc (db->pool, alloc * sizeof (int16_t));
+        if (!pool) {
+            return -1;
+        }
+        db->pool = pool;
+        db->allocpool = alloc;
+    }
+    db->pool[db->poolsize++] = time;
+    db->songs[db->numsongs-1].count++;
+    return 0;
+}
+
+static int
+sldb_entry_cmp (const void *a, const void *b) {
+    const sldb_entry_t *ea = (const sldb_entry_t *)a;
+    const sldb_entry_t *eb = (const sldb_entry_t *)b;
+    int res = memcmp (ea->digest, eb->digest, 16);
+    if (res) {
+        return res;
+    }
+    // keep the first occurence of a duplicate digest in front
+    return ea->offset < eb->offset ? -1 : (ea->offset > eb->offset ? 1 : 0);
+}
+
+static void
+sldb_get_cache_path (char *path, int size) {
+    snprintf (path, size, "%s/hvsc_songlengths.bin", deadbeef->get_system_dir (DDB_SYS_DIR_CACHE));
+}
+
+static sldb_t *
+sldb_load_cache (const struct stat *src) {
+    char path[PATH_MAX];
+    sldb_get_cache_path (path, sizeof (path));
+    int fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat (fd, &st) || st.st_size < (off_t)sizeof (sldb_cache_header_t)) {
+        close (fd);
+        return NULL;
+    }
+    void *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    const sldb_cache_header_t *hdr = (const sldb_cache_header_t *)map;
+    if (memcmp (hdr->magic, SLDB_CACHE_MAGIC, 8)
+            || hdr->src_mtime != (int64_t)src->st_mtime
+            || hdr->src_size != (int64_t)src->st_size
+            || hdr->numsongs < 0 || hdr->poolsize < 0
+            || (size_t)st.st_size != sizeof (sldb_cache_header_t) + hdr->numsongs * sizeof (sldb_entry_t) + hdr->poolsize * sizeof (int16_t)) {
+        trace ("sid: sldb cache is out of date\n");
+        munmap (map, st.st_size);
+        return NULL;
+    }
+    sldb_t *db = (sldb_t *)calloc (1, sizeof (sldb_t));
+    db->map = map;
+    db->mapsize = st.st_size;
+    db->songs = (sldb_entry_t *)((uint8_t *)map + sizeof (sldb_cache_header_t));
+    db->numsongs = hdr->numsongs;
+    db->pool = (int16_t *)(db->songs + db->numsongs);
+    db->poolsize = hdr->poolsize;
+    trace ("sid: loaded sldb cache, %d songs\n", db->numsongs);
+    return db;
+}
+
+static void
+sldb_save_cache (const sldb_t *db, const struct stat *src) {
+    char path[PATH_MAX];
+    sldb_get_cache_path (path, sizeof (path));
+    char tempfile[PATH_MAX];
+    snprintf (tempfile, sizeof (tempfile), "%s.part", path);
+    mkdir (deadbeef->get_system_dir (DDB_SYS_DIR_CACHE), 0755);
+    FILE *fp = fopen (tempfile, "wb");
     if (!fp) {
-        trace ("sid: failed to open file %s\n", fname);
-        sldb_disable = 1;
+        trace ("sid: failed to write %s\n", tempfile);
         return;
     }
-    char str[1024];
+    sldb_cache_header_t hdr;
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, SLDB_CACHE_MAGIC, 8);
+    hdr.src_mtime = src->st_mtime;
+    hdr.src_size = src->st_size;
+    hdr.numsongs = db->numsongs;
+    hdr.poolsize = db->poolsize;
+    if (fwrite (&hdr, sizeof (hdr), 1, fp) != 1
+            || fwrite (db->songs, sizeof (sldb_entry_t), db->numsongs, fp) != (size_t)db->numsongs
+            || fwrite (db->pool, sizeof (int16_t), db->poolsize, fp) != (size_t)db->poolsize) {
+        fclose (fp);
+        unlink (tempfile);
+        return;
+    }
+    if (fclose (fp) || rename (tempfile, path)) {
+        unlink (tempfile);
+    }
+}
+
+static sldb_t *
+sldb_parse (FILE *fp) {
+    char str[4096];
 
     int line = 1;
-    if (fgets (str, 1024, fp) != str) {
-        goto fail; // eof
+    if (fgets (str, sizeof (str), fp) != str) {
+        return NULL; // eof
     }
     if (strncmp (str, "[Database]", 10)) {
-        goto fail; // bad format
+        return NULL; // bad format
     }
 
-    if (!sldb) {
-        sldb = (sldb_t *)malloc (sizeof (sldb_t));
-        memset (sldb, 0, sizeof (sldb_t));
-    }
-    while (fgets (str, 1024, fp) == str) {
-        if (sldb->sldb_size >= SLDB_MAX_SONGS) {
-            trace ("sldb loader ran out of memory.\n");
-            break;
-        }
+    sldb_t *db = (sldb_t *)calloc (1, sizeof (sldb_t));
+    while (fgets (str, sizeof (str), fp) == str) {
         line++;
         if (str[0] == ';') {
 //            trace ("reading songlength for %s", str);
@@ -173,17 +300,10 @@ sldb_load()
             trace ("bad md5 (sz=%d, line=%d)\n", sz, line);
             continue; // bad song md5
         }
-//        else {
-//            trace ("digest: ");
-//            for (int j = 0; j < 16; j++) {
-//                trace ("%02x", (int)digest[j]);
-//            }
-//            trace ("\n");
-//            exit (0);
-//        }
-        memcpy (sldb->sldb_digests[sldb->sldb_size], digest, 16);
-        sldb->sldb_lengths[sldb->sldb_size] = &sldb->sldb_pool[sldb->sldb_poolmark];
-        sldb->sldb_size++;
+        if (sldb_add_song (db, digest) < 0) {
+            trace ("sldb loader ran out of memory.\n");
+            break;
+        }
         // check '=' sign
         if (*p != '=') {
             continue; // no '=' sign
@@ -192,16 +312,15 @@ sldb_load()
         if (!(*p)) {
             continue; // unexpected eol
         }
-        int subsong = 0;
         while (*p >= ' ') {
             // read subsong lengths until eol
             char timestamp[7]; // up to MMM:SS
             sz = 0;
-            while (*p > ' ' && *p != '(' && sz < 7) {
+            while (*p > ' ' && *p != '(' && *p != '.' && sz < 7) {
                 timestamp[sz++] = *p;
                 p++;
             }
-            if (sz < 4 || sz == 6 && *p > ' ' && *p != '(') {
+            if (sz < 4 || sz == 6 && *p > ' ' && *p != '(' && *p != '.') {
                 break; // bad timestamp
             }
             timestamp[sz] = 0;
@@ -226,18 +345,14 @@ sldb_load()
                 //trace ("subsong %d, time %s:%s\n", subsong, minute, second);
                 time = atoi (minute) * 60 + atoi (second);
             }
-            if (sldb->sldb_poolmark >= SLDB_POOL_SIZE) {
+            if (sldb_add_length (db, time) < 0) {
                 trace ("sldb ran out of memory\n");
-                goto fail;
+                goto done;
             }
-            
-            sldb->sldb_lengths[sldb->sldb_size-1][subsong] = time;
-            sldb->sldb_poolmark++;
-            subsong++;
 
             // prepare for next timestamp
-            if (*p == '(') {
-                // skip until next whitespace
+            if (*p == '(' || *p == '.') {
+                // skip milliseconds and attributes until next whitespace
                 while (*p > ' ') {
                     p++;
                 }
@@ -255,10 +370,51 @@ sldb_load()
         }
     }
 
-fail:
+done:
+    qsort (db->songs, db->numsongs, sizeof (sldb_entry_t), sldb_entry_cmp);
+    return db;
+}
+
+static void
+sldb_load()
+{
+    if (sldb_disable) {
+        return;
+    }
+    trace ("sldb_load\n");
+    if (sldb_loaded || !conf_hvsc_enable) {
+        sldb_disable = 1;
+        return;
+    }
+    char conf_hvsc_path[1000];
+    deadbeef->conf_get_str ("hvsc_path", "", conf_hvsc_path, sizeof (conf_hvsc_path));
+    if (!conf_hvsc_path[0]) {
+        sldb_disable = 1;
+        return;
+    }
+    sldb_loaded = 1;
     sldb_disable = 1;
+    const char *fname = conf_hvsc_path;
+    struct stat st;
+    if (stat (fname, &st)) {
+        trace ("sid: failed to stat file %s\n", fname);
+        return;
+    }
+    sldb = sldb_load_cache (&st);
+    if (sldb) {
+        return;
+    }
+    FILE *fp = fopen (fname, "r");
+    if (!fp) {
+        trace ("sid: failed to open file %s\n", fname);
+        return;
+    }
+    sldb = sldb_parse (fp);
     fclose (fp);
-    trace ("HVSC sldb loaded %d songs, %d subsongs total\n", sldb->sldb_size, sldb->sldb_poolmark);
+    if (sldb) {
+        trace ("HVSC sldb loaded %d songs, %d subsongs total\n", sldb->numsongs, sldb->poolsize);
+        sldb_save_cache (sldb, &st);
+    }
 }
 
 static int
@@ -267,14 +423,34 @@ sldb_find (const uint8_t *digest) {
         trace ("sldb not loaded\n");
         return -1;
     }
-    for (int i = 0; i < sldb->sldb_size; i++) {
-        if (!memcmp (digest, sldb->sldb_digests[i], 16)) {
-            return i;
+    // find the first entry with matching digest
+    int lo = 0;
+    int hi = sldb->numsongs;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (memcmp (sldb->songs[mid].digest, digest, 16) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
         }
     }
+    if (lo < sldb->numsongs && !memcmp (sldb->songs[lo].digest, digest, 16)) {
+        return lo;
+    }
     return -1;
 }
 
+// returns subsong length in seconds, or -1 if unknown
+static int
+sldb_get_length (int song, int subsong) {
+    const sldb_entry_t *e = &sldb->songs[song];
+    if (subsong >= e->count) {
+        return -1;
+    }
+    return sldb->pool[e->offset + subsong];
+}
+
 DB_fileinfo_t *
 csid_open (uint32_t hints) {
     DB_fileinfo_t *_info = (DB_fileinfo_t *)malloc (sizeof (sid_info_t));
@@ -520,7 +696,7 @@ csid_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
 #endif
 
     int song = -1;
-    if (sldb_loaded) {
+    if (sldb) {
         song = sldb_find (sig);
     }
 
@@ -568,9 +744,9 @@ csid_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
             }
 
             float length = deadbeef->conf_get_float ("sid.defaultlength", 180);
-            if (sldb_loaded) {
-                if (song >= 0 && sldb->sldb_lengths[song][s] >= 0) {
-                    length = sldb->sldb_lengths[song][s];
+            if (sldb) {
+                if (song >= 0 && sldb_get_length (song, s) >= 0) {
+                    length = sldb_get_length (song, s);
                 }
                 //        if (song < 0) {
                 //            trace ("song %s not found in db, md5: ", fname);
@@ -602,7 +778,7 @@ sid_configchanged (void) {
 
     // pick up new sldb filename in case it was changed
     if (sldb) {
-        free (sldb);
+        sldb_free (sldb);
         sldb = NULL;
         sldb_loaded = 0;
     }
@@ -633,7 +809,7 @@ csid_start (void) {
 int
 csid_stop (void) {
     if (sldb) {
-        free (sldb);
+        sldb_free (sldb);
         sldb = NULL;
     }
     sldb_loaded = 0;
@@ -23,6 +23,7 @@
 
 #include <string.h>
 #include <zip.h>
+#include <zlib.h>
 #include <stdlib.h>
 #include <assert.h>
 #include "../../deadbeef.h"
@@ -41,6 +42,17 @@ static DB_vfs_t plugin;
 #define ZIP_BUFFER_SIZE 8192
 #endif
 
+// deflated entries are inflated by the plugin, which saves the inflate state
+// every ZIP_CHECKPOINT_INTERVAL bytes, so that seeking back only needs to
+// inflate from the nearest checkpoint, instead of from the start of the entry
+#define ZIP_CHECKPOINT_INTERVAL (2*1024*1024)
+#define ZIP_INFLATE_BUFFER_SIZE 16384
+
+typedef struct {
+    int64_t offset; // uncompressed offset
+    z_stream zs;
+} ddb_zip_checkpoint_t;
+
 typedef struct {
     DB_FILE file;
     struct zip* z;
@@ -49,6 +61,19 @@ typedef struct {
     int index;
     int64_t size;
 
+    // entry extracted into memory
+    uint8_t *mem;
+
+    // raw deflate stream, inflated with zlib
+    int inflate;
+    z_stream zs;
+    int zs_end;
+    uint8_t *inbuf;
+    int64_t raw_pos; // compressed bytes read from zf
+    ddb_zip_checkpoint_t **checkpoints; // zlib doesn't allow moving z_stream
+    int num_checkpoints;
+    int alloc_checkpoints;
+
 #if ENABLE_CACHE
     uint8_t buffer[ZIP_BUFFER_SIZE];
     int buffer_remaining;
@@ -56,6 +81,10 @@ typedef struct {
 #endif
 } ddb_zip_file_t;
 
+static const char settings_dlg[] =
+    "property \"Extract entries up to this size into memory (KB)\" entry vfs_zip.memory_extract_max_kb 4096;\n"
+;
+
 static const char *scheme_names[] = { "zip://", NULL };
 
 const char **
@@ -68,6 +97,149 @@ vfs_zip_is_streaming (void) {
     return 0;
 }
 
+static void
+vfs_zip_free_checkpoints (ddb_zip_file_t *zf) {
+    for (int i = 0; i < zf->num_checkpoints; i++) {
+        inflateEnd (&zf->checkpoints[i]->zs);
+        free (zf->checkpoints[i]);
+    }
+    free (zf->checkpoints);
+    zf->checkpoints = NULL;
+    zf->num_checkpoints = 0;
+    zf->alloc_checkpoints = 0;
+}
+
+static void
+vfs_zip_add_checkpoint (ddb_zip_file_t *zf) {
+    if (zf->num_checkpoints == zf->alloc_checkpoints) {
+        int n = zf->alloc_checkpoints ? zf->alloc_checkpoints * 2 : 16;
+        ddb_zip_checkpoint_t **cps = realloc (zf->checkpoints, n * sizeof (ddb_zip_checkpoint_t *));
+        if (!cps) {
+            return;
+        }
+        zf->checkpoints = cps;
+        zf->alloc_checkpoints = n;
+    }
+    ddb_zip_checkpoint_t *cp = malloc (sizeof (ddb_zip_checkpoint_t));
+    if (!cp) {
+        return;
+    }
+    if (inflateCopy (&cp->zs, &zf->zs) != Z_OK) {
+        free (cp);
+        return;
+    }
+    cp->offset = zf->zs.total_out;
+    zf->checkpoints[zf->num_checkpoints++] = cp;
+    trace ("vfs_zip: checkpoint %d at %lld (compressed %lld)\n", zf->num_checkpoints, cp->offset, (int64_t)cp->zs.total_in);
+}
+
+// move forward to the position in the raw stream
+static int
+vfs_zip_seek_raw (ddb_zip_file_t *zf, int64_t pos) {
+#if defined(LIBZIP_VERSION_MAJOR) && (LIBZIP_VERSION_MAJOR > 1 || LIBZIP_VERSION_MINOR >= 2)
+    if (!zip_fseek (zf->zf, pos, SEEK_SET)) {
+        zf->raw_pos = pos;
+        return 0;
+    }
+#endif
+    while (zf->raw_pos < pos) {
+        int sz = min (pos - zf->raw_pos, ZIP_INFLATE_BUFFER_SIZE);
+        zip_int64_t rb = zip_fread (zf->zf, zf->inbuf, sz);
+        if (rb != sz) {
+            return -1;
+        }
+        zf->raw_pos += rb;
+    }
+    return 0;
+}
+
+// continue inflating from the checkpoint, or from the start of the entry
+// if cp is NULL; the entry is reopened unless the checkpoint is ahead
+static int
+vfs_zip_restart (ddb_zip_file_t *zf, ddb_zip_checkpoint_t *cp) {
+    if (!zf->zf || !zf->inflate || !cp || cp->zs.total_in < zf->raw_pos) {
+        if (zf->zf) {
+            zip_fclose (zf->zf);
+        }
+        zf->zf = zip_fopen_index (zf->z, zf->index, zf->inflate ? ZIP_FL_COMPRESSED : 0);
+        if (!zf->zf) {
+            return -1;
+        }
+        zf->raw_pos = 0;
+    }
+    if (!zf->inflate) {
+        return 0;
+    }
+
+    inflateEnd (&zf->zs);
+    if (cp) {
+        if (inflateCopy (&zf->zs, &cp->zs) != Z_OK) {
+            return -1;
+        }
+    }
+    else {
+        memset (&zf->zs, 0, sizeof (zf->zs));
+        if (inflateInit2 (&zf->zs, -MAX_WBITS) != Z_OK) {
+            return -1;
+        }
+    }
+    zf->zs.next_in = zf->inbuf;
+    zf->zs.avail_in = 0;
+    zf->zs_end = 0;
+    if (cp && vfs_zip_seek_raw (zf, cp->zs.total_in) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int
+vfs_zip_inflate (ddb_zip_file_t *zf, uint8_t *out, int size) {
+    zf->zs.next_out = out;
+    zf->zs.avail_out = size;
+    while (zf->zs.avail_out > 0 && !zf->zs_end) {
+        if (zf->num_checkpoints == 0
+                || zf->zs.total_out >= zf->checkpoints[zf->num_checkpoints-1]->offset + ZIP_CHECKPOINT_INTERVAL) {
+            vfs_zip_add_checkpoint (zf);
+        }
+        if (zf->zs.avail_in == 0) {
+            // inflate may still have output pending when the input is over
+            zip_int64_t rb = zip_fread (zf->zf, zf->inbuf, ZIP_INFLATE_BUFFER_SIZE);
+            zf->zs.next_in = zf->inbuf;
+            zf->zs.avail_in = rb > 0 ? (uInt)rb : 0;
+            zf->raw_pos += zf->zs.avail_in;
+        }
+        // don't inflate past the next checkpoint
+        uInt avail_out = zf->zs.avail_out;
+        int64_t next_cp = zf->num_checkpoints ? zf->checkpoints[zf->num_checkpoints-1]->offset + ZIP_CHECKPOINT_INTERVAL : 0;
+        if (zf->num_checkpoints && next_cp > zf->zs.total_out && next_cp - zf->zs.total_out < avail_out) {
+            zf->zs.avail_out = (uInt)(next_cp - zf->zs.total_out);
+        }
+        uInt limited = avail_out - zf->zs.avail_out;
+        int ret = inflate (&zf->zs, Z_NO_FLUSH);
+        zf->zs.avail_out += limited;
+        if (ret == Z_STREAM_END) {
+            zf->zs_end = 1;
+        }
+        else if (ret == Z_BUF_ERROR) {
+            break; // no progress possible, truncated stream
+        }
+        else if (ret != Z_OK) {
+            trace ("vfs_zip: inflate error %d\n", ret);
+            break;
+        }
+    }
+    return size - zf->zs.avail_out;
+}
+
+// read uncompressed data from the current position of the entry
+static int
+vfs_zip_read_entry (ddb_zip_file_t *zf, void *ptr, int size) {
+    if (zf->inflate) {
+        return vfs_zip_inflate (zf, ptr, size);
+    }
+    return (int)zip_fread (zf->zf, ptr, size);
+}
+
 // fname must have form of zip://full_filepath.zip:full_filepath_in_zip
 DB_FILE*
 vfs_zip_open (const char *fname) {
@@ -102,19 +274,50 @@ vfs_zip_open (const char *fname) {
         return NULL;
     }
 
-    struct zip_file *zf = zip_fopen_index (z, st.index, 0);
-    if (!zf) {
-        zip_close (z);
-        return NULL;
-    }
-
     ddb_zip_file_t *f = malloc (sizeof (ddb_zip_file_t));
     memset (f, 0, sizeof (ddb_zip_file_t));
     f->file.vfs = &plugin;
     f->z = z;
-    f->zf = zf;
     f->index = st.index;
     f->size = st.size;
+
+    // small entries are extracted into memory
+    int64_t max_mem = (int64_t)deadbeef->conf_get_int ("vfs_zip.memory_extract_max_kb", 4096) * 1024;
+    if (f->size <= max_mem) {
+        struct zip_file *zf = zip_fopen_index (z, st.index, 0);
+        f->mem = malloc (f->size ? f->size : 1);
+        if (!zf || !f->mem || zip_fread (zf, f->mem, f->size) != f->size) {
+            trace ("vfs_zip: failed to extract %s\n", fname);
+            if (zf) {
+                zip_fclose (zf);
+            }
+            free (f->mem);
+            free (f);
+            zip_close (z);
+            return NULL;
+        }
+        zip_fclose (zf);
+        zip_close (z);
+        f->z = NULL;
+        return (DB_FILE*)f;
+    }
+
+    f->inflate = st.comp_method == ZIP_CM_DEFLATE && st.encryption_method == ZIP_EM_NONE;
+    if (f->inflate) {
+        f->inbuf = malloc (ZIP_INFLATE_BUFFER_SIZE);
+    }
+    if (vfs_zip_restart (f, NULL) < 0) {
+        if (f->zf) {
+            zip_fclose (f->zf);
+        }
+        if (f->inflate) {
+            inflateEnd (&f->zs);
+        }
+        free (f->inbuf);
+        free (f);
+        zip_close (z);
+        return NULL;
+    }
     trace ("vfs_zip: end open %s\n", fname);
     return (DB_FILE*)f;
 }
@@ -129,6 +332,12 @@ vfs_zip_close (DB_FILE *f) {
     if (zf->z) {
         zip_close (zf->z);
     }
+    if (zf->inflate) {
+        inflateEnd (&zf->zs);
+        vfs_zip_free_checkpoints (zf);
+        free (zf->inbuf);
+    }
+    free (zf->mem);
     free (zf);
 }
 
@@ -138,11 +347,17 @@ vfs_zip_read (void *ptr, size_t size, size_t nmemb, DB_FILE *f) {
 //    printf ("read: %d\n", size*nmemb);
 
     size_t sz = size * nmemb;
+    if (zf->mem) {
+        sz = min (sz, zf->size - zf->offset);
+        memcpy (ptr, zf->mem + zf->offset, sz);
+        zf->offset += sz;
+        return sz / size;
+    }
 #if ENABLE_CACHE
     while (sz) {
         if (zf->buffer_remaining == 0) {
             zf->buffer_pos = 0;
-            int rb = zip_fread (zf->zf, zf->buffer, ZIP_BUFFER_SIZE);
+            int rb = vfs_zip_read_entry (zf, zf->buffer, ZIP_BUFFER_SIZE);
             if (rb <= 0) {
                 break;
             }
@@ -157,9 +372,11 @@ vfs_zip_read (void *ptr, size_t size, size_t nmemb, DB_FILE *f) {
         ptr += from_buf;
     }
 #else
-    rb = zip_fread (zf->zf, ptr, sz);
-    sz -= rb;
-    zf->offset += rb;
+    int rb = vfs_zip_read_entry (zf, ptr, sz);
+    if (rb > 0) {
+        sz -= rb;
+        zf->offset += rb;
+    }
 #endif
 
     return (size * nmemb - sz) / size;
@@ -177,6 +394,14 @@ vfs_zip_seek (DB_FILE *f, int64_t offset, int whence) {
         offset = zf->size + offset;
     }
 
+    if (zf->mem) {
+        if (offset < 0 || offset > zf->size) {
+            return -1;
+        }
+        zf->offset = offset;
+        return 0;
+    }
+
 #if ENABLE_CACHE
     int64_t offs = offset - zf->offset;
     if ((offs < 0 && -offs <= zf->buffer_pos) || (offs >= 0 && offs < zf->buffer_remaining)) {
@@ -209,14 +434,22 @@ vfs_zip_seek (DB_FILE *f, int64_t offset, int whence) {
 
     zf->offset += zf->buffer_remaining;
 #endif
-    if (offset < zf->offset) {
+    // find the nearest checkpoint before the target
+    ddb_zip_checkpoint_t *cp = NULL;
+    if (zf->inflate) {
+        for (int i = zf->num_checkpoints-1; i >= 0; i--) {
+            if (zf->checkpoints[i]->offset <= offset) {
+                cp = zf->checkpoints[i];
+                break;
+            }
+        }
+    }
+    if (offset < zf->offset || (cp && cp->offset > zf->offset)) {
         // reopen
-        zip_fclose (zf->zf);
-        zf->zf = zip_fopen_index (zf->z, zf->index, 0);
-        if (!zf->zf) {
+        if (vfs_zip_restart (zf, cp) < 0) {
             return -1;
         }
-        zf->offset = 0;
+        zf->offset = cp ? cp->offset : 0;
     }
 #if ENABLE_CACHE
     zf->buffer_pos = 0;
@@ -226,7 +459,10 @@ vfs_zip_seek (DB_FILE *f, int64_t offset, int whence) {
     int64_t n = offset - zf->offset;
     while (n > 0) {
         int sz = min (n, sizeof (buf));
-        ssize_t rb = zip_fread (zf->zf, buf, sz);
+        int rb = vfs_zip_read_entry (zf, buf, sz);
+        if (rb <= 0) {
+            break;
+        }
         n -= rb;
         assert (n >= 0);
         zf->offset += rb;
@@ -249,10 +485,12 @@ vfs_zip_tell (DB_FILE *f) {
 void
 vfs_zip_rewind (DB_FILE *f) {
     ddb_zip_file_t *zf = (ddb_zip_file_t *)f;
-    zip_fclose (zf->zf);
-    zf->zf = zip_fopen_index (zf->z, zf->index, 0);
-    assert (zf->zf); // FIXME: better error handling?
     zf->offset = 0;
+    if (zf->mem) {
+        return;
+    }
+    int res = vfs_zip_restart (zf, NULL);
+    assert (!res); // FIXME: better error handling?
 #if ENABLE_CACHE
     zf->buffer_remaining = 0;
 #endif
@@ -340,6 +578,7 @@ static DB_vfs_t plugin = {
         "3. This notice may not be removed or altered from any source distribution.\n"
     ,
     .plugin.website = "http://deadbeef.sf.net",
+    .plugin.configdialog = settings_dlg,
     .open = vfs_zip_open,
     .close = vfs_zip_close,
     .read = vfs_zip_read,
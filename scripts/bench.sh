@@ -0,0 +1,69 @@
+#!/bin/sh
+# Decoder, DSP and cover art scaling benchmark, run by "make bench".
+# Usage: scripts/bench.sh [builddir]
+#
+# Runs the freshly built deadbeef with the freshly built plugins, using
+# an empty config. The test vectors are generated on the first run into
+# $BENCH_DIR/vectors, from a fixed reference wav, by the encoders found in
+# PATH (flac, lame, oggenc, mac, wavpack); the missing ones are skipped.
+# Set BENCH_VECTORS to a directory to use another set of files, and
+# BENCH_REPEAT to change the number of runs per stage (the fastest is reported).
+# The artwork scaler is benchmarked over synthetic covers generated into
+# $BENCH_DIR/covers, or over the files in BENCH_COVERS, when it has been built.
+
+BUILDDIR=${1:-.}
+BENCH_DIR=${BENCH_DIR:-$BUILDDIR/bench}
+BENCH_REPEAT=${BENCH_REPEAT:-5}
+DEADBEEF=$BUILDDIR/deadbeef
+
+if [ ! -x "$DEADBEEF" ]; then
+    echo "bench: $DEADBEEF not found, run make first" >&2
+    exit 1
+fi
+
+mkdir -p "$BENCH_DIR/plugins" "$BENCH_DIR/home" || exit 1
+
+# everything except the GUI plugins
+rm -f "$BENCH_DIR"/plugins/*.so
+for so in "$BUILDDIR"/plugins/*/.libs/*.so; do
+    case `basename "$so"` in
+        ddb_gui_*) ;;
+        *) ln -s "`cd \`dirname "$so"\` && pwd`/`basename "$so"`" "$BENCH_DIR/plugins/" ;;
+    esac
+done
+
+if [ -z "$BENCH_VECTORS" ]; then
+    BENCH_VECTORS=$BENCH_DIR/vectors
+    REF=$BENCH_VECTORS/reference.wav
+    if [ ! -f "$REF" ]; then
+        mkdir -p "$BENCH_VECTORS" || exit 1
+        "$DEADBEEF" --bench -w "$REF" || exit 1
+        command -v flac >/dev/null && flac -s -5 -o "$BENCH_VECTORS/reference.flac" "$REF"
+        command -v lame >/dev/null && lame --quiet -b 192 "$REF" "$BENCH_VECTORS/reference.mp3"
+        command -v oggenc >/dev/null && oggenc -Q -q 5 -o "$BENCH_VECTORS/reference.ogg" "$REF"
+        command -v mac >/dev/null && mac "$REF" "$BENCH_VECTORS/reference.ape" -c2000 >/dev/null 2>&1
+        command -v wavpack >/dev/null && wavpack -q -y "$REF" -o "$BENCH_VECTORS/reference.wv"
+    fi
+fi
+
+BENCH_HOME=`cd "$BENCH_DIR/home" && pwd`
+HOME=$BENCH_HOME \
+XDG_CONFIG_HOME=$BENCH_HOME/.config \
+XDG_CACHE_HOME=$BENCH_HOME/.cache \
+XDG_LOCAL_HOME=$BENCH_HOME/.local/lib/deadbeef \
+DEADBEEF_PLUGIN_DIR=`cd "$BENCH_DIR/plugins" && pwd` \
+    "$DEADBEEF" --bench -r "$BENCH_REPEAT" "$BENCH_VECTORS"/* 2>/dev/null
+res=$?
+
+SCALER_BENCH=$BUILDDIR/plugins/artwork/scaler_bench
+if [ -x "$SCALER_BENCH" ]; then
+    if [ -z "$BENCH_COVERS" ]; then
+        BENCH_COVERS=$BENCH_DIR/covers
+        if [ ! -d "$BENCH_COVERS" ]; then
+            mkdir -p "$BENCH_COVERS" && "$SCALER_BENCH" -w "$BENCH_COVERS" || exit 1
+        fi
+    fi
+    echo
+    "$SCALER_BENCH" -r "$BENCH_REPEAT" "$BENCH_COVERS"/* || res=1
+fi
+exit $res
@@ -0,0 +1,1342 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  remote control server
+
+  Copyright (C) 2009-2013 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+// The server thread serves any number of clients from a single epoll loop
+// (poll on the systems without epoll).
+//
+// A client which sends a NUL-separated command line, like a second deadbeef
+// instance does, is served the old way: the command line is executed once
+// the client has shut down writing, the reply is sent back NUL-terminated,
+// and the connection is closed.
+//
+// Otherwise the connection stays open, and the client sends commands
+// terminated by newlines, which can be pipelined.  Every command is answered
+// with a line of JSON, in order.  The subscribed events are pushed as lines
+// of JSON with an "event" key, and can arrive between the replies.
+//
+//   nowplaying <format>         {"ok":true,"nowplaying":"..."}, null when stopped
+//   status                      {"ok":true,"state":"playing","playpos":..,"duration":..,"playlist":..,"track":..}
+//   play, stop, pause, toggle-pause, play-pause, next, prev, random, activate, quit
+//   open <path>, queue <path>   replace the playlist with, or append a file or a folder
+//   perftrace <file>
+//   subscribe track [<format>]  {"event":"track","nowplaying":...} when a track starts, or playback stops
+//   subscribe state             {"event":"state","state":...} when playback starts, pauses or stops
+//   subscribe playpos [<ms>]    {"event":"playpos","playpos":..,"duration":..} every <ms> while playing, and after seeking
+//   unsubscribe [track|state|playpos]
+//
+// The commands which add files or write files run in the thread pool, one at
+// a time, so that they don't stall the other clients.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+#define USE_EPOLL 1
+#else
+#include <poll.h>
+#endif
+#include "server.h"
+#include "threading.h"
+#include "threadpool.h"
+#include "messagepump.h"
+#include "playlist.h"
+#include "streamer.h"
+#include "plugins.h"
+#include "common.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define SERVER_READ_CHUNK 4096
+#define SERVER_MAX_LINE 65536 // longest command of a persistent connection
+#define SERVER_MAX_MESSAGE (32*1024*1024) // longest legacy command line
+#define SERVER_MAX_OUTPUT (4*1024*1024) // clients which don't read their replies are dropped
+#define SERVER_PLAYPOS_INTERVAL 1000
+#define SERVER_MIN_PLAYPOS_INTERVAL 100
+#define SERVER_TRACK_FORMAT "%a - %t"
+#define SERVER_MAX_EVENTS 64
+
+enum {
+    CONN_UNKNOWN,
+    CONN_LEGACY,
+    CONN_LINES,
+};
+
+enum {
+    SUB_TRACK = 1,
+    SUB_STATE = 2,
+    SUB_PLAYPOS = 4,
+};
+
+enum {
+    WANT_READ = 1,
+    WANT_WRITE = 2,
+    READY_HUP = 4,
+};
+
+struct server_cmd_s;
+
+typedef struct server_conn_s {
+    int fd; // -1 once the connection is gone
+    int mode;
+    int events; // polled events
+    char *in;
+    int in_size;
+    int in_alloc;
+    char *out;
+    int out_pos;
+    int out_size;
+    int out_alloc;
+    int eof; // the client has shut down writing
+    int closing; // close once the output has been sent
+    struct server_cmd_s *cmd; // the command running or queued in the thread pool
+    unsigned subs;
+    char *track_format;
+    int last_state;
+    int playpos_interval;
+    int64_t next_playpos;
+    struct server_conn_s *next;
+} server_conn_t;
+
+typedef struct server_cmd_s {
+    server_conn_t *conn;
+    ddb_job_t *job;
+    char *cmdline;
+    int size;
+    int legacy;
+    char sendback[1024];
+    struct server_cmd_s *next;
+} server_cmd_t;
+
+#if USE_ABSTRACT_SOCKET_NAME
+static char server_id[] = "\0deadbeefplayer";
+#endif
+
+static int srv_socket = -1;
+static int wake_pipe[2] = { -1, -1 };
+#if USE_EPOLL
+static int epfd = -1;
+#else
+static struct pollfd *pfds;
+static server_conn_t **pfd_conns;
+static int pfds_alloc;
+#endif
+static volatile int server_terminate;
+
+static server_conn_t *conns;
+static int num_subscribed; // connections with subscriptions, read by server_message without lock
+
+// commands waiting for the thread pool, one runs at a time
+static server_cmd_t *cmd_queue;
+static server_cmd_t *cmd_queue_tail;
+static server_cmd_t *cmd_running;
+
+static uintptr_t mutex; // protects cmd_finished and notify_pending
+static server_cmd_t *cmd_finished;
+static unsigned notify_pending;
+
+int
+server_get_address (struct sockaddr_un *addr) {
+    memset (addr, 0, sizeof (struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+#if USE_ABSTRACT_SOCKET_NAME
+    memcpy (addr->sun_path, server_id, sizeof (server_id));
+    return offsetof(struct sockaddr_un, sun_path) + sizeof (server_id)-1;
+#else
+    char *socketdirenv = getenv ("DDB_SOCKET_DIR");
+    snprintf (addr->sun_path, sizeof (addr->sun_path), "%s/socket", socketdirenv ? socketdirenv : dbruntimedir);
+    return offsetof(struct sockaddr_un, sun_path) + strlen (addr->sun_path);
+#endif
+}
+
+static int
+set_nonblocking (int fd) {
+    int flags = fcntl (fd, F_GETFL, 0);
+    if (flags == -1) {
+        perror ("fcntl F_GETFL");
+        return -1;
+    }
+    if (fcntl (fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror ("fcntl F_SETFL");
+        return -1;
+    }
+    return 0;
+}
+
+static int64_t
+server_time_ms (void) {
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void
+server_wakeup (void) {
+    if (wake_pipe[1] >= 0) {
+        char c = 0;
+        // a full pipe means that the loop is going to wake up anyway
+        if (write (wake_pipe[1], &c, 1) < 0) {
+        }
+    }
+}
+
+int
+server_start (void) {
+    fprintf (stderr, "server_start\n");
+    srv_socket = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (srv_socket < 0) {
+        perror ("socket");
+        return -1;
+    }
+    if (set_nonblocking (srv_socket) < 0) {
+        return -1;
+    }
+
+    struct sockaddr_un srv_local;
+    int len = server_get_address (&srv_local);
+#if !USE_ABSTRACT_SOCKET_NAME
+    if (unlink(srv_local.sun_path) < 0) {
+        perror ("INFO: unlink socket");
+    }
+#endif
+
+    if (bind(srv_socket, (struct sockaddr *)&srv_local, len) < 0) {
+        perror ("bind");
+        return -1;
+    }
+
+    if (listen(srv_socket, SOMAXCONN) == -1) {
+        perror("listen");
+        return -1;
+    }
+
+    // wakes up the loop to stop, and to push the events
+    if (pipe (wake_pipe) < 0) {
+        perror ("pipe");
+        return -1;
+    }
+    if (set_nonblocking (wake_pipe[0]) < 0 || set_nonblocking (wake_pipe[1]) < 0) {
+        return -1;
+    }
+
+#if USE_EPOLL
+    epfd = epoll_create (SERVER_MAX_EVENTS);
+    if (epfd < 0) {
+        perror ("epoll_create");
+        return -1;
+    }
+    struct epoll_event ev;
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &srv_socket;
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, srv_socket, &ev) < 0) {
+        perror ("epoll_ctl");
+        return -1;
+    }
+    ev.data.ptr = wake_pipe;
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, wake_pipe[0], &ev) < 0) {
+        perror ("epoll_ctl");
+        return -1;
+    }
+#endif
+
+    mutex = mutex_create_nonrecursive ();
+    return 0;
+}
+
+void
+server_close (void) {
+    if (srv_socket >= 0) {
+        close (srv_socket);
+        srv_socket = -1;
+    }
+#if USE_EPOLL
+    if (epfd >= 0) {
+        close (epfd);
+        epfd = -1;
+    }
+#else
+    free (pfds);
+    pfds = NULL;
+    free (pfd_conns);
+    pfd_conns = NULL;
+    pfds_alloc = 0;
+#endif
+    for (int i = 0; i < 2; i++) {
+        if (wake_pipe[i] >= 0) {
+            close (wake_pipe[i]);
+            wake_pipe[i] = -1;
+        }
+    }
+    if (mutex) {
+        mutex_free (mutex);
+        mutex = 0;
+    }
+}
+
+void
+server_stop (void) {
+    server_terminate = 1;
+    server_wakeup ();
+}
+
+void
+server_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    unsigned what = 0;
+    switch (id) {
+    case DB_EV_SONGSTARTED:
+        what = SUB_TRACK | SUB_STATE | SUB_PLAYPOS;
+        break;
+    case DB_EV_SONGCHANGED:
+        if (!((ddb_event_trackchange_t *)ctx)->to) {
+            // stopped
+            what = SUB_TRACK | SUB_STATE;
+        }
+        break;
+    case DB_EV_SONGFINISHED:
+    case DB_EV_PAUSED:
+        what = SUB_STATE;
+        break;
+    case DB_EV_SEEKED:
+        what = SUB_PLAYPOS;
+        break;
+    }
+    if (!what || !num_subscribed || !mutex) {
+        return;
+    }
+    mutex_lock (mutex);
+    notify_pending |= what;
+    mutex_unlock (mutex);
+    server_wakeup ();
+}
+
+///// output
+
+// must be called only while the connection is open
+static void
+conn_kill (server_conn_t *c);
+
+static void
+conn_write (server_conn_t *c, const char *data, int len) {
+    if (c->fd < 0) {
+        return;
+    }
+    if (c->out_size - c->out_pos + len > SERVER_MAX_OUTPUT) {
+        trace ("server: dropping client %d which doesn't read its replies\n", c->fd);
+        conn_kill (c);
+        return;
+    }
+    if (c->out_size + len > c->out_alloc) {
+        if (c->out_pos > 0) {
+            memmove (c->out, c->out + c->out_pos, c->out_size - c->out_pos);
+            c->out_size -= c->out_pos;
+            c->out_pos = 0;
+        }
+        if (c->out_size + len > c->out_alloc) {
+            int size = c->out_alloc ? c->out_alloc : SERVER_READ_CHUNK;
+            while (size < c->out_size + len) {
+                size *= 2;
+            }
+            char *out = realloc (c->out, size);
+            if (!out) {
+                conn_kill (c);
+                return;
+            }
+            c->out = out;
+            c->out_alloc = size;
+        }
+    }
+    memcpy (c->out + c->out_size, data, len);
+    c->out_size += len;
+}
+
+static void
+conn_printf (server_conn_t *c, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start (ap, fmt);
+    int len = vsnprintf (buf, sizeof (buf), fmt, ap);
+    va_end (ap);
+    if (len < 0) {
+        return;
+    }
+    if (len < sizeof (buf)) {
+        conn_write (c, buf, len);
+        return;
+    }
+    char *mem = malloc (len + 1);
+    if (!mem) {
+        return;
+    }
+    va_start (ap, fmt);
+    vsnprintf (mem, len + 1, fmt, ap);
+    va_end (ap);
+    conn_write (c, mem, len);
+    free (mem);
+}
+
+// writes a JSON string, or null
+static void
+conn_write_string (server_conn_t *c, const char *s) {
+    if (!s) {
+        conn_write (c, "null", 4);
+        return;
+    }
+    conn_write (c, "\"", 1);
+    const char *run = s;
+    for (; *s; s++) {
+        uint8_t ch = (uint8_t)*s;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+        conn_write (c, run, (int)(s - run));
+        char esc[8];
+        switch (ch) {
+        case '"':
+            strcpy (esc, "\\\"");
+            break;
+        case '\\':
+            strcpy (esc, "\\\\");
+            break;
+        case '\n':
+            strcpy (esc, "\\n");
+            break;
+        case '\t':
+            strcpy (esc, "\\t");
+            break;
+        default:
+            snprintf (esc, sizeof (esc), "\\u%04x", ch);
+            break;
+        }
+        conn_write (c, esc, (int)strlen (esc));
+        run = s + 1;
+    }
+    conn_write (c, run, (int)(s - run));
+    conn_write (c, "\"", 1);
+}
+
+static void
+conn_reply_ok (server_conn_t *c) {
+    conn_write (c, "{\"ok\":true}\n", 12);
+}
+
+static void
+conn_reply_error (server_conn_t *c, const char *error) {
+    conn_write (c, "{\"ok\":false,\"error\":", 20);
+    conn_write_string (c, error);
+    conn_write (c, "}\n", 2);
+}
+
+// converts the sendback of server_exec_command_line
+static void
+conn_reply_result (server_conn_t *c, char *sendback) {
+    size_t len = strlen (sendback);
+    while (len > 0 && sendback[len-1] == '\n') {
+        sendback[--len] = 0;
+    }
+    const char err[] = "error ";
+    if (!strncmp (sendback, err, sizeof (err)-1)) {
+        conn_reply_error (c, sendback + sizeof (err)-1);
+    }
+    else if (sendback[0]) {
+        conn_write (c, "{\"ok\":true,\"message\":", 21);
+        conn_write_string (c, sendback);
+        conn_write (c, "}\n", 2);
+    }
+    else {
+        conn_reply_ok (c);
+    }
+}
+
+// the reply to a legacy command line
+static void
+conn_reply_legacy (server_conn_t *c, const char *sendback) {
+    conn_write (c, sendback, (int)strlen (sendback) + 1);
+    c->closing = 1;
+}
+
+///// player state
+
+static int
+server_get_state (void) {
+    DB_output_t *output = plug_get_output ();
+    return output ? output->state () : OUTPUT_STATE_STOPPED;
+}
+
+static const char *
+server_state_name (int state) {
+    switch (state) {
+    case OUTPUT_STATE_PLAYING:
+        return "playing";
+    case OUTPUT_STATE_PAUSED:
+        return "paused";
+    }
+    return "stopped";
+}
+
+// writes the title of the playing track, or null
+static void
+conn_write_nowplaying (server_conn_t *c, const char *format) {
+    playItem_t *curr = streamer_get_playing_track ();
+    DB_fileinfo_t *dec = streamer_get_current_fileinfo ();
+    if (curr && dec) {
+        char title[2048];
+        pl_format_title (curr, -1, title, sizeof (title), -1, format);
+        conn_write_string (c, title);
+    }
+    else {
+        conn_write_string (c, NULL);
+    }
+    if (curr) {
+        pl_item_unref (curr);
+    }
+}
+
+static void
+conn_write_playpos (server_conn_t *c) {
+    playItem_t *curr = streamer_get_playing_track ();
+    float playpos = 0;
+    float duration = 0;
+    if (curr) {
+        playpos = streamer_get_playpos ();
+        duration = pl_get_item_duration (curr);
+        pl_item_unref (curr);
+    }
+    conn_printf (c, "\"playpos\":%.3f,\"duration\":%.3f", playpos, duration);
+}
+
+static void
+conn_write_status (server_conn_t *c) {
+    playItem_t *curr = streamer_get_playing_track ();
+    int track = curr ? str_get_idx_of (curr) : -1;
+    if (curr) {
+        pl_item_unref (curr);
+    }
+    conn_printf (c, "\"state\":\"%s\",", server_state_name (server_get_state ()));
+    conn_write_playpos (c);
+    conn_printf (c, ",\"playlist\":%d,\"track\":%d", streamer_get_current_playlist (), track);
+}
+
+static void
+conn_push (server_conn_t *c, unsigned what) {
+    what &= c->subs;
+    if (what & SUB_TRACK) {
+        conn_write (c, "{\"event\":\"track\",\"nowplaying\":", 30);
+        conn_write_nowplaying (c, c->track_format);
+        conn_write (c, "}\n", 2);
+    }
+    if (what & SUB_STATE) {
+        int state = server_get_state ();
+        if (state != c->last_state) {
+            c->last_state = state;
+            conn_printf (c, "{\"event\":\"state\",\"state\":\"%s\"}\n", server_state_name (state));
+        }
+    }
+    if (what & SUB_PLAYPOS) {
+        conn_write (c, "{\"event\":\"playpos\",", 19);
+        conn_write_playpos (c);
+        conn_write (c, "}\n", 2);
+    }
+}
+
+///// commands
+
+static void
+server_cmd_work (ddb_job_t *job, void *ctx) {
+    server_cmd_t *cmd = ctx;
+    server_exec_command_line (cmd->cmdline, cmd->size, cmd->sendback, sizeof (cmd->sendback));
+    mutex_lock (mutex);
+    cmd->next = cmd_finished;
+    cmd_finished = cmd;
+    mutex_unlock (mutex);
+    server_wakeup ();
+}
+
+static void
+server_run_next_cmd (void) {
+    if (cmd_running || !cmd_queue || server_terminate) {
+        return;
+    }
+    cmd_running = cmd_queue;
+    cmd_queue = cmd_queue->next;
+    if (!cmd_queue) {
+        cmd_queue_tail = NULL;
+    }
+    cmd_running->next = NULL;
+    cmd_running->job = job_submit (DDB_JOB_PRIORITY_INTERACTIVE, server_cmd_work, NULL, cmd_running);
+    if (!cmd_running->job) {
+        server_cmd_work (NULL, cmd_running);
+    }
+}
+
+// the command runs in the thread pool, the connection waits for it
+static void
+conn_submit (server_conn_t *c, const char *cmdline, int size, int legacy) {
+    server_cmd_t *cmd = calloc (1, sizeof (server_cmd_t));
+    if (cmd) {
+        cmd->cmdline = malloc (size);
+    }
+    if (!cmd || !cmd->cmdline) {
+        free (cmd);
+        if (legacy) {
+            conn_reply_legacy (c, "");
+        }
+        else {
+            conn_reply_error (c, "out of memory");
+        }
+        return;
+    }
+    memcpy (cmd->cmdline, cmdline, size);
+    cmd->size = size;
+    cmd->legacy = legacy;
+    cmd->conn = c;
+    c->cmd = cmd;
+    if (cmd_queue_tail) {
+        cmd_queue_tail->next = cmd;
+    }
+    else {
+        cmd_queue = cmd;
+    }
+    cmd_queue_tail = cmd;
+    server_run_next_cmd ();
+}
+
+// whether the command line adds files, or writes a file
+static int
+server_cmd_is_slow (const char *cmdline, int len) {
+    const char *parg = cmdline;
+    const char *pend = cmdline + len;
+    while (parg < pend) {
+        if (!strcmp (parg, "--nowplaying") || !strcmp (parg, "--gui") || !strcmp (parg, "--sm-client-id")) {
+            // skip the argument
+            parg += strlen (parg) + 1;
+        }
+        else if (!strcmp (parg, "--perftrace") || parg[0] != '-') {
+            return 1;
+        }
+        if (parg < pend) {
+            parg += strlen (parg) + 1;
+        }
+    }
+    return 0;
+}
+
+static void
+conn_exec_legacy (server_conn_t *c) {
+    if (c->in_size == 1 && c->in[0] == 0) {
+        // FIXME: that should be called right after activation of gui plugin
+        messagepump_push (DB_EV_ACTIVATED, 0, 0, 0);
+        conn_reply_legacy (c, "");
+    }
+    else if (c->in_size > 0 && server_cmd_is_slow (c->in, c->in_size)) {
+        conn_submit (c, c->in, c->in_size, 1);
+    }
+    else {
+        char sendback[1024] = "";
+        if (c->in_size > 0) {
+            server_exec_command_line (c->in, c->in_size, sendback, sizeof (sendback));
+        }
+        conn_reply_legacy (c, sendback);
+    }
+}
+
+static void
+conn_subscribe (server_conn_t *c, char *arg, int subscribe) {
+    char *param = arg;
+    while (*param && *param != ' ') {
+        param++;
+    }
+    if (*param) {
+        *param++ = 0;
+        while (*param == ' ') {
+            param++;
+        }
+    }
+
+    unsigned what;
+    if (!strcmp (arg, "track")) {
+        what = SUB_TRACK;
+    }
+    else if (!strcmp (arg, "state")) {
+        what = SUB_STATE;
+    }
+    else if (!strcmp (arg, "playpos")) {
+        what = SUB_PLAYPOS;
+    }
+    else if (!subscribe && !arg[0]) {
+        what = SUB_TRACK | SUB_STATE | SUB_PLAYPOS;
+    }
+    else {
+        conn_reply_error (c, "expected track, state or playpos");
+        return;
+    }
+
+    int was_subscribed = c->subs != 0;
+    if (!subscribe) {
+        c->subs &= ~what;
+        conn_reply_ok (c);
+    }
+    else {
+        if (what == SUB_TRACK) {
+            char *format = strdup (param[0] ? param : SERVER_TRACK_FORMAT);
+            if (!format) {
+                conn_reply_error (c, "out of memory");
+                return;
+            }
+            free (c->track_format);
+            c->track_format = format;
+        }
+        else if (what == SUB_STATE) {
+            c->last_state = -1;
+        }
+        else if (what == SUB_PLAYPOS) {
+            int interval = param[0] ? atoi (param) : SERVER_PLAYPOS_INTERVAL;
+            c->playpos_interval = max (interval, SERVER_MIN_PLAYPOS_INTERVAL);
+            c->next_playpos = server_time_ms () + c->playpos_interval;
+        }
+        c->subs |= what;
+        conn_reply_ok (c);
+        // the current value, so that the client doesn't need to ask for it
+        conn_push (c, what);
+    }
+    if (was_subscribed != (c->subs != 0)) {
+        num_subscribed += c->subs ? 1 : -1;
+    }
+}
+
+static const char *simple_commands[] = {
+    "play", "stop", "pause", "toggle-pause", "play-pause", "next", "prev", "random", "quit", NULL
+};
+
+static void
+conn_exec_line (server_conn_t *c, char *line) {
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    char *arg = line;
+    while (*arg && *arg != ' ' && *arg != '\t') {
+        arg++;
+    }
+    if (*arg) {
+        *arg++ = 0;
+        while (*arg == ' ' || *arg == '\t') {
+            arg++;
+        }
+    }
+    if (!line[0]) {
+        return; // empty lines get no reply
+    }
+    trace ("server: %d: %s %s\n", c->fd, line, arg);
+
+    for (int i = 0; simple_commands[i]; i++) {
+        if (!strcmp (line, simple_commands[i])) {
+            char opt[20];
+            snprintf (opt, sizeof (opt), "--%s", line);
+            char sendback[1024];
+            server_exec_command_line (opt, (int)strlen (opt) + 1, sendback, sizeof (sendback));
+            conn_reply_result (c, sendback);
+            return;
+        }
+    }
+
+    if (!strcmp (line, "nowplaying")) {
+        if (!arg[0]) {
+            conn_reply_error (c, "nowplaying expects format argument");
+            return;
+        }
+        conn_write (c, "{\"ok\":true,\"nowplaying\":", 24);
+        conn_write_nowplaying (c, arg);
+        conn_write (c, "}\n", 2);
+    }
+    else if (!strcmp (line, "status")) {
+        conn_write (c, "{\"ok\":true,", 11);
+        conn_write_status (c);
+        conn_write (c, "}\n", 2);
+    }
+    else if (!strcmp (line, "activate")) {
+        messagepump_push (DB_EV_ACTIVATED, 0, 0, 0);
+        conn_reply_ok (c);
+    }
+    else if (!strcmp (line, "open") || !strcmp (line, "queue") || !strcmp (line, "perftrace")) {
+        if (!arg[0]) {
+            conn_reply_error (c, !strcmp (line, "perftrace") ? "perftrace expects file name argument" : "expected file or folder name");
+            return;
+        }
+        // turn it into a command line
+        char cmdline[PATH_MAX + 20];
+        int size;
+        if (!strcmp (line, "open")) {
+            size = snprintf (cmdline, sizeof (cmdline), "%s", arg);
+        }
+        else {
+            size = snprintf (cmdline, sizeof (cmdline), "--%s%c%s", line, 0, arg);
+        }
+        if (size < 0 || size >= sizeof (cmdline)) {
+            conn_reply_error (c, "file name is too long");
+            return;
+        }
+        conn_submit (c, cmdline, size + 1, 0);
+    }
+    else if (!strcmp (line, "subscribe")) {
+        conn_subscribe (c, arg, 1);
+    }
+    else if (!strcmp (line, "unsubscribe")) {
+        conn_subscribe (c, arg, 0);
+    }
+    else {
+        char err[100];
+        snprintf (err, sizeof (err), "unknown command %s", line);
+        conn_reply_error (c, err);
+    }
+}
+
+// executes the received commands, as long as nothing is running for the connection
+static void
+conn_process (server_conn_t *c) {
+    if (c->fd < 0 || c->closing || c->cmd) {
+        return;
+    }
+    if (c->mode == CONN_UNKNOWN) {
+        // a legacy command line always contains NULs, a command never does
+        for (int i = 0; i < c->in_size; i++) {
+            if (c->in[i] == 0) {
+                c->mode = CONN_LEGACY;
+                break;
+            }
+            if (c->in[i] == '\n') {
+                c->mode = CONN_LINES;
+                break;
+            }
+        }
+        if (c->mode == CONN_UNKNOWN) {
+            if (c->eof) {
+                // an unterminated command, or an empty legacy message
+                c->mode = c->in_size ? CONN_LINES : CONN_LEGACY;
+            }
+            else {
+                if (c->in_size >= SERVER_MAX_LINE) {
+                    conn_kill (c);
+                }
+                return;
+            }
+        }
+    }
+
+    if (c->mode == CONN_LEGACY) {
+        // the command line ends with the end of stream
+        if (c->eof) {
+            conn_exec_legacy (c);
+        }
+        else if (c->in_size >= SERVER_MAX_MESSAGE) {
+            conn_kill (c);
+        }
+        return;
+    }
+
+    int pos = 0;
+    while (pos < c->in_size && !c->cmd && !c->closing && c->fd >= 0) {
+        char *line = c->in + pos;
+        int avail = c->in_size - pos;
+        char *end = memchr (line, '\n', avail);
+        if (!end) {
+            if (avail >= SERVER_MAX_LINE) {
+                conn_reply_error (c, "command is too long");
+                c->closing = 1;
+                pos = c->in_size;
+                break;
+            }
+            if (!c->eof) {
+                break;
+            }
+            // the last command doesn't need the newline
+            end = line + avail;
+        }
+        *end = 0;
+        if (end > line && end[-1] == '\r') {
+            end[-1] = 0;
+        }
+        pos = min ((int)(end - c->in) + 1, c->in_size);
+        conn_exec_line (c, line);
+    }
+    if (pos > 0) {
+        memmove (c->in, c->in + pos, c->in_size - pos);
+        c->in_size -= pos;
+    }
+    if (c->eof && !c->in_size && !c->cmd) {
+        c->closing = 1;
+    }
+}
+
+///// connections
+
+static void
+conn_set_events (server_conn_t *c) {
+    if (c->fd < 0) {
+        return;
+    }
+    int events = 0;
+    int limit = c->mode == CONN_LEGACY ? SERVER_MAX_MESSAGE : SERVER_MAX_LINE;
+    if (!c->eof && !c->closing && c->in_size < limit) {
+        events |= WANT_READ;
+    }
+    if (c->out_pos < c->out_size) {
+        events |= WANT_WRITE;
+    }
+    if (events == c->events) {
+        return;
+    }
+#if USE_EPOLL
+    struct epoll_event ev;
+    memset (&ev, 0, sizeof (ev));
+    ev.events = ((events & WANT_READ) ? EPOLLIN : 0) | ((events & WANT_WRITE) ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    if (epoll_ctl (epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+        perror ("epoll_ctl");
+        conn_kill (c);
+        return;
+    }
+#endif
+    c->events = events;
+}
+
+static void
+conn_kill (server_conn_t *c) {
+    if (c->fd >= 0) {
+        // closing also removes it from epoll
+        close (c->fd);
+        c->fd = -1;
+    }
+    c->out_pos = c->out_size = 0;
+}
+
+static void
+conn_free (server_conn_t *c) {
+    if (c->subs) {
+        num_subscribed--;
+    }
+    conn_kill (c);
+    server_conn_t *prev = NULL;
+    for (server_conn_t *i = conns; i; prev = i, i = i->next) {
+        if (i == c) {
+            if (prev) {
+                prev->next = c->next;
+            }
+            else {
+                conns = c->next;
+            }
+            break;
+        }
+    }
+    free (c->in);
+    free (c->out);
+    free (c->track_format);
+    free (c);
+}
+
+static void
+conn_flush (server_conn_t *c) {
+    while (c->fd >= 0 && c->out_pos < c->out_size) {
+        ssize_t n = send (c->fd, c->out + c->out_pos, c->out_size - c->out_pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                conn_kill (c);
+            }
+            break;
+        }
+        c->out_pos += n;
+    }
+    if (c->out_pos == c->out_size) {
+        c->out_pos = c->out_size = 0;
+    }
+}
+
+// sends what can be sent, and frees the connection when it's done;
+// returns -1 if the connection was freed
+static int
+conn_update (server_conn_t *c) {
+    conn_flush (c);
+    if (c->cmd) {
+        // the command still refers to the connection
+        conn_set_events (c);
+        return 0;
+    }
+    if (c->fd < 0 || (c->closing && c->out_size == 0)) {
+        conn_free (c);
+        return -1;
+    }
+    conn_set_events (c);
+    return 0;
+}
+
+static void
+conn_read (server_conn_t *c) {
+    int limit = c->mode == CONN_LEGACY ? SERVER_MAX_MESSAGE : SERVER_MAX_LINE;
+    while (c->fd >= 0 && !c->eof && c->in_size < limit) {
+        // keep a byte for the terminator of an unterminated last command
+        if (c->in_alloc - c->in_size <= SERVER_READ_CHUNK / 2) {
+            int size = c->in_alloc ? c->in_alloc * 2 : SERVER_READ_CHUNK;
+            char *in = realloc (c->in, size);
+            if (!in) {
+                conn_kill (c);
+                return;
+            }
+            c->in = in;
+            c->in_alloc = size;
+        }
+        ssize_t rd = recv (c->fd, c->in + c->in_size, c->in_alloc - c->in_size - 1, 0);
+        if (rd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                conn_kill (c);
+            }
+            break;
+        }
+        if (rd == 0) {
+            c->eof = 1;
+            break;
+        }
+        c->in_size += rd;
+    }
+    if (c->in) {
+        c->in[c->in_size] = 0;
+    }
+    conn_process (c);
+}
+
+static void
+conn_handle (server_conn_t *c, int ready) {
+    if (ready & (WANT_READ | READY_HUP)) {
+        conn_read (c);
+    }
+    if (ready & READY_HUP) {
+        // can't reply anymore
+        conn_kill (c);
+    }
+    conn_update (c);
+}
+
+static void
+server_accept (void) {
+    for (;;) {
+        int fd = accept (srv_socket, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror ("accept");
+            }
+            return;
+        }
+        if (set_nonblocking (fd) < 0) {
+            close (fd);
+            continue;
+        }
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt (fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof (one));
+#endif
+        server_conn_t *c = calloc (1, sizeof (server_conn_t));
+        if (!c) {
+            close (fd);
+            continue;
+        }
+        c->fd = fd;
+        c->last_state = -1;
+        c->events = WANT_READ;
+#if USE_EPOLL
+        struct epoll_event ev;
+        memset (&ev, 0, sizeof (ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror ("epoll_ctl");
+            close (fd);
+            free (c);
+            continue;
+        }
+#endif
+        c->next = conns;
+        conns = c;
+    }
+}
+
+///// loop
+
+// replies to the commands which have finished in the thread pool
+static void
+server_run_finished (void) {
+    mutex_lock (mutex);
+    server_cmd_t *cmd = cmd_finished;
+    cmd_finished = NULL;
+    mutex_unlock (mutex);
+
+    while (cmd) {
+        server_cmd_t *next = cmd->next;
+        server_conn_t *c = cmd->conn;
+        if (cmd == cmd_running) {
+            cmd_running = NULL;
+        }
+        if (cmd->job) {
+            job_release (cmd->job);
+        }
+        c->cmd = NULL;
+        if (c->fd >= 0) {
+            if (cmd->legacy) {
+                conn_reply_legacy (c, cmd->sendback);
+            }
+            else {
+                conn_reply_result (c, cmd->sendback);
+            }
+        }
+        free (cmd->cmdline);
+        free (cmd);
+        // continue with the pipelined commands
+        conn_process (c);
+        conn_update (c);
+        cmd = next;
+    }
+    server_run_next_cmd ();
+}
+
+static void
+server_push_events (void) {
+    mutex_lock (mutex);
+    unsigned what = notify_pending;
+    notify_pending = 0;
+    mutex_unlock (mutex);
+
+    int64_t now = server_time_ms ();
+    int playing = -1;
+    server_conn_t *next;
+    for (server_conn_t *c = conns; c; c = next) {
+        next = c->next;
+        if (!c->subs || c->fd < 0) {
+            continue;
+        }
+        unsigned push = what;
+        if ((c->subs & SUB_PLAYPOS) && now >= c->next_playpos) {
+            if (playing < 0) {
+                playing = server_get_state () == OUTPUT_STATE_PLAYING;
+            }
+            if (playing) {
+                push |= SUB_PLAYPOS;
+            }
+            c->next_playpos = now + c->playpos_interval;
+        }
+        if (push & c->subs) {
+            conn_push (c, push);
+            conn_update (c);
+        }
+    }
+}
+
+// milliseconds till the next playpos update, -1 if there are none
+static int
+server_get_timeout (void) {
+    if (!num_subscribed) {
+        return -1;
+    }
+    int64_t now = server_time_ms ();
+    int64_t timeout = -1;
+    for (server_conn_t *c = conns; c; c = c->next) {
+        if (c->fd >= 0 && (c->subs & SUB_PLAYPOS)) {
+            int64_t t = max (c->next_playpos - now, 0);
+            if (timeout < 0 || t < timeout) {
+                timeout = t;
+            }
+        }
+    }
+    return (int)timeout;
+}
+
+static void
+server_drain_wakeups (void) {
+    char buf[64];
+    while (read (wake_pipe[0], buf, sizeof (buf)) > 0);
+}
+
+static int
+server_wait (int timeout) {
+#if USE_EPOLL
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int n = epoll_wait (epfd, events, SERVER_MAX_EVENTS, timeout);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        perror ("epoll_wait");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        void *ptr = events[i].data.ptr;
+        if (ptr == &srv_socket) {
+            server_accept ();
+        }
+        else if (ptr == wake_pipe) {
+            server_drain_wakeups ();
+        }
+        else {
+            uint32_t ev = events[i].events;
+            int ready = ((ev & EPOLLIN) ? WANT_READ : 0)
+                | ((ev & EPOLLOUT) ? WANT_WRITE : 0)
+                | ((ev & (EPOLLHUP | EPOLLERR)) ? READY_HUP : 0);
+            conn_handle (ptr, ready);
+        }
+    }
+#else
+    int count = 2;
+    for (server_conn_t *c = conns; c; c = c->next) {
+        count++;
+    }
+    if (count > pfds_alloc) {
+        struct pollfd *p = realloc (pfds, count * sizeof (struct pollfd));
+        if (p) {
+            pfds = p;
+        }
+        server_conn_t **pc = realloc (pfd_conns, count * sizeof (server_conn_t *));
+        if (pc) {
+            pfd_conns = pc;
+        }
+        if (!p || !pc) {
+            return -1;
+        }
+        pfds_alloc = count;
+    }
+    pfds[0].fd = srv_socket;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = wake_pipe[0];
+    pfds[1].events = POLLIN;
+    int n = 2;
+    for (server_conn_t *c = conns; c; c = c->next) {
+        if (c->fd < 0) {
+            continue;
+        }
+        pfds[n].fd = c->fd;
+        pfds[n].events = ((c->events & WANT_READ) ? POLLIN : 0) | ((c->events & WANT_WRITE) ? POLLOUT : 0);
+        pfd_conns[n] = c;
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        pfds[i].revents = 0;
+    }
+    if (poll (pfds, n, timeout) < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        perror ("poll");
+        return -1;
+    }
+    if (pfds[0].revents) {
+        server_accept ();
+    }
+    if (pfds[1].revents) {
+        server_drain_wakeups ();
+    }
+    for (int i = 2; i < n; i++) {
+        short ev = pfds[i].revents;
+        if (ev) {
+            int ready = ((ev & POLLIN) ? WANT_READ : 0)
+                | ((ev & POLLOUT) ? WANT_WRITE : 0)
+                | ((ev & POLLHUP) ? WANT_READ : 0) // some systems report a half-closed socket this way
+                | ((ev & (POLLERR | POLLNVAL)) ? READY_HUP : 0);
+            conn_handle (pfd_conns[i], ready);
+        }
+    }
+#endif
+    return 0;
+}
+
+// waits for the commands running in the thread pool, and frees all connections
+static void
+server_free_conns (void) {
+    for (server_conn_t *c = conns; c; c = c->next) {
+        conn_kill (c);
+    }
+    if (cmd_running && cmd_running->job) {
+        job_cancel (cmd_running->job);
+        job_wait (cmd_running->job);
+    }
+    server_run_finished ();
+    if (cmd_running) {
+        // cancelled before it started
+        cmd_running->next = cmd_queue;
+        cmd_queue = cmd_running;
+        job_release (cmd_running->job);
+        cmd_running = NULL;
+    }
+    // the rest didn't start
+    while (cmd_queue) {
+        server_cmd_t *next = cmd_queue->next;
+        cmd_queue->conn->cmd = NULL;
+        free (cmd_queue->cmdline);
+        free (cmd_queue);
+        cmd_queue = next;
+    }
+    cmd_queue_tail = NULL;
+    while (conns) {
+        conn_free (conns);
+    }
+}
+
+void
+server_loop (void *ctx) {
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-server", 0, 0, 0, 0);
+#endif
+    while (!server_terminate) {
+        if (server_wait (server_get_timeout ()) < 0) {
+            messagepump_push (DB_EV_TERMINATE, 0, 0, 0);
+            break;
+        }
+        server_run_finished ();
+        server_push_events ();
+    }
+    server_free_conns ();
+}
@@ -0,0 +1,61 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  remote control server
+
+  Copyright (C) 2009-2013 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+#ifndef __SERVER_H
+#define __SERVER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// fills in the address of the server socket, returns its length
+int
+server_get_address (struct sockaddr_un *addr);
+
+// binds the server socket, fails if it is not possible
+int
+server_start (void);
+
+// runs in the server thread until server_stop is called
+void
+server_loop (void *ctx);
+
+void
+server_stop (void);
+
+// must be called after the server thread has finished
+void
+server_close (void);
+
+// called by the main loop for every message, to push the subscribed events
+void
+server_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2);
+
+// implemented in main.c
+int
+server_exec_command_line (const char *cmdline, int len, char *sendback, int sbsize);
+
+#endif // __SERVER_H
@@ -81,7 +81,7 @@ settings_data_init (settings_data_t *settings_data, const char *layout) {
 
         // ignore layout options
         char key[MAX_TOKEN];
-        const char *skiptokens[] = { "vert", NULL };
+        const char *skiptokens[] = { "vert", "readonly", NULL };
         for (;;) {
             script = gettoken_warn_eof (script, key);
             int i = 0;
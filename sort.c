@@ -47,6 +47,7 @@ plt_sort (playlist_t *playlist, int iter, int id, const char *format, int order)
 
 static int pl_sort_is_duration;
 static int pl_sort_is_track;
+static const char *pl_sort_track_key;
 static int pl_sort_ascending;
 static int pl_sort_id;
 static int pl_sort_version; // 0: use pl_sort_format, 1: use pl_sort_tf_bytecode
@@ -90,14 +91,14 @@ pl_sort_compare_str (playItem_t *a, playItem_t *b) {
         int t1;
         int t2;
         const char *t;
-        t = pl_find_meta_raw (a, "track");
+        t = pl_find_meta_raw_interned (a, pl_sort_track_key);
         if (t && !isdigit (*t)) {
             t1 = 999999;
         }
         else {
             t1 = t ? atoi (t) : -1;
         }
-        t = pl_find_meta_raw (b, "track");
+        t = pl_find_meta_raw_interned (b, pl_sort_track_key);
         if (t && !isdigit (*t)) {
             t2 = 999999;
         }
@@ -234,6 +235,7 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
             || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
         ) {
         pl_sort_is_track = 1;
+        pl_sort_track_key = pl_meta_key_get ("track");
     }
     else {
         pl_sort_is_track = 0;
@@ -286,6 +288,11 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
         pl_sort_format = NULL;
     }
 
+    if (pl_sort_track_key) {
+        pl_meta_key_release (pl_sort_track_key);
+        pl_sort_track_key = NULL;
+    }
+
     if (version == 1) {
         tf_free (pl_sort_tf_bytecode);
         pl_sort_tf_bytecode = NULL;
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 #include <assert.h>
 #include <unistd.h>
 #ifdef __linux__
@@ -52,6 +53,7 @@
 #include "plugins/libparser/parser.h"
 #include "strdupa.h"
 #include "playqueue.h"
+#include "perftrace.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
@@ -92,6 +94,11 @@ static int stop_after_album = 0;
 
 static int conf_streamer_nosleep = 0;
 
+static int conf_streamer_preopen = 0;
+
+static int conf_crossfade_ms = 0;
+static int conf_crossfade_silence = 0;
+
 static int streaming_terminate;
 
 // buffer up to 3 seconds at 44100Hz stereo
@@ -123,6 +130,13 @@ static int badsong = -1;
 static float last_seekpos = -1;
 
 static float playpos = 0; // play position of current song
+static float output_latency; // seconds of audio buffered by the output, after streamer_read
+static float output_elapsed; // seconds of audio read by the output since the last flush or seek
+
+// time spent in the decoders and the dsp chain, for benchmarking;
+// updated by both the streamer and the output threads, under perf_mutex
+static ddb_streamer_perf_t perf;
+static uintptr_t perf_mutex;
 static int avg_bitrate = -1; // avg bitrate of current song
 static int last_bitrate = -1; // last bitrate of current song
 
@@ -147,6 +161,51 @@ static int streamer_buffering;
 // to allow interruption of stall file requests
 static DB_FILE *streamer_file;
 
+// the predicted next track is opened on a helper thread this many seconds
+// before the end of the current one
+#define PREOPEN_SECONDS 10
+#define PREROLL_SIZE MAX_BLOCK_SIZE
+
+// decoded data which has to be read before the rest of the decoder output
+typedef struct {
+    char data[PREROLL_SIZE];
+    int size;
+    int pos;
+} preroll_t;
+
+typedef struct {
+    playItem_t *track;
+    DB_fileinfo_t *fileinfo;
+    preroll_t preroll; // first decoded block
+    int done; // helper thread finished
+    int cancelled; // helper thread must free this when done
+} preopen_t;
+
+static uintptr_t preopen_mutex;
+static uintptr_t preopen_cond; // signalled when a helper finishes
+static preopen_t *preopen;
+static int preopen_running; // number of helper threads, including cancelled ones
+static playItem_t *preopen_predicted_for; // streaming track for which the last prediction was made
+
+// pre-decoded data of the current fileinfo
+static preroll_t fileinfo_preroll;
+
+// crossfade: during the overlap, the next track is decoded by xfade_fileinfo,
+// and mixed with the current one in the float domain
+#define XFADE_SILENCE_THRESHOLD 0.001f // -60dB
+#define XFADE_SILENCE_MIN_MS 1500 // trailing silence which ends the track early
+#define XFADE_SILENCE_MAX_SKIP_MS 10000 // leading silence skipped at most
+#define XFADE_TAIL_WINDOW 10 // seconds before the crossfade where trailing silence is detected
+
+static DB_fileinfo_t *xfade_fileinfo;
+static playItem_t *xfade_track;
+static preroll_t xfade_preroll;
+static int xfade_pos; // frames since the crossfade start
+static int xfade_len; // crossfade length in frames; if xfade_pos < xfade_len without xfade_fileinfo, the current track is fading in
+static int xfade_outgoing_done; // the outgoing track has ended, waiting for the switch
+static playItem_t *xfade_checked_for; // streaming track for which crossfade was already decided
+static int xfade_silent_frames; // trailing silence of the current track so far
+
 // for vis plugins
 static float freq_data[DDB_FREQ_BANDS * DDB_FREQ_MAX_CHANNELS];
 static float audio_data[DDB_FREQ_BANDS * 2 * DDB_FREQ_MAX_CHANNELS];
@@ -166,6 +225,14 @@ typedef struct wavedata_listener_s {
 static wavedata_listener_t *waveform_listeners;
 static wavedata_listener_t *spectrum_listeners;
 
+// visualization data is delayed by the output latency, to match what is heard
+#define VIS_DELAY_MAX_SECONDS 2
+static float *vis_delay;
+static int vis_delay_size; // in frames
+static int vis_delay_frames;
+static int vis_delay_channels;
+static int vis_delay_flush; // set by streamer_reset, the delayed frames are not going to be played
+
 #if DETECT_PL_LOCK_RC
 volatile pthread_t streamer_lock_tid = 0;
 #endif
@@ -959,6 +1026,479 @@ static DB_fileinfo_t *dec_open (DB_decoder_t *dec, uint32_t hints, playItem_t *i
     return dec->open (hints);
 }
 
+// returns the track which streamer_move_to_nextsong_real (0) is expected to pick, with a ref,
+// or NULL if it can't be predicted
+static playItem_t *
+streamer_predict_next_track (void) {
+    if (stop_after_current || stop_after_album) {
+        return NULL;
+    }
+    playItem_t *it = playqueue_getnext ();
+    if (it) {
+        return it;
+    }
+    pl_lock ();
+    playItem_t *curr = playlist_track;
+    playlist_t *plt = streamer_playlist;
+    if (!curr || !plt || -1 == str_get_idx_of (curr)) {
+        pl_unlock ();
+        return NULL;
+    }
+    int pl_order = pl_get_order ();
+    int pl_loop_mode = conf_get_int ("playback.loop", 0);
+    if (pl_loop_mode == PLAYBACK_MODE_LOOP_SINGLE) {
+        it = curr;
+    }
+    else if (pl_order == PLAYBACK_ORDER_LINEAR) {
+        it = curr->next[PL_MAIN];
+        if (!it && pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) {
+            it = plt->head[PL_MAIN];
+        }
+    }
+    else if (pl_order == PLAYBACK_ORDER_SHUFFLE_TRACKS || pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS) {
+        // same as in streamer_move_to_nextsong_real, except reshuffling,
+        // which can't be predicted
+        int rating = pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS ? curr->shufflerating : 0;
+        for (playItem_t *i = plt->head[PL_MAIN]; i; i = i->next[PL_MAIN]) {
+            if (i->played || i->shufflerating < rating) {
+                continue;
+            }
+            if (!it || i->shufflerating < it->shufflerating) {
+                it = i;
+            }
+        }
+    }
+    if (it) {
+        pl_item_ref (it);
+    }
+    pl_unlock ();
+    return it;
+}
+
+// pcm_convert, timed by perftrace
+static int
+streamer_pcm_convert (const ddb_waveformat_t *inputfmt, const char *input, const ddb_waveformat_t *outputfmt, char *output, int inputsize) {
+    int64_t t = perftrace_begin ();
+    int res = pcm_convert (inputfmt, input, outputfmt, output, inputsize);
+    perftrace_end (PERFTRACE_PCM_CONVERT, NULL, t);
+    return res;
+}
+
+// returns index of the first frame which is not silent, or number of frames
+static int
+streamer_find_sound (const ddb_waveformat_t *fmt, const char *bytes, int size) {
+    int samplesize = fmt->channels * fmt->bps / 8;
+    int nframes = size / samplesize;
+    ddb_waveformat_t ffmt;
+    memcpy (&ffmt, fmt, sizeof (ddb_waveformat_t));
+    ffmt.bps = 32;
+    ffmt.is_float = 1;
+    float buf[nframes * fmt->channels];
+    pcm_convert (fmt, bytes, &ffmt, (char *)buf, nframes * samplesize);
+    for (int f = 0; f < nframes; f++) {
+        for (int c = 0; c < fmt->channels; c++) {
+            if (fabsf (buf[f * fmt->channels + c]) > XFADE_SILENCE_THRESHOLD) {
+                return f;
+            }
+        }
+    }
+    return nframes;
+}
+
+static void
+preopen_free (preopen_t *po) {
+    if (po->fileinfo) {
+        po->fileinfo->plugin->free (po->fileinfo);
+    }
+    pl_item_unref (po->track);
+    free (po);
+}
+
+static void
+preopen_thread (void *ctx) {
+    preopen_t *po = ctx;
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-preopen", 0, 0, 0, 0);
+#endif
+    char decoder_id[100] = "";
+    pl_lock ();
+    const char *dec_id = pl_find_meta (po->track, ":DECODER");
+    if (dec_id) {
+        strncpy (decoder_id, dec_id, sizeof (decoder_id)-1);
+    }
+    pl_unlock ();
+
+    DB_decoder_t *dec = decoder_id[0] ? plug_get_decoder_for_id (decoder_id) : NULL;
+    DB_fileinfo_t *fi = NULL;
+    if (dec) {
+        trace ("preopen: init decoder for %s (%s)\n", pl_find_meta (po->track, ":URI"), dec->plugin.id);
+        fi = dec_open (dec, STREAMER_HINTS, po->track);
+        if (fi && dec->init (fi, DB_PLAYITEM (po->track)) != 0) {
+            dec->free (fi);
+            fi = NULL;
+        }
+    }
+    // pre-roll the first block, in whole samples
+    if (fi && fi->fmt.samplerate > 0 && fi->fmt.channels > 0 && fi->fmt.bps > 0) {
+        int samplesize = fi->fmt.channels * fi->fmt.bps / 8;
+        int skip_silence = conf_crossfade_ms > 0 && conf_crossfade_silence;
+        int maxskip = XFADE_SILENCE_MAX_SKIP_MS * fi->fmt.samplerate / 1000;
+        int skipped = 0;
+        for (;;) {
+            int rd = fi->plugin->read (fi, po->preroll.data, PREROLL_SIZE / samplesize * samplesize);
+            if (rd <= 0) {
+                break;
+            }
+            if (!skip_silence) {
+                po->preroll.size = rd;
+                break;
+            }
+            // drop leading silence
+            int nframes = rd / samplesize;
+            int f = streamer_find_sound (&fi->fmt, po->preroll.data, rd);
+            skipped += f;
+            if (f < nframes || skipped >= maxskip) {
+                memmove (po->preroll.data, po->preroll.data + f * samplesize, (nframes - f) * samplesize);
+                po->preroll.size = (nframes - f) * samplesize;
+                break;
+            }
+        }
+    }
+
+    mutex_lock (preopen_mutex);
+    po->fileinfo = fi;
+    po->done = 1;
+    int cancelled = po->cancelled;
+    cond_broadcast (preopen_cond);
+    mutex_unlock (preopen_mutex);
+    if (cancelled) {
+        preopen_free (po);
+    }
+    mutex_lock (preopen_mutex);
+    preopen_running--;
+    cond_broadcast (preopen_cond);
+    mutex_unlock (preopen_mutex);
+}
+
+static void
+streamer_preopen_discard (void) {
+    if (!preopen) {
+        return;
+    }
+    mutex_lock (preopen_mutex);
+    preopen->cancelled = 1;
+    int done = preopen->done;
+    mutex_unlock (preopen_mutex);
+    if (done) {
+        preopen_free (preopen);
+    }
+    preopen = NULL;
+}
+
+// starts opening the predicted next track, when the current one is about to end
+static void
+streamer_preopen_check (void) {
+    if (!conf_streamer_preopen || !fileinfo || !streaming_track || preopen_predicted_for == streaming_track) {
+        return;
+    }
+    float lead = PREOPEN_SECONDS;
+    if (conf_crossfade_ms > 0) {
+        lead += conf_crossfade_ms / 1000.f;
+        if (conf_crossfade_silence) {
+            lead += XFADE_TAIL_WINDOW;
+        }
+    }
+    float dur = pl_get_item_duration (streaming_track);
+    if (dur <= 0 || dur - fileinfo->readpos > lead) {
+        return;
+    }
+    preopen_predicted_for = streaming_track;
+
+    playItem_t *next = streamer_predict_next_track ();
+    if (!next) {
+        streamer_preopen_discard ();
+        return;
+    }
+    if (preopen && preopen->track == next) {
+        pl_item_unref (next);
+        return;
+    }
+    streamer_preopen_discard ();
+    // remote streams need content-type detection, and may not allow a second connection
+    pl_lock ();
+    int has_decoder = pl_find_meta_raw (next, ":DECODER") != NULL;
+    pl_unlock ();
+    if (!has_decoder || is_remote_stream (next)) {
+        pl_item_unref (next);
+        return;
+    }
+    trace ("preopen: predicted next track %s\n", pl_find_meta (next, ":URI"));
+    preopen = calloc (1, sizeof (preopen_t));
+    preopen->track = next;
+    mutex_lock (preopen_mutex);
+    preopen_running++;
+    mutex_unlock (preopen_mutex);
+    intptr_t tid = thread_start_low_priority (preopen_thread, preopen);
+    if (!tid) {
+        mutex_lock (preopen_mutex);
+        preopen_running--;
+        mutex_unlock (preopen_mutex);
+        preopen->done = 1;
+        streamer_preopen_discard ();
+        return;
+    }
+    thread_detach (tid);
+}
+
+// returns fileinfo pre-opened for the track, or NULL, and fills in its preroll;
+// drops the pre-opened track if it's not the one requested
+static DB_fileinfo_t *
+streamer_preopen_claim (playItem_t *it, preroll_t *preroll) {
+    if (!preopen) {
+        return NULL;
+    }
+    if (preopen->track != it) {
+        trace ("preopen: prediction missed\n");
+        streamer_preopen_discard ();
+        return NULL;
+    }
+    // the helper is already opening the file, waiting for it is faster than starting over
+    mutex_lock (preopen_mutex);
+    while (!preopen->done && !streaming_terminate) {
+        cond_wait_locked (preopen_cond, preopen_mutex);
+    }
+    int done = preopen->done;
+    mutex_unlock (preopen_mutex);
+    if (!done) {
+        streamer_preopen_discard ();
+        return NULL;
+    }
+    DB_fileinfo_t *fi = preopen->fileinfo;
+    if (fi) {
+        memcpy (preroll, &preopen->preroll, sizeof (preroll_t));
+    }
+    preopen->fileinfo = NULL;
+    preopen_free (preopen);
+    preopen = NULL;
+    return fi;
+}
+
+// reads from the decoder, starting with the pre-rolled data if any
+static int
+streamer_decoder_read_fi (DB_fileinfo_t *fi, preroll_t *preroll, char *bytes, int size) {
+    int rd = 0;
+    if (preroll->pos < preroll->size) {
+        rd = min (size, preroll->size - preroll->pos);
+        memcpy (bytes, preroll->data + preroll->pos, rd);
+        preroll->pos += rd;
+        if (rd == size) {
+            return rd;
+        }
+    }
+    int64_t tm1 = perftrace_time ();
+    int res = fi->plugin->read (fi, bytes + rd, size - rd);
+    int64_t tm2 = perftrace_time ();
+    perftrace_add (PERFTRACE_DECODE, NULL, tm1, tm2);
+    int samplesize = (fi->fmt.bps >> 3) * fi->fmt.channels;
+    mutex_lock (perf_mutex);
+    perf.decode_time += (tm2 - tm1) / 1000000000.0;
+    if (res > 0 && samplesize > 0) {
+        perf.decoded_frames += res / samplesize;
+    }
+    mutex_unlock (perf_mutex);
+    if (res > 0) {
+        rd += res;
+    }
+    return rd;
+}
+
+static int
+streamer_decoder_read (char *bytes, int size) {
+    return streamer_decoder_read_fi (fileinfo, &fileinfo_preroll, bytes, size);
+}
+
+static void
+streamer_crossfade_discard (void) {
+    if (xfade_fileinfo) {
+        xfade_fileinfo->plugin->free (xfade_fileinfo);
+        xfade_fileinfo = NULL;
+    }
+    if (xfade_track) {
+        pl_item_unref (xfade_track);
+        xfade_track = NULL;
+    }
+    xfade_pos = 0;
+    xfade_len = 0;
+    xfade_outgoing_done = 0;
+}
+
+// starts crossfading into the pre-opened next track, when the current one is about to end
+static void
+streamer_crossfade_check (void) {
+    if (!fileinfo || !streaming_track || xfade_checked_for == streaming_track || fileinfo->fmt.samplerate <= 0) {
+        return;
+    }
+    float dur = pl_get_item_duration (streaming_track);
+    if (dur <= 0) {
+        return;
+    }
+    int samplerate = fileinfo->fmt.samplerate;
+    float remaining = dur - fileinfo->readpos;
+    int silent = conf_crossfade_silence && xfade_silent_frames >= XFADE_SILENCE_MIN_MS * plug_get_output ()->fmt.samplerate / 1000;
+    if (remaining > conf_crossfade_ms / 1000.f && !silent) {
+        return;
+    }
+    if (!preopen) {
+        xfade_checked_for = streaming_track;
+        return;
+    }
+    mutex_lock (preopen_mutex);
+    int done = preopen->done;
+    mutex_unlock (preopen_mutex);
+    if (!done) {
+        return; // try again on next read
+    }
+    xfade_checked_for = streaming_track;
+
+    // mixing requires identical formats, otherwise the tracks are joined gaplessly
+    if (!preopen->fileinfo || memcmp (&preopen->fileinfo->fmt, &fileinfo->fmt, sizeof (ddb_waveformat_t))) {
+        return;
+    }
+    playItem_t *next = streamer_predict_next_track ();
+    if (!next || next != preopen->track) {
+        if (next) {
+            pl_item_unref (next);
+        }
+        return;
+    }
+    xfade_fileinfo = streamer_preopen_claim (next, &xfade_preroll);
+    if (!xfade_fileinfo) {
+        pl_item_unref (next);
+        return;
+    }
+    xfade_track = next;
+    xfade_pos = 0;
+    xfade_len = conf_crossfade_ms * samplerate / 1000;
+    if (!silent && remaining * samplerate < xfade_len) {
+        xfade_len = remaining * samplerate;
+    }
+    if (xfade_len < 1) {
+        xfade_len = 1;
+    }
+    xfade_outgoing_done = 0;
+    trace ("crossfade: %d frames into %s\n", xfade_len, pl_find_meta (next, ":URI"));
+}
+
+// adopts the incoming crossfade decoder, if it's for the requested track
+static DB_fileinfo_t *
+streamer_crossfade_claim (playItem_t *it) {
+    if (!xfade_fileinfo) {
+        return NULL;
+    }
+    if (xfade_track != it) {
+        streamer_crossfade_discard ();
+        return NULL;
+    }
+    DB_fileinfo_t *fi = xfade_fileinfo;
+    memcpy (&fileinfo_preroll, &xfade_preroll, sizeof (preroll_t));
+    xfade_fileinfo = NULL;
+    pl_item_unref (xfade_track);
+    xfade_track = NULL;
+    xfade_outgoing_done = 0;
+    // xfade_pos/xfade_len are kept, to finish fading in if the outgoing track ended early
+    return fi;
+}
+
+// tracks trailing silence of the current track near its end
+static void
+streamer_crossfade_track_silence (const ddb_waveformat_t *fmt, const char *bytes, int size) {
+    float dur = pl_get_item_duration (streaming_track);
+    if (dur <= 0 || dur - fileinfo->readpos > conf_crossfade_ms / 1000.f + XFADE_TAIL_WINDOW) {
+        return;
+    }
+    int nframes = size / (fmt->channels * fmt->bps / 8);
+    if (streamer_find_sound (fmt, bytes, size) < nframes) {
+        xfade_silent_frames = 0;
+    }
+    else {
+        xfade_silent_frames += nframes;
+    }
+}
+
+static int
+streamer_dsp_process (char *tempbuf, int nframes, int maxframes, ddb_waveformat_t *dspfmt, char *bytes);
+
+// decodes nframes of the current track, mixed with the incoming track during crossfade,
+// or faded in after a crossfade that ended early;
+// sets *is_eof when the outgoing track is finished
+static int
+streamer_read_crossfade (char *bytes, int size, int *is_eof) {
+    DB_output_t *output = plug_get_output ();
+    if (xfade_outgoing_done) {
+        *is_eof = 1;
+        return 0;
+    }
+    int nch = fileinfo->fmt.channels;
+    int samplesize = nch * fileinfo->fmt.bps / 8;
+    int nframes = size / (output->fmt.channels * output->fmt.bps / 8);
+    ddb_waveformat_t dspfmt;
+    memcpy (&dspfmt, &fileinfo->fmt, sizeof (ddb_waveformat_t));
+    dspfmt.bps = 32;
+    dspfmt.is_float = 1;
+
+    char input[nframes * samplesize];
+    int maxframes = nframes * MAX_DSP_RATIO;
+    float mix[maxframes * nch];
+    int frames_out;
+
+    if (xfade_fileinfo) {
+        // outgoing track, which is cut when the crossfade is over
+        int want = min (nframes, xfade_len - xfade_pos);
+        int frames_a = streamer_decoder_read (input, want * samplesize) / samplesize;
+        if (frames_a < want || xfade_pos + want >= xfade_len) {
+            *is_eof = 1;
+            xfade_outgoing_done = 1;
+        }
+        streamer_pcm_convert (&fileinfo->fmt, input, &dspfmt, (char *)mix, frames_a * samplesize);
+
+        float incoming[nframes * nch];
+        int frames_b = streamer_decoder_read_fi (xfade_fileinfo, &xfade_preroll, input, nframes * samplesize) / samplesize;
+        streamer_pcm_convert (&xfade_fileinfo->fmt, input, &dspfmt, (char *)incoming, frames_b * samplesize);
+
+        frames_out = max (frames_a, frames_b);
+        for (int f = 0; f < frames_out; f++) {
+            float g = xfade_pos + f < xfade_len ? (float)(xfade_pos + f) / xfade_len : 1.f;
+            // equal power
+            float ga = cosf (g * M_PI / 2);
+            float gb = sinf (g * M_PI / 2);
+            for (int c = 0; c < nch; c++) {
+                float a = f < frames_a ? mix[f * nch + c] * ga : 0;
+                float b = f < frames_b ? incoming[f * nch + c] * gb : 0;
+                mix[f * nch + c] = a + b;
+            }
+        }
+    }
+    else {
+        // incoming track became current before the crossfade was over
+        frames_out = streamer_decoder_read (input, nframes * samplesize) / samplesize;
+        if (frames_out < nframes) {
+            *is_eof = 1;
+        }
+        streamer_pcm_convert (&fileinfo->fmt, input, &dspfmt, (char *)mix, frames_out * samplesize);
+        for (int f = 0; f < frames_out && xfade_pos + f < xfade_len; f++) {
+            float gb = sinf ((float)(xfade_pos + f) / xfade_len * M_PI / 2);
+            for (int c = 0; c < nch; c++) {
+                mix[f * nch + c] *= gb;
+            }
+        }
+    }
+    xfade_pos = min (xfade_pos + frames_out, xfade_len);
+    if (frames_out <= 0) {
+        return 0;
+    }
+    return streamer_dsp_process ((char *)mix, frames_out, maxframes, &dspfmt, bytes);
+}
+
 // that must be called after last sample from str_playing_song was done reading
 static int
 streamer_set_current (playItem_t *it) {
@@ -966,6 +1506,7 @@ streamer_set_current (playItem_t *it) {
     DB_output_t *output = plug_get_output ();
     int err = 0;
     int do_songstarted = 0;
+    int crossfaded = 0;
     playItem_t *from, *to;
     // need to add refs here, because streamer_start_playback can destroy items
     from = playing_track;
@@ -1001,6 +1542,7 @@ streamer_set_current (playItem_t *it) {
     }
 
     if (!it || paused_stream) {
+        streamer_preopen_discard ();
         goto success;
     }
     if (to) {
@@ -1201,6 +1743,31 @@ m3u_error:
     }
     playlist_track = it;
 
+    if (decoder_id[0]) {
+        new_fileinfo = streamer_crossfade_claim (it);
+        if (new_fileinfo) {
+            crossfaded = 1;
+        }
+        else {
+            new_fileinfo = streamer_preopen_claim (it, &fileinfo_preroll);
+        }
+        if (new_fileinfo) {
+            trace ("using pre-opened decoder for %s\n", pl_find_meta (it, ":URI"));
+            new_fileinfo_file = new_fileinfo->file;
+            if (streaming_track) {
+                pl_item_unref (streaming_track);
+            }
+            streaming_track = it;
+            pl_item_ref (streaming_track);
+            streamer_set_replaygain (streaming_track);
+            goto success;
+        }
+    }
+    else {
+        streamer_preopen_discard ();
+        streamer_crossfade_discard ();
+    }
+
     int plug_idx = 0;
     for (;;) {
         if (!decoder_id[0] && plugs[0] && !plugs[plug_idx]) {
@@ -1236,7 +1803,7 @@ m3u_error:
                                     fprintf (stderr, "streamer: %s : changed decoder plugin to %s\n", fname, decs[i]->plugin.id);
                                     pl_replace_meta (it, "!DECODER", decs[i]->plugin.id);
                                     pl_replace_meta (it, "!FILETYPE", ext);
-                                    dec = decs[i];
+                                    dec = plug_resolve_decoder (decs[i]);
                                     break;
                                 }
                             }
@@ -1290,6 +1857,7 @@ m3u_error:
         }
         else {
             new_fileinfo_file = new_fileinfo->file;
+            fileinfo_preroll.size = 0;
             if (streaming_track) {
                 pl_item_unref (streaming_track);
             }
@@ -1304,6 +1872,10 @@ m3u_error:
         }
     }
 success:
+    if (!crossfaded) {
+        streamer_crossfade_discard ();
+    }
+    xfade_silent_frames = 0;
     if (fileinfo) {
         fileinfo->plugin->free (fileinfo);
         fileinfo = NULL;
@@ -1340,7 +1912,22 @@ streamer_get_playpos (void) {
     if (seek >= 0) {
         return seek;
     }
-    return playpos;
+    // report what is being heard, rather than what was last read by the output;
+    // after a flush or seek, the output can't have buffered more than it has read
+    float pos = playpos - min (output_latency, output_elapsed);
+    return pos > 0 ? pos : 0;
+}
+
+void
+streamer_get_perf (ddb_streamer_perf_t *stats) {
+    mutex_lock (perf_mutex);
+    memcpy (stats, &perf, sizeof (ddb_streamer_perf_t));
+    mutex_unlock (perf_mutex);
+}
+
+void
+streamer_set_output_latency (float latency) {
+    output_latency = latency > 0 ? latency : 0;
 }
 
 void
@@ -1703,6 +2290,10 @@ streamer_thread (void *ctx) {
             trace ("seeking to %f\n", seek);
             float pos = seek;
 
+            streamer_crossfade_discard ();
+            xfade_checked_for = NULL;
+            xfade_silent_frames = 0;
+
             if (playing_track != streaming_track) {
                 trace ("streamer already switched to next track\n");
 
@@ -1736,6 +2327,7 @@ streamer_thread (void *ctx) {
                     dec = plug_get_decoder_for_id (decoder_id);
                 }
                 pl_unlock ();
+                fileinfo_preroll.size = 0;
                 if (dec) {
                     fileinfo = dec_open (dec, STREAMER_HINTS, streaming_track);
                     if (fileinfo && dec->init (fileinfo, DB_PLAYITEM (streaming_track)) != 0) {
@@ -1776,6 +2368,8 @@ streamer_thread (void *ctx) {
                 }
                 streamer_lock ();
                 streamer_reset (1);
+                fileinfo_preroll.size = 0;
+                preopen_predicted_for = NULL;
                 if (fileinfo->plugin->seek (fileinfo, pos) >= 0) {
                     playpos = fileinfo->readpos;
                 }
@@ -1870,7 +2464,9 @@ streamer_thread (void *ctx) {
             streamer_lock ();
 
             if (bytesread > 0) {
+                int64_t t = perftrace_begin ();
                 ringbuf_write (&streamer_ringbuf, readbuffer, bytesread);
+                perftrace_end (PERFTRACE_RINGBUF_WRITE, NULL, t);
             }
 
             if (trace_bufferfill >= 1) {
@@ -1878,6 +2474,7 @@ streamer_thread (void *ctx) {
             }
         }
         streamer_unlock ();
+        streamer_preopen_check ();
         if ((streamer_ringbuf.remaining > 128000 && streamer_buffering) || !streaming_track) {
             streamer_buffering = 0;
             if (streaming_track) {
@@ -1918,6 +2515,14 @@ streamer_thread (void *ctx) {
         fileinfo = NULL;
         fileinfo_file = NULL;
     }
+    streamer_crossfade_discard ();
+    // wait for the helpers, since plugins are unloaded after the streamer is stopped
+    streamer_preopen_discard ();
+    mutex_lock (preopen_mutex);
+    while (preopen_running) {
+        cond_wait_locked (preopen_cond, preopen_mutex);
+    }
+    mutex_unlock (preopen_mutex);
     mutex_lock (currtrack_mutex);
     if (streaming_track) {
         pl_item_unref (streaming_track);
@@ -2181,6 +2786,9 @@ streamer_init (void) {
     mutex = mutex_create ();
     currtrack_mutex = mutex_create ();
     wdl_mutex = mutex_create ();
+    perf_mutex = mutex_create_nonrecursive ();
+    preopen_mutex = mutex_create ();
+    preopen_cond = cond_create ();
 
     ringbuf_init (&streamer_ringbuf, streambuffer, STREAM_BUFFER_SIZE);
 
@@ -2209,6 +2817,10 @@ streamer_free (void) {
     }
     streamer_abort_files ();
     streaming_terminate = 1;
+    // wake up the streamer if it's waiting for a pre-opened track
+    mutex_lock (preopen_mutex);
+    cond_broadcast (preopen_cond);
+    mutex_unlock (preopen_mutex);
     thread_join (streamer_tid);
 
     if (streaming_track) {
@@ -2230,12 +2842,25 @@ streamer_free (void) {
     ctmap_free ();
     ctmap_free_mutex ();
 
+    if (vis_delay) {
+        free (vis_delay);
+        vis_delay = NULL;
+    }
+    vis_delay_size = 0;
+    vis_delay_frames = 0;
+
     mutex_free (currtrack_mutex);
     currtrack_mutex = 0;
     mutex_free (mutex);
     mutex = 0;
     mutex_free (wdl_mutex);
     wdl_mutex = 0;
+    mutex_free (perf_mutex);
+    perf_mutex = 0;
+    mutex_free (preopen_mutex);
+    preopen_mutex = 0;
+    cond_free (preopen_cond);
+    preopen_cond = 0;
 
     streamer_dsp_chain_save();
 
@@ -2260,6 +2885,8 @@ streamer_reset (int full) { // must be called when current song changes by exter
     if (full) {
         streamer_lock ();
         streamer_ringbuf.remaining = 0;
+        output_elapsed = 0;
+        vis_delay_flush = 1;
         streamer_unlock ();
     }
 
@@ -2304,6 +2931,53 @@ streamer_set_output_format (void) {
     return 0;
 }
 
+// passes float data through the DSP chain (if enabled), and converts it to the output format
+// returns number of bytes written to the output buffer
+static int
+streamer_dsp_process (char *tempbuf, int nframes, int maxframes, ddb_waveformat_t *dspfmt, char *bytes) {
+    DB_output_t *output = plug_get_output ();
+    if (dsp_on) {
+        ddb_dsp_context_t *dsp = dsp_chain;
+        float ratio = 1.f;
+        int64_t tm1 = perftrace_time ();
+        int inframes = nframes;
+        while (dsp) {
+            if (dsp->enabled) {
+                float r = 1;
+                int64_t t = perftrace_begin ();
+                nframes = dsp->plugin->process (dsp, (float *)tempbuf, nframes, maxframes, dspfmt, &r);
+                perftrace_end (PERFTRACE_DSP, dsp->plugin->plugin.id, t);
+                ratio *= r;
+            }
+            dsp = dsp->next;
+        }
+        int64_t tm2 = perftrace_time ();
+        mutex_lock (perf_mutex);
+        perf.dsp_frames += inframes;
+        perf.dsp_time += (tm2 - tm1) / 1000000000.0;
+        mutex_unlock (perf_mutex);
+        dsp_ratio = ratio;
+
+        ddb_waveformat_t outfmt;
+        // preserve sampleformat, but take channels, samplerate
+        outfmt.bps = fileinfo->fmt.bps;
+        outfmt.is_float = fileinfo->fmt.is_float;
+        // channelmask from dsp chain
+        outfmt.channels = dspfmt->channels;
+        outfmt.samplerate = dspfmt->samplerate;
+        outfmt.channelmask = dspfmt->channelmask;
+        outfmt.is_bigendian = fileinfo->fmt.is_bigendian;
+        if (bytes_until_next_song <= 0 && memcmp (&output_format, &outfmt, sizeof (ddb_waveformat_t))) {
+            memcpy (&output_format, &outfmt, sizeof (ddb_waveformat_t));
+            streamer_set_output_format ();
+        }
+    }
+
+    //printf ("convert from %dbit %s %dch %dHz channelmask=%X to %dbit %s %dch %dHz channelmask=%X\n", dspfmt->bps, dspfmt->is_float ? "float" : "int", dspfmt->channels, dspfmt->samplerate, dspfmt->channelmask, output->fmt.bps, output->fmt.is_float ? "float" : "int", output->fmt.channels, output->fmt.samplerate, output->fmt.channelmask);
+
+    return streamer_pcm_convert (dspfmt, tempbuf, &output->fmt, bytes, nframes * dspfmt->channels * sizeof (float));
+}
+
 // decodes data and converts to current output format
 // returns number of bytes been read
 static int
@@ -2317,6 +2991,10 @@ streamer_read_async (char *bytes, int size) {
     }
     int is_eof = 0;
 
+    if (conf_crossfade_ms > 0 && !xfade_fileinfo && xfade_pos >= xfade_len) {
+        streamer_crossfade_check ();
+    }
+
     if (fileinfo->fmt.samplerate != -1) {
         int outputsamplesize = output->fmt.channels * output->fmt.bps / 8;
         int inputsamplesize = fileinfo->fmt.channels * fileinfo->fmt.bps / 8;
@@ -2347,9 +3025,12 @@ streamer_read_async (char *bytes, int size) {
             }
         }
 
-        if (!memcmp (&fileinfo->fmt, &output->fmt, sizeof (ddb_waveformat_t)) && (!dsp_on || can_bypass)) {
+        if (xfade_fileinfo || xfade_pos < xfade_len) {
+            bytesread = streamer_read_crossfade (bytes, size, &is_eof);
+        }
+        else if (!memcmp (&fileinfo->fmt, &output->fmt, sizeof (ddb_waveformat_t)) && (!dsp_on || can_bypass)) {
             // pass through from input to output
-            bytesread = fileinfo->plugin->read (fileinfo, bytes, size);
+            bytesread = streamer_decoder_read (bytes, size);
 
             if (bytesread != size) {
                 is_eof = 1;
@@ -2366,7 +3047,7 @@ streamer_read_async (char *bytes, int size) {
             char input[inputsize];
 
             // decode pcm
-            int nb = fileinfo->plugin->read (fileinfo, input, inputsize);
+            int nb = streamer_decoder_read (input, inputsize);
             if (nb != inputsize) {
                 is_eof = 1;
             }
@@ -2377,40 +3058,10 @@ streamer_read_async (char *bytes, int size) {
                 char tempbuf[inputsize/inputsamplesize * dspsamplesize * MAX_DSP_RATIO];
 
                 // convert to float
-                int tempsize = pcm_convert (&fileinfo->fmt, input, &dspfmt, tempbuf, inputsize);
+                int tempsize = streamer_pcm_convert (&fileinfo->fmt, input, &dspfmt, tempbuf, inputsize);
                 int nframes = inputsize / inputsamplesize;
-                ddb_dsp_context_t *dsp = dsp_chain;
-                float ratio = 1.f;
                 int maxframes = sizeof (tempbuf) / dspsamplesize;
-                while (dsp) {
-                    if (dsp->enabled) {
-                        float r = 1;
-                        nframes = dsp->plugin->process (dsp, (float *)tempbuf, nframes, maxframes, &dspfmt, &r);
-                        ratio *= r;
-                    }
-                    dsp = dsp->next;
-                }
-                dsp_ratio = ratio;
-
-                ddb_waveformat_t outfmt;
-                // preserve sampleformat, but take channels, samplerate
-                outfmt.bps = fileinfo->fmt.bps;
-                outfmt.is_float = fileinfo->fmt.is_float;
-                // channelmask from dsp chain
-                outfmt.channels = dspfmt.channels;
-                outfmt.samplerate = dspfmt.samplerate;
-                outfmt.channelmask = dspfmt.channelmask;
-                outfmt.is_bigendian = fileinfo->fmt.is_bigendian;
-                if (bytes_until_next_song <= 0 && memcmp (&output_format, &outfmt, sizeof (ddb_waveformat_t))) {
-                    memcpy (&output_format, &outfmt, sizeof (ddb_waveformat_t));
-                    streamer_set_output_format ();
-                }
-
-                //printf ("convert from %dbit %s %dch %dHz channelmask=%X to %dbit %s %dch %dHz channelmask=%X\n", dspfmt.bps, dspfmt.is_float ? "float" : "int", dspfmt.channels, dspfmt.samplerate, dspfmt.channelmask, output->fmt.bps, output->fmt.is_float ? "float" : "int", output->fmt.channels, output->fmt.samplerate, output->fmt.channelmask);
-
-                int n = pcm_convert (&dspfmt, tempbuf, &output->fmt, bytes, nframes * dspfmt.channels * sizeof (float));
-
-                bytesread = n;
+                bytesread = streamer_dsp_process (tempbuf, nframes, maxframes, &dspfmt, bytes);
             }
         }
         else {
@@ -2428,7 +3079,7 @@ streamer_read_async (char *bytes, int size) {
             // convert from input fmt to output fmt
             int inputsize = size/outputsamplesize*inputsamplesize;
             char input[inputsize];
-            int nb = fileinfo->plugin->read (fileinfo, input, inputsize);
+            int nb = streamer_decoder_read (input, inputsize);
             if (nb != inputsize) {
                 bytesread = nb;
                 is_eof = 1;
@@ -2437,7 +3088,7 @@ streamer_read_async (char *bytes, int size) {
 //            trace ("convert %d|%d|%d|%d|%d|%d to %d|%d|%d|%d|%d|%d\n"
 //                , fileinfo->fmt.bps, fileinfo->fmt.channels, fileinfo->fmt.samplerate, fileinfo->fmt.channelmask, fileinfo->fmt.is_float, fileinfo->fmt.is_bigendian
 //                , output->fmt.bps, output->fmt.channels, output->fmt.samplerate, output->fmt.channelmask, output->fmt.is_float, output->fmt.is_bigendian);
-            bytesread = pcm_convert (&fileinfo->fmt, input, &output->fmt, bytes, inputsize);
+            bytesread = streamer_pcm_convert (&fileinfo->fmt, input, &output->fmt, bytes, inputsize);
 
 #ifdef ANDROID
             // downsample
@@ -2493,6 +3144,10 @@ streamer_read_async (char *bytes, int size) {
         }
 #endif
 
+        if (conf_crossfade_ms > 0 && conf_crossfade_silence && bytesread > 0 && !xfade_fileinfo && xfade_pos >= xfade_len) {
+            streamer_crossfade_track_silence (&output->fmt, bytes, bytesread);
+        }
+
         replaygain_apply (&output->fmt, streaming_track, bytes, bytesread);
     }
     if (!is_eof) {
@@ -2516,22 +3171,74 @@ streamer_read_async (char *bytes, int size) {
     return bytesread;
 }
 
+// appends nframes to the visualization delay line, and replaces them with
+// the frames which are due, returns the number of frames in data
+static int
+streamer_vis_delay (float *data, int nframes, int channels, int samplerate) {
+    int delay = output_latency * samplerate;
+    if (delay > samplerate * VIS_DELAY_MAX_SECONDS) {
+        delay = samplerate * VIS_DELAY_MAX_SECONDS;
+    }
+    if (channels != vis_delay_channels || vis_delay_flush) {
+        vis_delay_frames = 0;
+        vis_delay_channels = channels;
+        vis_delay_flush = 0;
+    }
+    if (!delay && !vis_delay_frames) {
+        return nframes;
+    }
+
+    int total = vis_delay_frames + nframes;
+    if (total > vis_delay_size) {
+        float *buf = realloc (vis_delay, total * channels * sizeof (float));
+        if (!buf) {
+            vis_delay_frames = 0;
+            return nframes;
+        }
+        vis_delay = buf;
+        vis_delay_size = total;
+    }
+    memcpy (vis_delay + vis_delay_frames * channels, data, nframes * channels * sizeof (float));
+
+    int ready = total - delay;
+    if (ready <= 0) {
+        vis_delay_frames = total;
+        return 0;
+    }
+    // when the latency goes down, drop the frames which are late
+    int skip = 0;
+    if (ready > nframes) {
+        skip = ready - nframes;
+        ready = nframes;
+    }
+    memcpy (data, vis_delay + skip * channels, ready * channels * sizeof (float));
+    vis_delay_frames = total - skip - ready;
+    memmove (vis_delay, vis_delay + (skip + ready) * channels, vis_delay_frames * channels * sizeof (float));
+    return ready;
+}
+
 int
 streamer_read (char *bytes, int size) {
-#if 0
-    struct timeval tm1;
-    gettimeofday (&tm1, NULL);
-#endif
+    int64_t tm1 = perftrace_begin ();
     if (!playing_track) {
         return -1;
     }
     DB_output_t *output = plug_get_output ();
     streamer_lock ();
     int sz = min (size, streamer_ringbuf.remaining);
+    if (tm1) {
+        perftrace_buffer_fill ((int)((int64_t)streamer_ringbuf.remaining * 100 / STREAM_BUFFER_SIZE));
+        if (sz < size && streaming_track && !streamer_buffering) {
+            perftrace_underrun ();
+        }
+    }
     if (sz) {
+        int64_t t = perftrace_begin ();
         ringbuf_read (&streamer_ringbuf, bytes, sz);
+        perftrace_end (PERFTRACE_RINGBUF_READ, NULL, t);
         playpos += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels) * dsp_ratio;
         playtime += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels);
+        output_elapsed += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels);
         if (bytes_until_next_song > 0) {
             bytes_until_next_song -= sz;
             if (bytes_until_next_song < 0) {
@@ -2566,14 +3273,6 @@ streamer_read (char *bytes, int size) {
         avg_bitrate = -1;
     }
 
-#if 0
-    struct timeval tm2;
-    gettimeofday (&tm2, NULL);
-
-    int ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-    printf ("streamer_read took %d ms\n", ms);
-#endif
-
     if (waveform_listeners || spectrum_listeners) {
         int in_frame_size = (output->fmt.bps >> 3) * output->fmt.channels;
         int in_frames = sz / in_frame_size;
@@ -2588,15 +3287,18 @@ streamer_read (char *bytes, int size) {
 
         float temp_audio_data[in_frames * out_fmt.channels];
         pcm_convert (&output->fmt, bytes, &out_fmt, (char *)temp_audio_data, sz);
+        in_frames = streamer_vis_delay (temp_audio_data, in_frames, out_fmt.channels, out_fmt.samplerate);
         ddb_audio_data_t data;
         data.fmt = &out_fmt;
         data.data = temp_audio_data;
         data.nframes = in_frames;
-        mutex_lock (wdl_mutex);
-        for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
-            l->callback (l->ctx, &data);
+        if (in_frames > 0) {
+            mutex_lock (wdl_mutex);
+            for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
+                l->callback (l->ctx, &data);
+            }
+            mutex_unlock (wdl_mutex);
         }
-        mutex_unlock (wdl_mutex);
 
         if (out_fmt.channels != audio_data_channels || !spectrum_listeners) {
             audio_data_fill = 0;
@@ -2699,6 +3401,7 @@ streamer_read (char *bytes, int size) {
         }
     }
 
+    perftrace_end (PERFTRACE_OUTPUT_READ, NULL, tm1);
     return sz;
 }
 
@@ -2755,6 +3458,12 @@ streamer_configchanged (void) {
     }
 
     conf_streamer_nosleep = conf_get_int ("streamer.nosleep", 0);
+    conf_streamer_preopen = conf_get_int ("streamer.preopen", 0);
+    // crossfade decodes the next track with a second instance of the decoder,
+    // which not every plugin supports, so it's tied to the preopen setting;
+    // without it the tracks are joined gaplessly
+    conf_crossfade_ms = conf_streamer_preopen ? conf_get_int ("streamer.crossfade_ms", 0) : 0;
+    conf_crossfade_silence = conf_get_int ("streamer.crossfade_silence", 0);
 }
 
 static void
@@ -82,6 +82,15 @@ streamer_ok_to_read (int len);
 float
 streamer_get_playpos (void);
 
+// set by the output plugin: how many seconds of audio returned by
+// streamer_read are not heard yet
+void
+streamer_set_output_latency (float latency);
+
+// cumulative decoder and dsp timings, updated by the streamer thread
+void
+streamer_get_perf (ddb_streamer_perf_t *stats);
+
 void
 streamer_song_removed_notify (playItem_t *it);
 
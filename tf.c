@@ -93,6 +93,76 @@ static playlist_t empty_playlist;
 // empty code is used when "code" argumen is null
 static char empty_code[4] = {0};
 
+// metadata keys used by the special case fields,
+// interned once for lookups by pointer comparison
+enum {
+    TF_KEY_ALBUM_ARTIST,
+    TF_KEY_ALBUMARTIST,
+    TF_KEY_BAND,
+    TF_KEY_ARTIST,
+    TF_KEY_COMPOSER,
+    TF_KEY_PERFORMER,
+    TF_KEY_ALBUM,
+    TF_KEY_VENUE,
+    TF_KEY_TRACK,
+    TF_KEY_TITLE,
+    TF_KEY_DISC,
+    TF_KEY_NUMDISCS,
+    TF_KEY_YEAR,
+    TF_KEY_URI,
+    TF_KEY_CHANNELS,
+    TF_KEY_SAMPLERATE,
+    TF_KEY_BITRATE,
+    TF_KEY_FILE_SIZE,
+    TF_KEY_FILETYPE,
+    TF_KEY_REPLAYGAIN_ALBUMGAIN,
+    TF_KEY_REPLAYGAIN_ALBUMPEAK,
+    TF_KEY_REPLAYGAIN_TRACKGAIN,
+    TF_KEY_REPLAYGAIN_TRACKPEAK,
+    TF_KEY_COUNT,
+};
+
+static const char *tf_key_names[TF_KEY_COUNT] = {
+    "album artist",
+    "albumartist",
+    "band",
+    "artist",
+    "composer",
+    "performer",
+    "album",
+    "venue",
+    "track",
+    "title",
+    "disc",
+    "numdiscs",
+    "year",
+    ":URI",
+    ":CHANNELS",
+    ":SAMPLERATE",
+    ":BITRATE",
+    ":FILE_SIZE",
+    ":FILETYPE",
+    ":REPLAYGAIN_ALBUMGAIN",
+    ":REPLAYGAIN_ALBUMPEAK",
+    ":REPLAYGAIN_TRACKGAIN",
+    ":REPLAYGAIN_TRACKPEAK",
+};
+
+static const char *tf_keys[TF_KEY_COUNT];
+
+// must be called with pl_lock held
+static const char *
+tf_find_meta (playItem_t *it, int key) {
+    if (!tf_keys[0]) {
+        pl_lock ();
+        for (int i = TF_KEY_COUNT-1; i >= 0 && !tf_keys[0]; i--) {
+            tf_keys[i] = pl_meta_key_get (tf_key_names[i]);
+        }
+        pl_unlock ();
+    }
+    return pl_find_meta_raw_interned (it, tf_keys[key]);
+}
+
 int
 tf_eval (ddb_tf_context_t *ctx, char *code, char *out, int outlen) {
     if (!code) {
@@ -1088,7 +1158,7 @@ tf_func_meta (ddb_tf_context_t *ctx, int argc, char *arglens, char *args, char *
 
 const char *
 tf_get_channels_string_for_track (playItem_t *it) {
-    const char *val = pl_find_meta_raw (it, ":CHANNELS");
+    const char *val = tf_find_meta (it, TF_KEY_CHANNELS);
     if (val) {
         int ch = atoi (val);
         if (ch == 1) {
@@ -1296,9 +1366,9 @@ tf_eval_int (ddb_tf_context_t *ctx, char *code, int size, char *out, int outlen,
                 // compatible with fb2k syntax
                 pl_lock ();
                 const char *val = NULL;
-                const char *aa_fields[] = { "album artist", "albumartist", "band", "artist", "composer", "performer", NULL };
-                const char *a_fields[] = { "artist", "album artist", "albumartist", "composer", "performer", NULL };
-                const char *alb_fields[] = { "album", "venue", NULL };
+                static const int aa_fields[] = { TF_KEY_ALBUM_ARTIST, TF_KEY_ALBUMARTIST, TF_KEY_BAND, TF_KEY_ARTIST, TF_KEY_COMPOSER, TF_KEY_PERFORMER, -1 };
+                static const int a_fields[] = { TF_KEY_ARTIST, TF_KEY_ALBUM_ARTIST, TF_KEY_ALBUMARTIST, TF_KEY_COMPOSER, TF_KEY_PERFORMER, -1 };
+                static const int alb_fields[] = { TF_KEY_ALBUM, TF_KEY_VENUE, -1 };
 
                 // set to 1 if special case handler successfully wrote the output
                 int skip_out = 0;
@@ -1306,37 +1376,37 @@ tf_eval_int (ddb_tf_context_t *ctx, char *code, int size, char *out, int outlen,
                 // temp vars used for strcmp optimizations
                 int tmp_a = 0, tmp_b = 0, tmp_c = 0, tmp_d = 0;
 
-                if (!strcmp (name, aa_fields[0])) {
-                    for (int i = 0; !val && aa_fields[i]; i++) {
-                        val = pl_find_meta_raw (it, aa_fields[i]);
+                if (!strcmp (name, "album artist")) {
+                    for (int i = 0; !val && aa_fields[i] >= 0; i++) {
+                        val = tf_find_meta (it, aa_fields[i]);
                     }
                 }
-                else if (!strcmp (name, a_fields[0])) {
-                    for (int i = 0; !val && a_fields[i]; i++) {
-                        val = pl_find_meta_raw (it, a_fields[i]);
+                else if (!strcmp (name, "artist")) {
+                    for (int i = 0; !val && a_fields[i] >= 0; i++) {
+                        val = tf_find_meta (it, a_fields[i]);
                     }
                 }
                 else if (!strcmp (name, "album")) {
-                    for (int i = 0; !val && alb_fields[i]; i++) {
-                        val = pl_find_meta_raw (it, alb_fields[i]);
+                    for (int i = 0; !val && alb_fields[i] >= 0; i++) {
+                        val = tf_find_meta (it, alb_fields[i]);
                     }
                 }
                 else if (!strcmp (name, "track artist")) {
                     const char *aa = NULL;
-                    for (int i = 0; !val && aa_fields[i]; i++) {
-                        val = pl_find_meta_raw (it, aa_fields[i]);
+                    for (int i = 0; !val && aa_fields[i] >= 0; i++) {
+                        val = tf_find_meta (it, aa_fields[i]);
                     }
                     aa = val;
                     val = NULL;
-                    for (int i = 0; !val && a_fields[i]; i++) {
-                        val = pl_find_meta_raw (it, a_fields[i]);
+                    for (int i = 0; !val && a_fields[i] >= 0; i++) {
+                        val = tf_find_meta (it, a_fields[i]);
                     }
                     if (val && aa && !strcmp (val, aa)) {
                         val = NULL;
                     }
                 }
                 else if (!strcmp (name, "tracknumber")) {
-                    const char *v = pl_find_meta_raw (it, "track");
+                    const char *v = tf_find_meta (it, TF_KEY_TRACK);
                     if (v) {
                         const char *p = v;
                         while (*p) {
@@ -1354,9 +1424,9 @@ tf_eval_int (ddb_tf_context_t *ctx, char *code, int size, char *out, int outlen,
                     }
                 }
                 else if (!strcmp (name, "title")) {
-                    val = pl_find_meta_raw (it, "title");
+                    val = tf_find_meta (it, TF_KEY_TITLE);
                     if (!val) {
-                        const char *v = pl_find_meta_raw (it, ":URI");
+                        const char *v = tf_find_meta (it, TF_KEY_URI);
                         if (v) {
                             const char *start = strrchr (v, '/');
                             if (start) {
@@ -1377,30 +1447,30 @@ tf_eval_int (ddb_tf_context_t *ctx, char *code, int size, char *out, int outlen,
                     }
                 }
                 else if (!strcmp (name, "discnumber")) {
-                    val = pl_find_meta_raw (it, "disc");
+                    val = tf_find_meta (it, TF_KEY_DISC);
                 }
                 else if (!strcmp (name, "totaldiscs")) {
-                    val = pl_find_meta_raw (it, "numdiscs");
+                    val = tf_find_meta (it, TF_KEY_NUMDISCS);
                 }
                 else if (!strcmp (name, "track number")) {
-                    val = pl_find_meta_raw (it, "track");
+                    val = tf_find_meta (it, TF_KEY_TRACK);
                 }
                 else if (!strcmp (name, "date")) {
                     // NOTE: foobar2000 uses "date" instead of "year"
                     // so for %date% we simply return the content of "year"
-                    val = pl_find_meta_raw (it, "year");
+                    val = tf_find_meta (it, TF_KEY_YEAR);
                 }
                 else if (!strcmp (name, "samplerate")) {
-                    val = pl_find_meta_raw (it, ":SAMPLERATE");
+                    val = tf_find_meta (it, TF_KEY_SAMPLERATE);
                 }
                 else if (!strcmp (name, "bitrate")) {
-                    val = pl_find_meta_raw (it, ":BITRATE");
+                    val = tf_find_meta (it, TF_KEY_BITRATE);
                 }
                 else if (!strcmp (name, "filesize")) {
-                    val = pl_find_meta_raw (it, ":FILE_SIZE");
+                    val = tf_find_meta (it, TF_KEY_FILE_SIZE);
                 }
                 else if (!strcmp (name, "filesize_natural")) {
-                    const char *v = pl_find_meta_raw (it, ":FILE_SIZE");
+                    const char *v = tf_find_meta (it, TF_KEY_FILE_SIZE);
                     if (v) {
                         int64_t bs = atoll (v);
                         int len;
@@ -1428,19 +1498,19 @@ tf_eval_int (ddb_tf_context_t *ctx, char *code, int size, char *out, int outlen,
                     val = tf_get_channels_string_for_track (it);
                 }
                 else if (!strcmp (name, "codec")) {
-                    val = pl_find_meta_raw (it, ":FILETYPE");
+                    val = tf_find_meta (it, TF_KEY_FILETYPE);
                 }
                 else if (!strcmp (name, "replaygain_album_gain")) {
-                    val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMGAIN");
+                    val = tf_find_meta (it, TF_KEY_REPLAYGAIN_ALBUMGAIN);
                 }
                 else if (!strcmp (name, "replaygain_album_peak")) {
-                    val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMPEAK");
+                    val = tf_find_meta (it, TF_KEY_REPLAYGAIN_ALBUMPEAK);
                 }
                 else if (!strcmp (name, "replaygain_track_gain")) {
-                    val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKGAIN");
+                    val = tf_find_meta (it, TF_KEY_REPLAYGAIN_TRACKGAIN);
                 }
                 else if (!strcmp (name, "replaygain_track_peak")) {
-                    val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKPEAK");
+                    val = tf_find_meta (it, TF_KEY_REPLAYGAIN_TRACKPEAK);
                 }
                 else if ((tmp_a = !strcmp (name, "playback_time")) || (tmp_b = !strcmp (name, "playback_time_seconds")) || (tmp_c = !strcmp (name, "playback_time_remaining")) || (tmp_d = !strcmp (name, "playback_time_remaining_seconds"))) {
                     playItem_t *playing = streamer_get_playing_track ();
@@ -1553,7 +1623,7 @@ tf_eval_int (ddb_tf_context_t *ctx, char *code, int size, char *out, int outlen,
                     }
                 }
                 else if (!strcmp (name, "filename")) {
-                    const char *v = pl_find_meta_raw (it, ":URI");
+                    const char *v = tf_find_meta (it, TF_KEY_URI);
                     if (v) {
                         const char *start = strrchr (val, '/');
                         if (start) {
@@ -1570,7 +1640,7 @@ tf_eval_int (ddb_tf_context_t *ctx, char *code, int size, char *out, int outlen,
                     }
                 }
                 else if (!strcmp (name, "filename_ext")) {
-                    const char *v = pl_find_meta_raw (it, ":URI");
+                    const char *v = tf_find_meta (it, TF_KEY_URI);
                     if (v) {
                         const char *start = strrchr (v, '/');
                         if (start) {
@@ -1580,7 +1650,7 @@ tf_eval_int (ddb_tf_context_t *ctx, char *code, int size, char *out, int outlen,
                     }
                 }
                 else if (!strcmp (name, "directoryname")) {
-                    const char *v = pl_find_meta_raw (it, ":URI");
+                    const char *v = tf_find_meta (it, TF_KEY_URI);
                     if (v) {
                         const char *end = strrchr (v, '/');
                         if (end) {
@@ -1597,7 +1667,7 @@ tf_eval_int (ddb_tf_context_t *ctx, char *code, int size, char *out, int outlen,
                     }
                 }
                 else if (!strcmp (name, "path")) {
-                    val = pl_find_meta_raw (it, ":URI");
+                    val = tf_find_meta (it, TF_KEY_URI);
                 }
                 // index of track in playlist (zero-padded)
                 else if (!strcmp (name, "list_index")) {
@@ -68,11 +68,39 @@ cond_free (uintptr_t cond);
 int
 cond_wait (uintptr_t cond, uintptr_t mutex);
 
+// same as cond_wait, but the mutex must be locked by the caller,
+// and is still locked on return;
+// allows checking the wait condition without missing a signal.
+// must be used with non-recursive mutexes
+int
+cond_wait_locked (uintptr_t cond, uintptr_t mutex);
+
+// same as cond_wait_locked, but gives up after timeout_ms milliseconds;
+// returns ETIMEDOUT in that case
+int
+cond_wait_timeout_locked (uintptr_t cond, uintptr_t mutex, int timeout_ms);
+
 int
 cond_signal (uintptr_t cond);
 
 int
 cond_broadcast (uintptr_t cond);
 
+// read-write lock, for read-mostly data; not recursive for writers
+uintptr_t
+rwlock_create (void);
+
+void
+rwlock_free (uintptr_t rwl);
+
+int
+rwlock_rdlock (uintptr_t rwl);
+
+int
+rwlock_wrlock (uintptr_t rwl);
+
+int
+rwlock_unlock (uintptr_t rwl);
+
 #endif
 
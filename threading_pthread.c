@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include "threading.h"
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -221,6 +222,36 @@ cond_wait (uintptr_t c, uintptr_t m) {
     return err;
 }
 
+int
+cond_wait_locked (uintptr_t c, uintptr_t m) {
+    pthread_cond_t *cond = (pthread_cond_t *)c;
+    pthread_mutex_t *mutex = (pthread_mutex_t *)m;
+    int err = pthread_cond_wait (cond, mutex);
+    if (err != 0) {
+        fprintf (stderr, "pthread_cond_wait failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
+int
+cond_wait_timeout_locked (uintptr_t c, uintptr_t m, int timeout_ms) {
+    pthread_cond_t *cond = (pthread_cond_t *)c;
+    pthread_mutex_t *mutex = (pthread_mutex_t *)m;
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    int err = pthread_cond_timedwait (cond, mutex, &ts);
+    if (err != 0 && err != ETIMEDOUT) {
+        fprintf (stderr, "pthread_cond_timedwait failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
 int
 cond_signal (uintptr_t c) {
     pthread_cond_t *cond = (pthread_cond_t *)c;
@@ -240,3 +271,54 @@ cond_broadcast (uintptr_t c) {
     }
     return err;
 }
+
+uintptr_t
+rwlock_create (void) {
+    pthread_rwlock_t *rwl = malloc (sizeof (pthread_rwlock_t));
+    int err = pthread_rwlock_init (rwl, NULL);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_init failed: %s\n", strerror (err));
+        free (rwl);
+        return 0;
+    }
+    return (uintptr_t)rwl;
+}
+
+void
+rwlock_free (uintptr_t _rwl) {
+    if (_rwl) {
+        pthread_rwlock_t *rwl = (pthread_rwlock_t *)_rwl;
+        pthread_rwlock_destroy (rwl);
+        free (rwl);
+    }
+}
+
+int
+rwlock_rdlock (uintptr_t _rwl) {
+    pthread_rwlock_t *rwl = (pthread_rwlock_t *)_rwl;
+    int err = pthread_rwlock_rdlock (rwl);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_rdlock failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
+int
+rwlock_wrlock (uintptr_t _rwl) {
+    pthread_rwlock_t *rwl = (pthread_rwlock_t *)_rwl;
+    int err = pthread_rwlock_wrlock (rwl);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_wrlock failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
+int
+rwlock_unlock (uintptr_t _rwl) {
+    pthread_rwlock_t *rwl = (pthread_rwlock_t *)_rwl;
+    int err = pthread_rwlock_unlock (rwl);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_unlock failed: %s\n", strerror (err));
+    }
+    return err;
+}
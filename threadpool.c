@@ -0,0 +1,361 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  shared worker thread pool
+
+  Copyright (C) 2009-2013 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "threadpool.h"
+#include "threading.h"
+#include "messagepump.h"
+#include "conf.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+#define MAX_WORKERS 16
+
+enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_FINISHED,
+};
+
+struct ddb_job_s {
+    int refc; // protected by mutex
+    int priority;
+    int state;
+    volatile int cancelled;
+    void (*work) (ddb_job_t *job, void *ctx);
+    void (*done) (ddb_job_t *job, void *ctx, int cancelled);
+    void *ctx;
+    struct ddb_job_s *next; // in a priority queue, or in the completion list
+};
+
+typedef struct {
+    ddb_job_t *head;
+    ddb_job_t *tail;
+} job_queue_t;
+
+static uintptr_t mutex;
+static uintptr_t jobs_cond; // workers wait for jobs
+static uintptr_t finished_cond; // job_wait waits for jobs to finish
+
+static job_queue_t queues[DDB_JOB_PRIORITY_BACKGROUND+1];
+static job_queue_t completions;
+
+static intptr_t workers[MAX_WORKERS];
+static ddb_job_t *running[MAX_WORKERS];
+static int num_workers;
+static int num_background; // workers running background jobs
+static int terminate;
+
+int
+threadpool_init (void) {
+    mutex = mutex_create_nonrecursive ();
+    jobs_cond = cond_create ();
+    finished_cond = cond_create ();
+    return 0;
+}
+
+static void
+job_queue_append (job_queue_t *q, ddb_job_t *job) {
+    job->next = NULL;
+    if (q->tail) {
+        q->tail->next = job;
+    }
+    else {
+        q->head = job;
+    }
+    q->tail = job;
+}
+
+static ddb_job_t *
+job_queue_pop (job_queue_t *q) {
+    ddb_job_t *job = q->head;
+    if (job) {
+        q->head = job->next;
+        if (!q->head) {
+            q->tail = NULL;
+        }
+        job->next = NULL;
+    }
+    return job;
+}
+
+static int
+job_queue_remove (job_queue_t *q, ddb_job_t *job) {
+    ddb_job_t *prev = NULL;
+    for (ddb_job_t *j = q->head; j; prev = j, j = j->next) {
+        if (j == job) {
+            if (prev) {
+                prev->next = j->next;
+            }
+            else {
+                q->head = j->next;
+            }
+            if (q->tail == j) {
+                q->tail = prev;
+            }
+            j->next = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// must be called with mutex locked
+static void
+job_unref_locked (ddb_job_t *job) {
+    if (--job->refc == 0) {
+        free (job);
+    }
+}
+
+// must be called with mutex locked
+// returns 1 if the main loop needs to be woken up to run the completion
+static int
+job_finish_locked (ddb_job_t *job) {
+    job->state = JOB_FINISHED;
+    cond_broadcast (finished_cond);
+    if (job->done) {
+        // the pool reference is released after the completion callback
+        job_queue_append (&completions, job);
+        return 1;
+    }
+    job_unref_locked (job);
+    return 0;
+}
+
+// must be called with mutex locked
+static ddb_job_t *
+threadpool_next_job_locked (void) {
+    for (int p = DDB_JOB_PRIORITY_REALTIME; p <= DDB_JOB_PRIORITY_BACKGROUND; p++) {
+        if (p == DDB_JOB_PRIORITY_BACKGROUND && num_workers > 1 && num_background >= num_workers - 1) {
+            // keep one worker available for the interactive jobs
+            break;
+        }
+        ddb_job_t *job = job_queue_pop (&queues[p]);
+        if (job) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void
+threadpool_worker (void *ctx) {
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-worker", 0, 0, 0, 0);
+#endif
+    int idx = (int)(intptr_t)ctx;
+    mutex_lock (mutex);
+    while (!terminate) {
+        ddb_job_t *job = threadpool_next_job_locked ();
+        if (!job) {
+            cond_wait_locked (jobs_cond, mutex);
+            continue;
+        }
+        job->state = JOB_RUNNING;
+        running[idx] = job;
+        int background = job->priority == DDB_JOB_PRIORITY_BACKGROUND;
+        if (background) {
+            num_background++;
+        }
+        mutex_unlock (mutex);
+
+        if (!job->cancelled) {
+            job->work (job, job->ctx);
+        }
+
+        mutex_lock (mutex);
+        running[idx] = NULL;
+        if (background) {
+            num_background--;
+            if (queues[DDB_JOB_PRIORITY_BACKGROUND].head) {
+                // a background slot became available
+                cond_broadcast (jobs_cond);
+            }
+        }
+        int wakeup = job_finish_locked (job);
+        mutex_unlock (mutex);
+        if (wakeup) {
+            messagepump_wakeup ();
+        }
+        mutex_lock (mutex);
+    }
+    mutex_unlock (mutex);
+}
+
+// must be called with mutex locked
+static void
+threadpool_start_workers_locked (void) {
+    if (num_workers) {
+        return;
+    }
+    int n = conf_get_int ("threadpool.threads", 0);
+    if (n <= 0) {
+        long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+        n = ncpu > 0 ? (int)ncpu : 2;
+        if (n > 8) {
+            n = 8;
+        }
+    }
+    if (n < 2) {
+        n = 2;
+    }
+    if (n > MAX_WORKERS) {
+        n = MAX_WORKERS;
+    }
+    for (int i = 0; i < n; i++) {
+        workers[num_workers] = thread_start (threadpool_worker, (void *)(intptr_t)num_workers);
+        if (!workers[num_workers]) {
+            break;
+        }
+        num_workers++;
+    }
+    trace ("threadpool: started %d workers\n", num_workers);
+}
+
+ddb_job_t *
+job_submit (int priority, void (*work) (ddb_job_t *job, void *ctx), void (*done) (ddb_job_t *job, void *ctx, int cancelled), void *ctx) {
+    if (!work || priority < DDB_JOB_PRIORITY_REALTIME || priority > DDB_JOB_PRIORITY_BACKGROUND) {
+        return NULL;
+    }
+    ddb_job_t *job = malloc (sizeof (ddb_job_t));
+    if (!job) {
+        return NULL;
+    }
+    memset (job, 0, sizeof (ddb_job_t));
+    job->refc = 2; // caller and pool
+    job->priority = priority;
+    job->state = JOB_QUEUED;
+    job->work = work;
+    job->done = done;
+    job->ctx = ctx;
+
+    mutex_lock (mutex);
+    if (!terminate) {
+        threadpool_start_workers_locked ();
+    }
+    if (terminate || !num_workers) {
+        mutex_unlock (mutex);
+        free (job);
+        return NULL;
+    }
+    job_queue_append (&queues[priority], job);
+    cond_broadcast (jobs_cond);
+    mutex_unlock (mutex);
+    return job;
+}
+
+void
+job_cancel (ddb_job_t *job) {
+    int wakeup = 0;
+    mutex_lock (mutex);
+    job->cancelled = 1;
+    if (job->state == JOB_QUEUED && job_queue_remove (&queues[job->priority], job)) {
+        wakeup = job_finish_locked (job);
+    }
+    mutex_unlock (mutex);
+    if (wakeup) {
+        messagepump_wakeup ();
+    }
+}
+
+int
+job_cancelled (ddb_job_t *job) {
+    return job->cancelled;
+}
+
+void
+job_wait (ddb_job_t *job) {
+    mutex_lock (mutex);
+    while (job->state != JOB_FINISHED) {
+        cond_wait_locked (finished_cond, mutex);
+    }
+    mutex_unlock (mutex);
+}
+
+void
+job_release (ddb_job_t *job) {
+    mutex_lock (mutex);
+    job_unref_locked (job);
+    mutex_unlock (mutex);
+}
+
+void
+threadpool_run_completions (void) {
+    mutex_lock (mutex);
+    ddb_job_t *list = completions.head;
+    completions.head = completions.tail = NULL;
+    mutex_unlock (mutex);
+
+    while (list) {
+        ddb_job_t *next = list->next;
+        list->done (list, list->ctx, list->cancelled);
+        job_release (list);
+        list = next;
+    }
+}
+
+void
+threadpool_stop (void) {
+    mutex_lock (mutex);
+    terminate = 1;
+    for (int p = DDB_JOB_PRIORITY_REALTIME; p <= DDB_JOB_PRIORITY_BACKGROUND; p++) {
+        ddb_job_t *job;
+        while ((job = job_queue_pop (&queues[p]))) {
+            job->cancelled = 1;
+            job_finish_locked (job);
+        }
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (running[i]) {
+            running[i]->cancelled = 1;
+        }
+    }
+    cond_broadcast (jobs_cond);
+    mutex_unlock (mutex);
+
+    for (int i = 0; i < num_workers; i++) {
+        thread_join (workers[i]);
+    }
+    num_workers = 0;
+
+    // the main loop is not running anymore, deliver the results from here
+    threadpool_run_completions ();
+}
+
+void
+threadpool_free (void) {
+    mutex_free (mutex);
+    cond_free (jobs_cond);
+    cond_free (finished_cond);
+}
@@ -0,0 +1,63 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  shared worker thread pool
+
+  Copyright (C) 2009-2013 Alexey Yakovenko
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+#ifndef __THREADPOOL_H
+#define __THREADPOOL_H
+
+#include "deadbeef.h"
+
+int
+threadpool_init (void);
+
+// cancels the queued jobs, waits for the running ones, and delivers
+// the pending completions; no new jobs are accepted afterwards
+void
+threadpool_stop (void);
+
+void
+threadpool_free (void);
+
+// calls the completion callbacks of the finished jobs,
+// must be called from the main loop
+void
+threadpool_run_completions (void);
+
+ddb_job_t *
+job_submit (int priority, void (*work) (ddb_job_t *job, void *ctx), void (*done) (ddb_job_t *job, void *ctx, int cancelled), void *ctx);
+
+void
+job_cancel (ddb_job_t *job);
+
+int
+job_cancelled (ddb_job_t *job);
+
+void
+job_wait (ddb_job_t *job);
+
+void
+job_release (ddb_job_t *job);
+
+#endif // __THREADPOOL_H